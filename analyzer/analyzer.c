@@ -34,92 +34,7 @@
 
 #include "mq.h"
 #include "msg.h"
-
-/************************ Overridable request API ****************************/
-SUPRIVATE void
-suscan_inspector_overridable_request_destroy(
-    struct suscan_inspector_overridable_request *self)
-{
-  free(self);
-}
-
-SUPRIVATE struct suscan_inspector_overridable_request *
-suscan_inspector_overridable_request_new(suscan_inspector_t *insp)
-{
-  struct suscan_inspector_overridable_request *new = NULL;
-
-  SU_TRYCATCH(
-      new = calloc(1, sizeof(struct suscan_inspector_overridable_request)),
-      goto done);
-
-  new->insp = insp;
-
-  return new;
-
-done:
-  if (new != NULL)
-    suscan_inspector_overridable_request_destroy(new);
-
-  return NULL;
-}
-
-struct suscan_inspector_overridable_request *
-suscan_analyzer_acquire_overridable(
-    suscan_analyzer_t *self,
-    SUHANDLE handle)
-{
-  struct suscan_inspector_overridable_request *req = NULL;
-  struct suscan_inspector_overridable_request *own_req = NULL;
-  suscan_inspector_t *insp = NULL;
-
-  /*
-   * TODO: Maybe acquire scheduler mutex?
-   */
-
-  SU_TRYCATCH(suscan_analyzer_lock_inspector_list(self), goto done);
-  SU_TRYCATCH(insp = suscan_analyzer_get_inspector(self, handle), goto done);
-  SU_TRYCATCH(insp->state == SUSCAN_ASYNC_STATE_RUNNING, goto done);
-
-  if ((req = suscan_inspector_get_userdata(insp)) == NULL) {
-    /* No userdata. Release mutex, create object and lock again. */
-    suscan_analyzer_unlock_inspector_list(self);
-
-    SU_TRYCATCH(
-        own_req = suscan_inspector_overridable_request_new(insp),
-        goto done);
-
-    SU_TRYCATCH(suscan_analyzer_lock_inspector_list(self), goto done);
-
-    /* Many things may have happened here */
-    SU_TRYCATCH(handle >= 0 && handle < self->inspector_count, goto done);
-    SU_TRYCATCH(insp = suscan_analyzer_get_inspector(self, handle), goto done);
-    SU_TRYCATCH(insp->state == SUSCAN_ASYNC_STATE_RUNNING, goto done);
-
-    req = own_req;
-    own_req = NULL;
-
-    req->next = self->insp_overridable;
-    self->insp_overridable = req;
-
-    suscan_inspector_set_userdata(insp, req);
-  }
-
-done:
-  if (own_req != NULL)
-    suscan_inspector_overridable_request_destroy(own_req);
-
-  return req;
-}
-
-SUBOOL
-suscan_analyzer_release_overridable(
-    suscan_analyzer_t *self,
-    struct suscan_inspector_overridable_request *rq)
-{
-  suscan_analyzer_unlock_inspector_list(self);
-
-  return SU_TRUE;
-}
+#include "bufpool.h"
 
 /************************* Baseband filter API *******************************/
 SUPRIVATE struct suscan_analyzer_baseband_filter *
@@ -152,7 +67,8 @@ suscan_analyzer_register_baseband_filter(
     suscan_analyzer_baseband_filter_func_t func,
     void *privdata)
 {
-  struct suscan_analyzer_baseband_filter *new;
+  struct suscan_analyzer_baseband_filter *new = NULL;
+  SUBOOL mutex_acquired = SU_FALSE;
 
   SU_TRYCATCH(
       self->params.mode == SUSCAN_ANALYZER_MODE_CHANNEL,
@@ -165,19 +81,134 @@ suscan_analyzer_register_baseband_filter(
   new->func = func;
   new->privdata = privdata;
 
+  /* The source worker walks this list with the loop mutex held */
+  SU_TRYCATCH(suscan_analyzer_lock_loop(self), goto fail);
+  mutex_acquired = SU_TRUE;
+
   SU_TRYCATCH(
       PTR_LIST_APPEND_CHECK(self->bbfilt, new) != -1,
       goto fail);
 
+  suscan_analyzer_unlock_loop(self);
+
   return SU_TRUE;
 
 fail:
+  if (mutex_acquired)
+    suscan_analyzer_unlock_loop(self);
+
   if (new != NULL)
     suscan_analyzer_baseband_filter_destroy(new);
 
   return SU_FALSE;
 }
 
+SUBOOL
+suscan_analyzer_unregister_baseband_filter(
+    suscan_analyzer_t *self,
+    suscan_analyzer_baseband_filter_func_t func,
+    void *privdata)
+{
+  unsigned int i;
+  SUBOOL found = SU_FALSE;
+
+  SU_TRYCATCH(suscan_analyzer_lock_loop(self), return SU_FALSE);
+
+  for (i = 0; i < self->bbfilt_count; ++i)
+    if (self->bbfilt_list[i] != NULL
+        && self->bbfilt_list[i]->func == func
+        && self->bbfilt_list[i]->privdata == privdata) {
+      suscan_analyzer_baseband_filter_destroy(self->bbfilt_list[i]);
+      self->bbfilt_list[i] = NULL;
+      found = SU_TRUE;
+      break;
+    }
+
+  suscan_analyzer_unlock_loop(self);
+
+  return found;
+}
+
+SUBOOL
+suscan_analyzer_set_output_policy(
+    suscan_analyzer_t *self,
+    uint32_t type,
+    enum suscan_mq_policy_type policy,
+    unsigned int budget)
+{
+  return suscan_mq_set_policy(self->mq_out, type, policy, budget);
+}
+
+void
+suscan_analyzer_get_telemetry(
+    const suscan_analyzer_t *self,
+    struct suscan_telemetry *telemetry)
+{
+  suscan_telemetry_load(&self->telemetry, telemetry);
+}
+
+SUBOOL
+suscan_analyzer_set_telemetry_interval(
+    suscan_analyzer_t *self,
+    SUFLOAT interval)
+{
+  SU_TRYCATCH(interval >= 0, return SU_FALSE);
+
+  /* Picked up by the source worker on its next block */
+  self->interval_telemetry = interval;
+
+  return SU_TRUE;
+}
+
+SUBOOL
+suscan_analyzer_enable_pretrigger(suscan_analyzer_t *self, SUFLOAT history)
+{
+  suscan_pretrigger_t *pretrig = NULL;
+
+  if (self->pretrig != NULL) {
+    SU_ERROR("Pre-trigger history already enabled\n");
+    goto fail;
+  }
+
+  SU_TRYCATCH(
+      pretrig = suscan_pretrigger_new(
+          suscan_analyzer_get_samp_rate(self),
+          history),
+      goto fail);
+
+  SU_TRYCATCH(
+      suscan_analyzer_register_baseband_filter(
+          self,
+          suscan_pretrigger_baseband_filter,
+          pretrig),
+      goto fail);
+
+  self->pretrig = pretrig;
+
+  return SU_TRUE;
+
+fail:
+  if (pretrig != NULL)
+    suscan_pretrigger_destroy(pretrig);
+
+  return SU_FALSE;
+}
+
+SUBOOL
+suscan_analyzer_trigger_capture(
+    suscan_analyzer_t *self,
+    SUFLOAT pre,
+    SUFLOAT post,
+    const char *path)
+{
+  if (self->pretrig == NULL) {
+    SU_ERROR("Triggered capture requires pre-trigger history\n");
+    return SU_FALSE;
+  }
+
+  return suscan_pretrigger_trigger(self->pretrig, pre, post, path);
+}
+
 /************************ Source worker callback *****************************/
 
 SUBOOL
@@ -286,19 +317,30 @@ suscan_analyzer_readjust_detector(
 {
   su_channel_detector_t *new_detector = NULL;
 
+  SUBOOL ok = SU_FALSE;
+
   su_channel_params_adjust(params);
 
+  /* The detector worker may be feeding it right now */
+  suscan_analyzer_enter_detector(analyzer);
+
   if (!su_channel_detector_set_params(analyzer->detector, params)) {
     /* If not possibe, re-create detector object */
     SU_TRYCATCH(
         new_detector = su_channel_detector_new(params),
-        return SU_FALSE);
+        goto done);
 
     su_channel_detector_destroy(analyzer->detector);
     analyzer->detector = new_detector;
+    analyzer->det_count = 0;
   }
 
-  return SU_TRUE;
+  ok = SU_TRUE;
+
+done:
+  suscan_analyzer_leave_detector(analyzer);
+
+  return ok;
 }
 
 /* Locally-defined prototypes. These should not appear in analyzer.h */
@@ -327,10 +369,11 @@ suscan_analyzer_thread(void *data)
 
   switch (self->params.mode) {
     case SUSCAN_ANALYZER_MODE_CHANNEL:
-      if (!suscan_worker_push(
-            self->source_wk,
-            suscan_source_channel_wk_cb,
-            self->source)) {
+      suscan_worker_task_init(
+          &self->source_task,
+          suscan_source_channel_wk_cb,
+          self->source);
+      if (!suscan_worker_push_task(self->source_wk, &self->source_task)) {
           suscan_analyzer_send_status(
               self,
               SUSCAN_ANALYZER_MESSAGE_TYPE_SOURCE_INIT,
@@ -341,10 +384,11 @@ suscan_analyzer_thread(void *data)
       break;
 
     case SUSCAN_ANALYZER_MODE_WIDE_SPECTRUM:
-      if (!suscan_worker_push(
-            self->source_wk,
-            suscan_source_wide_wk_cb,
-            self->source)) {
+      suscan_worker_task_init(
+          &self->source_task,
+          suscan_source_wide_wk_cb,
+          self->source);
+      if (!suscan_worker_push_task(self->source_wk, &self->source_task)) {
           suscan_analyzer_send_status(
               self,
               SUSCAN_ANALYZER_MESSAGE_TYPE_SOURCE_INIT,
@@ -444,6 +488,7 @@ suscan_analyzer_thread(void *data)
 
           self->interval_channels = new_params->channel_update_int;
 
+          (void) pthread_mutex_lock(&self->det_queue_mutex);
           if (SU_ABS(self->interval_psd - new_params->psd_update_int) > 1e-6) {
             self->interval_psd = new_params->psd_update_int;
             self->det_num_psd = 0;
@@ -453,6 +498,7 @@ suscan_analyzer_thread(void *data)
             clock_gettime(CLOCK_MONOTONIC, &self->last_psd);
 #endif /* __linux__ */
           }
+          (void) pthread_mutex_unlock(&self->det_queue_mutex);
 
           /* ^^^^^^^^^^^^^ Source parameters update end ^^^^^^^^^^^^^^^^^  */
 
@@ -499,6 +545,16 @@ suscan_analyzer_read(suscan_analyzer_t *analyzer, uint32_t *type)
   return suscan_mq_read(analyzer->mq_out, type);
 }
 
+unsigned int
+suscan_analyzer_read_batch(
+    suscan_analyzer_t *analyzer,
+    struct suscan_msg *msgs,
+    unsigned int max,
+    const struct timespec *timeout)
+{
+  return suscan_mq_read_batch(analyzer->mq_out, msgs, max, timeout);
+}
+
 struct suscan_analyzer_inspector_msg *
 suscan_analyzer_read_inspector_msg(suscan_analyzer_t *analyzer)
 {
@@ -577,12 +633,6 @@ suscan_analyzer_init_detector_params(
 }
 
 /********************** Suscan analyzer public API ***************************/
-void
-suscan_analyzer_source_barrier(suscan_analyzer_t *analyzer)
-{
-  pthread_barrier_wait(&analyzer->barrier);
-}
-
 void
 suscan_analyzer_enter_sched(suscan_analyzer_t *analyzer)
 {
@@ -595,6 +645,18 @@ suscan_analyzer_leave_sched(suscan_analyzer_t *analyzer)
   pthread_mutex_unlock(&analyzer->sched_lock);
 }
 
+void
+suscan_analyzer_enter_detector(suscan_analyzer_t *analyzer)
+{
+  pthread_mutex_lock(&analyzer->det_mutex);
+}
+
+void
+suscan_analyzer_leave_detector(suscan_analyzer_t *analyzer)
+{
+  pthread_mutex_unlock(&analyzer->det_mutex);
+}
+
 su_specttuner_channel_t *
 suscan_analyzer_open_channel_ex(
     suscan_analyzer_t *analyzer,
@@ -732,7 +794,6 @@ suscan_analyzer_destroy(suscan_analyzer_t *analyzer)
 {
   uint32_t type;
   unsigned int i;
-  struct suscan_inspector_overridable_request *req;
   void *private;
 
   /* Prevent source from entering in timeout loops */
@@ -771,6 +832,21 @@ suscan_analyzer_destroy(suscan_analyzer_t *analyzer)
       return;
     }
 
+  /* After the source worker, which is the one pushing blocks to it */
+  if (analyzer->det_wk != NULL)
+    if (!suscan_analyzer_halt_worker(analyzer->det_wk)) {
+      SU_ERROR("Detector worker destruction failed, memory leak ahead\n");
+      return;
+    }
+
+  /* Blocks the detector worker never got to */
+  while (analyzer->det_queue_count > 0) {
+    suscan_pool_free(analyzer->det_queue[analyzer->det_queue_head].data);
+    analyzer->det_queue_head =
+        (analyzer->det_queue_head + 1) % SUSCAN_ANALYZER_DETECTOR_QUEUE_LEN;
+    --analyzer->det_queue_count;
+  }
+
   /* Halt all inspector scheduler workers */
   if (analyzer->sched != NULL) {
     if (!suscan_inspsched_destroy(analyzer->sched)) {
@@ -778,9 +854,6 @@ suscan_analyzer_destroy(suscan_analyzer_t *analyzer)
       return;
     }
 
-    /* FIXME: Add flag to prevent initialization errors! */
-    pthread_barrier_destroy(&analyzer->barrier);
-
     pthread_mutex_destroy(&analyzer->sched_lock);
   }
 
@@ -794,6 +867,12 @@ suscan_analyzer_destroy(suscan_analyzer_t *analyzer)
   if (analyzer->loop_init)
     pthread_mutex_destroy(&analyzer->loop_mutex);
 
+  if (analyzer->det_mutex_init)
+    pthread_mutex_destroy(&analyzer->det_mutex);
+
+  if (analyzer->det_queue_init)
+    pthread_mutex_destroy(&analyzer->det_queue_mutex);
+
   if (analyzer->inspector_list_init)
     pthread_mutex_destroy(&analyzer->inspector_list_mutex);
 
@@ -801,19 +880,8 @@ suscan_analyzer_destroy(suscan_analyzer_t *analyzer)
   if (analyzer->stuner != NULL)
     su_specttuner_destroy(analyzer->stuner);
 
-  /* Free all pending overridable requests */
-  while (analyzer->insp_overridable != NULL) {
-    req = analyzer->insp_overridable->next;
-
-    suscan_inspector_overridable_request_destroy(
-        analyzer->insp_overridable);
-
-    analyzer->insp_overridable = req;
-  }
-
   /* Free read buffer */
-  if (analyzer->read_buf != NULL)
-    free(analyzer->read_buf);
+  suscan_pool_free(analyzer->read_buf);
 
   /* Remove all channel analyzers */
   for (i = 0; i < analyzer->inspector_count; ++i)
@@ -827,8 +895,9 @@ suscan_analyzer_destroy(suscan_analyzer_t *analyzer)
   if (analyzer->source != NULL)
     suscan_source_destroy(analyzer->source);
 
-  /* Release slow worker data */
-  suscan_analyzer_destroy_slow_worker_data(analyzer);
+  /* No workers left: every hotconf snapshot can go */
+  if (analyzer->hotconf_init)
+    suscan_hotconf_finalize(&analyzer->hotconf);
 
   if (analyzer->throttle_mutex_init)
     pthread_mutex_destroy(&analyzer->throttle_mutex);
@@ -841,8 +910,21 @@ suscan_analyzer_destroy(suscan_analyzer_t *analyzer)
   if (analyzer->bbfilt_list != NULL)
     free(analyzer->bbfilt_list);
 
+  if (analyzer->pretrig != NULL)
+    suscan_pretrigger_destroy(analyzer->pretrig);
+
+  if (analyzer->psd_spare != NULL)
+    suscan_analyzer_psd_msg_destroy(analyzer->psd_spare);
+
+  /* The output queue belongs to the client and may outlive us */
+  if (analyzer->mq_out != NULL)
+    suscan_mq_set_enqueue_histogram(analyzer->mq_out, NULL);
+
   suscan_mq_finalize(&analyzer->mq_in);
 
+  if (analyzer->memory_locked)
+    suscan_thread_unlock_memory();
+
   free(analyzer);
 }
 
@@ -873,7 +955,40 @@ fail:
 SUBOOL
 suscan_analyzer_set_iq_reverse(suscan_analyzer_t *analyzer, SUBOOL rev)
 {
-  analyzer->iq_rev = rev;
+  /* Let the source fuse IQ reversal with sample conversion if possible */
+  /* Read by the source worker */
+  if (analyzer->source != NULL
+      && suscan_source_set_iq_reverse(analyzer->source, rev))
+    __atomic_store_n(&analyzer->iq_rev, SU_FALSE, __ATOMIC_RELAXED);
+  else
+    __atomic_store_n(&analyzer->iq_rev, rev, __ATOMIC_RELAXED);
+
+  return SU_TRUE;
+}
+
+SUBOOL
+suscan_analyzer_seek_async(suscan_analyzer_t *self, const struct timeval *pos)
+{
+  SUFLOAT samp_rate;
+  SUSCOUNT sample;
+
+  if (suscan_analyzer_is_real_time(self)
+      || self->params.mode != SUSCAN_ANALYZER_MODE_CHANNEL) {
+    SU_ERROR("Seek is only supported by file sources in channel mode\n");
+    return SU_FALSE;
+  }
+
+  SU_TRYCATCH(pos->tv_sec >= 0 && pos->tv_usec >= 0, return SU_FALSE);
+
+  /* Positions are given at the file rate, before decimation */
+  samp_rate = self->source->samp_rate;
+  sample = (SUSCOUNT) pos->tv_sec * (SUSCOUNT) samp_rate
+      + (SUSCOUNT) (pos->tv_usec * 1e-6 * samp_rate);
+
+  /* Latest request wins */
+  __atomic_store_n(&self->seek_req_value, sample, __ATOMIC_RELEASE);
+  __atomic_store_n(&self->seek_req, SU_TRUE, __ATOMIC_RELEASE);
+
   return SU_TRUE;
 }
 
@@ -900,6 +1015,7 @@ suscan_analyzer_new(
   struct sigutils_specttuner_params st_params =
       sigutils_specttuner_params_INITIALIZER;
   struct sigutils_channel_detector_params det_params;
+  struct suscan_hotconf_snapshot *snap;
   unsigned int worker_count;
   unsigned int i;
 
@@ -913,11 +1029,16 @@ suscan_analyzer_new(
 
   new->params = *params;
 
+  /* Before allocating anything, so that MCL_FUTURE covers it all */
+  new->memory_locked =
+      suscan_analyzer_thread_params_lock_memory(&params->threads);
+
   /* Allocate read buffer */
 
   new->read_size = SUSCAN_ANALYZER_READ_SIZE; /* params->detector_params.window_size; */
 
-  if ((new->read_buf = malloc(
+  /* Pool buffer: the detector worker may hold references to it */
+  if ((new->read_buf = suscan_pool_alloc(
       new->read_size * sizeof(SUCOMPLEX))) == NULL) {
     SU_ERROR("Failed to allocate read buffer\n");
     goto fail;
@@ -938,6 +1059,8 @@ suscan_analyzer_new(
   /* Periodic updates */
   new->interval_channels = params->channel_update_int;
   new->interval_psd      = params->psd_update_int;
+  new->interval_telemetry = SUSCAN_ANALYZER_TELEMETRY_INTERVAL;
+  new->last_telemetry     = suscan_telemetry_now();
 
 #ifdef __linux__
   clock_gettime(CLOCK_MONOTONIC_COARSE, &new->last_psd);
@@ -951,6 +1074,10 @@ suscan_analyzer_new(
   /* Create channel detector */
   (void) pthread_mutex_init(&new->loop_mutex, NULL); /* Always succeeds */
   new->loop_init = SU_TRUE;
+  (void) pthread_mutex_init(&new->det_mutex, NULL);
+  new->det_mutex_init = SU_TRUE;
+  (void) pthread_mutex_init(&new->det_queue_mutex, NULL);
+  new->det_queue_init = SU_TRUE;
   det_params = params->detector_params;
   suscan_analyzer_init_detector_params(new, &det_params);
   SU_TRYCATCH(
@@ -958,41 +1085,63 @@ suscan_analyzer_new(
       goto fail);
 
   /* Create source worker */
-  if ((new->source_wk = suscan_worker_new(&new->mq_in, new))
-      == NULL) {
+  if ((new->source_wk = suscan_worker_new_ex(
+      &new->mq_in,
+      new,
+      &params->threads,
+      SUSCAN_ANALYZER_THREAD_ROLE_SOURCE,
+      "suscan-source")) == NULL) {
     SU_ERROR("Cannot create source worker thread\n");
     goto fail;
   }
 
   /* Create slow worker */
-  if ((new->slow_wk = suscan_worker_new(&new->mq_in, new))
-      == NULL) {
+  if ((new->slow_wk = suscan_worker_new_ex(
+      &new->mq_in,
+      new,
+      &params->threads,
+      SUSCAN_ANALYZER_THREAD_ROLE_SLOW,
+      "suscan-slow")) == NULL) {
     SU_ERROR("Cannot create slow worker thread\n");
     goto fail;
   }
 
-  /* Initialize gain request mutex */
-  SU_TRYCATCH(pthread_mutex_init(&new->hotconf_mutex, NULL) != -1, goto fail);
-  new->gain_req_mutex_init = SU_TRUE;
+  /*
+   * In channel mode, the PSD is computed by its own worker so that the
+   * source never waits for it. Wide spectrum mode needs the PSD before
+   * hopping, so it keeps feeding the detector from the source worker.
+   */
+  if (params->mode == SUSCAN_ANALYZER_MODE_CHANNEL) {
+    if ((new->det_wk = suscan_worker_new_ex(
+        &new->mq_in,
+        new,
+        &params->threads,
+        SUSCAN_ANALYZER_THREAD_ROLE_DETECTOR,
+        "suscan-detector")) == NULL) {
+      SU_ERROR("Cannot create detector worker thread\n");
+      goto fail;
+    }
+  }
+
+  /* Hot configuration, read by the source and slow workers */
+  SU_TRYCATCH(suscan_hotconf_init(&new->hotconf), goto fail);
+  new->hotconf_init = SU_TRUE;
+  SU_TRYCATCH(
+      (new->source_reader = suscan_hotconf_register_reader(&new->hotconf))
+      != -1,
+      goto fail);
+  SU_TRYCATCH(
+      (new->slow_reader = suscan_hotconf_register_reader(&new->hotconf))
+      != -1,
+      goto fail);
 
   /* Create spectral tuner, with matching read size */
   st_params.window_size = det_params.window_size;
   SU_TRYCATCH(new->stuner = su_specttuner_new(&st_params), goto fail);
 
-  /* Create inspector scheduler and barrier */
+  /* Create inspector scheduler */
   SU_TRYCATCH(new->sched = suscan_inspsched_new(new), goto fail);
 
-  /*
-   * During barrier initialization, we take the number of scheduler workers
-   * plus 1 (the source worker)
-   */
-  SU_TRYCATCH(
-      pthread_barrier_init(
-          &new->barrier,
-          NULL,
-          suscan_inspsched_get_num_workers(new->sched) + 1) == 0,
-      goto fail);
-
   /*
    * This mutex will protect the spectral tuner from concurrent access by
    * consumer, analyzer and scheduler worker threads
@@ -1011,17 +1160,48 @@ suscan_analyzer_new(
 
   new->mq_out = mq;
 
+  /* Bound what a slow client can make us accumulate */
+  new->reported_drops = suscan_mq_get_dropped_total(mq);
+  suscan_mq_set_disposer(mq, suscan_analyzer_dispose_message);
+  SU_TRYCATCH(
+      suscan_analyzer_set_output_policy(
+          new,
+          SUSCAN_ANALYZER_MESSAGE_TYPE_PSD,
+          SUSCAN_MQ_POLICY_COALESCE,
+          SUSCAN_ANALYZER_PSD_BUDGET),
+      goto fail);
+  SU_TRYCATCH(
+      suscan_analyzer_set_output_policy(
+          new,
+          SUSCAN_ANALYZER_MESSAGE_TYPE_SAMPLES,
+          SUSCAN_MQ_POLICY_DROP_OLDEST,
+          SUSCAN_ANALYZER_SAMPLES_BUDGET),
+      goto fail);
+  SU_TRYCATCH(
+      suscan_analyzer_set_output_policy(
+          new,
+          SUSCAN_ANALYZER_MESSAGE_TYPE_TELEMETRY,
+          SUSCAN_MQ_POLICY_DROP_OLDEST,
+          SUSCAN_ANALYZER_TELEMETRY_BUDGET),
+      goto fail);
+  suscan_mq_set_enqueue_histogram(
+      mq,
+      &new->telemetry.stage[SUSCAN_TELEMETRY_STAGE_MQ_ENQUEUE]);
+
   SU_TRYCATCH(suscan_source_start_capture(new->source), goto fail);
 
   if (new->read_size < new->source->mtu) {
     new->read_size = new->source->mtu;
-    SUCOMPLEX *temp;
+    suscan_pool_free(new->read_buf);
     SU_TRYCATCH(
-        temp = realloc(new->read_buf, new->read_size * sizeof(SUCOMPLEX)),
+        new->read_buf = suscan_pool_alloc(new->read_size * sizeof(SUCOMPLEX)),
         goto fail);
-    new->read_buf = temp;
   }
 
+  /* Keep the first blocks from page faulting in the source worker */
+  if (params->threads.lock_memory)
+    suscan_thread_prefault(new->read_buf, new->read_size * sizeof(SUCOMPLEX));
+
   new->effective_samp_rate = suscan_analyzer_get_samp_rate(new);
 
   /*
@@ -1050,6 +1230,12 @@ suscan_analyzer_new(
             SUSCAN_ANALYZER_MIN_POST_HOP_FFTS * det_params.window_size;
     new->current_sweep_params.max_freq = params->max_freq;
     new->current_sweep_params.min_freq = params->min_freq;
+
+    /* Later changes start from here */
+    SU_TRYCATCH(snap = suscan_hotconf_begin(&new->hotconf), goto fail);
+    suscan_hotconf_snapshot_set_sweep_params(snap, &new->current_sweep_params);
+    suscan_hotconf_commit(&new->hotconf, snap);
+    new->source_hotconf_version = suscan_hotconf_get_version(&new->hotconf);
   }
 
   if (pthread_create(
@@ -33,6 +33,10 @@
 #include "throttle.h"
 #include "inspector/inspector.h"
 #include "inspsched.h"
+#include "pretrigger.h"
+#include "hotconf.h"
+#include "telemetry.h"
+#include "threads.h"
 #include "mq.h"
 
 #ifdef __cplusplus
@@ -44,6 +48,20 @@ extern "C" {
 #define SUSCAN_ANALYZER_READ_SIZE             512
 #define SUSCAN_ANALYZER_MIN_POST_HOP_FFTS     7
 
+/* Default output budgets. A stalled client must not exhaust memory */
+#define SUSCAN_ANALYZER_PSD_BUDGET            2
+#define SUSCAN_ANALYZER_SAMPLES_BUDGET        256
+#define SUSCAN_ANALYZER_TELEMETRY_BUDGET      4
+
+#define SUSCAN_ANALYZER_TELEMETRY_INTERVAL    1.0 /* Seconds, 0 disables */
+#define SUSCAN_ANALYZER_DROPS_INTERVAL        0.25 /* Seconds between reports */
+
+/*
+ * Blocks the source worker may have in flight to the detector worker.
+ * Past this, blocks are dropped instead of stalling acquisition.
+ */
+#define SUSCAN_ANALYZER_DETECTOR_QUEUE_LEN    4
+
 enum suscan_analyzer_mode {
   SUSCAN_ANALYZER_MODE_CHANNEL,
   SUSCAN_ANALYZER_MODE_WIDE_SPECTRUM
@@ -56,6 +74,7 @@ struct suscan_analyzer_params {
   SUFLOAT  psd_update_int;
   SUFREQ   min_freq;
   SUFREQ   max_freq;
+  struct suscan_analyzer_thread_params threads; /* Only read on creation */
 };
 
 #define suscan_analyzer_params_INITIALIZER {                               \
@@ -65,6 +84,7 @@ struct suscan_analyzer_params {
   SU_ADDSFX(.04),                               /* psd_update_int */        \
   0,                                            /* min_freq */              \
   0,                                            /* max_freq */              \
+  suscan_analyzer_thread_params_INITIALIZER,    /* threads */               \
 }
 
 typedef SUBOOL (*suscan_analyzer_baseband_filter_func_t) (
@@ -78,41 +98,12 @@ struct suscan_analyzer_baseband_filter {
   void *privdata;
 };
 
-struct suscan_analyzer_gain_request {
-  char *name;
-  SUFLOAT value;
-};
-
-struct suscan_inspector_overridable_request
-{
-  suscan_inspector_t *insp;
-
-  SUBOOL  dead;
-  SUBOOL  freq_request;
-  SUFREQ  new_freq;
-  SUBOOL  bandwidth_request;
-  SUFLOAT new_bandwidth;
-
-  struct suscan_inspector_overridable_request *next;
-};
-
-enum suscan_analyzer_sweep_strategy {
-  SUSCAN_ANALYZER_SWEEP_STRATEGY_STOCHASTIC,
-  SUSCAN_ANALYZER_SWEEP_STRATEGY_PROGRESSIVE,
-};
-
-enum suscan_analyzer_spectrum_partitioning {
-  SUSCAN_ANALYZER_SPECTRUM_PARTITIONING_DISCRETE,
-  SUSCAN_ANALYZER_SPECTRUM_PARTITIONING_CONTINUOUS
-};
-
-struct suscan_analyzer_sweep_params {
-  enum suscan_analyzer_sweep_strategy strategy;
-  enum suscan_analyzer_spectrum_partitioning partitioning;
-
-  SUFREQ min_freq;
-  SUFREQ max_freq;
-  SUSCOUNT fft_min_samples; /* Minimum number of FFT frames before updating */
+/* Read buffer shared with the detector worker, which holds a reference */
+struct suscan_analyzer_detector_block {
+  SUCOMPLEX *data;
+  SUSCOUNT   size;
+  struct timespec read_start;
+  SUBOOL     gap; /* Blocks were dropped right before this one */
 };
 
 struct suscan_analyzer {
@@ -142,58 +133,71 @@ struct suscan_analyzer {
   SUSCOUNT det_count;
   SUSCOUNT det_num_psd;
 
-  /* This mutex shall protect hot-config requests */
-  /* XXX: This is cumbersome. Create a hotconf object to handle these things */
-  pthread_mutex_t hotconf_mutex;
-
-  /* Frequency request */
-  SUBOOL freq_req;
-  SUFREQ freq_req_value;
-  SUFREQ lnb_req_value;
-
-  /* XXX: Define list for inspector frequency set */
-  SUBOOL   inspector_freq_req;
-  SUHANDLE inspector_freq_req_handle;
-  SUFREQ   inspector_freq_req_value;
-
-  SUBOOL   inspector_bw_req;
-  SUHANDLE inspector_bw_req_handle;
-  SUFLOAT  inspector_bw_req_value;
-
-  /* Bandwidth request */
-  SUBOOL  bw_req;
-  SUFLOAT bw_req_value;
-
-  /* Gain request */
-  SUBOOL gain_req_mutex_init;
-  PTR_LIST(struct suscan_analyzer_gain_request, gain_request);
-
-  /* Atenna request */
-  char *antenna_req;
+  /* Hot configuration (frequency, gains, overrides, sweep...) */
+  suscan_hotconf_t hotconf;
+  SUBOOL   hotconf_init;
+  int      source_reader;          /* Hotconf reader slot of the source worker */
+  int      slow_reader;            /* Hotconf reader slot of the slow worker */
+  uint64_t source_hotconf_version; /* Last snapshot seen by the source worker */
+  uint64_t freq_applied;           /* Versions applied by the slow worker */
+  uint64_t bw_applied;
+  uint64_t antenna_applied;
+  uint64_t gain_applied;
+
+  /* Seek request (file sources only), served by the source worker */
+  SUBOOL   seek_req;
+  SUSCOUNT seek_req_value;
+  SUBOOL   seek_flushing; /* Tuner output is discarded, not inspected */
 
   /* Usage statistics (CPU, etc) */
-  SUFLOAT cpu_usage;
+  SUFLOAT cpu_usage; /* Source thread CPU time fraction, smoothed */
   struct timespec read_start;
-  struct timespec process_start;
-  struct timespec process_end;
+  uint64_t usage_cpu_ns;  /* Source thread CPU time at the last block */
+  uint64_t usage_wall_ns; /* Monotonic time at the last block */
   struct timespec last_psd;
   struct timespec last_channels;
 
+  /* Pipeline telemetry */
+  struct suscan_telemetry telemetry;
+  struct suscan_telemetry telemetry_last; /* As of the last report */
+  SUFLOAT  interval_telemetry;
+  uint64_t last_telemetry;
+  uint64_t telemetry_source_cpu; /* Thread CPU times as of the last report */
+  uint64_t telemetry_slow_cpu;
+
   /* Source worker objects */
   su_channel_detector_t *detector; /* Channel detector */
   suscan_worker_t *source_wk; /* Used by one source only */
+  struct suscan_worker_task source_task; /* Requeued after every read */
   suscan_worker_t *slow_wk; /* Worker for slow operations */
   SUCOMPLEX *read_buf;
   SUSCOUNT   read_size;
   PTR_LIST(struct suscan_analyzer_baseband_filter, bbfilt);
+  suscan_pretrigger_t *pretrig; /* Pre-trigger history, if enabled */
+  uint64_t reported_drops; /* Output drops already notified */
+  uint64_t last_drops_report;
+  struct suscan_analyzer_psd_msg *psd_spare; /* Reused by coalescing */
+
+  /* Detector worker: computes the PSD off the source thread (channel mode) */
+  suscan_worker_t *det_wk;
+  struct suscan_worker_task det_task;
+  pthread_mutex_t  det_mutex; /* Detector, det_count */
+  SUBOOL           det_mutex_init;
+  pthread_mutex_t  det_queue_mutex; /* Queue, det_num_psd, last_psd */
+  SUBOOL           det_queue_init;
+  struct suscan_analyzer_detector_block
+                   det_queue[SUSCAN_ANALYZER_DETECTOR_QUEUE_LEN];
+  unsigned int     det_queue_head;
+  unsigned int     det_queue_count;
+  SUBOOL           det_task_queued;
+  SUBOOL           det_gap;
+  uint64_t         telemetry_det_cpu;
 
   /* Spectral tuner */
   su_specttuner_t    *stuner;
 
-  /* Wide sweep parameters */
-  SUBOOL sweep_params_requested;
+  /* Wide sweep parameters, as last picked up from the hotconf */
   struct suscan_analyzer_sweep_params current_sweep_params;
-  struct suscan_analyzer_sweep_params pending_sweep_params;
   SUFREQ   curr_freq;
   SUSCOUNT part_ndx;
   SUSCOUNT fft_samples; /* Number of FFT frames */
@@ -204,12 +208,10 @@ struct suscan_analyzer {
   SUBOOL                inspector_list_init;
   suscan_inspsched_t *sched; /* Inspector scheduler */
   pthread_mutex_t     sched_lock;
-  pthread_barrier_t   barrier; /* Sched barrier */
-
-  struct suscan_inspector_overridable_request *insp_overridable;
 
   /* Analyzer thread */
   pthread_t thread;
+  SUBOOL    memory_locked;
 };
 
 typedef struct suscan_analyzer suscan_analyzer_t;
@@ -287,9 +289,26 @@ SUBOOL suscan_analyzer_set_dc_remove(suscan_analyzer_t *analyzer, SUBOOL val);
 SUBOOL suscan_analyzer_set_iq_reverse(suscan_analyzer_t *analyzer, SUBOOL val);
 SUBOOL suscan_analyzer_set_agc(suscan_analyzer_t *analyzer, SUBOOL val);
 
-void suscan_analyzer_destroy_slow_worker_data(suscan_analyzer_t *);
+/*
+ * Moves a file source to `pos' (time since the start of the capture).
+ * The absolute time of the capture start, if known, is available through
+ * suscan_source_config_get_start_time.
+ */
+SUBOOL suscan_analyzer_seek_async(
+    suscan_analyzer_t *analyzer,
+    const struct timeval *pos);
 
 void *suscan_analyzer_read(suscan_analyzer_t *analyzer, uint32_t *type);
+
+/*
+ * Reads all pending messages (up to max) at once. Each entry must be
+ * disposed as if returned by suscan_analyzer_read. See suscan_mq_read_batch.
+ */
+unsigned int suscan_analyzer_read_batch(
+    suscan_analyzer_t *analyzer,
+    struct suscan_msg *msgs,
+    unsigned int max,
+    const struct timespec *timeout);
 struct suscan_analyzer_inspector_msg *suscan_analyzer_read_inspector_msg(
     suscan_analyzer_t *analyzer);
 SUBOOL suscan_analyzer_write(
@@ -306,15 +325,6 @@ suscan_analyzer_t *suscan_analyzer_new(
     suscan_source_config_t *config,
     struct suscan_mq *mq);
 
-struct suscan_inspector_overridable_request *
-suscan_analyzer_acquire_overridable(
-    suscan_analyzer_t *self,
-    SUHANDLE handle);
-
-SUBOOL suscan_analyzer_release_overridable(
-    suscan_analyzer_t *self,
-    struct suscan_inspector_overridable_request *rq);
-
 suscan_inspector_t *suscan_analyzer_get_inspector(
     const suscan_analyzer_t *analyzer,
     SUHANDLE handle);
@@ -327,17 +337,70 @@ SUBOOL suscan_analyzer_lock_inspector_list(suscan_analyzer_t *analyzer);
 
 void suscan_analyzer_unlock_inspector_list(suscan_analyzer_t *analyzer);
 
-void suscan_analyzer_source_barrier(suscan_analyzer_t *analyzer);
-
 void suscan_analyzer_enter_sched(suscan_analyzer_t *analyzer);
 
 void suscan_analyzer_leave_sched(suscan_analyzer_t *analyzer);
 
+void suscan_analyzer_enter_detector(suscan_analyzer_t *analyzer);
+
+void suscan_analyzer_leave_detector(suscan_analyzer_t *analyzer);
+
 SUBOOL suscan_analyzer_register_baseband_filter(
     suscan_analyzer_t *analyzer,
     suscan_analyzer_baseband_filter_func_t func,
     void *privdata);
 
+/*
+ * Removes a filter registered with the same func and privdata. Once this
+ * returns, the source worker will not call it again.
+ */
+SUBOOL suscan_analyzer_unregister_baseband_filter(
+    suscan_analyzer_t *analyzer,
+    suscan_analyzer_baseband_filter_func_t func,
+    void *privdata);
+
+/*
+ * Bounds the number of pending messages of a given type in the output
+ * queue. Drops are notified through SUSCAN_ANALYZER_MESSAGE_TYPE_SAMPLES_LOST
+ * status messages, whose code is the number of messages lost since the
+ * last notification.
+ */
+SUBOOL suscan_analyzer_set_output_policy(
+    suscan_analyzer_t *analyzer,
+    uint32_t type,
+    enum suscan_mq_policy_type policy,
+    unsigned int budget);
+
+/*
+ * Cumulative stage timings and counters since the analyzer was created.
+ * The same data is periodically sent as interval deltas in
+ * SUSCAN_ANALYZER_MESSAGE_TYPE_TELEMETRY messages.
+ */
+void suscan_analyzer_get_telemetry(
+    const suscan_analyzer_t *analyzer,
+    struct suscan_telemetry *telemetry);
+
+/* Sets how often telemetry messages are sent. 0 disables them */
+SUBOOL suscan_analyzer_set_telemetry_interval(
+    suscan_analyzer_t *analyzer,
+    SUFLOAT interval);
+
+/* Keeps the last `history' seconds of baseband for triggered captures */
+SUBOOL suscan_analyzer_enable_pretrigger(
+    suscan_analyzer_t *analyzer,
+    SUFLOAT history);
+
+/*
+ * Asynchronously saves `pre' seconds before and `post' seconds after the
+ * current instant to path (raw complex float32). Typically called when a
+ * SUSCAN_ANALYZER_MESSAGE_TYPE_CHANNEL message reports a new channel.
+ */
+SUBOOL suscan_analyzer_trigger_capture(
+    suscan_analyzer_t *analyzer,
+    SUFLOAT pre,
+    SUFLOAT post,
+    const char *path);
+
 su_specttuner_channel_t *suscan_analyzer_open_channel_ex(
     suscan_analyzer_t *analyzer,
     const struct sigutils_channel *chan_info,
@@ -466,6 +529,12 @@ SUBOOL suscan_analyzer_reset_equalizer_async(
     SUHANDLE handle,
     uint32_t req_id);
 
+/* Replied with the inspector CPU accounting (see cpu_time and cpu_usage) */
+SUBOOL suscan_analyzer_get_inspector_info_async(
+    suscan_analyzer_t *analyzer,
+    SUHANDLE handle,
+    uint32_t req_id);
+
 #ifdef __cplusplus
 }
 #endif /* __cplusplus */
@@ -0,0 +1,241 @@
+/*
+
+  Copyright (C) 2020 Gonzalo José Carracedo Carballal
+
+  This program is free software: you can redistribute it and/or modify
+  it under the terms of the GNU Lesser General Public License as
+  published by the Free Software Foundation, either version 3 of the
+  License, or (at your option) any later version.
+
+  This program is distributed in the hope that it will be useful, but
+  WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+  GNU Lesser General Public License for more details.
+
+  You should have received a copy of the GNU Lesser General Public
+  License along with this program.  If not, see
+  <http://www.gnu.org/licenses/>
+
+*/
+
+#include <stdlib.h>
+#include <string.h>
+
+#define SU_LOG_DOMAIN "blockring"
+
+#include <sigutils/sigutils.h>
+#include "blockring.h"
+
+SUINLINE void *
+suscan_block_ring_block(const struct suscan_block_ring *self, unsigned int n)
+{
+  return self->buffer
+      + (n % self->block_count) * self->block_samples * self->sample_size;
+}
+
+SUPRIVATE void
+suscan_block_ring_wake_writer(struct suscan_block_ring *self)
+{
+  if (__atomic_load_n(&self->writer_waiting, __ATOMIC_SEQ_CST)) {
+    pthread_mutex_lock(&self->mutex);
+    pthread_cond_broadcast(&self->cond);
+    pthread_mutex_unlock(&self->mutex);
+  }
+}
+
+SUPRIVATE void *
+suscan_block_ring_thread(void *data)
+{
+  struct suscan_block_ring *self = (struct suscan_block_ring *) data;
+  unsigned int tail = self->tail;
+
+  for (;;) {
+    if (__atomic_load_n(&self->head, __ATOMIC_SEQ_CST) == tail) {
+      pthread_mutex_lock(&self->mutex);
+      __atomic_store_n(&self->writer_waiting, 1, __ATOMIC_SEQ_CST);
+      while (__atomic_load_n(&self->head, __ATOMIC_SEQ_CST) == tail
+          && !self->halt)
+        pthread_cond_wait(&self->cond, &self->mutex);
+      __atomic_store_n(&self->writer_waiting, 0, __ATOMIC_RELAXED);
+      pthread_mutex_unlock(&self->mutex);
+
+      /* Halt only once everything published has been consumed */
+      if (__atomic_load_n(&self->head, __ATOMIC_SEQ_CST) == tail)
+        break;
+    }
+
+    if (!__atomic_load_n(&self->failed, __ATOMIC_RELAXED)
+        && !(self->ops.consume) (
+            self->privdata,
+            suscan_block_ring_block(self, tail),
+            self->block_samples,
+            tail % self->block_count))
+      __atomic_store_n(&self->failed, SU_TRUE, __ATOMIC_RELAXED);
+
+    __atomic_store_n(&self->tail, ++tail, __ATOMIC_SEQ_CST);
+  }
+
+  return NULL;
+}
+
+SUBOOL
+suscan_block_ring_write(
+    struct suscan_block_ring *self,
+    const SUCOMPLEX *samples,
+    SUSCOUNT length)
+{
+  uint8_t *dest;
+  SUSCOUNT chunk;
+
+  while (length > 0) {
+    /* Dropping a block: skip samples until a whole block is gone */
+    if (self->discard > 0) {
+      chunk = SU_MIN(self->discard, length);
+
+      self->discard -= chunk;
+      self->produced += chunk;
+      samples += chunk;
+      length -= chunk;
+
+      if (self->discard == 0)
+        __atomic_add_fetch(&self->dropped_blocks, 1, __ATOMIC_RELAXED);
+
+      continue;
+    }
+
+    if (self->fill == 0) {
+      /* Need a fresh block, but the writer thread is behind */
+      if (self->head - __atomic_load_n(&self->tail, __ATOMIC_SEQ_CST)
+          == self->block_count) {
+        self->discard = self->block_samples;
+        continue;
+      }
+
+      if (self->ops.start != NULL)
+        (self->ops.start) (
+            self->privdata,
+            self->head % self->block_count,
+            self->produced);
+    }
+
+    chunk = SU_MIN(self->block_samples - self->fill, length);
+    dest = (uint8_t *) suscan_block_ring_block(self, self->head)
+        + self->fill * self->sample_size;
+
+    if (self->ops.copy != NULL)
+      (self->ops.copy) (dest, samples, chunk);
+    else
+      memcpy(dest, samples, chunk * sizeof(SUCOMPLEX));
+
+    self->fill += chunk;
+    self->produced += chunk;
+    samples += chunk;
+    length -= chunk;
+
+    if (self->fill == self->block_samples) {
+      self->fill = 0;
+      __atomic_store_n(&self->head, self->head + 1, __ATOMIC_SEQ_CST);
+      suscan_block_ring_wake_writer(self);
+    }
+  }
+
+  return !__atomic_load_n(&self->failed, __ATOMIC_RELAXED);
+}
+
+void
+suscan_block_ring_halt(struct suscan_block_ring *self)
+{
+  if (!self->thread_running)
+    return;
+
+  pthread_mutex_lock(&self->mutex);
+  self->halt = SU_TRUE;
+  pthread_cond_broadcast(&self->cond);
+  pthread_mutex_unlock(&self->mutex);
+
+  pthread_join(self->thread, NULL);
+  self->thread_running = SU_FALSE;
+}
+
+void *
+suscan_block_ring_get_partial(
+    struct suscan_block_ring *self,
+    SUSCOUNT *samples,
+    unsigned int *index)
+{
+  *samples = self->fill;
+  *index = self->head % self->block_count;
+
+  return suscan_block_ring_block(self, self->head);
+}
+
+void
+suscan_block_ring_finalize(struct suscan_block_ring *self)
+{
+  suscan_block_ring_halt(self);
+
+  if (self->mutex_init)
+    pthread_mutex_destroy(&self->mutex);
+
+  if (self->cond_init)
+    pthread_cond_destroy(&self->cond);
+
+  if (self->buffer != NULL)
+    free(self->buffer);
+
+  memset(self, 0, sizeof(struct suscan_block_ring));
+}
+
+SUBOOL
+suscan_block_ring_init(
+    struct suscan_block_ring *self,
+    const struct suscan_block_ring_ops *ops,
+    void *privdata,
+    size_t sample_size,
+    SUSCOUNT block_samples,
+    unsigned int block_count,
+    size_t alignment)
+{
+  void *buffer;
+
+  memset(self, 0, sizeof(struct suscan_block_ring));
+
+  SU_TRYCATCH(ops->consume != NULL, goto fail);
+  SU_TRYCATCH(block_samples > 0 && block_count > 0, goto fail);
+  SU_TRYCATCH(ops->copy != NULL || sample_size == sizeof(SUCOMPLEX), goto fail);
+
+  self->ops = *ops;
+  self->privdata = privdata;
+  self->sample_size = sample_size;
+  self->block_samples = block_samples;
+  self->block_count = block_count;
+
+  if (alignment < sizeof(void *))
+    alignment = sizeof(void *);
+
+  SU_TRYCATCH(
+      posix_memalign(
+          &buffer,
+          alignment,
+          block_count * block_samples * sample_size) == 0,
+      goto fail);
+  self->buffer = buffer;
+
+  SU_TRYCATCH(pthread_mutex_init(&self->mutex, NULL) == 0, goto fail);
+  self->mutex_init = SU_TRUE;
+
+  SU_TRYCATCH(pthread_cond_init(&self->cond, NULL) == 0, goto fail);
+  self->cond_init = SU_TRUE;
+
+  SU_TRYCATCH(
+      pthread_create(&self->thread, NULL, suscan_block_ring_thread, self) == 0,
+      goto fail);
+  self->thread_running = SU_TRUE;
+
+  return SU_TRUE;
+
+fail:
+  suscan_block_ring_finalize(self);
+
+  return SU_FALSE;
+}
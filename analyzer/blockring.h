@@ -0,0 +1,148 @@
+/*
+
+  Copyright (C) 2020 Gonzalo José Carracedo Carballal
+
+  This program is free software: you can redistribute it and/or modify
+  it under the terms of the GNU Lesser General Public License as
+  published by the Free Software Foundation, either version 3 of the
+  License, or (at your option) any later version.
+
+  This program is distributed in the hope that it will be useful, but
+  WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+  GNU Lesser General Public License for more details.
+
+  You should have received a copy of the GNU Lesser General Public
+  License along with this program.  If not, see
+  <http://www.gnu.org/licenses/>
+
+*/
+
+#ifndef _BLOCKRING_H
+#define _BLOCKRING_H
+
+#include <stdint.h>
+#include <stddef.h>
+#include <pthread.h>
+#include <sigutils/sigutils.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif /* __cplusplus */
+
+/*
+ * Single-producer ring of sample blocks, drained by its own writer
+ * thread. Used by the sinks that run as baseband filters (recorder,
+ * capture writer): the producer only copies samples and never blocks.
+ * If the ring is full, a whole block worth of samples is dropped and
+ * accounted.
+ *
+ * Sleeping protocol (same as the source read-ahead ring): the writer
+ * announces itself and re-checks the ring under the mutex, the producer
+ * publishes first and takes the mutex only if the writer is sleeping.
+ */
+struct suscan_block_ring_ops {
+  /*
+   * Writer thread: consumes a full block. Block n is passed as
+   * n % block_count. Once it fails, no more blocks are consumed.
+   */
+  SUBOOL (*consume) (
+      void *privdata,
+      void *block,
+      SUSCOUNT samples,
+      unsigned int index);
+
+  /* Producer: converts samples into the ring. NULL means memcpy */
+  void (*copy) (void *dest, const SUCOMPLEX *samples, SUSCOUNT length);
+
+  /* Producer: a new block starts with the given sample. May be NULL */
+  void (*start) (void *privdata, unsigned int index, uint64_t first_sample);
+};
+
+struct suscan_block_ring {
+  struct suscan_block_ring_ops ops;
+  void *privdata;
+
+  uint8_t *buffer;
+  size_t sample_size;    /* Bytes per sample in the ring */
+  SUSCOUNT block_samples;
+  unsigned int block_count;
+
+  /* Producer state */
+  SUSCOUNT fill;     /* Samples in the block being filled */
+  SUSCOUNT discard;  /* Samples left to drop from the current dropped block */
+  uint64_t produced; /* Samples seen, including the dropped ones */
+
+  unsigned int head; /* Written by the producer */
+  unsigned int tail; /* Written by the writer thread */
+
+  SUBOOL halt;
+  int writer_waiting;
+
+  pthread_mutex_t mutex;
+  SUBOOL mutex_init;
+  pthread_cond_t cond;
+  SUBOOL cond_init;
+  pthread_t thread;
+  SUBOOL thread_running;
+
+  /* Statistics, shared between threads: accessed atomically */
+  uint64_t dropped_blocks;
+  SUBOOL   failed;
+};
+
+/*
+ * Blocks are aligned to alignment bytes (0 for no particular alignment).
+ * The writer thread starts right away.
+ */
+SUBOOL suscan_block_ring_init(
+    struct suscan_block_ring *self,
+    const struct suscan_block_ring_ops *ops,
+    void *privdata,
+    size_t sample_size,
+    SUSCOUNT block_samples,
+    unsigned int block_count,
+    size_t alignment);
+
+SUBOOL suscan_block_ring_write(
+    struct suscan_block_ring *self,
+    const SUCOMPLEX *samples,
+    SUSCOUNT length);
+
+/* Waits for all published blocks to be consumed and stops the thread */
+void suscan_block_ring_halt(struct suscan_block_ring *self);
+
+/* After halting: the block being filled, with *samples in it */
+void *suscan_block_ring_get_partial(
+    struct suscan_block_ring *self,
+    SUSCOUNT *samples,
+    unsigned int *index);
+
+SUINLINE SUBOOL
+suscan_block_ring_has_failed(const struct suscan_block_ring *self)
+{
+  return __atomic_load_n(&self->failed, __ATOMIC_RELAXED);
+}
+
+SUINLINE uint64_t
+suscan_block_ring_get_dropped(const struct suscan_block_ring *self)
+{
+  return __atomic_load_n(&self->dropped_blocks, __ATOMIC_RELAXED);
+}
+
+/* Blocks waiting to be consumed */
+SUINLINE unsigned int
+suscan_block_ring_get_fill(const struct suscan_block_ring *self)
+{
+  return __atomic_load_n(&self->head, __ATOMIC_SEQ_CST)
+      - __atomic_load_n(&self->tail, __ATOMIC_SEQ_CST);
+}
+
+/* Halts the thread if still running */
+void suscan_block_ring_finalize(struct suscan_block_ring *self);
+
+#ifdef __cplusplus
+}
+#endif /* __cplusplus */
+
+#endif /* _BLOCKRING_H */
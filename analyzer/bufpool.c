@@ -19,85 +19,462 @@
 
 #define SU_LOG_DOMAIN "bufpool"
 
+#include <stdlib.h>
+#include <string.h>
 #include <sigutils/log.h>
 
 #include "bufpool.h"
 
-#define MIN_POOL 5
-#define NUM_POOLS 16
+struct suscan_magazine {
+  struct suscan_buffer_header *rounds;
+  unsigned int count;
+};
 
-SUPRIVATE struct suscan_pool pools[NUM_POOLS];
+struct suscan_pool_cache {
+  struct suscan_magazine loaded[SUSCAN_BUFPOOL_NUM_CLASSES];
+  struct suscan_magazine previous[SUSCAN_BUFPOOL_NUM_CLASSES];
 
+  /* Written by the owner only, read by suscan_bufpool_get_stats */
+  uint64_t hits;
+  uint64_t misses;
+
+  struct suscan_pool_cache *next;
+  struct suscan_pool_cache *prev;
+};
+
+SUPRIVATE struct suscan_pool pools[SUSCAN_BUFPOOL_NUM_CLASSES];
+SUPRIVATE pthread_once_t pools_once = PTHREAD_ONCE_INIT;
+SUPRIVATE pthread_key_t cache_key;
+SUPRIVATE SUBOOL cache_key_ok = SU_FALSE;
+
+SUPRIVATE pthread_mutex_t caches_mutex = PTHREAD_MUTEX_INITIALIZER;
+SUPRIVATE struct suscan_pool_cache *caches;
+
+/* Counters of exited threads and allocations that bypassed the caches */
+SUPRIVATE uint64_t retired_hits;
+SUPRIVATE uint64_t retired_misses;
+SUPRIVATE uint64_t bytes_held;
+
+SUPRIVATE __thread struct suscan_pool_cache *thread_cache;
+
+SUINLINE void
+suscan_pool_count(uint64_t *counter)
+{
+  __atomic_store_n(counter, *counter + 1, __ATOMIC_RELAXED);
+}
+
+SUINLINE size_t
+suscan_pool_class_size(unsigned int index)
+{
+  return (size_t) 1 << (index + SUSCAN_BUFPOOL_MIN_CLASS);
+}
+
+SUPRIVATE unsigned int
+suscan_pool_class_for(size_t size)
+{
+  unsigned int index = 0;
+
+  while (suscan_pool_class_size(index) < size)
+    if (++index == SUSCAN_BUFPOOL_NUM_CLASSES)
+      return SUSCAN_BUFPOOL_UNPOOLED;
+
+  return index;
+}
+
+/***************************** System allocator ******************************/
+SUPRIVATE struct suscan_buffer_header *
+suscan_pool_system_alloc(size_t payload)
+{
+  void *mem;
+
+  if (posix_memalign(
+      &mem,
+      SUSCAN_BUFPOOL_ALIGNMENT,
+      sizeof(struct suscan_buffer_header) + payload) != 0)
+    return NULL;
+
+  __atomic_add_fetch(&bytes_held, payload, __ATOMIC_RELAXED);
+
+  return mem;
+}
+
+SUPRIVATE void
+suscan_pool_system_free(struct suscan_buffer_header *header)
+{
+  size_t payload;
+
+  if (header->pool_index == SUSCAN_BUFPOOL_UNPOOLED)
+    payload = header->size;
+  else
+    payload = suscan_pool_class_size(header->pool_index);
+
+  header->magic = 0;
+  free(header);
+
+  __atomic_sub_fetch(&bytes_held, payload, __ATOMIC_RELAXED);
+}
+
+SUPRIVATE void
+suscan_pool_system_free_rounds(struct suscan_buffer_header *rounds)
+{
+  struct suscan_buffer_header *next;
+
+  while (rounds != NULL) {
+    next = rounds->next;
+    suscan_pool_system_free(rounds);
+    rounds = next;
+  }
+}
+
+/********************************** Depots ***********************************/
+/* All depot methods are called with the depot mutex held */
+SUPRIVATE SUBOOL
+suscan_pool_depot_get(struct suscan_pool *pool, struct suscan_magazine *mag)
+{
+  if (pool->full != NULL) {
+    mag->rounds = pool->full;
+    mag->count  = pool->rounds;
+    pool->full  = pool->full->next_mag;
+    --pool->magazines;
+  } else if (pool->loose != NULL) {
+    mag->rounds = pool->loose;
+    mag->count  = pool->loose_count;
+    pool->loose = NULL;
+    pool->loose_count = 0;
+  } else {
+    return SU_FALSE;
+  }
+
+  return SU_TRUE;
+}
+
+SUPRIVATE SUBOOL
+suscan_pool_depot_put(struct suscan_pool *pool, struct suscan_magazine *mag)
+{
+  if (pool->magazines == SUSCAN_BUFPOOL_DEPOT_MAGAZINES)
+    return SU_FALSE;
+
+  mag->rounds->next_mag = pool->full;
+  pool->full = mag->rounds;
+  ++pool->magazines;
+
+  return SU_TRUE;
+}
+
+SUPRIVATE SUBOOL
+suscan_pool_depot_put_round(
+    struct suscan_pool *pool,
+    struct suscan_buffer_header *header)
+{
+  struct suscan_magazine mag;
+
+  if (pool->loose_count == pool->rounds) {
+    mag.rounds = pool->loose;
+    mag.count = pool->loose_count;
+
+    if (!suscan_pool_depot_put(pool, &mag))
+      return SU_FALSE;
+
+    pool->loose = NULL;
+    pool->loose_count = 0;
+  }
+
+  header->next = pool->loose;
+  pool->loose = header;
+  ++pool->loose_count;
+
+  return SU_TRUE;
+}
+
+/****************************** Thread caches ********************************/
+SUPRIVATE void
+suscan_pool_cache_flush(unsigned int index, struct suscan_magazine *mag)
+{
+  struct suscan_pool *pool = &pools[index];
+  struct suscan_buffer_header *header;
+  struct suscan_buffer_header *reject = NULL;
+
+  pthread_mutex_lock(&pool->mutex);
+  while ((header = mag->rounds) != NULL) {
+    mag->rounds = header->next;
+    if (!suscan_pool_depot_put_round(pool, header)) {
+      header->next = reject;
+      reject = header;
+    }
+  }
+  pthread_mutex_unlock(&pool->mutex);
+
+  mag->count = 0;
+
+  suscan_pool_system_free_rounds(reject);
+}
+
+SUPRIVATE void
+suscan_pool_cache_destroy(void *ptr)
+{
+  struct suscan_pool_cache *cache = (struct suscan_pool_cache *) ptr;
+  unsigned int i;
+
+  thread_cache = NULL;
+
+  for (i = 0; i < SUSCAN_BUFPOOL_NUM_CLASSES; ++i) {
+    suscan_pool_cache_flush(i, &cache->loaded[i]);
+    suscan_pool_cache_flush(i, &cache->previous[i]);
+  }
+
+  pthread_mutex_lock(&caches_mutex);
+  if (cache->prev != NULL)
+    cache->prev->next = cache->next;
+  else
+    caches = cache->next;
+
+  if (cache->next != NULL)
+    cache->next->prev = cache->prev;
+
+  __atomic_add_fetch(&retired_hits, cache->hits, __ATOMIC_RELAXED);
+  __atomic_add_fetch(&retired_misses, cache->misses, __ATOMIC_RELAXED);
+  pthread_mutex_unlock(&caches_mutex);
+
+  free(cache);
+}
+
+SUPRIVATE void
+suscan_pool_init_once(void)
+{
+  unsigned int i;
+  size_t rounds;
+
+  for (i = 0; i < SUSCAN_BUFPOOL_NUM_CLASSES; ++i) {
+    /* Large classes keep fewer buffers per magazine */
+    rounds = SUSCAN_BUFPOOL_MAGAZINE_BYTES / suscan_pool_class_size(i);
+    if (rounds < 1)
+      rounds = 1;
+    else if (rounds > SUSCAN_BUFPOOL_MAGAZINE_ROUNDS)
+      rounds = SUSCAN_BUFPOOL_MAGAZINE_ROUNDS;
+
+    pools[i].rounds = rounds;
+    pthread_mutex_init(&pools[i].mutex, NULL);
+  }
+
+  cache_key_ok =
+      pthread_key_create(&cache_key, suscan_pool_cache_destroy) == 0;
+}
+
+/* NULL if the thread cache could not be created: go to the system instead */
+SUPRIVATE struct suscan_pool_cache *
+suscan_pool_get_cache(void)
+{
+  struct suscan_pool_cache *cache;
+
+  if (thread_cache != NULL)
+    return thread_cache;
+
+  pthread_once(&pools_once, suscan_pool_init_once);
+
+  if (!cache_key_ok)
+    return NULL;
+
+  if ((cache = calloc(1, sizeof(struct suscan_pool_cache))) == NULL)
+    return NULL;
+
+  if (pthread_setspecific(cache_key, cache) != 0) {
+    free(cache);
+    return NULL;
+  }
+
+  pthread_mutex_lock(&caches_mutex);
+  cache->next = caches;
+  if (caches != NULL)
+    caches->prev = cache;
+  caches = cache;
+  pthread_mutex_unlock(&caches_mutex);
+
+  thread_cache = cache;
+
+  return cache;
+}
+
+/******************************** Public API *********************************/
+void *
+suscan_pool_alloc(size_t size)
+{
+  struct suscan_pool_cache *cache;
+  struct suscan_magazine *mag;
+  struct suscan_magazine tmp;
+  struct suscan_buffer_header *header = NULL;
+  unsigned int index;
+
+  if (size > UINT32_MAX) {
+    SU_ERROR("Pool allocation of %lu bytes is too big\n", (unsigned long) size);
+    return NULL;
+  }
+
+  index = suscan_pool_class_for(size);
+
+  if (index == SUSCAN_BUFPOOL_UNPOOLED
+      || (cache = suscan_pool_get_cache()) == NULL) {
+    __atomic_add_fetch(&retired_misses, 1, __ATOMIC_RELAXED);
+    header = suscan_pool_system_alloc(
+        index == SUSCAN_BUFPOOL_UNPOOLED
+        ? size
+        : suscan_pool_class_size(index));
+  } else {
+    mag = &cache->loaded[index];
+
+    if (mag->count == 0) {
+      if (cache->previous[index].count > 0) {
+        tmp = *mag;
+        *mag = cache->previous[index];
+        cache->previous[index] = tmp;
+      } else {
+        pthread_mutex_lock(&pools[index].mutex);
+        (void) suscan_pool_depot_get(&pools[index], mag);
+        pthread_mutex_unlock(&pools[index].mutex);
+      }
+    }
+
+    if (mag->count > 0) {
+      header = mag->rounds;
+      mag->rounds = header->next;
+      --mag->count;
+      suscan_pool_count(&cache->hits);
+    } else {
+      suscan_pool_count(&cache->misses);
+      header = suscan_pool_system_alloc(suscan_pool_class_size(index));
+    }
+  }
+
+  SU_TRYCATCH(header != NULL, return NULL);
+
+  header->next = NULL;
+  header->next_mag = NULL;
+  header->magic = SUSCAN_BUFPOOL_MAGIC;
+  header->size = size;
+  header->refs = 1;
+  header->pool_index = index;
+
+  return header + 1;
+}
 
 void
-suscan_buffer_return(SUCOMPLEX *data)
+suscan_pool_ref(void *data)
+{
+  __atomic_add_fetch(
+      &suscan_buffer_get_header(data)->refs,
+      1,
+      __ATOMIC_RELAXED);
+}
+
+void
+suscan_pool_free(void *data)
 {
   struct suscan_buffer_header *header;
+  struct suscan_pool_cache *cache;
+  struct suscan_magazine *mag;
+  struct suscan_magazine *prev;
+  struct suscan_magazine tmp;
   unsigned int index;
+  SUBOOL stored;
 
-  header = (struct suscan_buffer_header *) (
-      (char *) data - sizeof(struct suscan_buffer_header));
+  if (data == NULL)
+    return;
 
-  if (header->pool_index >= NUM_POOLS) {
+  header = suscan_buffer_get_header(data);
+  index = header->pool_index;
+
+  if (header->magic != SUSCAN_BUFPOOL_MAGIC
+      || (index >= SUSCAN_BUFPOOL_NUM_CLASSES
+          && index != SUSCAN_BUFPOOL_UNPOOLED)) {
     SU_ERROR("*** INVALID POOL BUFFER RETURN ***\n");
     abort();
   }
 
-  index = header->pool_index;
+  if (__atomic_sub_fetch(&header->refs, 1, __ATOMIC_ACQ_REL) != 0)
+    return;
 
-  pthread_mutex_lock(&pools[index].mutex);
-  header->next = pools[index].first;
-  pools[index].first = header;
-  pthread_mutex_lock(&pools[index].mutex);
+  /* Buffers may come from any thread: they join the caller's magazines */
+  if (index == SUSCAN_BUFPOOL_UNPOOLED
+      || (cache = suscan_pool_get_cache()) == NULL) {
+    suscan_pool_system_free(header);
+    return;
+  }
+
+  mag = &cache->loaded[index];
+
+  if (mag->count == pools[index].rounds) {
+    prev = &cache->previous[index];
+
+    /* Both magazines full: the older one goes to the depot */
+    if (prev->count > 0) {
+      pthread_mutex_lock(&pools[index].mutex);
+      stored = suscan_pool_depot_put(&pools[index], prev);
+      pthread_mutex_unlock(&pools[index].mutex);
+
+      if (!stored)
+        suscan_pool_system_free_rounds(prev->rounds);
 
+      prev->rounds = NULL;
+      prev->count = 0;
+    }
+
+    tmp = *mag;
+    *mag = *prev;
+    *prev = tmp;
+  }
+
+  header->next = mag->rounds;
+  mag->rounds = header;
+  ++mag->count;
+}
+
+void
+suscan_buffer_return(SUCOMPLEX *data)
+{
+  suscan_pool_free(data);
 }
 
 SUCOMPLEX *
 suscan_buffer_alloc(unsigned int length)
 {
-  unsigned int i = 0;
-  struct suscan_buffer_header *header = NULL;
+  return suscan_pool_alloc(length * sizeof(SUCOMPLEX));
+}
+
+void
+suscan_bufpool_get_stats(struct suscan_bufpool_stats *stats)
+{
+  struct suscan_pool_cache *cache;
+  unsigned int i;
+  uint64_t rounds;
 
-  while ((length >>= 1) != 0)
-    ++i;
+  pthread_once(&pools_once, suscan_pool_init_once);
 
-  if (i < MIN_POOL)
-    i = MIN_POOL;
+  memset(stats, 0, sizeof(struct suscan_bufpool_stats));
 
-  if (i >= NUM_POOLS) {
-    SU_ERROR("Pool allocation of %d samples is too big\n", length);
-    return NULL;
-  }
+  pthread_mutex_lock(&caches_mutex);
+  stats->hits   = __atomic_load_n(&retired_hits, __ATOMIC_RELAXED);
+  stats->misses = __atomic_load_n(&retired_misses, __ATOMIC_RELAXED);
 
-  pthread_mutex_lock(&pools[i].mutex);
-  header = pools[i].first;
-  if (header != NULL)
-    pools[i].first = header->next;
-  pthread_mutex_unlock(&pools[i].mutex);
-
-  if (header == NULL) {
-    SU_TRYCATCH(
-        header = malloc(
-          sizeof(struct suscan_buffer_header) + (sizeof(SUCOMPLEX) << i)),
-        return NULL);
+  for (cache = caches; cache != NULL; cache = cache->next) {
+    stats->hits   += __atomic_load_n(&cache->hits, __ATOMIC_RELAXED);
+    stats->misses += __atomic_load_n(&cache->misses, __ATOMIC_RELAXED);
   }
+  pthread_mutex_unlock(&caches_mutex);
 
-  header->pool_index = i;
-  header->length = length;
+  for (i = 0; i < SUSCAN_BUFPOOL_NUM_CLASSES; ++i) {
+    pthread_mutex_lock(&pools[i].mutex);
+    rounds = pools[i].magazines * pools[i].rounds + pools[i].loose_count;
+    pthread_mutex_unlock(&pools[i].mutex);
+
+    stats->bytes_cached += rounds * suscan_pool_class_size(i);
+  }
 
-  return header->data;
+  stats->bytes_held = __atomic_load_n(&bytes_held, __ATOMIC_RELAXED);
 }
 
 SUBOOL
 suscan_init_pools(void)
 {
-  unsigned int i;
-
-  for (i = 0; i < NUM_POOLS; ++i) {
-    SU_TRYCATCH(
-        pthread_mutex_init(&pools[i].mutex, NULL) != -1,
-        return SU_FALSE);
-  }
+  pthread_once(&pools_once, suscan_pool_init_once);
 
-  return SU_TRUE;
+  return cache_key_ok;
 }
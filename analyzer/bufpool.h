@@ -27,40 +27,85 @@ extern "C" {
 
 #include <sigutils/types.h>
 #include <pthread.h>
+#include <stdint.h>
 
+/*
+ * Buffers are handed out from power-of-two size classes. Every thread keeps
+ * two magazines (bounded stacks of free buffers) per class, and exchanges
+ * whole magazines with a global, mutex-protected depot only when they run
+ * empty or full. Buffers may be returned from any thread.
+ */
+#define SUSCAN_BUFPOOL_ALIGNMENT         64
+#define SUSCAN_BUFPOOL_MIN_CLASS         6   /* 64 bytes */
+#define SUSCAN_BUFPOOL_NUM_CLASSES       19  /* Up to 16 MiB */
+#define SUSCAN_BUFPOOL_MAGAZINE_ROUNDS   16
+#define SUSCAN_BUFPOOL_MAGAZINE_BYTES    (1 << 20)
+#define SUSCAN_BUFPOOL_DEPOT_MAGAZINES   32
+#define SUSCAN_BUFPOOL_UNPOOLED          0xffff
+#define SUSCAN_BUFPOOL_MAGIC             0x5342504c
+
+/* Padded so that payloads keep the alignment of the allocation */
 struct suscan_buffer_header {
   union {
     struct {
+      struct suscan_buffer_header *next;     /* Next round in magazine */
+      struct suscan_buffer_header *next_mag; /* Next magazine in depot */
+      uint32_t magic;
+      uint32_t size;                         /* Requested size, in bytes */
+      uint32_t refs;
       uint16_t pool_index;
-      uint16_t length;
     };
 
-    struct suscan_buffer_header *next;
-    SUCOMPLEX placeholder;
+    char padding[SUSCAN_BUFPOOL_ALIGNMENT];
   };
-
-  SUCOMPLEX data[0];
 };
 
-
 struct suscan_pool {
-  struct suscan_buffer_header *first;
-  unsigned int allocated;
+  struct suscan_buffer_header *full;  /* Full magazines */
+  unsigned int magazines;
+  struct suscan_buffer_header *loose; /* Partial magazine */
+  unsigned int loose_count;
+  unsigned int rounds;                /* Rounds per magazine */
   pthread_mutex_t mutex;
 };
 
-SUINLINE uint16_t
-suscan_buffer_get_length(const SUCOMPLEX *data)
+struct suscan_bufpool_stats {
+  uint64_t hits;         /* Served from a magazine or the depot */
+  uint64_t misses;       /* Served by the system allocator */
+  uint64_t bytes_held;   /* Obtained from the system, in use or cached */
+  uint64_t bytes_cached; /* Part of bytes_held sitting in the depots */
+};
+
+SUINLINE struct suscan_buffer_header *
+suscan_buffer_get_header(const void *data)
 {
-  struct suscan_buffer_header *header;
-  header = (struct suscan_buffer_header *) (
-      (char *) data - sizeof(struct suscan_buffer_header));
+  return (struct suscan_buffer_header *) data - 1;
+}
 
-  return header->length;
+SUINLINE size_t
+suscan_pool_get_size(const void *data)
+{
+  return suscan_buffer_get_header(data)->size;
 }
 
+SUINLINE unsigned int
+suscan_buffer_get_length(const SUCOMPLEX *data)
+{
+  return suscan_pool_get_size(data) / sizeof(SUCOMPLEX);
+}
+
+/*
+ * Aligned to SUSCAN_BUFPOOL_ALIGNMENT. Buffers start with one reference,
+ * suscan_pool_free drops one and recycles the buffer when none are left.
+ */
+void *suscan_pool_alloc(size_t size);
+void suscan_pool_ref(void *data);
+void suscan_pool_free(void *data);
+
 void suscan_buffer_return(SUCOMPLEX *data);
 SUCOMPLEX *suscan_buffer_alloc(unsigned int length);
+
+void suscan_bufpool_get_stats(struct suscan_bufpool_stats *stats);
 SUBOOL suscan_init_pools(void);
 
 #ifdef __cplusplus
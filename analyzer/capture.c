@@ -0,0 +1,1070 @@
+/*
+
+  Copyright (C) 2020 Gonzalo José Carracedo Carballal
+
+  This program is free software: you can redistribute it and/or modify
+  it under the terms of the GNU Lesser General Public License as
+  published by the Free Software Foundation, either version 3 of the
+  License, or (at your option) any later version.
+
+  This program is distributed in the hope that it will be useful, but
+  WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+  GNU Lesser General Public License for more details.
+
+  You should have received a copy of the GNU Lesser General Public
+  License along with this program.  If not, see
+  <http://www.gnu.org/licenses/>
+
+*/
+
+
+#define _FILE_OFFSET_BITS 64
+
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <sys/stat.h>
+#include <time.h>
+#include <math.h>
+
+#define SU_LOG_DOMAIN "capture"
+
+#include <sigutils/sigutils.h>
+#include "capture.h"
+#include "analyzer.h"
+
+/****************************** Serialization ********************************/
+SUPRIVATE void
+suscan_capture_put_u32(uint8_t *p, uint32_t val)
+{
+  unsigned int i;
+
+  for (i = 0; i < 4; ++i)
+    p[i] = val >> (8 * i);
+}
+
+SUPRIVATE void
+suscan_capture_put_u64(uint8_t *p, uint64_t val)
+{
+  unsigned int i;
+
+  for (i = 0; i < 8; ++i)
+    p[i] = val >> (8 * i);
+}
+
+SUPRIVATE void
+suscan_capture_put_f64(uint8_t *p, double val)
+{
+  uint64_t as_int;
+
+  memcpy(&as_int, &val, sizeof(uint64_t));
+  suscan_capture_put_u64(p, as_int);
+}
+
+SUPRIVATE void
+suscan_capture_put_f32(uint8_t *p, float val)
+{
+  uint32_t as_int;
+
+  memcpy(&as_int, &val, sizeof(uint32_t));
+  suscan_capture_put_u32(p, as_int);
+}
+
+SUPRIVATE uint32_t
+suscan_capture_get_u32(const uint8_t *p)
+{
+  uint32_t val = 0;
+  unsigned int i;
+
+  for (i = 0; i < 4; ++i)
+    val |= (uint32_t) p[i] << (8 * i);
+
+  return val;
+}
+
+SUPRIVATE uint64_t
+suscan_capture_get_u64(const uint8_t *p)
+{
+  uint64_t val = 0;
+  unsigned int i;
+
+  for (i = 0; i < 8; ++i)
+    val |= (uint64_t) p[i] << (8 * i);
+
+  return val;
+}
+
+SUPRIVATE double
+suscan_capture_get_f64(const uint8_t *p)
+{
+  uint64_t as_int = suscan_capture_get_u64(p);
+  double val;
+
+  memcpy(&val, &as_int, sizeof(double));
+
+  return val;
+}
+
+SUPRIVATE float
+suscan_capture_get_f32(const uint8_t *p)
+{
+  uint32_t as_int = suscan_capture_get_u32(p);
+  float val;
+
+  memcpy(&val, &as_int, sizeof(float));
+
+  return val;
+}
+
+SUPRIVATE void
+suscan_capture_header_serialize(
+    const struct suscan_capture_header *header,
+    uint8_t *buf)
+{
+  memset(buf, 0, SUSCAN_CAPTURE_HEADER_SIZE);
+
+  memcpy(buf, SUSCAN_CAPTURE_MAGIC, 8);
+  suscan_capture_put_u32(buf + 8,  header->version);
+  suscan_capture_put_u32(buf + 12, header->quant_bits);
+  suscan_capture_put_f64(buf + 16, header->samp_rate);
+  suscan_capture_put_u32(buf + 24, header->block_size);
+  suscan_capture_put_u64(buf + 32, header->index_offset);
+  suscan_capture_put_u64(buf + 40, header->block_count);
+  suscan_capture_put_u64(buf + 48, header->start_time);
+}
+
+SUPRIVATE SUBOOL
+suscan_capture_header_deserialize(
+    struct suscan_capture_header *header,
+    const uint8_t *buf)
+{
+  if (memcmp(buf, SUSCAN_CAPTURE_MAGIC, 8) != 0)
+    return SU_FALSE;
+
+  header->version      = suscan_capture_get_u32(buf + 8);
+  header->quant_bits   = suscan_capture_get_u32(buf + 12);
+  header->samp_rate    = suscan_capture_get_f64(buf + 16);
+  header->block_size   = suscan_capture_get_u32(buf + 24);
+  header->index_offset = suscan_capture_get_u64(buf + 32);
+  header->block_count  = suscan_capture_get_u64(buf + 40);
+  header->start_time   = suscan_capture_get_u64(buf + 48);
+
+  return SU_TRUE;
+}
+
+SUPRIVATE void
+suscan_capture_block_header_serialize(
+    const struct suscan_capture_block_header *header,
+    uint8_t *buf)
+{
+  memset(buf, 0, SUSCAN_CAPTURE_BLOCK_HEADER_SIZE);
+
+  suscan_capture_put_u32(buf,      SUSCAN_CAPTURE_BLOCK_MAGIC);
+  suscan_capture_put_u32(buf + 4,  header->samples);
+  suscan_capture_put_u64(buf + 8,  header->timestamp);
+  suscan_capture_put_f64(buf + 16, header->freq);
+  suscan_capture_put_f32(buf + 24, header->scale);
+  buf[28] = header->width;
+  suscan_capture_put_u32(buf + 32, header->payload_size);
+}
+
+SUPRIVATE SUBOOL
+suscan_capture_block_header_deserialize(
+    struct suscan_capture_block_header *header,
+    const uint8_t *buf)
+{
+  if (suscan_capture_get_u32(buf) != SUSCAN_CAPTURE_BLOCK_MAGIC)
+    return SU_FALSE;
+
+  header->samples      = suscan_capture_get_u32(buf + 4);
+  header->timestamp    = suscan_capture_get_u64(buf + 8);
+  header->freq         = suscan_capture_get_f64(buf + 16);
+  header->scale        = suscan_capture_get_f32(buf + 24);
+  header->width        = buf[28];
+  header->payload_size = suscan_capture_get_u32(buf + 32);
+
+  return SU_TRUE;
+}
+
+/******************************** Bit packing ********************************/
+SUINLINE uint32_t
+suscan_capture_zigzag(int32_t val)
+{
+  return ((uint32_t) val << 1) ^ (uint32_t) (val >> 31);
+}
+
+SUINLINE int32_t
+suscan_capture_unzigzag(uint32_t val)
+{
+  return (int32_t) (val >> 1) ^ -(int32_t) (val & 1);
+}
+
+SUPRIVATE SUSCOUNT
+suscan_capture_pack(
+    uint8_t *out,
+    const uint32_t *values,
+    SUSCOUNT count,
+    unsigned int width)
+{
+  uint64_t acc = 0;
+  unsigned int bits = 0;
+  SUSCOUNT i, p = 0;
+
+  for (i = 0; i < count; ++i) {
+    acc |= (uint64_t) values[i] << bits;
+    bits += width;
+    while (bits >= 8) {
+      out[p++] = acc;
+      acc >>= 8;
+      bits -= 8;
+    }
+  }
+
+  if (bits > 0)
+    out[p++] = acc;
+
+  return p;
+}
+
+SUPRIVATE void
+suscan_capture_unpack(
+    uint32_t *values,
+    const uint8_t *in,
+    SUSCOUNT count,
+    unsigned int width)
+{
+  uint64_t acc = 0;
+  uint32_t mask = width < 32 ? (1u << width) - 1 : 0xffffffff;
+  unsigned int bits = 0;
+  SUSCOUNT i, p = 0;
+
+  for (i = 0; i < count; ++i) {
+    while (bits < width) {
+      acc |= (uint64_t) in[p++] << bits;
+      bits += 8;
+    }
+
+    values[i] = acc & mask;
+    acc >>= width;
+    bits -= width;
+  }
+}
+
+/* Worst case: every delta needs quant_bits + 1 bits */
+SUINLINE SUSCOUNT
+suscan_capture_max_payload_size(SUSCOUNT samples, unsigned int quant_bits)
+{
+  return (2 * samples * (quant_bits + 1) + 7) / 8;
+}
+
+/********************************* Writer ************************************/
+SUPRIVATE SUBOOL
+suscan_capture_writer_encode_block(
+    suscan_capture_writer_t *self,
+    const SUCOMPLEX *samples,
+    SUSCOUNT n,
+    const struct suscan_capture_pending_block *info)
+{
+  struct suscan_capture_block_header header;
+  struct suscan_capture_index_entry *entry;
+  uint8_t buf[SUSCAN_CAPTURE_BLOCK_HEADER_SIZE];
+  const SUFLOAT *as_real = (const SUFLOAT *) samples;
+  uint32_t *zigzag = (uint32_t *) self->quant;
+  SUFLOAT peak = 0, k = 0;
+  int32_t qmax = (1 << (self->header.quant_bits - 1)) - 1;
+  int32_t prev_i = 0, prev_q = 0;
+  int32_t q_i, q_q;
+  uint32_t all = 0;
+  off_t offset;
+  SUSCOUNT i;
+  void *tmp;
+
+  if (n == 0)
+    return SU_TRUE;
+
+  for (i = 0; i < 2 * n; ++i)
+    if (SU_ABS(as_real[i]) > peak)
+      peak = SU_ABS(as_real[i]);
+
+  if (peak > 0)
+    k = qmax / peak;
+
+  /* Quantize and delta-code, one plane per component */
+  for (i = 0; i < n; ++i) {
+    q_i = lrintf(k * as_real[2 * i]);
+    q_q = lrintf(k * as_real[2 * i + 1]);
+
+    zigzag[i]     = suscan_capture_zigzag(q_i - prev_i);
+    zigzag[n + i] = suscan_capture_zigzag(q_q - prev_q);
+    all |= zigzag[i] | zigzag[n + i];
+
+    prev_i = q_i;
+    prev_q = q_q;
+  }
+
+  header.samples = n;
+  header.timestamp = self->header.start_time
+      + (uint64_t) (1e9 * info->first_sample / self->header.samp_rate);
+  header.freq = info->freq;
+  header.scale = peak;
+  header.width = 0;
+
+  while (all != 0) {
+    ++header.width;
+    all >>= 1;
+  }
+
+  header.payload_size = suscan_capture_pack(
+      self->payload,
+      zigzag,
+      2 * n,
+      header.width);
+
+  SU_TRYCATCH((offset = ftello(self->fp)) != -1, return SU_FALSE);
+
+  suscan_capture_block_header_serialize(&header, buf);
+  SU_TRYCATCH(fwrite(buf, sizeof(buf), 1, self->fp) == 1, return SU_FALSE);
+
+  if (header.payload_size > 0)
+    SU_TRYCATCH(
+        fwrite(self->payload, header.payload_size, 1, self->fp) == 1,
+        return SU_FALSE);
+
+  /* Append to block index */
+  if (self->index_count == self->index_alloc) {
+    SU_TRYCATCH(
+        tmp = realloc(
+            self->index,
+            2 * self->index_alloc * sizeof(struct suscan_capture_index_entry)),
+        return SU_FALSE);
+    self->index = tmp;
+    self->index_alloc *= 2;
+  }
+
+  entry = self->index + self->index_count++;
+  entry->offset = offset;
+  entry->first_sample = self->sample_count;
+  entry->timestamp = header.timestamp;
+
+  self->sample_count += n;
+
+  return SU_TRUE;
+}
+
+/* Writer thread */
+SUPRIVATE SUBOOL
+suscan_capture_writer_consume(
+    void *privdata,
+    void *block,
+    SUSCOUNT samples,
+    unsigned int index)
+{
+  suscan_capture_writer_t *self = (suscan_capture_writer_t *) privdata;
+
+  return suscan_capture_writer_encode_block(
+      self,
+      (const SUCOMPLEX *) block,
+      samples,
+      self->pending + index);
+}
+
+/* Producer: remember what the block starts with */
+SUPRIVATE void
+suscan_capture_writer_start(
+    void *privdata,
+    unsigned int index,
+    uint64_t first_sample)
+{
+  suscan_capture_writer_t *self = (suscan_capture_writer_t *) privdata;
+
+  self->pending[index].freq = self->freq;
+  self->pending[index].first_sample = first_sample;
+}
+
+SUBOOL
+suscan_capture_writer_write(
+    suscan_capture_writer_t *self,
+    const SUCOMPLEX *samples,
+    SUSCOUNT length)
+{
+  SU_TRYCATCH(self->fp != NULL, return SU_FALSE);
+
+  return suscan_block_ring_write(&self->ring, samples, length);
+}
+
+SUBOOL
+suscan_capture_writer_close(suscan_capture_writer_t *self)
+{
+  uint8_t buf[SUSCAN_CAPTURE_HEADER_SIZE];
+  uint8_t entry[SUSCAN_CAPTURE_INDEX_ENTRY_SIZE];
+  const SUCOMPLEX *partial;
+  unsigned int index;
+  SUSCOUNT samples;
+  off_t offset;
+  SUSCOUNT i;
+  SUBOOL ok = SU_FALSE;
+
+  if (self->fp == NULL)
+    return SU_TRUE;
+
+  SU_TRYCATCH(self->ring_init, goto done);
+
+  /* Let the writer thread write everything that was published */
+  suscan_block_ring_halt(&self->ring);
+
+  if (suscan_block_ring_get_dropped(&self->ring) > 0)
+    SU_WARNING(
+        "Capture dropped %lu blocks of %lu samples\n",
+        (unsigned long) suscan_block_ring_get_dropped(&self->ring),
+        (unsigned long) self->header.block_size);
+
+  SU_TRYCATCH(!suscan_block_ring_has_failed(&self->ring), goto done);
+
+  /* Last, partial block */
+  partial = suscan_block_ring_get_partial(&self->ring, &samples, &index);
+  SU_TRYCATCH(
+      suscan_capture_writer_encode_block(
+          self,
+          partial,
+          samples,
+          self->pending + index),
+      goto done);
+
+  /* Index: magic, reserved, count, entries */
+  SU_TRYCATCH((offset = ftello(self->fp)) != -1, goto done);
+
+  memset(buf, 0, 16);
+  suscan_capture_put_u32(buf, SUSCAN_CAPTURE_INDEX_MAGIC);
+  suscan_capture_put_u64(buf + 8, self->index_count);
+  SU_TRYCATCH(fwrite(buf, 16, 1, self->fp) == 1, goto done);
+
+  for (i = 0; i < self->index_count; ++i) {
+    suscan_capture_put_u64(entry,      self->index[i].offset);
+    suscan_capture_put_u64(entry + 8,  self->index[i].first_sample);
+    suscan_capture_put_u64(entry + 16, self->index[i].timestamp);
+    SU_TRYCATCH(fwrite(entry, sizeof(entry), 1, self->fp) == 1, goto done);
+  }
+
+  /* Index is in place: update file header */
+  self->header.index_offset = offset;
+  self->header.block_count = self->index_count;
+
+  suscan_capture_header_serialize(&self->header, buf);
+  SU_TRYCATCH(fseeko(self->fp, 0, SEEK_SET) != -1, goto done);
+  SU_TRYCATCH(fwrite(buf, sizeof(buf), 1, self->fp) == 1, goto done);
+
+  ok = SU_TRUE;
+
+done:
+  if (fclose(self->fp) != 0)
+    ok = SU_FALSE;
+
+  self->fp = NULL;
+
+  return ok;
+}
+
+void
+suscan_capture_writer_destroy(suscan_capture_writer_t *self)
+{
+  if (self->fp != NULL)
+    (void) suscan_capture_writer_close(self);
+
+  if (self->ring_init)
+    suscan_block_ring_finalize(&self->ring);
+
+  if (self->quant != NULL)
+    free(self->quant);
+
+  if (self->payload != NULL)
+    free(self->payload);
+
+  if (self->index != NULL)
+    free(self->index);
+
+  free(self);
+}
+
+suscan_capture_writer_t *
+suscan_capture_writer_new(
+    const char *path,
+    SUFLOAT samp_rate,
+    SUSCOUNT block_size,
+    unsigned int quant_bits)
+{
+  struct suscan_block_ring_ops ops;
+  suscan_capture_writer_t *new = NULL;
+  uint8_t buf[SUSCAN_CAPTURE_HEADER_SIZE];
+  struct timespec now;
+
+  if (block_size == 0)
+    block_size = SUSCAN_CAPTURE_DEFAULT_BLOCK_SIZE;
+
+  if (quant_bits == 0)
+    quant_bits = SUSCAN_CAPTURE_DEFAULT_QUANT_BITS;
+
+  SU_TRYCATCH(samp_rate > 0, goto fail);
+  SU_TRYCATCH(block_size <= UINT32_MAX, goto fail);
+  SU_TRYCATCH(quant_bits >= SUSCAN_CAPTURE_MIN_QUANT_BITS, goto fail);
+  SU_TRYCATCH(quant_bits <= SUSCAN_CAPTURE_MAX_QUANT_BITS, goto fail);
+
+  SU_TRYCATCH(new = calloc(1, sizeof(suscan_capture_writer_t)), goto fail);
+
+  new->header.version = SUSCAN_CAPTURE_VERSION;
+  new->header.quant_bits = quant_bits;
+  new->header.samp_rate = samp_rate;
+  new->header.block_size = block_size;
+
+  clock_gettime(CLOCK_REALTIME, &now);
+  new->header.start_time = now.tv_sec * 1000000000ull + now.tv_nsec;
+
+  SU_TRYCATCH(
+      new->quant = malloc(2 * block_size * sizeof(int32_t)),
+      goto fail);
+  SU_TRYCATCH(
+      new->payload = malloc(
+          suscan_capture_max_payload_size(block_size, quant_bits)),
+      goto fail);
+
+  new->index_alloc = 64;
+  SU_TRYCATCH(
+      new->index = malloc(
+          new->index_alloc * sizeof(struct suscan_capture_index_entry)),
+      goto fail);
+
+  if ((new->fp = fopen(path, "wb")) == NULL) {
+    SU_ERROR("Cannot open capture file %s for writing\n", path);
+    goto fail;
+  }
+
+  /* Placeholder header. Updated on close. */
+  suscan_capture_header_serialize(&new->header, buf);
+  SU_TRYCATCH(fwrite(buf, sizeof(buf), 1, new->fp) == 1, goto fail);
+
+  memset(&ops, 0, sizeof(struct suscan_block_ring_ops));
+  ops.consume = suscan_capture_writer_consume;
+  ops.start = suscan_capture_writer_start;
+
+  SU_TRYCATCH(
+      suscan_block_ring_init(
+          &new->ring,
+          &ops,
+          new,
+          sizeof(SUCOMPLEX),
+          block_size,
+          SUSCAN_CAPTURE_WRITER_RING_BLOCKS,
+          0),
+      goto fail);
+  new->ring_init = SU_TRUE;
+
+  return new;
+
+fail:
+  if (new != NULL)
+    suscan_capture_writer_destroy(new);
+
+  return NULL;
+}
+
+/* Runs in the source worker: only copies samples, never touches the disk */
+SUBOOL
+suscan_capture_writer_baseband_filter(
+    void *privdata,
+    struct suscan_analyzer *analyzer,
+    const SUCOMPLEX *samples,
+    SUSCOUNT length)
+{
+  suscan_capture_writer_t *self = (suscan_capture_writer_t *) privdata;
+
+  suscan_capture_writer_set_freq(
+      self,
+      suscan_source_config_get_freq(suscan_source_get_config(analyzer->source)));
+
+  return suscan_capture_writer_write(self, samples, length);
+}
+
+/********************************* Reader ************************************/
+/* What the decoder needs from a block header before reading the payload */
+SUPRIVATE SUBOOL
+suscan_capture_reader_block_is_sane(
+    const suscan_capture_reader_t *self,
+    const struct suscan_capture_block_header *header)
+{
+  return header->samples <= self->header.block_size
+      && header->width <= self->header.quant_bits + 1
+      && header->payload_size
+      == (2 * (uint64_t) header->samples * header->width + 7) / 8;
+}
+
+SUPRIVATE SUSDIFF
+suscan_capture_reader_decode(
+    suscan_capture_reader_t *self,
+    struct suscan_capture_slot *slot,
+    uint64_t block)
+{
+  struct suscan_capture_block_header header;
+  uint8_t buf[SUSCAN_CAPTURE_BLOCK_HEADER_SIZE];
+  const struct suscan_capture_index_entry *entry = self->index + block;
+  uint32_t *zigzag = slot->values;
+  SUFLOAT *as_real = (SUFLOAT *) slot->samples;
+  int32_t qmax = (1 << (self->header.quant_bits - 1)) - 1;
+  int32_t acc_i = 0, acc_q = 0;
+  SUFLOAT k;
+  SUSCOUNT n, i;
+
+  SU_TRYCATCH(
+      pread(self->fd, buf, sizeof(buf), entry->offset) == sizeof(buf),
+      return -1);
+  SU_TRYCATCH(suscan_capture_block_header_deserialize(&header, buf), return -1);
+  SU_TRYCATCH(suscan_capture_reader_block_is_sane(self, &header), return -1);
+
+  n = header.samples;
+
+  if (header.payload_size > 0)
+    SU_TRYCATCH(
+        pread(
+            self->fd,
+            slot->payload,
+            header.payload_size,
+            entry->offset + sizeof(buf)) == header.payload_size,
+        return -1);
+
+  if (header.width > 0)
+    suscan_capture_unpack(zigzag, slot->payload, 2 * n, header.width);
+  else
+    memset(zigzag, 0, 2 * n * sizeof(uint32_t));
+
+  k = header.scale / qmax;
+
+  for (i = 0; i < n; ++i) {
+    acc_i += suscan_capture_unzigzag(zigzag[i]);
+    acc_q += suscan_capture_unzigzag(zigzag[n + i]);
+    as_real[2 * i]     = k * acc_i;
+    as_real[2 * i + 1] = k * acc_q;
+  }
+
+  slot->freq = header.freq;
+
+  return n;
+}
+
+/* Called with the mutex held */
+SUPRIVATE SUBOOL
+suscan_capture_reader_can_claim(const suscan_capture_reader_t *self)
+{
+  if (!self->loop && self->next_seq >= self->header.block_count)
+    return SU_FALSE;
+
+  return self->slots[self->next_seq % self->slot_count].state
+      == SUSCAN_CAPTURE_SLOT_EMPTY;
+}
+
+SUPRIVATE void *
+suscan_capture_reader_thread(void *data)
+{
+  suscan_capture_reader_t *self = (suscan_capture_reader_t *) data;
+  struct suscan_capture_slot *slot;
+  uint64_t seq, generation;
+  SUSDIFF length;
+
+  pthread_mutex_lock(&self->mutex);
+
+  while (!self->halt) {
+    if (!suscan_capture_reader_can_claim(self)) {
+      pthread_cond_wait(&self->cond, &self->mutex);
+      continue;
+    }
+
+    seq = self->next_seq++;
+    generation = self->generation;
+
+    slot = self->slots + seq % self->slot_count;
+    slot->state = SUSCAN_CAPTURE_SLOT_BUSY;
+    slot->seq = seq;
+    slot->generation = generation;
+
+    pthread_mutex_unlock(&self->mutex);
+
+    length = suscan_capture_reader_decode(
+        self,
+        slot,
+        seq % self->header.block_count);
+
+    pthread_mutex_lock(&self->mutex);
+
+    /* Blocks decoded before a seek are discarded */
+    slot->length = length;
+    slot->state = generation == self->generation
+        ? SUSCAN_CAPTURE_SLOT_READY
+        : SUSCAN_CAPTURE_SLOT_EMPTY;
+
+    pthread_cond_broadcast(&self->cond);
+  }
+
+  pthread_mutex_unlock(&self->mutex);
+
+  return NULL;
+}
+
+SUSDIFF
+suscan_capture_reader_read(
+    suscan_capture_reader_t *self,
+    SUCOMPLEX *buf,
+    SUSCOUNT max)
+{
+  struct suscan_capture_slot *slot;
+  SUSCOUNT avail;
+
+  /* No samples at all: there are no decoders either, even if looping */
+  if (self->sample_count == 0)
+    return 0;
+
+  pthread_mutex_lock(&self->mutex);
+
+  for (;;) {
+    if (!self->loop && self->read_seq >= self->header.block_count) {
+      pthread_mutex_unlock(&self->mutex);
+      return 0;
+    }
+
+    slot = self->slots + self->read_seq % self->slot_count;
+
+    while (slot->state != SUSCAN_CAPTURE_SLOT_READY
+        || slot->seq != self->read_seq)
+      pthread_cond_wait(&self->cond, &self->mutex);
+
+    /* Empty blocks must not be mistaken for the end of the stream */
+    if (slot->length != 0)
+      break;
+
+    slot->state = SUSCAN_CAPTURE_SLOT_EMPTY;
+    ++self->read_seq;
+    self->read_offset = 0;
+    pthread_cond_broadcast(&self->cond);
+  }
+
+  pthread_mutex_unlock(&self->mutex);
+
+  if (slot->length < 0) {
+    SU_ERROR(
+        "Failed to decode capture block %lu\n",
+        (unsigned long) (slot->seq % self->header.block_count));
+    return -1;
+  }
+
+  avail = slot->length - self->read_offset;
+  if (max > avail)
+    max = avail;
+
+  memcpy(buf, slot->samples + self->read_offset, max * sizeof(SUCOMPLEX));
+
+  self->read_offset += max;
+  self->freq = slot->freq;
+
+  if (self->read_offset >= slot->length) {
+    pthread_mutex_lock(&self->mutex);
+    slot->state = SUSCAN_CAPTURE_SLOT_EMPTY;
+    ++self->read_seq;
+    self->read_offset = 0;
+    pthread_cond_broadcast(&self->cond);
+    pthread_mutex_unlock(&self->mutex);
+  }
+
+  return max;
+}
+
+SUBOOL
+suscan_capture_reader_seek(suscan_capture_reader_t *self, uint64_t sample)
+{
+  uint64_t lo = 0, hi, mid;
+  unsigned int i;
+
+  if (self->header.block_count == 0 || sample >= self->sample_count)
+    return SU_FALSE;
+
+  /* Last block whose first sample is not after the requested one */
+  hi = self->header.block_count - 1;
+  while (lo < hi) {
+    mid = (lo + hi + 1) / 2;
+    if (self->index[mid].first_sample <= sample)
+      lo = mid;
+    else
+      hi = mid - 1;
+  }
+
+  pthread_mutex_lock(&self->mutex);
+
+  ++self->generation;
+
+  for (i = 0; i < self->slot_count; ++i)
+    if (self->slots[i].state == SUSCAN_CAPTURE_SLOT_READY)
+      self->slots[i].state = SUSCAN_CAPTURE_SLOT_EMPTY;
+
+  self->next_seq = self->read_seq = lo;
+  self->read_offset = sample - self->index[lo].first_sample;
+
+  pthread_cond_broadcast(&self->cond);
+  pthread_mutex_unlock(&self->mutex);
+
+  return SU_TRUE;
+}
+
+SUPRIVATE SUBOOL
+suscan_capture_reader_load_index(suscan_capture_reader_t *self)
+{
+  struct suscan_capture_block_header header;
+  uint8_t buf[SUSCAN_CAPTURE_BLOCK_HEADER_SIZE];
+  uint8_t entry[SUSCAN_CAPTURE_INDEX_ENTRY_SIZE];
+  struct stat sbuf;
+  SUSCOUNT alloc = 64;
+  uint64_t count = 0;
+  uint64_t i;
+  off_t offset;
+  void *tmp;
+
+  if (self->header.index_offset != 0) {
+    SU_TRYCATCH(
+        pread(self->fd, buf, 16, self->header.index_offset) == 16,
+        return SU_FALSE);
+    SU_TRYCATCH(
+        suscan_capture_get_u32(buf) == SUSCAN_CAPTURE_INDEX_MAGIC,
+        return SU_FALSE);
+
+    count = suscan_capture_get_u64(buf + 8);
+    SU_TRYCATCH(count == self->header.block_count, return SU_FALSE);
+
+    SU_TRYCATCH(
+        self->index = malloc(
+            (count > 0 ? count : 1) * sizeof(struct suscan_capture_index_entry)),
+        return SU_FALSE);
+
+    for (i = 0; i < count; ++i) {
+      SU_TRYCATCH(
+          pread(
+              self->fd,
+              entry,
+              sizeof(entry),
+              self->header.index_offset + 16 + i * sizeof(entry))
+          == sizeof(entry),
+          return SU_FALSE);
+      self->index[i].offset       = suscan_capture_get_u64(entry);
+      self->index[i].first_sample = suscan_capture_get_u64(entry + 8);
+      self->index[i].timestamp    = suscan_capture_get_u64(entry + 16);
+    }
+
+    if (count > 0) {
+      SU_TRYCATCH(
+          pread(self->fd, buf, sizeof(buf), self->index[count - 1].offset)
+          == sizeof(buf),
+          return SU_FALSE);
+      SU_TRYCATCH(
+          suscan_capture_block_header_deserialize(&header, buf),
+          return SU_FALSE);
+      self->sample_count = self->index[count - 1].first_sample + header.samples;
+    }
+
+    return SU_TRUE;
+  }
+
+  /* Capture was not properly closed: rebuild index by walking blocks */
+  SU_WARNING("Capture file has no index, scanning blocks...\n");
+
+  SU_TRYCATCH(fstat(self->fd, &sbuf) == 0, return SU_FALSE);
+
+  SU_TRYCATCH(
+      self->index = malloc(alloc * sizeof(struct suscan_capture_index_entry)),
+      return SU_FALSE);
+
+  offset = SUSCAN_CAPTURE_HEADER_SIZE;
+
+  /* A crash usually leaves a half-written block at the end: stop there */
+  while (offset + (off_t) sizeof(buf) <= sbuf.st_size
+      && pread(self->fd, buf, sizeof(buf), offset) == sizeof(buf)
+      && suscan_capture_block_header_deserialize(&header, buf)
+      && suscan_capture_reader_block_is_sane(self, &header)
+      && offset + (off_t) sizeof(buf) + header.payload_size
+      <= sbuf.st_size) {
+    if (count == alloc) {
+      SU_TRYCATCH(
+          tmp = realloc(
+              self->index,
+              2 * alloc * sizeof(struct suscan_capture_index_entry)),
+          return SU_FALSE);
+      self->index = tmp;
+      alloc *= 2;
+    }
+
+    self->index[count].offset = offset;
+    self->index[count].first_sample = self->sample_count;
+    self->index[count].timestamp = header.timestamp;
+    ++count;
+
+    self->sample_count += header.samples;
+    offset += sizeof(buf) + header.payload_size;
+  }
+
+  self->header.block_count = count;
+
+  return SU_TRUE;
+}
+
+SUBOOL
+suscan_capture_file_probe(const char *path)
+{
+  uint8_t buf[8];
+  int fd;
+  SUBOOL ok = SU_FALSE;
+
+  if ((fd = open(path, O_RDONLY)) == -1)
+    return SU_FALSE;
+
+  if (read(fd, buf, sizeof(buf)) == sizeof(buf))
+    ok = memcmp(buf, SUSCAN_CAPTURE_MAGIC, sizeof(buf)) == 0;
+
+  close(fd);
+
+  return ok;
+}
+
+void
+suscan_capture_reader_destroy(suscan_capture_reader_t *self)
+{
+  unsigned int i;
+
+  if (self->thread_count > 0) {
+    pthread_mutex_lock(&self->mutex);
+    self->halt = SU_TRUE;
+    pthread_cond_broadcast(&self->cond);
+    pthread_mutex_unlock(&self->mutex);
+
+    for (i = 0; i < self->thread_count; ++i)
+      pthread_join(self->threads[i], NULL);
+  }
+
+  if (self->slots != NULL) {
+    for (i = 0; i < self->slot_count; ++i) {
+      if (self->slots[i].samples != NULL)
+        free(self->slots[i].samples);
+
+      if (self->slots[i].values != NULL)
+        free(self->slots[i].values);
+
+      if (self->slots[i].payload != NULL)
+        free(self->slots[i].payload);
+    }
+
+    free(self->slots);
+  }
+
+  if (self->mutex_init)
+    pthread_mutex_destroy(&self->mutex);
+
+  if (self->cond_init)
+    pthread_cond_destroy(&self->cond);
+
+  if (self->index != NULL)
+    free(self->index);
+
+  if (self->fd != -1)
+    close(self->fd);
+
+  free(self);
+}
+
+suscan_capture_reader_t *
+suscan_capture_reader_new(const char *path, SUBOOL loop)
+{
+  suscan_capture_reader_t *new = NULL;
+  uint8_t buf[SUSCAN_CAPTURE_HEADER_SIZE];
+  SUSCOUNT max_payload;
+  long cpus;
+  unsigned int i;
+
+  SU_TRYCATCH(new = calloc(1, sizeof(suscan_capture_reader_t)), goto fail);
+
+  new->fd = -1;
+  new->loop = loop;
+
+  if ((new->fd = open(path, O_RDONLY)) == -1) {
+    SU_ERROR("Cannot open capture file %s\n", path);
+    goto fail;
+  }
+
+  SU_TRYCATCH(
+      pread(new->fd, buf, sizeof(buf), 0) == sizeof(buf),
+      goto fail);
+
+  if (!suscan_capture_header_deserialize(&new->header, buf)) {
+    SU_ERROR("%s: not a suscan capture file\n", path);
+    goto fail;
+  }
+
+  SU_TRYCATCH(new->header.version == SUSCAN_CAPTURE_VERSION, goto fail);
+  SU_TRYCATCH(new->header.block_size > 0, goto fail);
+  SU_TRYCATCH(
+      new->header.quant_bits >= SUSCAN_CAPTURE_MIN_QUANT_BITS
+      && new->header.quant_bits <= SUSCAN_CAPTURE_MAX_QUANT_BITS,
+      goto fail);
+
+  SU_TRYCATCH(suscan_capture_reader_load_index(new), goto fail);
+
+  SU_TRYCATCH(pthread_mutex_init(&new->mutex, NULL) == 0, goto fail);
+  new->mutex_init = SU_TRUE;
+
+  SU_TRYCATCH(pthread_cond_init(&new->cond, NULL) == 0, goto fail);
+  new->cond_init = SU_TRUE;
+
+  /* One decoder per spare CPU, two slots per decoder */
+  cpus = sysconf(_SC_NPROCESSORS_ONLN) - 1;
+  if (cpus < 1)
+    cpus = 1;
+  else if (cpus > SUSCAN_CAPTURE_READER_MAX_THREADS)
+    cpus = SUSCAN_CAPTURE_READER_MAX_THREADS;
+
+  new->slot_count = 2 * cpus;
+
+  SU_TRYCATCH(
+      new->slots = calloc(new->slot_count, sizeof(struct suscan_capture_slot)),
+      goto fail);
+
+  max_payload = suscan_capture_max_payload_size(
+      new->header.block_size,
+      new->header.quant_bits);
+
+  for (i = 0; i < new->slot_count; ++i) {
+    SU_TRYCATCH(
+        new->slots[i].samples = malloc(
+            new->header.block_size * sizeof(SUCOMPLEX)),
+        goto fail);
+    SU_TRYCATCH(
+        new->slots[i].values = malloc(
+            2 * new->header.block_size * sizeof(uint32_t)),
+        goto fail);
+    SU_TRYCATCH(new->slots[i].payload = malloc(max_payload), goto fail);
+  }
+
+  /* Nothing to decode. Reads return end of stream right away */
+  if (new->sample_count == 0)
+    return new;
+
+  for (i = 0; i < cpus; ++i) {
+    SU_TRYCATCH(
+        pthread_create(
+            new->threads + i,
+            NULL,
+            suscan_capture_reader_thread,
+            new) == 0,
+        goto fail);
+    ++new->thread_count;
+  }
+
+  return new;
+
+fail:
+  if (new != NULL)
+    suscan_capture_reader_destroy(new);
+
+  return NULL;
+}
@@ -0,0 +1,255 @@
+/*
+
+  Copyright (C) 2020 Gonzalo José Carracedo Carballal
+
+  This program is free software: you can redistribute it and/or modify
+  it under the terms of the GNU Lesser General Public License as
+  published by the Free Software Foundation, either version 3 of the
+  License, or (at your option) any later version.
+
+  This program is distributed in the hope that it will be useful, but
+  WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+  GNU Lesser General Public License for more details.
+
+  You should have received a copy of the GNU Lesser General Public
+  License along with this program.  If not, see
+  <http://www.gnu.org/licenses/>
+
+*/
+
+
+#ifndef _CAPTURE_H
+#define _CAPTURE_H
+
+#include <stdio.h>
+#include <stdint.h>
+#include <pthread.h>
+#include <sigutils/sigutils.h>
+#include "blockring.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif /* __cplusplus */
+
+/*
+ * Suscan capture files are chunked IQ containers. After a fixed-size file
+ * header, samples are stored in blocks of (at most) block_size samples.
+ * Each block carries its own header (timestamp, center frequency, scale)
+ * and a payload with the quantized samples, delta-coded and bit-packed
+ * with the minimum width that fits the whole block. A block index is
+ * appended on close, so readers can seek without scanning the file.
+ *
+ * Compression is lossy: samples are quantized to quant_bits signed
+ * integers relative to the peak amplitude of their block, so the step
+ * is the same for the whole block and weak samples in a loud block keep
+ * only a few significant bits, whatever quant_bits is.
+ *
+ * All fields are stored little endian.
+ */
+#define SUSCAN_CAPTURE_MAGIC              "SUSCAP01"
+#define SUSCAN_CAPTURE_BLOCK_MAGIC        0x4b4c4253 /* SBLK */
+#define SUSCAN_CAPTURE_INDEX_MAGIC        0x58444953 /* SIDX */
+#define SUSCAN_CAPTURE_VERSION            1
+
+#define SUSCAN_CAPTURE_HEADER_SIZE        64
+#define SUSCAN_CAPTURE_BLOCK_HEADER_SIZE  36
+#define SUSCAN_CAPTURE_INDEX_ENTRY_SIZE   24
+
+#define SUSCAN_CAPTURE_DEFAULT_BLOCK_SIZE 65536
+#define SUSCAN_CAPTURE_DEFAULT_QUANT_BITS 16
+#define SUSCAN_CAPTURE_MIN_QUANT_BITS     4
+#define SUSCAN_CAPTURE_MAX_QUANT_BITS     24
+
+#define SUSCAN_CAPTURE_WRITER_RING_BLOCKS 8
+#define SUSCAN_CAPTURE_READER_MAX_THREADS 4
+
+struct suscan_capture_header {
+  uint32_t version;
+  uint32_t quant_bits;
+  SUFLOAT  samp_rate;
+  uint32_t block_size;
+  uint64_t index_offset; /* 0 if the file was not properly closed */
+  uint64_t block_count;
+  uint64_t start_time;   /* Realtime, in nanoseconds */
+};
+
+struct suscan_capture_block_header {
+  uint32_t samples;
+  uint64_t timestamp;    /* Realtime, in nanoseconds */
+  SUFREQ   freq;
+  SUFLOAT  scale;        /* Peak amplitude of the block components */
+  uint8_t  width;        /* Bits per packed delta */
+  uint32_t payload_size;
+};
+
+struct suscan_capture_index_entry {
+  uint64_t offset;
+  uint64_t first_sample;
+  uint64_t timestamp;
+};
+
+/******************************** Writer *************************************/
+struct suscan_capture_pending_block {
+  SUFREQ   freq;
+  uint64_t first_sample; /* Counting dropped samples, for the timestamp */
+};
+
+/*
+ * The producer only copies samples into a block ring (see blockring.h).
+ * Full blocks are quantized, packed and written by its writer thread.
+ */
+struct suscan_capture_writer {
+  FILE *fp;
+  struct suscan_capture_header header;
+  SUFREQ freq;
+
+  struct suscan_block_ring ring;
+  SUBOOL ring_init;
+  struct suscan_capture_pending_block pending[SUSCAN_CAPTURE_WRITER_RING_BLOCKS];
+
+  /* Writer thread state */
+  uint64_t   sample_count; /* Samples in the file */
+  int32_t   *quant;
+  uint8_t   *payload;
+
+  /* Block index, written on close */
+  struct suscan_capture_index_entry *index;
+  SUSCOUNT index_count;
+  SUSCOUNT index_alloc;
+};
+
+typedef struct suscan_capture_writer suscan_capture_writer_t;
+
+SUINLINE void
+suscan_capture_writer_set_freq(suscan_capture_writer_t *self, SUFREQ freq)
+{
+  self->freq = freq;
+}
+
+suscan_capture_writer_t *suscan_capture_writer_new(
+    const char *path,
+    SUFLOAT samp_rate,
+    SUSCOUNT block_size,
+    unsigned int quant_bits);
+
+SUBOOL suscan_capture_writer_write(
+    suscan_capture_writer_t *self,
+    const SUCOMPLEX *samples,
+    SUSCOUNT length);
+
+/*
+ * Waits for the pending blocks, flushes the last one, writes the index
+ * and closes the file.
+ */
+SUBOOL suscan_capture_writer_close(suscan_capture_writer_t *self);
+
+void suscan_capture_writer_destroy(suscan_capture_writer_t *self);
+
+/*
+ * Baseband filter callback (see suscan_analyzer_register_baseband_filter).
+ * privdata must be a suscan_capture_writer_t.
+ */
+struct suscan_analyzer;
+
+SUBOOL suscan_capture_writer_baseband_filter(
+    void *privdata,
+    struct suscan_analyzer *analyzer,
+    const SUCOMPLEX *samples,
+    SUSCOUNT length);
+
+/******************************** Reader *************************************/
+enum suscan_capture_slot_state {
+  SUSCAN_CAPTURE_SLOT_EMPTY,
+  SUSCAN_CAPTURE_SLOT_BUSY,
+  SUSCAN_CAPTURE_SLOT_READY
+};
+
+struct suscan_capture_slot {
+  enum suscan_capture_slot_state state;
+  uint64_t  seq;         /* Block sequence number (grows while looping) */
+  uint64_t  generation;  /* Seek generation this slot was claimed in */
+  SUCOMPLEX *samples;
+  SUSDIFF   length;      /* Decoded samples, or -1 on error */
+  SUFREQ    freq;
+  uint32_t *values;      /* Unpacked deltas */
+  uint8_t  *payload;
+};
+
+/*
+ * Blocks are decoded in parallel by a small pool of threads into a ring
+ * of slots. Block sequence number n always goes to slot n % slot_count,
+ * so the consumer gets them in order.
+ */
+struct suscan_capture_reader {
+  int fd;
+  struct suscan_capture_header header;
+  struct suscan_capture_index_entry *index;
+  uint64_t sample_count;
+  SUBOOL loop;
+
+  struct suscan_capture_slot *slots;
+  unsigned int slot_count;
+
+  pthread_t threads[SUSCAN_CAPTURE_READER_MAX_THREADS];
+  unsigned int thread_count;
+
+  pthread_mutex_t mutex;
+  SUBOOL mutex_init;
+  pthread_cond_t cond;
+  SUBOOL cond_init;
+
+  /* Protected by mutex */
+  SUBOOL   halt;
+  uint64_t generation;
+  uint64_t next_seq;     /* Next block to be claimed by a decoder */
+  uint64_t read_seq;     /* Next block to be consumed */
+
+  /* Consumer-only state */
+  SUSCOUNT read_offset;  /* Samples consumed from the current block */
+  SUFREQ   freq;
+};
+
+typedef struct suscan_capture_reader suscan_capture_reader_t;
+
+SUINLINE SUFLOAT
+suscan_capture_reader_get_samp_rate(const suscan_capture_reader_t *self)
+{
+  return self->header.samp_rate;
+}
+
+/* Center frequency of the block being consumed */
+SUINLINE SUFREQ
+suscan_capture_reader_get_freq(const suscan_capture_reader_t *self)
+{
+  return self->freq;
+}
+
+SUINLINE uint64_t
+suscan_capture_reader_get_sample_count(const suscan_capture_reader_t *self)
+{
+  return self->sample_count;
+}
+
+SUBOOL suscan_capture_file_probe(const char *path);
+
+suscan_capture_reader_t *suscan_capture_reader_new(
+    const char *path,
+    SUBOOL loop);
+
+SUSDIFF suscan_capture_reader_read(
+    suscan_capture_reader_t *self,
+    SUCOMPLEX *buf,
+    SUSCOUNT max);
+
+SUBOOL suscan_capture_reader_seek(
+    suscan_capture_reader_t *self,
+    uint64_t sample);
+
+void suscan_capture_reader_destroy(suscan_capture_reader_t *self);
+
+#ifdef __cplusplus
+}
+#endif /* __cplusplus */
+
+#endif /* _CAPTURE_H */
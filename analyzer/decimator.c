@@ -0,0 +1,633 @@
+/*
+
+  Copyright (C) 2020 Gonzalo José Carracedo Carballal
+
+  This program is free software: you can redistribute it and/or modify
+  it under the terms of the GNU Lesser General Public License as
+  published by the Free Software Foundation, either version 3 of the
+  License, or (at your option) any later version.
+
+  This program is distributed in the hope that it will be useful, but
+  WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+  GNU Lesser General Public License for more details.
+
+  You should have received a copy of the GNU Lesser General Public
+  License along with this program.  If not, see
+  <http://www.gnu.org/licenses/>
+
+*/
+
+
+#include <stdlib.h>
+#include <string.h>
+#include <math.h>
+
+#define SU_LOG_DOMAIN "decimator"
+
+#include <sigutils/sigutils.h>
+#include <sigutils/taps.h>
+#include "decimator.h"
+
+#ifdef HAVE_VOLK
+#  include <volk/volk.h>
+#endif /* HAVE_VOLK */
+
+SUINLINE SUCOMPLEX
+suscan_decimator_dot(
+    const SUCOMPLEX *x,
+    const SUFLOAT *h,
+    unsigned int len)
+{
+#if defined(HAVE_VOLK) && defined(_SU_SINGLE_PRECISION)
+  lv_32fc_t result;
+
+  volk_32fc_32f_dot_prod_32fc(
+      &result,
+      (const lv_32fc_t *) x,
+      h,
+      len);
+
+  return result;
+#else
+  /*
+   * Real and imaginary parts are accumulated separately, so the compiler
+   * can vectorize this as two real inner products.
+   */
+  const SUFLOAT *as_real = (const SUFLOAT *) x;
+  SUFLOAT re = 0, im = 0;
+  unsigned int i;
+
+  for (i = 0; i < len; ++i) {
+    re += h[i] * as_real[2 * i];
+    im += h[i] * as_real[2 * i + 1];
+  }
+
+  return re + I * im;
+#endif /* defined(HAVE_VOLK) && defined(_SU_SINGLE_PRECISION) */
+}
+
+/*
+ * Half-band filters have odd length 4K + 3 and every other tap around the
+ * center is zero. Being symmetric, each output costs K + 2 multiplies.
+ */
+SUINLINE SUCOMPLEX
+suscan_decimator_dot_halfband(
+    const SUCOMPLEX *x,
+    const SUFLOAT *h,
+    unsigned int len)
+{
+  unsigned int c = len >> 1;
+  unsigned int j;
+  SUCOMPLEX acc = h[c] * x[c];
+
+  for (j = 1; j <= c; j += 2)
+    acc += h[c + j] * (x[c - j] + x[c + j]);
+
+  return acc;
+}
+
+SUPRIVATE SUCOMPLEX *
+suscan_decimator_get_room(suscan_decimator_t *self, SUSCOUNT *len)
+{
+  *len = self->capacity - self->fill;
+
+  return self->history + self->fill;
+}
+
+SUCOMPLEX *
+suscan_decimator_get_input(
+    suscan_decimator_t *self,
+    SUSCOUNT max_out,
+    SUSCOUNT *len)
+{
+  SUSCOUNT needed;
+  SUSCOUNT avail = self->capacity - self->fill;
+
+  /* Samples required to produce exactly max_out outputs */
+  needed = self->next + (max_out > 0 ? max_out - 1 : 0) * self->factor + 1;
+  needed = needed > self->fill ? needed - self->fill : 1;
+
+  *len = needed < avail ? needed : avail;
+
+  return self->history + self->fill;
+}
+
+SUSCOUNT
+suscan_decimator_feed(
+    suscan_decimator_t *self,
+    SUSCOUNT len,
+    SUCOMPLEX *out,
+    SUSCOUNT max_out)
+{
+  SUSCOUNT n = 0;
+  SUSCOUNT shift;
+  SUSCOUNT keep = self->length - 1;
+
+  self->fill += len;
+
+  if (self->halfband) {
+    while (self->next < self->fill && n < max_out) {
+      out[n++] = suscan_decimator_dot_halfband(
+          self->history + self->next - keep,
+          self->h,
+          self->length);
+      self->next += self->factor;
+    }
+  } else {
+    while (self->next < self->fill && n < max_out) {
+      out[n++] = suscan_decimator_dot(
+          self->history + self->next - keep,
+          self->h,
+          self->length);
+      self->next += self->factor;
+    }
+  }
+
+  /* Discard samples that will not be needed by any future output */
+  shift = (self->next < self->fill ? self->next : self->fill) - keep;
+
+  if (shift > 0) {
+    memmove(
+        self->history,
+        self->history + shift,
+        (self->fill - shift) * sizeof(SUCOMPLEX));
+    self->fill -= shift;
+    self->next -= shift;
+  }
+
+  return n;
+}
+
+void
+suscan_decimator_reset(suscan_decimator_t *self)
+{
+  memset(self->history, 0, (self->length - 1) * sizeof(SUCOMPLEX));
+
+  self->fill = self->length - 1;
+  self->next = self->length - 1;
+}
+
+suscan_decimator_t *
+suscan_decimator_new_from_taps(
+    unsigned int factor,
+    const SUFLOAT *taps,
+    unsigned int length,
+    SUSCOUNT max_input)
+{
+  suscan_decimator_t *new = NULL;
+  unsigned int i;
+
+  SU_TRYCATCH(factor > 0, goto fail);
+  SU_TRYCATCH(length > 0, goto fail);
+  SU_TRYCATCH(max_input > 0, goto fail);
+
+  SU_TRYCATCH(new = calloc(1, sizeof(suscan_decimator_t)), goto fail);
+
+  new->factor = factor;
+  new->length = length;
+  new->capacity = length - 1 + factor + max_input;
+
+  SU_TRYCATCH(new->h = malloc(length * sizeof(SUFLOAT)), goto fail);
+  SU_TRYCATCH(
+      new->history = malloc(new->capacity * sizeof(SUCOMPLEX)),
+      goto fail);
+
+  /* Time-reverse the filter so outputs are plain inner products */
+  for (i = 0; i < length; ++i)
+    new->h[i] = taps[length - i - 1];
+
+  suscan_decimator_reset(new);
+
+  return new;
+
+fail:
+  if (new != NULL)
+    suscan_decimator_destroy(new);
+
+  return NULL;
+}
+
+suscan_decimator_t *
+suscan_decimator_new(
+    unsigned int factor,
+    unsigned int taps_per_phase,
+    SUSCOUNT max_input)
+{
+  suscan_decimator_t *new = NULL;
+  SUFLOAT *taps = NULL;
+  unsigned int length = factor * taps_per_phase;
+
+  SU_TRYCATCH(length > 0, goto done);
+  SU_TRYCATCH(taps = malloc(length * sizeof(SUFLOAT)), goto done);
+
+  /*
+   * Decim 1: Filter cutoff: 1
+   * Decim 2: Filter cutoff: .5
+   * Decim 3: Filter cutoff: .3333...
+   */
+  su_taps_brickwall_lp_init(taps, 1 / (SUFLOAT) factor, length);
+
+  new = suscan_decimator_new_from_taps(factor, taps, length, max_input);
+
+done:
+  if (taps != NULL)
+    free(taps);
+
+  return new;
+}
+
+void
+suscan_decimator_destroy(suscan_decimator_t *self)
+{
+  if (self->h != NULL)
+    free(self->h);
+
+  if (self->history != NULL)
+    free(self->history);
+
+  free(self);
+}
+
+/**************************** Decimation chain *******************************/
+SUPRIVATE void
+suscan_decimator_normalize(SUFLOAT *h, unsigned int length)
+{
+  SUFLOAT sum = 0;
+  unsigned int i;
+
+  for (i = 0; i < length; ++i)
+    sum += h[i];
+
+  for (i = 0; i < length; ++i)
+    h[i] /= sum;
+}
+
+/* Boxcar of length factor, convolved with itself order times */
+SUPRIVATE SUFLOAT *
+suscan_decimator_cic_taps(unsigned int factor, unsigned int *length)
+{
+  SUFLOAT *h = NULL;
+  SUFLOAT *prev = NULL;
+  unsigned int len = (factor - 1) * SUSCAN_DECIMATOR_CIC_ORDER + 1;
+  unsigned int curr_len = 1;
+  unsigned int i, j, n;
+
+  SU_TRYCATCH(h = calloc(len, sizeof(SUFLOAT)), goto fail);
+  SU_TRYCATCH(prev = calloc(len, sizeof(SUFLOAT)), goto fail);
+
+  h[0] = 1;
+
+  for (n = 0; n < SUSCAN_DECIMATOR_CIC_ORDER; ++n) {
+    memcpy(prev, h, curr_len * sizeof(SUFLOAT));
+    memset(h, 0, len * sizeof(SUFLOAT));
+
+    for (i = 0; i < curr_len; ++i)
+      for (j = 0; j < factor; ++j)
+        h[i + j] += prev[i];
+
+    curr_len += factor - 1;
+  }
+
+  suscan_decimator_normalize(h, len);
+
+  free(prev);
+
+  *length = len;
+
+  return h;
+
+fail:
+  if (h != NULL)
+    free(h);
+
+  if (prev != NULL)
+    free(prev);
+
+  return NULL;
+}
+
+SUPRIVATE void
+suscan_decimator_halfband_taps(SUFLOAT *h, unsigned int length)
+{
+  int c = length >> 1;
+  int i, k;
+
+  for (i = 0; i < length; ++i) {
+    k = i - c;
+    if (k == 0)
+      h[i] = .5;
+    else if (k % 2 == 0)
+      h[i] = 0;
+    else
+      h[i] = SU_SIN(.5 * M_PI * k) / (M_PI * k);
+  }
+
+  su_taps_apply_hamming(h, length);
+
+  suscan_decimator_normalize(h, length);
+}
+
+/*
+ * Magnitude response of the normalized CIC at frequency f (in cycles per
+ * sample at the CIC input rate)
+ */
+SUPRIVATE SUFLOAT
+suscan_decimator_cic_response(unsigned int factor, SUFLOAT f)
+{
+  if (f <= 0)
+    return 1;
+
+  return SU_POW(
+      SU_ABS(SU_SIN(M_PI * f * factor) / (factor * SU_SIN(M_PI * f))),
+      SUSCAN_DECIMATOR_CIC_ORDER);
+}
+
+/*
+ * Final stage: brickwall antialias filter, convolved with a 3-tap
+ * compensator [-a, 1 + 2a, -a] that flattens the CIC droop at the edge
+ * of the passband.
+ */
+SUPRIVATE SUFLOAT *
+suscan_decimator_final_taps(
+    unsigned int factor,
+    unsigned int taps_per_phase,
+    unsigned int cic_factor,
+    unsigned int cic_to_final,
+    unsigned int *length)
+{
+  SUFLOAT *lp = NULL;
+  SUFLOAT *h = NULL;
+  unsigned int lp_len = factor * taps_per_phase;
+  SUFLOAT comp[3];
+  SUFLOAT f_p, droop, a = 0;
+  unsigned int i, j;
+
+  SU_TRYCATCH(lp = malloc(lp_len * sizeof(SUFLOAT)), goto fail);
+  SU_TRYCATCH(h = calloc(lp_len + 2, sizeof(SUFLOAT)), goto fail);
+
+  su_taps_brickwall_lp_init(lp, 1 / (SUFLOAT) factor, lp_len);
+
+  if (cic_factor > 1) {
+    f_p = .5 / factor;
+    droop = suscan_decimator_cic_response(
+        cic_factor,
+        f_p / (cic_to_final * cic_factor));
+    a = (1 / droop - 1) / (2 * (1 - SU_COS(2 * M_PI * f_p)));
+  }
+
+  comp[0] = comp[2] = -a;
+  comp[1] = 1 + 2 * a;
+
+  for (i = 0; i < lp_len; ++i)
+    for (j = 0; j < 3; ++j)
+      h[i + j] += lp[i] * comp[j];
+
+  free(lp);
+
+  *length = lp_len + 2;
+
+  return h;
+
+fail:
+  if (lp != NULL)
+    free(lp);
+
+  if (h != NULL)
+    free(h);
+
+  return NULL;
+}
+
+SUCOMPLEX *
+suscan_decimator_chain_get_input(
+    suscan_decimator_chain_t *self,
+    SUSCOUNT max_out,
+    SUSCOUNT *len)
+{
+  SUSCOUNT pending = suscan_decimator_chain_get_pending(self);
+  SUSCOUNT room;
+  SUSCOUNT wanted;
+  SUSCOUNT fits;
+  SUCOMPLEX *input;
+
+  input = suscan_decimator_get_room(self->stages[0], &room);
+
+  /* Every stage may produce at most one extra sample due to rounding */
+  if (pending >= max_out || pending + self->stage_count >= self->output_size) {
+    *len = 0;
+    return input;
+  }
+
+  wanted = (max_out - pending) * self->ratio;
+  fits = (self->output_size - pending - self->stage_count) * self->ratio;
+
+  if (wanted > fits)
+    wanted = fits;
+
+  *len = wanted < room ? wanted : room;
+
+  return input;
+}
+
+SUSCOUNT
+suscan_decimator_chain_feed(
+    suscan_decimator_chain_t *self,
+    SUSCOUNT len,
+    SUCOMPLEX *out,
+    SUSCOUNT max_out)
+{
+  SUCOMPLEX *next_input;
+  SUSCOUNT room;
+  SUSCOUNT pending;
+  unsigned int i;
+
+  if (len > 0) {
+    /* Intermediate stages write directly into the input of the next one */
+    for (i = 0; i < self->stage_count - 1; ++i) {
+      next_input = suscan_decimator_get_room(self->stages[i + 1], &room);
+      len = suscan_decimator_feed(self->stages[i], len, next_input, room);
+    }
+
+    if (self->output_ptr > 0) {
+      memmove(
+          self->output,
+          self->output + self->output_ptr,
+          suscan_decimator_chain_get_pending(self) * sizeof(SUCOMPLEX));
+      self->output_len -= self->output_ptr;
+      self->output_ptr = 0;
+    }
+
+    self->output_len += suscan_decimator_feed(
+        self->stages[i],
+        len,
+        self->output + self->output_len,
+        self->output_size - self->output_len);
+  }
+
+  pending = suscan_decimator_chain_get_pending(self);
+  if (max_out > pending)
+    max_out = pending;
+
+  memcpy(out, self->output + self->output_ptr, max_out * sizeof(SUCOMPLEX));
+
+  self->output_ptr += max_out;
+  if (self->output_ptr == self->output_len)
+    self->output_ptr = self->output_len = 0;
+
+  return max_out;
+}
+
+void
+suscan_decimator_chain_reset(suscan_decimator_chain_t *self)
+{
+  unsigned int i;
+
+  for (i = 0; i < self->stage_count; ++i)
+    suscan_decimator_reset(self->stages[i]);
+
+  self->output_ptr = self->output_len = 0;
+}
+
+/*
+ * Decimation planner. The ratio R is written as 2^p * q, with q odd. The
+ * final stage (the one with the sharpest filter, running at the lowest
+ * rate) decimates by 2 if R is even, or by q otherwise. Up to
+ * SUSCAN_DECIMATOR_CHAIN_MAX_HALFBANDS half-band stages take the
+ * following factors of 2, and whatever is left is done by the CIC.
+ *
+ * Ratios below SUSCAN_DECIMATOR_CHAIN_MIN_RATIO result in a single stage.
+ */
+suscan_decimator_chain_t *
+suscan_decimator_chain_new(
+    unsigned int ratio,
+    unsigned int taps_per_phase,
+    SUSCOUNT max_input)
+{
+  suscan_decimator_chain_t *new = NULL;
+  SUFLOAT *taps = NULL;
+  SUFLOAT hb_taps[4 * SUSCAN_DECIMATOR_HALFBAND_ORDER + 3];
+  unsigned int hb_len = 4 * SUSCAN_DECIMATOR_HALFBAND_ORDER + 3;
+  unsigned int p = 0, q = ratio;
+  unsigned int final_factor;
+  unsigned int halfbands;
+  unsigned int cic_factor;
+  unsigned int length;
+  unsigned int i;
+
+  SU_TRYCATCH(ratio > 0, goto fail);
+
+  SU_TRYCATCH(new = calloc(1, sizeof(suscan_decimator_chain_t)), goto fail);
+
+  new->ratio = ratio;
+
+  /* Plan */
+  while ((q & 1) == 0) {
+    q >>= 1;
+    ++p;
+  }
+
+  if (ratio < SUSCAN_DECIMATOR_CHAIN_MIN_RATIO) {
+    final_factor = ratio;
+    halfbands = 0;
+    cic_factor = 1;
+  } else {
+    if (p > 0) {
+      final_factor = 2;
+      --p;
+    } else {
+      final_factor = q;
+      q = 1;
+    }
+
+    halfbands = p < SUSCAN_DECIMATOR_CHAIN_MAX_HALFBANDS
+        ? p
+        : SUSCAN_DECIMATOR_CHAIN_MAX_HALFBANDS;
+    p -= halfbands;
+    cic_factor = (1 << p) * q;
+  }
+
+  SU_INFO(
+      "Decimation by %u: CIC %u, %u half-band stages, final FIR %u\n",
+      ratio,
+      cic_factor,
+      halfbands,
+      final_factor);
+
+  /* Build stages */
+  if (cic_factor > 1) {
+    SU_TRYCATCH(taps = suscan_decimator_cic_taps(cic_factor, &length), goto fail);
+    SU_TRYCATCH(
+        new->stages[new->stage_count++] = suscan_decimator_new_from_taps(
+            cic_factor,
+            taps,
+            length,
+            max_input),
+        goto fail);
+    free(taps);
+    taps = NULL;
+    max_input = max_input / cic_factor + 2;
+  }
+
+  suscan_decimator_halfband_taps(hb_taps, hb_len);
+
+  for (i = 0; i < halfbands; ++i) {
+    SU_TRYCATCH(
+        new->stages[new->stage_count] = suscan_decimator_new_from_taps(
+            2,
+            hb_taps,
+            hb_len,
+            max_input),
+        goto fail);
+    new->stages[new->stage_count++]->halfband = SU_TRUE;
+    max_input = max_input / 2 + 2;
+  }
+
+  SU_TRYCATCH(
+      taps = suscan_decimator_final_taps(
+          final_factor,
+          taps_per_phase,
+          cic_factor,
+          1 << halfbands,
+          &length),
+      goto fail);
+  SU_TRYCATCH(
+      new->stages[new->stage_count++] = suscan_decimator_new_from_taps(
+          final_factor,
+          taps,
+          length,
+          max_input),
+      goto fail);
+  free(taps);
+  taps = NULL;
+
+  new->output_size = max_input / final_factor + 2 * new->stage_count + 1;
+  SU_TRYCATCH(
+      new->output = malloc(new->output_size * sizeof(SUCOMPLEX)),
+      goto fail);
+
+  return new;
+
+fail:
+  if (taps != NULL)
+    free(taps);
+
+  if (new != NULL)
+    suscan_decimator_chain_destroy(new);
+
+  return NULL;
+}
+
+void
+suscan_decimator_chain_destroy(suscan_decimator_chain_t *self)
+{
+  unsigned int i;
+
+  for (i = 0; i < self->stage_count; ++i)
+    suscan_decimator_destroy(self->stages[i]);
+
+  if (self->output != NULL)
+    free(self->output);
+
+  free(self);
+}
@@ -0,0 +1,163 @@
+/*
+
+  Copyright (C) 2020 Gonzalo José Carracedo Carballal
+
+  This program is free software: you can redistribute it and/or modify
+  it under the terms of the GNU Lesser General Public License as
+  published by the Free Software Foundation, either version 3 of the
+  License, or (at your option) any later version.
+
+  This program is distributed in the hope that it will be useful, but
+  WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+  GNU Lesser General Public License for more details.
+
+  You should have received a copy of the GNU Lesser General Public
+  License along with this program.  If not, see
+  <http://www.gnu.org/licenses/>
+
+*/
+
+
+#ifndef _DECIMATOR_H
+#define _DECIMATOR_H
+
+#include <sigutils/sigutils.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif /* __cplusplus */
+
+#define SUSCAN_DECIMATOR_DEFAULT_TAPS_PER_PHASE 5
+
+/* Decimation chain planning */
+#define SUSCAN_DECIMATOR_CHAIN_MIN_RATIO      8
+#define SUSCAN_DECIMATOR_CHAIN_MAX_HALFBANDS  3
+#define SUSCAN_DECIMATOR_CHAIN_MAX_STAGES     (SUSCAN_DECIMATOR_CHAIN_MAX_HALFBANDS + 2)
+#define SUSCAN_DECIMATOR_CIC_ORDER            4
+#define SUSCAN_DECIMATOR_HALFBAND_ORDER       4 /* Length: 4 * order + 3 */
+
+/*
+ * Polyphase FIR decimator. Only one output every `factor' input samples
+ * is computed, each one as a single contiguous inner product between the
+ * (time-reversed) antialias filter and the input history.
+ *
+ * Input samples are written directly into the decimator's history buffer
+ * (see suscan_decimator_get_input), and decimated samples are written
+ * directly into the caller's buffer. No intermediate copies are made.
+ */
+struct suscan_decimator {
+  unsigned int factor;
+  unsigned int length;
+
+  /* Half-band filters: odd taps around the center are zero */
+  SUBOOL halfband;
+
+  SUFLOAT   *h;        /* Time-reversed antialias filter */
+  SUCOMPLEX *history;  /* Previous length - 1 samples + new input */
+  SUSCOUNT   capacity;
+  SUSCOUNT   fill;     /* Valid samples in history */
+  SUSCOUNT   next;     /* Index of the newest sample of the next output */
+};
+
+typedef struct suscan_decimator suscan_decimator_t;
+
+SUINLINE unsigned int
+suscan_decimator_get_factor(const suscan_decimator_t *self)
+{
+  return self->factor;
+}
+
+/*
+ * Returns a pointer to the region where new input samples must be
+ * written, and the maximum number of samples that can be written there
+ * so that no more than max_out samples are produced by the next call
+ * to suscan_decimator_feed.
+ */
+SUCOMPLEX *suscan_decimator_get_input(
+    suscan_decimator_t *self,
+    SUSCOUNT max_out,
+    SUSCOUNT *len);
+
+/*
+ * Process len samples previously written to the input region. Returns
+ * the number of decimated samples written to out (never more than
+ * max_out).
+ */
+SUSCOUNT suscan_decimator_feed(
+    suscan_decimator_t *self,
+    SUSCOUNT len,
+    SUCOMPLEX *out,
+    SUSCOUNT max_out);
+
+void suscan_decimator_reset(suscan_decimator_t *self);
+
+suscan_decimator_t *suscan_decimator_new_from_taps(
+    unsigned int factor,
+    const SUFLOAT *taps,
+    unsigned int length,
+    SUSCOUNT max_input);
+
+suscan_decimator_t *suscan_decimator_new(
+    unsigned int factor,
+    unsigned int taps_per_phase,
+    SUSCOUNT max_input);
+
+void suscan_decimator_destroy(suscan_decimator_t *self);
+
+/*
+ * Multi-stage decimation chain, for large decimation ratios. The ratio is
+ * split in a CIC front end, up to SUSCAN_DECIMATOR_CHAIN_MAX_HALFBANDS
+ * half-band stages and a final polyphase FIR stage, which also
+ * compensates the passband droop of the CIC.
+ *
+ * The CIC is implemented in its non-recursive form (a polyphase FIR whose
+ * taps are the boxcar convolved with itself SUSCAN_DECIMATOR_CIC_ORDER
+ * times): this costs the same order number of MACs per input sample as
+ * the recursive form, without the unbounded floating point integrators.
+ */
+struct suscan_decimator_chain {
+  unsigned int ratio;
+  unsigned int stage_count;
+  suscan_decimator_t *stages[SUSCAN_DECIMATOR_CHAIN_MAX_STAGES];
+
+  /* Output of the last stage, not yet delivered */
+  SUCOMPLEX *output;
+  SUSCOUNT   output_size;
+  SUSCOUNT   output_ptr;
+  SUSCOUNT   output_len;
+};
+
+typedef struct suscan_decimator_chain suscan_decimator_chain_t;
+
+SUINLINE SUSCOUNT
+suscan_decimator_chain_get_pending(const suscan_decimator_chain_t *self)
+{
+  return self->output_len - self->output_ptr;
+}
+
+SUCOMPLEX *suscan_decimator_chain_get_input(
+    suscan_decimator_chain_t *self,
+    SUSCOUNT max_out,
+    SUSCOUNT *len);
+
+SUSCOUNT suscan_decimator_chain_feed(
+    suscan_decimator_chain_t *self,
+    SUSCOUNT len,
+    SUCOMPLEX *out,
+    SUSCOUNT max_out);
+
+void suscan_decimator_chain_reset(suscan_decimator_chain_t *self);
+
+suscan_decimator_chain_t *suscan_decimator_chain_new(
+    unsigned int ratio,
+    unsigned int taps_per_phase,
+    SUSCOUNT max_input);
+
+void suscan_decimator_chain_destroy(suscan_decimator_chain_t *self);
+
+#ifdef __cplusplus
+}
+#endif /* __cplusplus */
+
+#endif /* _DECIMATOR_H */
@@ -95,6 +95,19 @@ suscan_estimator_read(const suscan_estimator_t *estimator, SUFLOAT *out)
   return (estimator->classptr->read) (estimator->privdata, out);
 }
 
+SUBOOL
+suscan_estimator_reset(suscan_estimator_t *estimator, SUSCOUNT fs)
+{
+  void *fresh;
+
+  SU_TRYCATCH(fresh = (estimator->classptr->ctor) (fs), return SU_FALSE);
+
+  (estimator->classptr->dtor) (estimator->privdata);
+  estimator->privdata = fresh;
+
+  return SU_TRUE;
+}
+
 void
 suscan_estimator_destroy(suscan_estimator_t *estimator)
 {
@@ -82,6 +82,9 @@ SUBOOL suscan_estimator_read(
     const suscan_estimator_t *estimator,
     SUFLOAT *out);
 
+/* Starts over, as if no samples had been fed */
+SUBOOL suscan_estimator_reset(suscan_estimator_t *estimator, SUSCOUNT fs);
+
 void suscan_estimator_destroy(suscan_estimator_t *estimator);
 
 /******************** Builtin channel estimators *****************************/
@@ -0,0 +1,451 @@
+/*
+
+  Copyright (C) 2020 Gonzalo José Carracedo Carballal
+
+  This program is free software: you can redistribute it and/or modify
+  it under the terms of the GNU Lesser General Public License as
+  published by the Free Software Foundation, either version 3 of the
+  License, or (at your option) any later version.
+
+  This program is distributed in the hope that it will be useful, but
+  WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+  GNU Lesser General Public License for more details.
+
+  You should have received a copy of the GNU Lesser General Public
+  License along with this program.  If not, see
+  <http://www.gnu.org/licenses/>
+
+*/
+
+
+#define SU_LOG_DOMAIN "hotconf"
+
+#include <stdlib.h>
+#include <string.h>
+#include <sigutils/log.h>
+
+#include "hotconf.h"
+
+/***************************** Snapshot methods ******************************/
+SUPRIVATE void
+suscan_hotconf_snapshot_destroy(struct suscan_hotconf_snapshot *snap)
+{
+  unsigned int i;
+
+  for (i = 0; i < snap->gain_count; ++i)
+    free(snap->gain_list[i].name);
+
+  if (snap->gain_list != NULL)
+    free(snap->gain_list);
+
+  if (snap->override_list != NULL)
+    free(snap->override_list);
+
+  if (snap->antenna != NULL)
+    free(snap->antenna);
+
+  free(snap);
+}
+
+SUPRIVATE struct suscan_hotconf_snapshot *
+suscan_hotconf_snapshot_dup(const struct suscan_hotconf_snapshot *snap)
+{
+  struct suscan_hotconf_snapshot *new = NULL;
+  unsigned int i;
+
+  SU_TRYCATCH(
+      new = malloc(sizeof(struct suscan_hotconf_snapshot)),
+      goto fail);
+
+  *new = *snap;
+
+  new->antenna = NULL;
+  new->gain_list = NULL;
+  new->gain_count = 0;
+  new->override_list = NULL;
+  new->override_count = 0;
+  new->retired_epoch = 0;
+  new->next_retired = NULL;
+
+  if (snap->antenna != NULL)
+    SU_TRYCATCH(new->antenna = strdup(snap->antenna), goto fail);
+
+  if (snap->gain_count > 0) {
+    SU_TRYCATCH(
+        new->gain_list = malloc(
+            snap->gain_count * sizeof(struct suscan_hotconf_gain)),
+        goto fail);
+
+    for (i = 0; i < snap->gain_count; ++i) {
+      new->gain_list[i] = snap->gain_list[i];
+      SU_TRYCATCH(
+          new->gain_list[i].name = strdup(snap->gain_list[i].name),
+          goto fail);
+      ++new->gain_count;
+    }
+  }
+
+  if (snap->override_count > 0) {
+    SU_TRYCATCH(
+        new->override_list = malloc(
+            snap->override_count * sizeof(struct suscan_hotconf_override)),
+        goto fail);
+
+    memcpy(
+        new->override_list,
+        snap->override_list,
+        snap->override_count * sizeof(struct suscan_hotconf_override));
+    new->override_count = snap->override_count;
+  }
+
+  return new;
+
+fail:
+  if (new != NULL)
+    suscan_hotconf_snapshot_destroy(new);
+
+  return NULL;
+}
+
+void
+suscan_hotconf_snapshot_set_freq(
+    struct suscan_hotconf_snapshot *snap,
+    SUFREQ freq,
+    SUFREQ lnb)
+{
+  snap->freq = freq;
+  snap->lnb  = lnb;
+  snap->freq_version = snap->version;
+}
+
+void
+suscan_hotconf_snapshot_set_bandwidth(
+    struct suscan_hotconf_snapshot *snap,
+    SUFLOAT bw)
+{
+  snap->bw = bw;
+  snap->bw_version = snap->version;
+}
+
+SUBOOL
+suscan_hotconf_snapshot_set_antenna(
+    struct suscan_hotconf_snapshot *snap,
+    const char *name)
+{
+  char *dup;
+
+  SU_TRYCATCH(dup = strdup(name), return SU_FALSE);
+
+  if (snap->antenna != NULL)
+    free(snap->antenna);
+
+  snap->antenna = dup;
+  snap->antenna_version = snap->version;
+
+  return SU_TRUE;
+}
+
+SUBOOL
+suscan_hotconf_snapshot_set_gain(
+    struct suscan_hotconf_snapshot *snap,
+    const char *name,
+    SUFLOAT value)
+{
+  struct suscan_hotconf_gain *tmp;
+  unsigned int i;
+  char *dup;
+
+  for (i = 0; i < snap->gain_count; ++i)
+    if (strcmp(snap->gain_list[i].name, name) == 0)
+      break;
+
+  if (i == snap->gain_count) {
+    SU_TRYCATCH(dup = strdup(name), return SU_FALSE);
+    if ((tmp = realloc(
+        snap->gain_list,
+        (i + 1) * sizeof(struct suscan_hotconf_gain))) == NULL) {
+      free(dup);
+      return SU_FALSE;
+    }
+
+    snap->gain_list = tmp;
+    snap->gain_list[i].name = dup;
+    ++snap->gain_count;
+  }
+
+  snap->gain_list[i].value = value;
+  snap->gain_list[i].version = snap->version;
+
+  return SU_TRUE;
+}
+
+void
+suscan_hotconf_snapshot_set_sweep_params(
+    struct suscan_hotconf_snapshot *snap,
+    const struct suscan_analyzer_sweep_params *params)
+{
+  snap->sweep = *params;
+  snap->sweep_version = snap->version;
+}
+
+SUPRIVATE struct suscan_hotconf_override *
+suscan_hotconf_snapshot_get_override(
+    struct suscan_hotconf_snapshot *snap,
+    SUHANDLE handle)
+{
+  struct suscan_hotconf_override *tmp;
+  unsigned int i;
+
+  for (i = 0; i < snap->override_count; ++i)
+    if (snap->override_list[i].handle == handle)
+      return snap->override_list + i;
+
+  SU_TRYCATCH(
+      tmp = realloc(
+          snap->override_list,
+          (i + 1) * sizeof(struct suscan_hotconf_override)),
+      return NULL);
+
+  snap->override_list = tmp;
+  memset(tmp + i, 0, sizeof(struct suscan_hotconf_override));
+  tmp[i].handle = handle;
+  ++snap->override_count;
+
+  return tmp + i;
+}
+
+SUBOOL
+suscan_hotconf_snapshot_set_inspector_freq(
+    struct suscan_hotconf_snapshot *snap,
+    SUHANDLE handle,
+    SUFREQ freq)
+{
+  struct suscan_hotconf_override *ovr;
+
+  SU_TRYCATCH(
+      ovr = suscan_hotconf_snapshot_get_override(snap, handle),
+      return SU_FALSE);
+
+  ovr->freq = freq;
+  ovr->freq_version = snap->version;
+
+  return SU_TRUE;
+}
+
+SUBOOL
+suscan_hotconf_snapshot_set_inspector_bandwidth(
+    struct suscan_hotconf_snapshot *snap,
+    SUHANDLE handle,
+    SUFLOAT bw)
+{
+  struct suscan_hotconf_override *ovr;
+
+  SU_TRYCATCH(
+      ovr = suscan_hotconf_snapshot_get_override(snap, handle),
+      return SU_FALSE);
+
+  ovr->bw = bw;
+  ovr->bw_version = snap->version;
+
+  return SU_TRUE;
+}
+
+void
+suscan_hotconf_snapshot_forget_inspector(
+    struct suscan_hotconf_snapshot *snap,
+    SUHANDLE handle)
+{
+  unsigned int i;
+
+  for (i = 0; i < snap->override_count; ++i)
+    if (snap->override_list[i].handle == handle) {
+      snap->override_list[i] = snap->override_list[--snap->override_count];
+      break;
+    }
+}
+
+/****************************** Hotconf methods *******************************/
+/* Called with the writer mutex held */
+SUPRIVATE void
+suscan_hotconf_reclaim(suscan_hotconf_t *self)
+{
+  struct suscan_hotconf_snapshot **prev, *snap;
+  uint64_t min_epoch = UINT64_MAX;
+  uint64_t epoch;
+  unsigned int i;
+
+  for (i = 0; i < SUSCAN_HOTCONF_MAX_READERS; ++i) {
+    epoch = __atomic_load_n(&self->reader_epoch[i], __ATOMIC_SEQ_CST);
+    if (epoch != SUSCAN_HOTCONF_QUIESCENT && epoch < min_epoch)
+      min_epoch = epoch;
+  }
+
+  /*
+   * A reader that entered in epoch E may hold anything that was still
+   * current when E began, i.e. anything retired in E or later.
+   */
+  prev = &self->retired;
+  while ((snap = *prev) != NULL) {
+    if (snap->retired_epoch < min_epoch) {
+      *prev = snap->next_retired;
+      suscan_hotconf_snapshot_destroy(snap);
+    } else {
+      prev = &snap->next_retired;
+    }
+  }
+}
+
+const struct suscan_hotconf_snapshot *
+suscan_hotconf_enter(suscan_hotconf_t *self, int reader)
+{
+  __atomic_store_n(
+      &self->reader_epoch[reader],
+      __atomic_load_n(&self->epoch, __ATOMIC_SEQ_CST),
+      __ATOMIC_SEQ_CST);
+
+  return __atomic_load_n(&self->current, __ATOMIC_SEQ_CST);
+}
+
+void
+suscan_hotconf_leave(suscan_hotconf_t *self, int reader)
+{
+  __atomic_store_n(
+      &self->reader_epoch[reader],
+      SUSCAN_HOTCONF_QUIESCENT,
+      __ATOMIC_RELEASE);
+}
+
+struct suscan_hotconf_snapshot *
+suscan_hotconf_begin(suscan_hotconf_t *self)
+{
+  struct suscan_hotconf_snapshot *new;
+
+  SU_TRYCATCH(
+      pthread_mutex_lock(&self->writer_mutex) == 0,
+      return NULL);
+
+  if ((new = suscan_hotconf_snapshot_dup(self->current)) == NULL) {
+    pthread_mutex_unlock(&self->writer_mutex);
+    return NULL;
+  }
+
+  ++new->version;
+
+  return new;
+}
+
+void
+suscan_hotconf_commit(
+    suscan_hotconf_t *self,
+    struct suscan_hotconf_snapshot *snap)
+{
+  struct suscan_hotconf_snapshot *old = self->current;
+
+  __atomic_store_n(&self->current, snap, __ATOMIC_SEQ_CST);
+  __atomic_store_n(&self->version, snap->version, __ATOMIC_RELEASE);
+
+  old->retired_epoch = __atomic_fetch_add(&self->epoch, 1, __ATOMIC_SEQ_CST);
+  old->next_retired = self->retired;
+  self->retired = old;
+
+  suscan_hotconf_reclaim(self);
+
+  pthread_mutex_unlock(&self->writer_mutex);
+}
+
+void
+suscan_hotconf_abort(
+    suscan_hotconf_t *self,
+    struct suscan_hotconf_snapshot *snap)
+{
+  suscan_hotconf_snapshot_destroy(snap);
+
+  pthread_mutex_unlock(&self->writer_mutex);
+}
+
+int
+suscan_hotconf_register_reader(suscan_hotconf_t *self)
+{
+  int i;
+
+  SU_TRYCATCH(pthread_mutex_lock(&self->writer_mutex) == 0, return -1);
+
+  for (i = 0; i < SUSCAN_HOTCONF_MAX_READERS; ++i)
+    if (!self->reader_used[i]) {
+      self->reader_used[i] = SU_TRUE;
+      self->reader_epoch[i] = SUSCAN_HOTCONF_QUIESCENT;
+      break;
+    }
+
+  pthread_mutex_unlock(&self->writer_mutex);
+
+  if (i == SUSCAN_HOTCONF_MAX_READERS) {
+    SU_ERROR("Too many hotconf readers\n");
+    return -1;
+  }
+
+  return i;
+}
+
+void
+suscan_hotconf_unregister_reader(suscan_hotconf_t *self, int reader)
+{
+  if (reader < 0 || reader >= SUSCAN_HOTCONF_MAX_READERS)
+    return;
+
+  (void) pthread_mutex_lock(&self->writer_mutex);
+
+  self->reader_used[reader] = SU_FALSE;
+  __atomic_store_n(
+      &self->reader_epoch[reader],
+      SUSCAN_HOTCONF_QUIESCENT,
+      __ATOMIC_SEQ_CST);
+
+  pthread_mutex_unlock(&self->writer_mutex);
+}
+
+SUBOOL
+suscan_hotconf_init(suscan_hotconf_t *self)
+{
+  memset(self, 0, sizeof(suscan_hotconf_t));
+
+  SU_TRYCATCH(
+      self->current = calloc(1, sizeof(struct suscan_hotconf_snapshot)),
+      goto fail);
+
+  self->epoch = SUSCAN_HOTCONF_QUIESCENT + 1;
+
+  SU_TRYCATCH(pthread_mutex_init(&self->writer_mutex, NULL) == 0, goto fail);
+  self->writer_mutex_init = SU_TRUE;
+
+  return SU_TRUE;
+
+fail:
+  suscan_hotconf_finalize(self);
+
+  return SU_FALSE;
+}
+
+/* No reader may be inside by now */
+void
+suscan_hotconf_finalize(suscan_hotconf_t *self)
+{
+  struct suscan_hotconf_snapshot *next;
+
+  while (self->retired != NULL) {
+    next = self->retired->next_retired;
+    suscan_hotconf_snapshot_destroy(self->retired);
+    self->retired = next;
+  }
+
+  if (self->current != NULL) {
+    suscan_hotconf_snapshot_destroy(self->current);
+    self->current = NULL;
+  }
+
+  if (self->writer_mutex_init) {
+    pthread_mutex_destroy(&self->writer_mutex);
+    self->writer_mutex_init = SU_FALSE;
+  }
+}
@@ -0,0 +1,196 @@
+/*
+
+  Copyright (C) 2020 Gonzalo José Carracedo Carballal
+
+  This program is free software: you can redistribute it and/or modify
+  it under the terms of the GNU Lesser General Public License as
+  published by the Free Software Foundation, either version 3 of the
+  License, or (at your option) any later version.
+
+  This program is distributed in the hope that it will be useful, but
+  WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+  GNU Lesser General Public License for more details.
+
+  You should have received a copy of the GNU Lesser General Public
+  License along with this program.  If not, see
+  <http://www.gnu.org/licenses/>
+
+*/
+
+
+#ifndef _ANALYZER_HOTCONF_H
+#define _ANALYZER_HOTCONF_H
+
+#include <sigutils/types.h>
+#include <pthread.h>
+#include <stdint.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif /* __cplusplus */
+
+/*
+ * Hot configuration: settings the client may change while the analyzer
+ * runs. Every change produces a new immutable snapshot that is published
+ * with an atomic pointer swap. Readers (the analyzer workers) check the
+ * version at block boundaries and never take a lock. Snapshots replaced
+ * while a reader may still be looking at them are reclaimed once every
+ * reader has moved past the epoch in which they were retired.
+ */
+#define SUSCAN_HOTCONF_MAX_READERS 8
+#define SUSCAN_HOTCONF_QUIESCENT   0
+
+enum suscan_analyzer_sweep_strategy {
+  SUSCAN_ANALYZER_SWEEP_STRATEGY_STOCHASTIC,
+  SUSCAN_ANALYZER_SWEEP_STRATEGY_PROGRESSIVE,
+};
+
+enum suscan_analyzer_spectrum_partitioning {
+  SUSCAN_ANALYZER_SPECTRUM_PARTITIONING_DISCRETE,
+  SUSCAN_ANALYZER_SPECTRUM_PARTITIONING_CONTINUOUS
+};
+
+struct suscan_analyzer_sweep_params {
+  enum suscan_analyzer_sweep_strategy strategy;
+  enum suscan_analyzer_spectrum_partitioning partitioning;
+
+  SUFREQ min_freq;
+  SUFREQ max_freq;
+  SUSCOUNT fft_min_samples; /* Minimum number of FFT frames before updating */
+};
+
+/*
+ * Every setting records the snapshot version in which it last changed
+ * (0 if never set). A reader that remembers the last version it consumed
+ * applies only what is newer.
+ */
+struct suscan_hotconf_gain {
+  char    *name;
+  SUFLOAT  value;
+  uint64_t version;
+};
+
+struct suscan_hotconf_override {
+  SUHANDLE handle;
+  SUFREQ   freq;
+  uint64_t freq_version;
+  SUFLOAT  bw;
+  uint64_t bw_version;
+};
+
+struct suscan_hotconf_snapshot {
+  uint64_t version;
+
+  /* Source settings, applied by the slow worker */
+  SUFREQ   freq;
+  SUFREQ   lnb;
+  uint64_t freq_version;
+
+  SUFLOAT  bw;
+  uint64_t bw_version;
+
+  char    *antenna;
+  uint64_t antenna_version;
+
+  struct suscan_hotconf_gain *gain_list;
+  unsigned int gain_count;
+
+  /* Inspector overrides, applied by the source worker */
+  struct suscan_hotconf_override *override_list;
+  unsigned int override_count;
+
+  /* Sweep parameters, applied by the wide spectrum worker */
+  struct suscan_analyzer_sweep_params sweep;
+  uint64_t sweep_version;
+
+  /* Reclamation */
+  uint64_t retired_epoch;
+  struct suscan_hotconf_snapshot *next_retired;
+};
+
+struct suscan_hotconf {
+  struct suscan_hotconf_snapshot *current; /* Accessed atomically */
+  uint64_t version;                        /* Same as current->version */
+  uint64_t epoch;
+
+  /* Epoch each reader entered in, SUSCAN_HOTCONF_QUIESCENT if outside */
+  uint64_t reader_epoch[SUSCAN_HOTCONF_MAX_READERS];
+  SUBOOL   reader_used[SUSCAN_HOTCONF_MAX_READERS];
+
+  pthread_mutex_t writer_mutex; /* Serializes writers only */
+  SUBOOL writer_mutex_init;
+  struct suscan_hotconf_snapshot *retired;
+};
+
+typedef struct suscan_hotconf suscan_hotconf_t;
+
+/* Cheap check for changes, no need to enter */
+SUINLINE uint64_t
+suscan_hotconf_get_version(const suscan_hotconf_t *self)
+{
+  return __atomic_load_n(&self->version, __ATOMIC_ACQUIRE);
+}
+
+SUBOOL suscan_hotconf_init(suscan_hotconf_t *self);
+void suscan_hotconf_finalize(suscan_hotconf_t *self);
+
+/* Each reader thread needs its own slot. Returns -1 if none is left */
+int suscan_hotconf_register_reader(suscan_hotconf_t *self);
+void suscan_hotconf_unregister_reader(suscan_hotconf_t *self, int reader);
+
+/* The snapshot remains valid until suscan_hotconf_leave */
+const struct suscan_hotconf_snapshot *suscan_hotconf_enter(
+    suscan_hotconf_t *self,
+    int reader);
+void suscan_hotconf_leave(suscan_hotconf_t *self, int reader);
+
+/*
+ * Writers get a private copy of the current snapshot, modify it with the
+ * setters below and publish it with suscan_hotconf_commit (or drop it
+ * with suscan_hotconf_abort). Writers are serialized between both calls.
+ */
+struct suscan_hotconf_snapshot *suscan_hotconf_begin(suscan_hotconf_t *self);
+void suscan_hotconf_commit(
+    suscan_hotconf_t *self,
+    struct suscan_hotconf_snapshot *snap);
+void suscan_hotconf_abort(
+    suscan_hotconf_t *self,
+    struct suscan_hotconf_snapshot *snap);
+
+void suscan_hotconf_snapshot_set_freq(
+    struct suscan_hotconf_snapshot *snap,
+    SUFREQ freq,
+    SUFREQ lnb);
+void suscan_hotconf_snapshot_set_bandwidth(
+    struct suscan_hotconf_snapshot *snap,
+    SUFLOAT bw);
+SUBOOL suscan_hotconf_snapshot_set_antenna(
+    struct suscan_hotconf_snapshot *snap,
+    const char *name);
+SUBOOL suscan_hotconf_snapshot_set_gain(
+    struct suscan_hotconf_snapshot *snap,
+    const char *name,
+    SUFLOAT value);
+void suscan_hotconf_snapshot_set_sweep_params(
+    struct suscan_hotconf_snapshot *snap,
+    const struct suscan_analyzer_sweep_params *params);
+SUBOOL suscan_hotconf_snapshot_set_inspector_freq(
+    struct suscan_hotconf_snapshot *snap,
+    SUHANDLE handle,
+    SUFREQ freq);
+SUBOOL suscan_hotconf_snapshot_set_inspector_bandwidth(
+    struct suscan_hotconf_snapshot *snap,
+    SUHANDLE handle,
+    SUFLOAT bw);
+
+/* Drops pending overrides of a handle that is about to be disposed */
+void suscan_hotconf_snapshot_forget_inspector(
+    struct suscan_hotconf_snapshot *snap,
+    SUHANDLE handle);
+
+#ifdef __cplusplus
+}
+#endif /* __cplusplus */
+
+#endif /* _ANALYZER_HOTCONF_H */
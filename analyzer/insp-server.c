@@ -29,6 +29,7 @@
 #include <sigutils/sigutils.h>
 
 #include "inspector/inspector.h"
+#include "bufpool.h"
 #include "mq.h"
 #include "msg.h"
 
@@ -45,6 +46,8 @@ suscan_inspector_sampler_loop(
     struct suscan_mq *mq_out)
 {
   struct suscan_analyzer_sample_batch_msg *msg = NULL;
+  SUCOMPLEX *samples = NULL;
+  SUSCOUNT count;
   SUSDIFF fed;
 
   while (samp_count > 0) {
@@ -56,16 +59,21 @@ suscan_inspector_sampler_loop(
         goto fail);
 
     if (suscan_inspector_get_output_length(insp) > insp->sample_msg_watermark) {
-      /* New samples produced by sampler: send to client */
+      /* New samples produced by sampler: send the buffer itself */
+      count = suscan_inspector_get_output_length(insp);
+
+      SU_TRYCATCH(
+          samples = suscan_inspector_take_output_buffer(insp),
+          goto fail);
+
       SU_TRYCATCH(
-          msg = suscan_analyzer_sample_batch_msg_new(
+          msg = suscan_analyzer_sample_batch_msg_new_from_buffer(
               insp->inspector_id,
-              suscan_inspector_get_output_buffer(insp),
-              suscan_inspector_get_output_length(insp)),
+              samples,
+              count),
           goto fail);
 
-      /* Reset size */
-      insp->sampler_ptr = 0;
+      samples = NULL;
 
       SU_TRYCATCH(
           suscan_mq_write(mq_out, SUSCAN_ANALYZER_MESSAGE_TYPE_SAMPLES, msg),
@@ -84,6 +92,9 @@ fail:
   if (msg != NULL)
     suscan_analyzer_sample_batch_msg_destroy(msg);
 
+  if (samples != NULL)
+    suscan_buffer_return(samples);
+
   return SU_FALSE;
 }
 
@@ -94,6 +105,7 @@ suscan_inspector_spectrum_loop(
     SUSCOUNT samp_count,
     struct suscan_mq *mq_out)
 {
+  struct suscan_analyzer_inspector_msg fresh;
   struct suscan_analyzer_inspector_msg *msg = NULL;
   struct timespec now, sub;
   suscan_spectsrc_t *src = NULL;
@@ -112,41 +124,66 @@ suscan_inspector_spectrum_loop(
         seconds = sub.tv_sec + 1e-9 * sub.tv_nsec;
         if (seconds >= insp->interval_spectrum) {
           insp->last_spectrum = now;
-          SU_TRYCATCH(
-              msg = suscan_analyzer_inspector_msg_new(
-                  SUSCAN_ANALYZER_INSPECTOR_MSGKIND_SPECTRUM,
-                  rand()),
-              goto fail);
 
-          msg->inspector_id = insp->inspector_id;
-          msg->spectsrc_id = insp->spectsrc_index;
-          msg->samp_rate = insp->samp_info.equiv_fs;
-          msg->spectrum_size = SUSCAN_INSPECTOR_SPECTRUM_BUF_SIZE;
+          /* Build the frame on the stack, it may never need a message */
+          memset(&fresh, 0, sizeof(struct suscan_analyzer_inspector_msg));
+          fresh.kind = SUSCAN_ANALYZER_INSPECTOR_MSGKIND_SPECTRUM;
+          fresh.req_id = rand();
+          fresh.inspector_id = insp->inspector_id;
+          fresh.spectsrc_id = insp->spectsrc_index;
+          fresh.samp_rate = insp->samp_info.equiv_fs;
+          fresh.spectrum_size = SUSCAN_INSPECTOR_SPECTRUM_BUF_SIZE;
+
+          /* The spare buffer stays ours until the frame is queued */
+          if (insp->spectrum_spare == NULL)
+            SU_TRYCATCH(
+                insp->spectrum_spare =
+                    suscan_pool_alloc(fresh.spectrum_size * sizeof(SUFLOAT)),
+                goto fail);
 
-          SU_TRYCATCH(
-              msg->spectrum_data = malloc(msg->spectrum_size * sizeof(SUFLOAT)),
-              goto fail);
+          fresh.spectrum_data = insp->spectrum_spare;
 
           SU_TRYCATCH(
-              suscan_spectsrc_calculate(src, msg->spectrum_data),
+              suscan_spectsrc_calculate(src, fresh.spectrum_data),
               goto fail);
 
           /* Use signal floor as noise level */
-          N0 = msg->spectrum_data[0];
-          for (i = 1; i < msg->spectrum_size; ++i)
-            if (N0 > msg->spectrum_data[i])
-              N0 = msg->spectrum_data[i];
+          N0 = fresh.spectrum_data[0];
+          for (i = 1; i < fresh.spectrum_size; ++i)
+            if (N0 > fresh.spectrum_data[i])
+              N0 = fresh.spectrum_data[i];
 
-          msg->N0 = N0;
+          fresh.N0 = N0;
 
-          SU_TRYCATCH(
-              suscan_mq_write(
-                  mq_out,
-                  SUSCAN_ANALYZER_MESSAGE_TYPE_INSPECTOR,
-                  msg),
-              goto fail);
+          /*
+           * If the consumer did not read our last frame yet, the fresh one
+           * takes its place and we get the stale buffer back.
+           */
+          if (suscan_mq_coalesce(
+              mq_out,
+              SUSCAN_ANALYZER_MESSAGE_TYPE_INSPECTOR,
+              suscan_analyzer_inspector_msg_coalesce_spectrum,
+              &fresh)) {
+            insp->spectrum_spare = fresh.spectrum_data;
+          } else {
+            SU_TRYCATCH(
+                msg = suscan_analyzer_inspector_msg_new(
+                    SUSCAN_ANALYZER_INSPECTOR_MSGKIND_SPECTRUM,
+                    fresh.req_id),
+                goto fail);
 
-          msg = NULL; /* We don't own this anymore */
+            *msg = fresh;
+            insp->spectrum_spare = NULL;
+
+            SU_TRYCATCH(
+                suscan_mq_write(
+                    mq_out,
+                    SUSCAN_ANALYZER_MESSAGE_TYPE_INSPECTOR,
+                    msg),
+                goto fail);
+
+            msg = NULL; /* We don't own this anymore */
+          }
         } else {
           SU_TRYCATCH(suscan_spectsrc_drop(src), goto fail);
         }
@@ -257,6 +294,9 @@ suscan_analyzer_on_channel_data(
             (su_specttuner_channel_t *) channel),
         return SU_FALSE);
 
+    /* Blocks of this channel may still be in flight */
+    suscan_inspsched_drain_task_info(task_info->sched, task_info);
+
     /* Remove from scheduler: no further processing will take place */
     SU_TRYCATCH(
         suscan_inspsched_remove_task_info(
@@ -273,10 +313,11 @@ suscan_analyzer_on_channel_data(
     return SU_TRUE;
   }
 
-  task_info->data = data;
-  task_info->size = size;
+  /* Silence pushed through the tuner after a seek: nothing to inspect */
+  if (task_info->sched->analyzer->seek_flushing)
+    return SU_TRUE;
 
-  return suscan_inspsched_queue_task(task_info->sched, task_info);
+  return suscan_inspsched_queue_task(task_info->sched, task_info, data, size);
 }
 
 suscan_inspector_t *
@@ -298,20 +339,15 @@ suscan_analyzer_get_inspector(
 }
 
 SUPRIVATE SUBOOL
-suscan_analyzer_mark_inspector_as_dead(
+suscan_analyzer_forget_inspector_overrides(
     suscan_analyzer_t *self,
-    suscan_inspector_t *insp)
+    SUHANDLE handle)
 {
-  struct suscan_inspector_overridable_request *req = NULL;
+  struct suscan_hotconf_snapshot *snap;
 
-  SU_TRYCATCH(
-      suscan_analyzer_lock_inspector_list(self),
-      return SU_FALSE);
-
-  if ((req = suscan_inspector_get_userdata(insp)) != NULL)
-    req->dead = SU_TRUE;
-
-  suscan_analyzer_unlock_inspector_list(self);
+  SU_TRYCATCH(snap = suscan_hotconf_begin(&self->hotconf), return SU_FALSE);
+  suscan_hotconf_snapshot_forget_inspector(snap, handle);
+  suscan_hotconf_commit(&self->hotconf, snap);
 
   return SU_TRUE;
 }
@@ -321,8 +357,6 @@ suscan_analyzer_dispose_inspector_handle(
     suscan_analyzer_t *analyzer,
     SUHANDLE handle)
 {
-  struct suscan_inspector_overridable_request *req = NULL;
-
   if (handle < 0 || handle >= analyzer->inspector_count)
     return SU_FALSE;
 
@@ -521,6 +555,25 @@ done:
  * in the beginning of the queue
  */
 
+/* INFO requests are served by the analyzer thread only */
+SUPRIVATE void
+suscan_analyzer_get_inspector_cpu_info(
+    suscan_inspector_t *insp,
+    uint64_t *cpu_time,
+    SUFLOAT *cpu_usage)
+{
+  uint64_t cpu = __atomic_load_n(&insp->telemetry.cpu_ns, __ATOMIC_RELAXED);
+  uint64_t now = suscan_telemetry_now();
+
+  *cpu_time = cpu;
+  *cpu_usage = now > insp->info_wall_ns
+      ? (SUFLOAT) (cpu - insp->info_cpu_ns) / (now - insp->info_wall_ns)
+      : 0;
+
+  insp->info_cpu_ns  = cpu;
+  insp->info_wall_ns = now;
+}
+
 /*
  * TODO: !!!!!!!!! Protect access to inspector object !!!!!!!!!!!!!!!
  */
@@ -681,6 +734,20 @@ suscan_analyzer_parse_inspector_msg(
 
       break;
 
+    case SUSCAN_ANALYZER_INSPECTOR_MSGKIND_INFO:
+      if ((insp = suscan_analyzer_get_inspector(
+          analyzer,
+          msg->handle)) == NULL) {
+        /* No such handle */
+        msg->kind = SUSCAN_ANALYZER_INSPECTOR_MSGKIND_WRONG_HANDLE;
+      } else {
+        suscan_analyzer_get_inspector_cpu_info(
+            insp,
+            &msg->cpu_time,
+            &msg->cpu_usage);
+      }
+      break;
+
     case SUSCAN_ANALYZER_INSPECTOR_MSGKIND_CLOSE:
       if ((insp = suscan_analyzer_get_inspector(
           analyzer,
@@ -701,18 +768,21 @@ suscan_analyzer_parse_inspector_msg(
         } else {
           /*
            * Inspector is still running. Mark it as halting, so it will not
-           * come back to the worker queue. Also, mark overridable request
-           * as dead, so we prevent dealing with the inspector while it is
-           * being removed.
+           * come back to the worker queue.
            */
-          SU_TRYCATCH(
-              suscan_analyzer_mark_inspector_as_dead(analyzer, insp),
-              goto done);
           insp->state = SUSCAN_ASYNC_STATE_HALTING;
         }
 
         /* We can't trust the inspector contents from here on out */
         insp = NULL;
+
+        /*
+         * Pending overrides must not reach whoever reuses this handle.
+         * The handle no longer resolves, so no new ones can be added.
+         */
+        SU_TRYCATCH(
+            suscan_analyzer_forget_inspector_overrides(analyzer, msg->handle),
+            goto done);
       }
       break;
 
@@ -30,6 +30,8 @@
 #include <sigutils/sampling.h>
 
 #include "inspector/inspector.h"
+#include "bufpool.h"
+#include "threads.h"
 
 void
 suscan_inspector_lock(suscan_inspector_t *insp)
@@ -98,6 +100,12 @@ suscan_inspector_destroy(suscan_inspector_t *insp)
   if (insp->spectsrc_list != NULL)
     free(insp->spectsrc_list);
 
+  if (insp->spectrum_spare != NULL)
+    suscan_pool_free(insp->spectrum_spare);
+
+  if (insp->sampler_buf != NULL)
+    suscan_buffer_return(insp->sampler_buf);
+
   free(insp);
 }
 
@@ -131,6 +139,59 @@ suscan_inspector_notify_bandwidth(
   return SU_TRUE;
 }
 
+SUBOOL
+suscan_inspector_reset(suscan_inspector_t *insp)
+{
+  suscan_config_t *config = NULL;
+  void *fresh = NULL;
+  unsigned int i;
+  SUBOOL ok = SU_FALSE;
+
+  /* A fresh demodulator, with the configuration of the current one */
+  SU_TRYCATCH(config = suscan_inspector_create_config(insp), goto done);
+  SU_TRYCATCH(suscan_inspector_get_config(insp, config), goto done);
+  SU_TRYCATCH(fresh = (insp->iface->open) (&insp->samp_info), goto done);
+  SU_TRYCATCH((insp->iface->parse_config) (fresh, config), goto done);
+
+  suscan_inspector_lock(insp);
+
+  (insp->iface->commit_config) (fresh);
+
+  /* The channel bandwidth may have changed since it was opened */
+  if (insp->new_bandwidth > 0 && insp->iface->new_bandwidth != NULL)
+    (insp->iface->new_bandwidth) (fresh, insp->new_bandwidth);
+
+  (insp->iface->close) (insp->privdata);
+  insp->privdata = fresh;
+  fresh = NULL;
+
+  suscan_inspector_unlock(insp);
+
+  for (i = 0; i < insp->estimator_count; ++i)
+    SU_TRYCATCH(
+        suscan_estimator_reset(
+            insp->estimator_list[i],
+            insp->samp_info.equiv_fs),
+        goto done);
+
+  for (i = 0; i < insp->spectsrc_count; ++i)
+    suscan_spectsrc_reset(insp->spectsrc_list[i]);
+
+  /* Samples demodulated before the reset are not sent */
+  insp->sampler_ptr = 0;
+
+  ok = SU_TRUE;
+
+done:
+  if (fresh != NULL)
+    (insp->iface->close) (fresh);
+
+  if (config != NULL)
+    suscan_config_destroy(config);
+
+  return ok;
+}
+
 SUPRIVATE SUBOOL
 suscan_inspector_add_estimator(
     suscan_inspector_t *insp,
@@ -204,9 +265,14 @@ suscan_inspector_new(
   SU_TRYCATCH(new = calloc(1, sizeof (suscan_inspector_t)), goto fail);
 
   new->state = SUSCAN_ASYNC_STATE_CREATED;
+  new->info_wall_ns = suscan_telemetry_now();
 
   SU_TRYCATCH(pthread_mutex_init(&new->mutex, NULL) != -1, goto fail);
 
+  SU_TRYCATCH(
+      new->sampler_buf = suscan_buffer_alloc(SUSCAN_INSPECTOR_SAMPLER_BUF_SIZE),
+      goto fail);
+
   /* Initialize sampling info */
   new->samp_info.schan = channel;
   new->samp_info.equiv_fs = fs / channel->decimation;
@@ -254,6 +320,53 @@ suscan_inspector_feed_bulk(
   return (insp->iface->feed) (insp->privdata, insp, x, count);
 }
 
+/*
+ * Gives away the sampler buffer (and our reference to it) and puts a fresh
+ * one in its place. The output length is reset.
+ */
+SUCOMPLEX *
+suscan_inspector_take_output_buffer(suscan_inspector_t *insp)
+{
+  SUCOMPLEX *fresh;
+  SUCOMPLEX *result;
+
+  SU_TRYCATCH(
+      fresh = suscan_buffer_alloc(SUSCAN_INSPECTOR_SAMPLER_BUF_SIZE),
+      return NULL);
+
+  result = insp->sampler_buf;
+
+  insp->sampler_buf = fresh;
+  insp->sampler_ptr = 0;
+
+  return result;
+}
+
+/*
+ * Only long-lived buffers are worth moving. Sample batches and spectrum
+ * frames are recycled through the buffer pool and replaced as they are
+ * sent.
+ */
+void
+suscan_inspector_move_to_node(suscan_inspector_t *insp, int node)
+{
+  suscan_spectsrc_t *src;
+  unsigned int i;
+
+  for (i = 0; i < insp->spectsrc_count; ++i) {
+    src = insp->spectsrc_list[i];
+
+    suscan_numa_move(
+        src->window_func,
+        src->window_size * sizeof(SUCOMPLEX),
+        node);
+    suscan_numa_move(
+        src->window_buffer,
+        src->window_size * sizeof(SU_FFTW(_complex)),
+        node);
+  }
+}
+
 SUBOOL
 suscan_init_inspectors(void)
 {
@@ -27,6 +27,7 @@ extern "C" {
 
 #include <sigutils/sigutils.h>
 #include "interface.h"
+#include "telemetry.h"
 
 #define SUHANDLE int32_t
 
@@ -63,16 +64,22 @@ struct suscan_inspector {
   struct timespec last_spectrum;
 
   uint32_t spectsrc_index;
+  SUFLOAT *spectrum_spare; /* Buffer recovered from a coalesced frame */
 
   SUBOOL    params_requested;    /* New parameters requested */
   SUBOOL    bandwidth_notified;  /* New bandwidth set */
   SUFREQ    new_bandwidth;
 
-  /* Sampler output */
-  SUCOMPLEX sampler_buf[SUSCAN_INSPECTOR_SAMPLER_BUF_SIZE];
+  /* Sampler output, pooled and handed to the client by reference */
+  SUCOMPLEX *sampler_buf;
   SUSCOUNT  sampler_ptr;
   SUSCOUNT  sample_msg_watermark; /* Watermark. When reached, message is sent */
 
+  /* Loop timings and CPU time, published with the analyzer telemetry */
+  struct suscan_inspector_telemetry telemetry;
+  uint64_t info_cpu_ns;  /* CPU accounting as of the last INFO request */
+  uint64_t info_wall_ns;
+
   PTR_LIST(suscan_estimator_t, estimator); /* Parameter estimators */
   PTR_LIST(suscan_spectsrc_t, spectsrc); /* Spectrum source */
 };
@@ -150,6 +157,13 @@ void suscan_inspector_unlock(suscan_inspector_t *insp);
 
 void suscan_inspector_reset_equalizer(suscan_inspector_t *insp);
 
+/*
+ * Brings the inspector back to the state it had right after being
+ * configured: demodulator loops, estimators, spectrum windows and
+ * pending output start over. The inspector must not be running.
+ */
+SUBOOL suscan_inspector_reset(suscan_inspector_t *insp);
+
 void suscan_inspector_assert_params(suscan_inspector_t *insp);
 
 void suscan_inspector_destroy(suscan_inspector_t *insp);
@@ -176,6 +190,11 @@ SUSDIFF suscan_inspector_feed_bulk(
     const SUCOMPLEX *x,
     int count);
 
+SUCOMPLEX *suscan_inspector_take_output_buffer(suscan_inspector_t *insp);
+
+/* Best effort: migrates the inspector buffers to a NUMA node */
+void suscan_inspector_move_to_node(suscan_inspector_t *insp, int node);
+
 SUBOOL suscan_init_inspectors(void);
 
 /* Builtin inspectors */
@@ -21,23 +21,41 @@
 #define SU_LOG_DOMAIN "inspsched"
 
 #include <sigutils/log.h>
+#include <stdio.h>
 #include <unistd.h>
+#include <string.h>
 
 #include "inspsched.h"
 
 #include "analyzer.h"
 #include "msg.h"
 
-SUPRIVATE SUBOOL
-suscan_inpsched_task_cb(
-    struct suscan_mq *mq_out,
-    void *wk_private,
-    void *cb_private)
+/* Records a loop both in the inspector and in the analyzer totals */
+SUINLINE uint64_t
+suscan_inspsched_record_loop(
+    suscan_inspsched_t *sched,
+    suscan_inspector_t *insp,
+    enum suscan_telemetry_loop loop,
+    enum suscan_telemetry_stage stage,
+    uint64_t start)
 {
-  suscan_inspsched_t *sched = (suscan_inspsched_t *) wk_private;
-  struct suscan_inspector_task_info *task_info =
-      (struct suscan_inspector_task_info *) cb_private;
-  unsigned int i;
+  uint64_t now = suscan_telemetry_now();
+
+  suscan_histogram_record(&insp->telemetry.loop[loop], now - start);
+  suscan_histogram_record(&sched->analyzer->telemetry.stage[stage], now - start);
+
+  return now;
+}
+
+SUPRIVATE void
+suscan_inspsched_run_block(
+    suscan_inspsched_t *sched,
+    struct suscan_inspector_task_info *task_info,
+    const SUCOMPLEX *data,
+    SUSCOUNT size)
+{
+  suscan_inspector_t *insp = task_info->inspector;
+  uint64_t t = suscan_telemetry_now();
 
   /*
    * We just process the incoming data. If we broke something,
@@ -45,61 +63,300 @@ suscan_inpsched_task_cb(
    */
   SU_TRYCATCH(
       suscan_inspector_sampler_loop(
-          task_info->inspector,
-          task_info->data,
-          task_info->size,
+          insp,
+          data,
+          size,
           sched->analyzer->mq_out),
       goto fail);
 
+  t = suscan_inspsched_record_loop(
+      sched,
+      insp,
+      SUSCAN_TELEMETRY_LOOP_SAMPLER,
+      SUSCAN_TELEMETRY_STAGE_SAMPLER,
+      t);
+
   /* Feed all enabled estimators */
   SU_TRYCATCH(
       suscan_inspector_estimator_loop(
-          task_info->inspector,
-          task_info->data,
-          task_info->size,
+          insp,
+          data,
+          size,
           sched->analyzer->mq_out),
       goto fail);
 
+  t = suscan_inspsched_record_loop(
+      sched,
+      insp,
+      SUSCAN_TELEMETRY_LOOP_ESTIMATOR,
+      SUSCAN_TELEMETRY_STAGE_ESTIMATOR,
+      t);
+
   /* Feed spectrum */
   SU_TRYCATCH(
       suscan_inspector_spectrum_loop(
-          task_info->inspector,
-          task_info->data,
-          task_info->size,
+          insp,
+          data,
+          size,
           sched->analyzer->mq_out),
       goto fail);
 
-  return SU_FALSE;
+  (void) suscan_inspsched_record_loop(
+      sched,
+      insp,
+      SUSCAN_TELEMETRY_LOOP_SPECTRUM,
+      SUSCAN_TELEMETRY_STAGE_SPECTRUM,
+      t);
+
+  return;
 
 fail:
   task_info->inspector->state = SUSCAN_ASYNC_STATE_HALTING;
+}
+
+SUPRIVATE unsigned int
+suscan_inspsched_get_min_workers(void)
+{
+  long count;
+
+  if ((count = sysconf(_SC_NPROCESSORS_ONLN)) < 2)
+    count = 2;
+
+  return count - 1;
+}
+
+SUPRIVATE uint64_t
+suscan_inspsched_now_ns(void)
+{
+  struct timespec ts;
+
+  clock_gettime(CLOCK_MONOTONIC, &ts);
 
-  return SU_FALSE;
+  return (uint64_t) ts.tv_sec * 1000000000ull + ts.tv_nsec;
 }
 
+/******************************* Task deques *********************************/
 SUPRIVATE SUBOOL
-suscan_inpsched_barrier_cb(
-    struct suscan_mq *mq_out,
-    void *wk_private,
-    void *cb_private)
+suscan_inspsched_worker_push(
+    struct suscan_inspsched_worker *self,
+    struct suscan_inspector_task_info *task_info)
 {
-  suscan_inspsched_t *sched = (suscan_inspsched_t *) wk_private;
+  struct suscan_inspector_task_info **deque = NULL;
+  unsigned int i, alloc;
+  SUBOOL ok = SU_FALSE;
+
+  pthread_mutex_lock(&self->deque_mutex);
+
+  if (self->deque_count == self->deque_alloc) {
+    alloc = self->deque_alloc == 0
+        ? SUSCAN_INSPSCHED_DEQUE_MIN_SIZE
+        : 2 * self->deque_alloc;
+
+    SU_TRYCATCH(
+        deque = malloc(alloc * sizeof(struct suscan_inspector_task_info *)),
+        goto done);
+
+    for (i = 0; i < self->deque_count; ++i)
+      deque[i] = self->deque[(self->deque_head + i) % self->deque_alloc];
 
-  suscan_analyzer_source_barrier(sched->analyzer);
+    if (self->deque != NULL)
+      free(self->deque);
 
-  return SU_FALSE;
+    self->deque = deque;
+    self->deque_alloc = alloc;
+    self->deque_head = 0;
+  }
+
+  self->deque[(self->deque_head + self->deque_count++) % self->deque_alloc] =
+      task_info;
+
+  ok = SU_TRUE;
+
+done:
+  pthread_mutex_unlock(&self->deque_mutex);
+
+  return ok;
 }
 
+/* The owner takes from the back, thieves from the front */
+SUPRIVATE struct suscan_inspector_task_info *
+suscan_inspsched_worker_pop(struct suscan_inspsched_worker *self, SUBOOL steal)
+{
+  struct suscan_inspector_task_info *task_info = NULL;
 
-SUPRIVATE unsigned int
-suscan_inspsched_get_min_workers(void)
+  pthread_mutex_lock(&self->deque_mutex);
+
+  if (self->deque_count > 0) {
+    if (steal) {
+      task_info = self->deque[self->deque_head];
+      self->deque_head = (self->deque_head + 1) % self->deque_alloc;
+    } else {
+      task_info = self->deque[
+          (self->deque_head + self->deque_count - 1) % self->deque_alloc];
+    }
+
+    --self->deque_count;
+  }
+
+  pthread_mutex_unlock(&self->deque_mutex);
+
+  return task_info;
+}
+
+SUPRIVATE struct suscan_inspector_task_info *
+suscan_inspsched_worker_find_task(struct suscan_inspsched_worker *self)
 {
-  long count;
+  suscan_inspsched_t *sched = self->sched;
+  struct suscan_inspsched_worker *victim;
+  struct suscan_inspector_task_info *task_info;
+  unsigned int i, pass;
+
+  if ((task_info = suscan_inspsched_worker_pop(self, SU_FALSE)) != NULL)
+    return task_info;
+
+  /* Steal from workers of the same node first, then from the rest */
+  for (pass = 0; pass < 2; ++pass)
+    for (i = 1; i < sched->worker_count; ++i) {
+      victim = sched->worker_list[(self->index + i) % sched->worker_count];
+      if ((victim->node == self->node) != (pass == 0))
+        continue;
+
+      if ((task_info = suscan_inspsched_worker_pop(victim, SU_TRUE)) != NULL) {
+        ++self->steals;
+        return task_info;
+      }
+    }
 
-  if ((count = sysconf(_SC_NPROCESSORS_ONLN)) < 2)
-    count = 2;
+  return NULL;
+}
 
-  return count - 1;
+/****************************** Worker threads ********************************/
+/* Processes the buffers of a task, in order, until none is left */
+SUPRIVATE void
+suscan_inspsched_worker_run(
+    struct suscan_inspsched_worker *self,
+    struct suscan_inspector_task_info *task_info)
+{
+  suscan_inspsched_t *sched = self->sched;
+  unsigned int slot;
+  uint64_t start, elapsed;
+  uint64_t cpu_start;
+
+  pthread_mutex_lock(&sched->mutex);
+
+  while (task_info->pending > 0) {
+    slot = task_info->buffer_read;
+    pthread_mutex_unlock(&sched->mutex);
+
+    /* Referenced buffers are not touched by the source */
+    start = suscan_inspsched_now_ns();
+    cpu_start = suscan_telemetry_thread_cpu_now();
+    suscan_inspsched_run_block(
+        sched,
+        task_info,
+        task_info->buffer_data[slot],
+        task_info->buffer_size[slot]);
+    __atomic_add_fetch(
+        &task_info->inspector->telemetry.cpu_ns,
+        suscan_telemetry_thread_cpu_now() - cpu_start,
+        __ATOMIC_RELAXED);
+    elapsed = suscan_inspsched_now_ns() - start;
+
+    __atomic_add_fetch(&self->busy_ns, elapsed, __ATOMIC_RELAXED);
+    __atomic_add_fetch(&self->tasks, 1, __ATOMIC_RELAXED);
+
+    pthread_mutex_lock(&sched->mutex);
+    /* Read by queue_task when placing the task, under the same mutex */
+    task_info->cost +=
+        SUSCAN_INSPSCHED_COST_ALPHA * (1e-9 * elapsed - task_info->cost);
+    --task_info->buffer_refs[slot];
+    task_info->buffer_read = (slot + 1) % SUSCAN_INSPSCHED_BUFFERS;
+    --task_info->pending;
+    --sched->outstanding;
+    pthread_cond_broadcast(&sched->done_cond);
+  }
+
+  task_info->placed_on->load -= task_info->placed_cost;
+  task_info->placed_on = NULL;
+  task_info->scheduled = SU_FALSE;
+  pthread_cond_broadcast(&sched->done_cond);
+
+  pthread_mutex_unlock(&sched->mutex);
+}
+
+SUPRIVATE void *
+suscan_inspsched_worker_thread(void *data)
+{
+  struct suscan_inspsched_worker *self =
+      (struct suscan_inspsched_worker *) data;
+  suscan_inspsched_t *sched = self->sched;
+  struct suscan_inspector_task_info *task_info;
+  uint64_t seq;
+
+  for (;;) {
+    pthread_mutex_lock(&sched->mutex);
+    seq = sched->queued_seq;
+    pthread_mutex_unlock(&sched->mutex);
+
+    while ((task_info = suscan_inspsched_worker_find_task(self)) != NULL)
+      suscan_inspsched_worker_run(self, task_info);
+
+    /* Nothing left anywhere. Sleep unless something was queued meanwhile */
+    pthread_mutex_lock(&sched->mutex);
+    if (sched->halt_req) {
+      pthread_mutex_unlock(&sched->mutex);
+      break;
+    }
+
+    if (seq == sched->queued_seq) {
+      ++sched->idle;
+      while (seq == sched->queued_seq && !sched->halt_req)
+        pthread_cond_wait(&sched->work_cond, &sched->mutex);
+      --sched->idle;
+    }
+    pthread_mutex_unlock(&sched->mutex);
+  }
+
+  return NULL;
+}
+
+SUPRIVATE void
+suscan_inspsched_worker_destroy(struct suscan_inspsched_worker *self)
+{
+  if (self->deque_mutex_init)
+    pthread_mutex_destroy(&self->deque_mutex);
+
+  if (self->deque != NULL)
+    free(self->deque);
+
+  free(self);
+}
+
+SUPRIVATE struct suscan_inspsched_worker *
+suscan_inspsched_worker_new(suscan_inspsched_t *sched, unsigned int index)
+{
+  struct suscan_inspsched_worker *new = NULL;
+
+  SU_TRYCATCH(
+      new = calloc(1, sizeof(struct suscan_inspsched_worker)),
+      goto fail);
+
+  new->sched = sched;
+  new->index = index;
+  new->node = -1;
+
+  SU_TRYCATCH(pthread_mutex_init(&new->deque_mutex, NULL) == 0, goto fail);
+  new->deque_mutex_init = SU_TRUE;
+
+  clock_gettime(CLOCK_MONOTONIC, &new->last_query);
+
+  return new;
+
+fail:
+  if (new != NULL)
+    suscan_inspsched_worker_destroy(new);
+
+  return NULL;
 }
 
 struct suscan_inspector_task_info *
@@ -112,6 +369,7 @@ suscan_inspector_task_info_new(suscan_inspector_t *inspector)
       return NULL);
 
   new->index = -1;
+  new->node = -1;
   new->inspector = inspector;
 
   return new;
@@ -120,6 +378,15 @@ suscan_inspector_task_info_new(suscan_inspector_t *inspector)
 void
 suscan_inspector_task_info_destroy(struct suscan_inspector_task_info *info)
 {
+  unsigned int i;
+
+  for (i = 0; i < SUSCAN_INSPSCHED_BUFFERS; ++i)
+    if (info->buffer_data[i] != NULL)
+      suscan_numa_free(
+          info->buffer_data[i],
+          info->buffer_alloc[i] * sizeof(SUCOMPLEX),
+          info->buffer_node[i]);
+
   free(info);
 }
 
@@ -128,6 +395,7 @@ suscan_inspsched_append_task_info(
     suscan_inspsched_t *sched,
     struct suscan_inspector_task_info *info)
 {
+  unsigned int i, node;
   int index;
 
   SU_TRYCATCH(info->index == -1, return SU_FALSE);
@@ -141,6 +409,18 @@ suscan_inspsched_append_task_info(
   info->index = index;
   info->sched = sched;
 
+  /* Home the task on the node with the fewest tasks */
+  if (sched->node_count > 1) {
+    node = 0;
+    for (i = 1; i < sched->node_count; ++i)
+      if (sched->node_tasks[i] < sched->node_tasks[node])
+        node = i;
+
+    info->node = node;
+    ++sched->node_tasks[node];
+    suscan_inspector_move_to_node(info->inspector, node);
+  }
+
   return SU_TRUE;
 }
 
@@ -159,6 +439,9 @@ suscan_inspsched_remove_task_info(
 
   sched->task_info_list[info->index] = NULL;
 
+  if (info->node >= 0)
+    --sched->node_tasks[info->node];
+
   info->index = -1;
   info->sched = NULL;
 
@@ -168,38 +451,180 @@ suscan_inspsched_remove_task_info(
 SUBOOL
 suscan_inspsched_queue_task(
     suscan_inspsched_t *sched,
-    struct suscan_inspector_task_info *task_info)
+    struct suscan_inspector_task_info *task_info,
+    const SUCOMPLEX *data,
+    SUSCOUNT size)
 {
-  /* Process new samples */
-  SU_TRYCATCH(
-      suscan_worker_push(
-          sched->worker_list[sched->last_worker],
-          suscan_inpsched_task_cb,
-          task_info),
-      return SU_FALSE);
+  struct suscan_inspsched_worker *target;
+  SUCOMPLEX *buffer;
+  unsigned int i, slot;
+  uint64_t start;
+  SUBOOL ok = SU_FALSE;
+
+  /* Only if the worker is N blocks behind */
+  pthread_mutex_lock(&sched->mutex);
+  slot = task_info->buffer_write;
+  if (task_info->buffer_refs[slot] > 0) {
+    start = suscan_telemetry_now();
+    while (task_info->buffer_refs[slot] > 0)
+      pthread_cond_wait(&sched->done_cond, &sched->mutex);
+    (void) suscan_telemetry_record(
+        &sched->analyzer->telemetry,
+        SUSCAN_TELEMETRY_STAGE_SCHED_WAIT,
+        start);
+  }
+  pthread_mutex_unlock(&sched->mutex);
 
-  if (++sched->last_worker == sched->worker_count)
-    sched->last_worker = 0;
+  /* Unreferenced buffers belong to the source. Keep them on the home node */
+  if (task_info->buffer_alloc[slot] < size) {
+    SU_TRYCATCH(
+        buffer = suscan_numa_alloc(size * sizeof(SUCOMPLEX), task_info->node),
+        return SU_FALSE);
+    if (task_info->buffer_data[slot] != NULL)
+      suscan_numa_free(
+          task_info->buffer_data[slot],
+          task_info->buffer_alloc[slot] * sizeof(SUCOMPLEX),
+          task_info->buffer_node[slot]);
+    task_info->buffer_data[slot] = buffer;
+    task_info->buffer_alloc[slot] = size;
+    task_info->buffer_node[slot] = task_info->node;
+  }
 
-  return SU_TRUE;
+  memcpy(task_info->buffer_data[slot], data, size * sizeof(SUCOMPLEX));
+  task_info->buffer_size[slot] = size;
+
+  pthread_mutex_lock(&sched->mutex);
+
+  if (!task_info->scheduled) {
+    /*
+     * Initial placement: the worker with the lowest estimated load,
+     * among those of the home node of the task (if any).
+     */
+    target = NULL;
+    for (i = 0; i < sched->worker_count; ++i)
+      if (task_info->node < 0
+          || sched->worker_list[i]->node == task_info->node)
+        if (target == NULL || sched->worker_list[i]->load < target->load)
+          target = sched->worker_list[i];
+
+    if (target == NULL)
+      target = sched->worker_list[0];
+
+    SU_TRYCATCH(suscan_inspsched_worker_push(target, task_info), goto done);
+
+    task_info->scheduled = SU_TRUE;
+    task_info->placed_on = target;
+    task_info->placed_cost = task_info->cost;
+    target->load += task_info->cost;
+
+    ++sched->queued_seq;
+    if (sched->idle > 0)
+      pthread_cond_broadcast(&sched->work_cond);
+  }
+
+  ++task_info->buffer_refs[slot];
+  task_info->buffer_write = (slot + 1) % SUSCAN_INSPSCHED_BUFFERS;
+  ++task_info->pending;
+  ++sched->outstanding;
+
+  ok = SU_TRUE;
+
+done:
+  pthread_mutex_unlock(&sched->mutex);
+
+  return ok;
 }
 
 SUBOOL
 suscan_inspsched_sync(suscan_inspsched_t *sched)
 {
-  unsigned int i;
+  uint64_t start;
+
+  pthread_mutex_lock(&sched->mutex);
+  if (sched->outstanding > 0) {
+    start = suscan_telemetry_now();
+    while (sched->outstanding > 0)
+      pthread_cond_wait(&sched->done_cond, &sched->mutex);
+    (void) suscan_telemetry_record(
+        &sched->analyzer->telemetry,
+        SUSCAN_TELEMETRY_STAGE_SCHED_WAIT,
+        start);
+  }
+  pthread_mutex_unlock(&sched->mutex);
 
-  /* Queue barriers */
-  for (i = 0; i < sched->worker_count; ++i)
-    SU_TRYCATCH(
-        suscan_worker_push(
-            sched->worker_list[i],
-            suscan_inpsched_barrier_cb,
-            NULL),
-        return SU_FALSE);
+  return SU_TRUE;
+}
+
+void
+suscan_inspsched_drain_task_info(
+    suscan_inspsched_t *sched,
+    struct suscan_inspector_task_info *info)
+{
+  pthread_mutex_lock(&sched->mutex);
+  while (info->scheduled)
+    pthread_cond_wait(&sched->done_cond, &sched->mutex);
+  pthread_mutex_unlock(&sched->mutex);
+}
 
-  /* Wait for all threads */
-  suscan_analyzer_source_barrier(sched->analyzer);
+SUBOOL
+suscan_inspsched_get_worker_cpu_time(
+    suscan_inspsched_t *sched,
+    unsigned int index,
+    uint64_t *ns)
+{
+  SU_TRYCATCH(index < sched->worker_count, return SU_FALSE);
+
+  if (!sched->worker_list[index]->thread_running)
+    return SU_FALSE;
+
+  return suscan_telemetry_get_thread_cpu(
+      sched->worker_list[index]->thread,
+      ns);
+}
+
+SUBOOL
+suscan_inspsched_get_worker_stats(
+    suscan_inspsched_t *sched,
+    unsigned int index,
+    struct suscan_inspsched_worker_stats *stats)
+{
+  struct suscan_inspsched_worker *worker;
+  struct timespec now;
+  uint64_t busy, wall, cpu;
+  SUBOOL cpu_ok;
+
+  SU_TRYCATCH(index < sched->worker_count, return SU_FALSE);
+
+  worker = sched->worker_list[index];
+
+  cpu_ok = suscan_inspsched_get_worker_cpu_time(sched, index, &cpu);
+
+  /* Concurrent callers share the window: keep it consistent */
+  pthread_mutex_lock(&sched->mutex);
+
+  clock_gettime(CLOCK_MONOTONIC, &now);
+  busy = __atomic_load_n(&worker->busy_ns, __ATOMIC_RELAXED);
+  if (!cpu_ok)
+    cpu = worker->last_cpu_ns;
+
+  wall = (uint64_t) (now.tv_sec - worker->last_query.tv_sec) * 1000000000ull
+      + now.tv_nsec - worker->last_query.tv_nsec;
+
+  stats->utilization = wall > 0
+      ? (SUFLOAT) (busy - worker->last_busy_ns) / wall
+      : 0;
+  stats->cpu_usage = wall > 0
+      ? (SUFLOAT) (cpu - worker->last_cpu_ns) / wall
+      : 0;
+  stats->cpu_time = cpu;
+  stats->tasks = __atomic_load_n(&worker->tasks, __ATOMIC_RELAXED);
+  stats->steals = __atomic_load_n(&worker->steals, __ATOMIC_RELAXED);
+
+  worker->last_query = now;
+  worker->last_busy_ns = busy;
+  worker->last_cpu_ns = cpu;
+
+  pthread_mutex_unlock(&sched->mutex);
 
   return SU_TRUE;
 }
@@ -209,19 +634,33 @@ suscan_inspsched_destroy(suscan_inspsched_t *sched)
 {
   unsigned int i;
 
-  /*
-   * Attempt to halt all workers. These are analyzer workers, and
-   * should be halted as such.
-   */
+  /* Tasks still in the deques are just dropped */
+  if (sched->sync_init) {
+    pthread_mutex_lock(&sched->mutex);
+    sched->halt_req = SU_TRUE;
+    pthread_cond_broadcast(&sched->work_cond);
+    pthread_mutex_unlock(&sched->mutex);
+  }
+
   for (i = 0; i < sched->worker_count; ++i)
-    if (!suscan_analyzer_halt_worker(sched->worker_list[i])) {
-      SU_ERROR("Fatal error while halting inspsched workers\n");
-      return SU_FALSE;
-    }
+    if (sched->worker_list[i]->thread_running)
+      if (pthread_join(sched->worker_list[i]->thread, NULL) != 0) {
+        SU_ERROR("Fatal error while halting inspsched workers\n");
+        return SU_FALSE;
+      }
+
+  for (i = 0; i < sched->worker_count; ++i)
+    suscan_inspsched_worker_destroy(sched->worker_list[i]);
 
   if (sched->worker_list != NULL)
     free(sched->worker_list);
 
+  if (sched->sync_init) {
+    pthread_cond_destroy(&sched->done_cond);
+    pthread_cond_destroy(&sched->work_cond);
+    pthread_mutex_destroy(&sched->mutex);
+  }
+
   /*
    * All workers halted, source worker must be finished by now
    * it is safe to go on with the object destruction
@@ -233,6 +672,9 @@ suscan_inspsched_destroy(suscan_inspsched_t *sched)
   if (sched->task_info_list != NULL)
     free(sched->task_info_list);
 
+  if (sched->node_tasks != NULL)
+    free(sched->node_tasks);
+
   free(sched);
 
   return SU_TRUE;
@@ -243,31 +685,74 @@ suscan_inspsched_t *
 suscan_inspsched_new(suscan_analyzer_t *analyzer)
 {
   suscan_inspsched_t *new = NULL;
-  suscan_worker_t *worker;
-
-  unsigned int i, count;
+  struct suscan_inspsched_worker *worker = NULL;
+  const struct suscan_analyzer_thread_params *threads =
+      &analyzer->params.threads;
+  struct suscan_analyzer_thread_params worker_threads;
+  struct suscan_thread_cpu_mask node_cpus;
+  char name[SUSCAN_THREAD_NAME_MAX];
+  unsigned int i, count, nodes = 1;
 
   SU_TRYCATCH(new = calloc(1, sizeof(suscan_inspsched_t)), goto fail);
 
   new->analyzer = analyzer;
 
-  count = suscan_inspsched_get_min_workers();
+  SU_TRYCATCH(pthread_mutex_init(&new->mutex, NULL) == 0, goto fail);
+  SU_TRYCATCH(pthread_cond_init(&new->work_cond, NULL) == 0, goto fail);
+  SU_TRYCATCH(pthread_cond_init(&new->done_cond, NULL) == 0, goto fail);
+  new->sync_init = SU_TRUE;
+
+  if ((count = threads->inspector_workers) == 0)
+    count = suscan_inspsched_get_min_workers();
+
+  /* Explicit CPU sets take precedence over the NUMA grouping */
+  if (threads->numa_placement
+      && suscan_thread_cpu_mask_is_empty(
+          &threads->cpus[SUSCAN_ANALYZER_THREAD_ROLE_INSPECTOR]))
+    nodes = suscan_numa_get_node_count();
+
+  if (nodes > count)
+    nodes = count;
 
+  new->node_count = nodes;
+  SU_TRYCATCH(
+      new->node_tasks = calloc(nodes, sizeof(unsigned int)),
+      goto fail);
+
+  /* All deques must exist before any thread starts stealing */
   for (i = 0; i < count; ++i) {
-    SU_TRYCATCH(worker = suscan_worker_new(&analyzer->mq_in, new), goto fail);
+    SU_TRYCATCH(worker = suscan_inspsched_worker_new(new, i), goto fail);
+    if (nodes > 1)
+      worker->node = i * nodes / count;
     SU_TRYCATCH(PTR_LIST_APPEND_CHECK(new->worker, worker) != -1, goto fail);
     worker = NULL;
   }
 
+  for (i = 0; i < count; ++i) {
+    /* Workers grouped by node run on the CPUs of their node */
+    worker_threads = *threads;
+    if (new->worker_list[i]->node >= 0
+        && suscan_numa_get_node_cpus(new->worker_list[i]->node, &node_cpus))
+      worker_threads.cpus[SUSCAN_ANALYZER_THREAD_ROLE_INSPECTOR] = node_cpus;
+
+    snprintf(name, sizeof(name), "suscan-insp%u", i);
+    SU_TRYCATCH(
+        suscan_analyzer_thread_create(
+            &worker_threads,
+            SUSCAN_ANALYZER_THREAD_ROLE_INSPECTOR,
+            name,
+            &new->worker_list[i]->thread,
+            suscan_inspsched_worker_thread,
+            new->worker_list[i]),
+        goto fail);
+    new->worker_list[i]->thread_running = SU_TRUE;
+  }
+
   return new;
 
 fail:
-  /*
-   * We can call worker_halt because it is empty and no messages will be
-   * emitted from any callback.
-   */
   if (worker != NULL)
-    suscan_worker_halt(worker);
+    suscan_inspsched_worker_destroy(worker);
 
   if (new != NULL)
     suscan_inspsched_destroy(new);
@@ -22,10 +22,23 @@
 #define _INSPSCHED_H
 
 #include <util.h>
+#include <pthread.h>
+#include <stdint.h>
+#include <time.h>
 #include <sigutils/specttuner.h>
 
 #include "worker.h"
 
+/* Weight of the last run in the per-task cost estimation */
+#define SUSCAN_INSPSCHED_COST_ALPHA     .1
+#define SUSCAN_INSPSCHED_DEQUE_MIN_SIZE 16
+
+/*
+ * Tuner output blocks buffered per inspector. While a worker processes
+ * block k, the source can channelize up to block k + N - 1.
+ */
+#define SUSCAN_INSPSCHED_BUFFERS        2
+
 struct suscan_inspector;
 struct suscan_inspsched;
 
@@ -34,12 +47,77 @@ struct suscan_inspector_task_info {
   struct suscan_inspsched *sched; /* BORROWED: Scheduler owning this task_info */
   struct suscan_inspector *inspector;  /* BORROWED: Inspector to feed */
   const su_specttuner_channel_t *channel; /* BORROWED: Channel */
-  const SUCOMPLEX *data;
-  SUSCOUNT size;
+  SUFLOAT cost; /* EWMA of the processing time, in seconds */
+  int node;     /* Home NUMA node, -1 if none */
+
+  /*
+   * Copies of the channel output. A buffer is referenced from the moment
+   * the source fills it until a worker is done with it, and the source
+   * only reuses unreferenced buffers. Buffers are consumed in order, by
+   * one worker at a time. Protected by the scheduler mutex.
+   */
+  SUCOMPLEX   *buffer_data[SUSCAN_INSPSCHED_BUFFERS];
+  SUSCOUNT     buffer_alloc[SUSCAN_INSPSCHED_BUFFERS];
+  int          buffer_node[SUSCAN_INSPSCHED_BUFFERS]; /* Allocated on */
+  SUSCOUNT     buffer_size[SUSCAN_INSPSCHED_BUFFERS];
+  unsigned int buffer_refs[SUSCAN_INSPSCHED_BUFFERS];
+  unsigned int buffer_write;
+  unsigned int buffer_read;
+  unsigned int pending;
+  SUBOOL       scheduled; /* In a deque or being processed */
+  struct suscan_inspsched_worker *placed_on;
+  SUFLOAT      placed_cost;
 };
 
 struct suscan_analyzer;
 
+/*
+ * Every worker owns a deque of tasks. New tasks are pushed to the
+ * least loaded worker (according to the estimated cost of the tasks
+ * placed on it that are still pending). Workers pop tasks from the back of
+ * their own deques and, once these are empty, steal from the front of
+ * the others'.
+ *
+ * On multi-node hosts, workers are split in per-node groups and every
+ * task gets a home node, where its buffers live. Placement and stealing
+ * stay within the home node as long as possible.
+ */
+struct suscan_inspsched_worker {
+  struct suscan_inspsched *sched;
+  unsigned int index;
+  int node; /* NUMA node this worker is pinned to, -1 if none */
+  pthread_t thread;
+  SUBOOL thread_running;
+
+  pthread_mutex_t deque_mutex;
+  SUBOOL deque_mutex_init;
+  struct suscan_inspector_task_info **deque;
+  unsigned int deque_alloc;
+  unsigned int deque_head;
+  unsigned int deque_count;
+
+  SUFLOAT load; /* Estimated cost of the tasks placed here */
+
+  /* Statistics, updated by the worker thread */
+  uint64_t busy_ns;
+  uint64_t tasks;
+  uint64_t steals;
+
+  /* Utilization window, updated by readers under the scheduler mutex */
+  struct timespec last_query;
+  uint64_t last_busy_ns;
+  uint64_t last_cpu_ns;
+  uint64_t telemetry_cpu_ns; /* Touched by the telemetry publisher only */
+};
+
+struct suscan_inspsched_worker_stats {
+  SUFLOAT  utilization; /* Busy time fraction since the previous query */
+  SUFLOAT  cpu_usage;   /* Thread CPU time fraction, same window */
+  uint64_t cpu_time;    /* Thread CPU time so far, in nanoseconds */
+  uint64_t tasks;
+  uint64_t steals;
+};
+
 struct suscan_inspsched {
   struct suscan_analyzer *analyzer;
 
@@ -47,8 +125,21 @@ struct suscan_inspsched {
   PTR_LIST(struct suscan_inspector_task_info, task_info);
 
   /* Worker pool */
-  PTR_LIST(suscan_worker_t, worker);
-  unsigned int last_worker; /* Used as rotatory index */
+  PTR_LIST(struct suscan_inspsched_worker, worker);
+
+  /* NUMA placement */
+  unsigned int  node_count; /* 1 if workers are not grouped by node */
+  unsigned int *node_tasks; /* Tasks homed on each node */
+
+  /* Protects idle workers, task buffers and placement */
+  pthread_mutex_t mutex;
+  pthread_cond_t  work_cond; /* Idle workers wait here */
+  pthread_cond_t  done_cond; /* Signaled every time a buffer is released */
+  SUBOOL sync_init;
+  unsigned int idle;
+  unsigned int outstanding; /* Buffers queued but not yet processed */
+  uint64_t     queued_seq;
+  SUBOOL       halt_req;
 };
 
 typedef struct suscan_inspsched suscan_inspsched_t;
@@ -79,12 +170,35 @@ SUBOOL suscan_inspsched_remove_task_info(
     suscan_inspsched_t *sched,
     struct suscan_inspector_task_info *info);
 
+/*
+ * Copies a block of channel output and queues it for processing. Blocks
+ * only if all the buffers of this task are still in use.
+ */
 SUBOOL suscan_inspsched_queue_task(
     suscan_inspsched_t *sched,
-    struct suscan_inspector_task_info *task_info);
+    struct suscan_inspector_task_info *task_info,
+    const SUCOMPLEX *data,
+    SUSCOUNT size);
 
+/* Waits until all queued blocks have been processed */
 SUBOOL suscan_inspsched_sync(suscan_inspsched_t *sched);
 
+/* Waits until all queued blocks of this task have been processed */
+void suscan_inspsched_drain_task_info(
+    suscan_inspsched_t *sched,
+    struct suscan_inspector_task_info *info);
+
+/* Thread CPU time consumed by a worker so far, in nanoseconds */
+SUBOOL suscan_inspsched_get_worker_cpu_time(
+    suscan_inspsched_t *sched,
+    unsigned int index,
+    uint64_t *ns);
+
+SUBOOL suscan_inspsched_get_worker_stats(
+    suscan_inspsched_t *sched,
+    unsigned int index,
+    struct suscan_inspsched_worker_stats *stats);
+
 suscan_inspsched_t *suscan_inspsched_new(struct suscan_analyzer *analyzer);
 
 SUBOOL suscan_inspsched_destroy(suscan_inspsched_t *sched);
@@ -0,0 +1,140 @@
+/*
+
+  Copyright (C) 2020 Gonzalo José Carracedo Carballal
+
+  This program is free software: you can redistribute it and/or modify
+  it under the terms of the GNU Lesser General Public License as
+  published by the Free Software Foundation, either version 3 of the
+  License, or (at your option) any later version.
+
+  This program is distributed in the hope that it will be useful, but
+  WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+  GNU Lesser General Public License for more details.
+
+  You should have received a copy of the GNU Lesser General Public
+  License along with this program.  If not, see
+  <http://www.gnu.org/licenses/>
+
+*/
+
+
+#include <string.h>
+#include <math.h>
+
+#define SU_LOG_DOMAIN "iqcorr"
+
+#include <sigutils/sigutils.h>
+#include "iqcorr.h"
+
+void
+suscan_iq_corrector_reset(suscan_iq_corrector_t *self)
+{
+  self->dc = 0;
+  self->ii = self->qq = self->iq = 0;
+  self->primed = SU_FALSE;
+  self->a = 1;
+  self->b = 0;
+}
+
+void
+suscan_iq_corrector_init(suscan_iq_corrector_t *self, SUFLOAT tau)
+{
+  memset(self, 0, sizeof(suscan_iq_corrector_t));
+
+  self->tau = tau;
+
+  suscan_iq_corrector_reset(self);
+}
+
+/*
+ * Blind IQ imbalance model: I = A cos(t), Q = B sin(t + phi). From the
+ * block statistics, A / B = sqrt(<I^2> / <Q^2>) and
+ * sin(phi) = <IQ> / sqrt(<I^2><Q^2>), and the corrected quadrature
+ * component is Q' = (A / B * Q - sin(phi) * I) / cos(phi).
+ */
+SUPRIVATE void
+suscan_iq_corrector_update_coefs(suscan_iq_corrector_t *self)
+{
+  SUFLOAT norm, s, c;
+
+  if (self->ii <= 0 || self->qq <= 0)
+    return;
+
+  norm = SU_SQRT(self->ii * self->qq);
+  s = self->iq / norm;
+
+  /* Nonsense estimate: keep the previous correction */
+  if (s <= -1 || s >= 1)
+    return;
+
+  c = SU_SQRT(1 - s * s);
+
+  self->a = SU_SQRT(self->ii / self->qq) / c;
+  self->b = -s / c;
+}
+
+void
+suscan_iq_corrector_feed(
+    suscan_iq_corrector_t *self,
+    SUCOMPLEX *buf,
+    SUSCOUNT len)
+{
+  SUFLOAT *as_real = (SUFLOAT *) buf;
+  SUFLOAT alpha;
+  SUFLOAT sum_i, sum_q;
+  SUFLOAT sum_ii, sum_qq, sum_iq;
+  SUFLOAT dc_i, dc_q;
+  SUFLOAT x_i, x_q;
+  SUFLOAT a, b;
+  SUSCOUNT i;
+
+  if (len == 0 || !suscan_iq_corrector_is_enabled(self))
+    return;
+
+  alpha = self->primed ? 1 - SU_EXP(-(SUFLOAT) len / self->tau) : 1;
+
+  /* DC: block mean, smoothed across blocks */
+  if (self->dc_remove) {
+    sum_i = sum_q = 0;
+    for (i = 0; i < len; ++i) {
+      sum_i += as_real[2 * i];
+      sum_q += as_real[2 * i + 1];
+    }
+
+    self->dc += alpha * ((sum_i + I * sum_q) / len - self->dc);
+
+    dc_i = SU_C_REAL(self->dc);
+    dc_q = SU_C_IMAG(self->dc);
+
+    for (i = 0; i < len; ++i) {
+      as_real[2 * i]     -= dc_i;
+      as_real[2 * i + 1] -= dc_q;
+    }
+  }
+
+  if (self->iq_balance) {
+    sum_ii = sum_qq = sum_iq = 0;
+    for (i = 0; i < len; ++i) {
+      x_i = as_real[2 * i];
+      x_q = as_real[2 * i + 1];
+      sum_ii += x_i * x_i;
+      sum_qq += x_q * x_q;
+      sum_iq += x_i * x_q;
+    }
+
+    self->ii += alpha * (sum_ii / len - self->ii);
+    self->qq += alpha * (sum_qq / len - self->qq);
+    self->iq += alpha * (sum_iq / len - self->iq);
+
+    suscan_iq_corrector_update_coefs(self);
+
+    a = self->a;
+    b = self->b;
+
+    for (i = 0; i < len; ++i)
+      as_real[2 * i + 1] = a * as_real[2 * i + 1] + b * as_real[2 * i];
+  }
+
+  self->primed = SU_TRUE;
+}
@@ -0,0 +1,90 @@
+/*
+
+  Copyright (C) 2020 Gonzalo José Carracedo Carballal
+
+  This program is free software: you can redistribute it and/or modify
+  it under the terms of the GNU Lesser General Public License as
+  published by the Free Software Foundation, either version 3 of the
+  License, or (at your option) any later version.
+
+  This program is distributed in the hope that it will be useful, but
+  WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+  GNU Lesser General Public License for more details.
+
+  You should have received a copy of the GNU Lesser General Public
+  License along with this program.  If not, see
+  <http://www.gnu.org/licenses/>
+
+*/
+
+
+#ifndef _IQCORR_H
+#define _IQCORR_H
+
+#include <sigutils/sigutils.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif /* __cplusplus */
+
+/*
+ * Block-based DC blocker and IQ imbalance corrector. Statistics are
+ * computed once per block (block mean, I/Q powers and cross-correlation)
+ * and smoothed across blocks with a one-pole filter whose time constant
+ * is given in samples. Correction coefficients are updated once per block
+ * too, so the per-sample work reduces to a few vectorizable loops.
+ */
+struct suscan_iq_corrector {
+  SUBOOL dc_remove;
+  SUBOOL iq_balance;
+  SUFLOAT tau; /* Time constant, in samples */
+
+  /* DC estimate */
+  SUCOMPLEX dc;
+
+  /* IQ imbalance estimates (DC-free) */
+  SUFLOAT ii;
+  SUFLOAT qq;
+  SUFLOAT iq;
+  SUBOOL  primed;
+
+  /* Q' = a * Q + b * I */
+  SUFLOAT a;
+  SUFLOAT b;
+};
+
+typedef struct suscan_iq_corrector suscan_iq_corrector_t;
+
+SUINLINE SUBOOL
+suscan_iq_corrector_is_enabled(const suscan_iq_corrector_t *self)
+{
+  return self->dc_remove || self->iq_balance;
+}
+
+SUINLINE void
+suscan_iq_corrector_set_dc_remove(suscan_iq_corrector_t *self, SUBOOL val)
+{
+  self->dc_remove = val;
+}
+
+SUINLINE void
+suscan_iq_corrector_set_iq_balance(suscan_iq_corrector_t *self, SUBOOL val)
+{
+  self->iq_balance = val;
+}
+
+void suscan_iq_corrector_init(suscan_iq_corrector_t *self, SUFLOAT tau);
+
+void suscan_iq_corrector_reset(suscan_iq_corrector_t *self);
+
+void suscan_iq_corrector_feed(
+    suscan_iq_corrector_t *self,
+    SUCOMPLEX *buf,
+    SUSCOUNT len);
+
+#ifdef __cplusplus
+}
+#endif /* __cplusplus */
+
+#endif /* _IQCORR_H */
@@ -25,6 +25,17 @@
 #include <libgen.h>
 #include <pthread.h>
 #include <stdint.h>
+#include <limits.h>
+#include <sched.h>
+#include <errno.h>
+#include <time.h>
+
+#ifdef __linux__
+#  include <unistd.h>
+#  include <linux/futex.h>
+#  include <sys/syscall.h>
+#  define SUSCAN_MQ_USE_FUTEX
+#endif /* __linux__ */
 
 #include "mq.h"
 
@@ -93,6 +104,42 @@ suscan_mq_return_msg(struct suscan_msg *msg)
         msg_pool_peak_copy);
 }
 
+/* Returns a whole chain of messages (linked by next) at once */
+SUPRIVATE void
+suscan_mq_return_msg_chain(struct suscan_msg *chain)
+{
+  struct suscan_msg *next;
+  int msg_pool_peak_copy = -1;
+
+  if (chain == NULL)
+    return;
+
+  suscan_msg_pool_enter();
+
+  while (chain != NULL) {
+    next = chain->next;
+
+    chain->free_next = msg_pool;
+    msg_pool = chain;
+
+    ++msg_pool_size;
+    if (msg_pool_size > msg_pool_peak) {
+      msg_pool_peak = msg_pool_size;
+      if ((msg_pool_peak % SUSCAN_MQ_POOL_WARNING_THRESHOLD) == 0)
+        msg_pool_peak_copy = msg_pool_peak;
+    }
+
+    chain = next;
+  }
+
+  suscan_msg_pool_leave();
+
+  if (msg_pool_peak_copy != -1)
+    SU_WARNING(
+        "Message pool freelist grew to %d elements!\n",
+        msg_pool_peak_copy);
+}
+
 #else
 SUPRIVATE struct suscan_msg *
 suscan_mq_alloc_msg(void)
@@ -105,6 +152,18 @@ suscan_mq_return_msg(struct suscan_msg *msg)
 {
   free(msg);
 }
+
+SUPRIVATE void
+suscan_mq_return_msg_chain(struct suscan_msg *chain)
+{
+  struct suscan_msg *next;
+
+  while (chain != NULL) {
+    next = chain->next;
+    free(chain);
+    chain = next;
+  }
+}
 #endif
 
 SUPRIVATE void
@@ -131,14 +190,37 @@ suscan_mq_wait_unsafe(struct suscan_mq *mq)
   pthread_cond_wait(&mq->acquire_cond, &mq->acquire_lock);
 }
 
-void
-suscan_mq_wait(struct suscan_mq *mq)
+/* Timeouts are relative. Deadlines are absolute, in CLOCK_REALTIME */
+SUPRIVATE void
+suscan_mq_get_deadline(struct timespec *deadline, const struct timespec *timeout)
 {
-  suscan_mq_enter(mq);
+  clock_gettime(CLOCK_REALTIME, deadline);
 
-  suscan_mq_wait_unsafe(mq);
+  deadline->tv_sec  += timeout->tv_sec;
+  deadline->tv_nsec += timeout->tv_nsec;
 
-  suscan_mq_leave(mq);
+  if (deadline->tv_nsec >= 1000000000) {
+    deadline->tv_nsec -= 1000000000;
+    ++deadline->tv_sec;
+  }
+}
+
+SUPRIVATE SUBOOL
+suscan_mq_get_remaining(const struct timespec *deadline, struct timespec *rem)
+{
+  struct timespec now;
+
+  clock_gettime(CLOCK_REALTIME, &now);
+
+  rem->tv_sec  = deadline->tv_sec - now.tv_sec;
+  rem->tv_nsec = deadline->tv_nsec - now.tv_nsec;
+
+  if (rem->tv_nsec < 0) {
+    rem->tv_nsec += 1000000000;
+    --rem->tv_sec;
+  }
+
+  return rem->tv_sec > 0 || (rem->tv_sec == 0 && rem->tv_nsec > 0);
 }
 
 SUPRIVATE struct suscan_msg *
@@ -172,29 +254,32 @@ suscan_mq_push_front(struct suscan_mq *mq, struct suscan_msg *msg)
 }
 
 SUPRIVATE void
-suscan_mq_push(struct suscan_mq *mq, struct suscan_msg *msg)
+suscan_mq_list_push(
+    struct suscan_msg **head,
+    struct suscan_msg **tail,
+    struct suscan_msg *msg)
 {
-  if (mq->tail != NULL)
-    mq->tail->next = msg;
+  if (*tail != NULL)
+    (*tail)->next = msg;
 
-  mq->tail = msg;
+  *tail = msg;
 
-  if (mq->head == NULL)
-    mq->head = msg;
+  if (*head == NULL)
+    *head = msg;
 }
 
 SUPRIVATE struct suscan_msg *
-suscan_mq_pop(struct suscan_mq *mq)
+suscan_mq_list_pop(struct suscan_msg **head, struct suscan_msg **tail)
 {
   struct suscan_msg *msg;
 
-  if ((msg = mq->head) == NULL)
+  if ((msg = *head) == NULL)
     return NULL;
 
-  mq->head = msg->next;
+  *head = msg->next;
 
-  if (mq->head == NULL)
-    mq->tail = NULL;
+  if (*head == NULL)
+    *tail = NULL;
 
   msg->next = NULL;
 
@@ -202,12 +287,15 @@ suscan_mq_pop(struct suscan_mq *mq)
 }
 
 SUPRIVATE struct suscan_msg *
-suscan_mq_pop_w_type(struct suscan_mq *mq, uint32_t type)
+suscan_mq_list_pop_w_type(
+    struct suscan_msg **head,
+    struct suscan_msg **tail,
+    uint32_t type)
 {
   struct suscan_msg *this, *prev;
 
   prev = NULL;
-  this = mq->head;
+  this = *head;
 
   while (this != NULL) {
     if (this->type == type)
@@ -218,12 +306,12 @@ suscan_mq_pop_w_type(struct suscan_mq *mq, uint32_t type)
 
   if (this != NULL) {
     if (prev == NULL)
-      mq->head = this->next;
+      *head = this->next;
     else
       prev->next = this->next;
 
-    if (this == mq->tail)
-      mq->tail = prev;
+    if (this == *tail)
+      *tail = prev;
 
     this->next = NULL;
   }
@@ -231,6 +319,914 @@ suscan_mq_pop_w_type(struct suscan_mq *mq, uint32_t type)
   return this;
 }
 
+SUPRIVATE void
+suscan_mq_push(struct suscan_mq *mq, struct suscan_msg *msg)
+{
+  suscan_mq_list_push(&mq->head, &mq->tail, msg);
+}
+
+SUPRIVATE struct suscan_msg *
+suscan_mq_pop(struct suscan_mq *mq)
+{
+  return suscan_mq_list_pop(&mq->head, &mq->tail);
+}
+
+SUPRIVATE struct suscan_msg *
+suscan_mq_pop_w_type(struct suscan_mq *mq, uint32_t type)
+{
+  return suscan_mq_list_pop_w_type(&mq->head, &mq->tail, type);
+}
+
+/************************** Backpressure accounting **************************/
+SUPRIVATE struct suscan_mq_policy *
+suscan_mq_get_policy(struct suscan_mq *mq, uint32_t type)
+{
+  if (type >= SUSCAN_MQ_MAX_POLICY_TYPES)
+    return NULL;
+
+  if (__atomic_load_n(&mq->policies[type].type, __ATOMIC_ACQUIRE)
+      == SUSCAN_MQ_POLICY_NONE)
+    return NULL;
+
+  return mq->policies + type;
+}
+
+SUPRIVATE void
+suscan_mq_account_push(struct suscan_mq *mq, uint32_t type)
+{
+  struct suscan_mq_policy *policy;
+
+  if ((policy = suscan_mq_get_policy(mq, type)) != NULL)
+    __atomic_add_fetch(&policy->pending, 1, __ATOMIC_RELAXED);
+}
+
+/* Must be called with acquire_lock held */
+SUPRIVATE void
+suscan_mq_account_pop(struct suscan_mq *mq, uint32_t type)
+{
+  struct suscan_mq_policy *policy;
+
+  if ((policy = suscan_mq_get_policy(mq, type)) != NULL) {
+    __atomic_sub_fetch(&policy->pending, 1, __ATOMIC_RELEASE);
+
+    if (mq->blocked_writers > 0)
+      suscan_mq_notify(mq);
+  }
+}
+
+/***************************** Ring backend **********************************/
+/*
+ * Bounded multi-producer ring (D. Vyukov's sequence-numbered slots).
+ * Writers claim a slot with a CAS on ring_head and publish it by storing
+ * its sequence number. Readers are serialized by acquire_lock, which
+ * writers only take in the slow paths (urgent messages and overflow).
+ *
+ * Typed reads may take a message from the middle of the ring. Such slots
+ * are marked dead and released once they reach the tail.
+ *
+ * Readers announce themselves in `sleepers' before checking for messages
+ * one last time, and writers check it after publishing. This way, a wakeup
+ * is only issued when a reader is actually sleeping.
+ */
+SUPRIVATE SUBOOL
+suscan_mq_ring_push(struct suscan_mq *mq, uint32_t type, void *private)
+{
+  struct suscan_mq_slot *slot;
+  uint64_t pos = __atomic_load_n(&mq->ring_head, __ATOMIC_RELAXED);
+  int64_t diff;
+
+  for (;;) {
+    slot = mq->slots + (pos & mq->ring_mask);
+    diff = (int64_t) (__atomic_load_n(&slot->seq, __ATOMIC_ACQUIRE) - pos);
+
+    if (diff == 0) {
+      if (__atomic_compare_exchange_n(
+          &mq->ring_head,
+          &pos,
+          pos + 1,
+          SU_TRUE,
+          __ATOMIC_RELAXED,
+          __ATOMIC_RELAXED))
+        break;
+    } else if (diff < 0) {
+      return SU_FALSE; /* Ring full */
+    } else {
+      pos = __atomic_load_n(&mq->ring_head, __ATOMIC_RELAXED);
+    }
+  }
+
+  slot->type = type;
+  slot->privdata = private;
+  slot->dead = SU_FALSE;
+
+  __atomic_store_n(&slot->seq, pos + 1, __ATOMIC_RELEASE);
+
+  return SU_TRUE;
+}
+
+SUPRIVATE void
+suscan_mq_ring_wake(struct suscan_mq *mq)
+{
+  __atomic_thread_fence(__ATOMIC_SEQ_CST);
+
+  if (__atomic_load_n(&mq->sleepers, __ATOMIC_RELAXED) == 0)
+    return;
+
+#ifdef SUSCAN_MQ_USE_FUTEX
+  __atomic_add_fetch(&mq->wake_seq, 1, __ATOMIC_SEQ_CST);
+  (void) syscall(
+      SYS_futex,
+      &mq->wake_seq,
+      FUTEX_WAKE_PRIVATE,
+      INT_MAX,
+      NULL,
+      NULL,
+      0);
+#else
+  suscan_mq_enter(mq);
+  __atomic_add_fetch(&mq->wake_seq, 1, __ATOMIC_SEQ_CST);
+  suscan_mq_notify(mq);
+  suscan_mq_leave(mq);
+#endif /* SUSCAN_MQ_USE_FUTEX */
+}
+
+/* Reader-side snapshot, to tell whether something arrived while asleep */
+struct suscan_mq_ring_mark {
+  uint64_t scan_end; /* First slot found unpublished */
+  unsigned int urgent_count;
+  unsigned int overflow_count;
+};
+
+SUPRIVATE SUBOOL
+suscan_mq_ring_has_news(
+    const struct suscan_mq *mq,
+    const struct suscan_mq_ring_mark *mark)
+{
+  const struct suscan_mq_slot *slot =
+      mq->slots + (mark->scan_end & mq->ring_mask);
+
+  return __atomic_load_n(&slot->seq, __ATOMIC_ACQUIRE) == mark->scan_end + 1
+      || __atomic_load_n(&mq->urgent_count, __ATOMIC_RELAXED)
+          != mark->urgent_count
+      || __atomic_load_n(&mq->overflow_count, __ATOMIC_RELAXED)
+          != mark->overflow_count;
+}
+
+/* Returns SU_FALSE if the deadline (if any) expired before sleeping */
+SUPRIVATE SUBOOL
+suscan_mq_ring_sleep(
+    struct suscan_mq *mq,
+    const struct suscan_mq_ring_mark *mark,
+    const struct timespec *deadline)
+{
+  struct timespec rem;
+  uint32_t seq = __atomic_load_n(&mq->wake_seq, __ATOMIC_SEQ_CST);
+
+  if (deadline != NULL && !suscan_mq_get_remaining(deadline, &rem))
+    return SU_FALSE;
+
+  __atomic_add_fetch(&mq->sleepers, 1, __ATOMIC_SEQ_CST);
+  __atomic_thread_fence(__ATOMIC_SEQ_CST);
+
+#ifdef SUSCAN_MQ_USE_FUTEX
+  if (!suscan_mq_ring_has_news(mq, mark))
+    (void) syscall(
+        SYS_futex,
+        &mq->wake_seq,
+        FUTEX_WAIT_PRIVATE,
+        seq,
+        deadline != NULL ? &rem : NULL,
+        NULL,
+        0);
+#else
+  suscan_mq_enter(mq);
+  while (!suscan_mq_ring_has_news(mq, mark)
+      && __atomic_load_n(&mq->wake_seq, __ATOMIC_SEQ_CST) == seq) {
+    if (deadline == NULL)
+      suscan_mq_wait_unsafe(mq);
+    else if (pthread_cond_timedwait(
+        &mq->acquire_cond,
+        &mq->acquire_lock,
+        deadline) == ETIMEDOUT)
+      break;
+  }
+  suscan_mq_leave(mq);
+#endif /* SUSCAN_MQ_USE_FUTEX */
+
+  __atomic_sub_fetch(&mq->sleepers, 1, __ATOMIC_SEQ_CST);
+
+  return SU_TRUE;
+}
+
+SUPRIVATE void
+suscan_mq_ring_release_tail(struct suscan_mq *mq, struct suscan_mq_slot *slot)
+{
+  __atomic_store_n(
+      &slot->seq,
+      mq->ring_tail + mq->ring_mask + 1,
+      __ATOMIC_RELEASE);
+  ++mq->ring_tail;
+}
+
+/* Must be called with acquire_lock held */
+SUPRIVATE SUBOOL
+suscan_mq_ring_pop_slot(
+    struct suscan_mq *mq,
+    SUBOOL with_type,
+    uint32_t type,
+    uint32_t *ptype,
+    void **private,
+    uint64_t *scan_end)
+{
+  struct suscan_mq_slot *slot;
+  uint64_t pos;
+
+  for (pos = mq->ring_tail; ; ++pos) {
+    slot = mq->slots + (pos & mq->ring_mask);
+
+    if (__atomic_load_n(&slot->seq, __ATOMIC_ACQUIRE) != pos + 1) {
+      *scan_end = pos;
+      return SU_FALSE;
+    }
+
+    if (slot->dead) {
+      if (pos == mq->ring_tail)
+        suscan_mq_ring_release_tail(mq, slot);
+      continue;
+    }
+
+    if (!with_type || slot->type == type) {
+      *ptype = slot->type;
+      *private = slot->privdata;
+
+      suscan_mq_account_pop(mq, slot->type);
+
+      if (pos == mq->ring_tail)
+        suscan_mq_ring_release_tail(mq, slot);
+      else
+        slot->dead = SU_TRUE;
+
+      return SU_TRUE;
+    }
+  }
+}
+
+/*
+ * Overflowed messages may only be taken once no slot is claimed but still
+ * unpublished: such a slot may hold an older message of a writer whose
+ * next message spilled to the overflow list. The publish wakes us up.
+ */
+SUPRIVATE SUBOOL
+suscan_mq_ring_overflow_ready(const struct suscan_mq *mq, uint64_t scan_end)
+{
+  return mq->overflow_count > 0
+      && scan_end == __atomic_load_n(&mq->ring_head, __ATOMIC_ACQUIRE);
+}
+
+/*
+ * Urgent messages go first, then the ring, then whatever overflowed
+ * once everything claimed in the ring has been published and read.
+ */
+SUPRIVATE SUBOOL
+suscan_mq_ring_poll(
+    struct suscan_mq *mq,
+    SUBOOL with_type,
+    uint32_t type,
+    uint32_t *ptype,
+    void **private,
+    struct suscan_mq_ring_mark *mark)
+{
+  struct suscan_msg *msg = NULL;
+  uint64_t scan_end;
+  SUBOOL ok = SU_TRUE;
+
+  suscan_mq_enter(mq);
+
+  if (mq->urgent_count > 0) {
+    msg = with_type ? suscan_mq_pop_w_type(mq, type) : suscan_mq_pop(mq);
+    if (msg != NULL)
+      __atomic_sub_fetch(&mq->urgent_count, 1, __ATOMIC_RELAXED);
+  }
+
+  if (msg == NULL
+      && suscan_mq_ring_pop_slot(
+          mq,
+          with_type,
+          type,
+          ptype,
+          private,
+          &scan_end))
+    goto done;
+
+  if (msg == NULL && suscan_mq_ring_overflow_ready(mq, scan_end)) {
+    msg = with_type
+        ? suscan_mq_list_pop_w_type(
+            &mq->overflow_head,
+            &mq->overflow_tail,
+            type)
+        : suscan_mq_list_pop(&mq->overflow_head, &mq->overflow_tail);
+    if (msg != NULL)
+      __atomic_sub_fetch(&mq->overflow_count, 1, __ATOMIC_RELEASE);
+  }
+
+  if (msg != NULL) {
+    *ptype = msg->type;
+    *private = msg->privdata;
+    suscan_mq_account_pop(mq, msg->type);
+  } else {
+    if (mark != NULL) {
+      mark->scan_end = scan_end;
+      mark->urgent_count = mq->urgent_count;
+      mark->overflow_count = mq->overflow_count;
+    }
+    ok = SU_FALSE;
+  }
+
+done:
+  suscan_mq_leave(mq);
+
+  if (msg != NULL)
+    suscan_msg_destroy(msg);
+
+  return ok;
+}
+
+SUPRIVATE void
+suscan_mq_ring_read(
+    struct suscan_mq *mq,
+    SUBOOL with_type,
+    uint32_t type,
+    uint32_t *ptype,
+    void **private)
+{
+  struct suscan_mq_ring_mark mark;
+
+  while (!suscan_mq_ring_poll(mq, with_type, type, ptype, private, &mark))
+    (void) suscan_mq_ring_sleep(mq, &mark, NULL);
+}
+
+/* Drains up to max messages in a single sweep */
+SUPRIVATE unsigned int
+suscan_mq_ring_poll_batch(
+    struct suscan_mq *mq,
+    struct suscan_msg *msgs,
+    unsigned int max,
+    struct suscan_mq_ring_mark *mark)
+{
+  struct suscan_msg *msg, *chain = NULL;
+  uint64_t scan_end = 0;
+  unsigned int n = 0;
+
+  suscan_mq_enter(mq);
+
+  while (n < max && mq->urgent_count > 0) {
+    msg = suscan_mq_pop(mq);
+    __atomic_sub_fetch(&mq->urgent_count, 1, __ATOMIC_RELAXED);
+    suscan_mq_account_pop(mq, msg->type);
+    msgs[n].type = msg->type;
+    msgs[n++].privdata = msg->privdata;
+    msg->next = chain;
+    chain = msg;
+  }
+
+  while (n < max
+      && suscan_mq_ring_pop_slot(
+          mq,
+          SU_FALSE,
+          0,
+          &msgs[n].type,
+          &msgs[n].privdata,
+          &scan_end))
+    ++n;
+
+  while (n < max
+      && suscan_mq_ring_overflow_ready(mq, scan_end)
+      && (msg = suscan_mq_list_pop(&mq->overflow_head, &mq->overflow_tail))
+      != NULL) {
+    __atomic_sub_fetch(&mq->overflow_count, 1, __ATOMIC_RELEASE);
+    suscan_mq_account_pop(mq, msg->type);
+    msgs[n].type = msg->type;
+    msgs[n++].privdata = msg->privdata;
+    msg->next = chain;
+    chain = msg;
+  }
+
+  if (n == 0) {
+    mark->scan_end = scan_end;
+    mark->urgent_count = mq->urgent_count;
+    mark->overflow_count = mq->overflow_count;
+  }
+
+  suscan_mq_leave(mq);
+
+  suscan_mq_return_msg_chain(chain);
+
+  return n;
+}
+
+/* msg is either NULL or a message to recycle */
+SUPRIVATE SUBOOL
+suscan_mq_ring_write(
+    struct suscan_mq *mq,
+    uint32_t type,
+    void *private,
+    struct suscan_msg *msg)
+{
+  unsigned int retries = SUSCAN_MQ_RING_FULL_RETRIES;
+  SUBOOL pushed = SU_FALSE;
+
+  /* Once something overflows, keep writing there until it drains */
+  while (__atomic_load_n(&mq->overflow_count, __ATOMIC_ACQUIRE) == 0) {
+    if ((pushed = suscan_mq_ring_push(mq, type, private)) || retries-- == 0)
+      break;
+
+    /* Full: give the reader a chance before spilling */
+    suscan_mq_ring_wake(mq);
+    sched_yield();
+  }
+
+  if (pushed) {
+    if (msg != NULL)
+      suscan_msg_destroy(msg);
+  } else {
+    if (msg == NULL)
+      SU_TRYCATCH(msg = suscan_msg_new(type, private), return SU_FALSE);
+
+    suscan_mq_enter(mq);
+    suscan_mq_list_push(&mq->overflow_head, &mq->overflow_tail, msg);
+    __atomic_add_fetch(&mq->overflow_count, 1, __ATOMIC_RELEASE);
+    ++mq->overflows;
+    suscan_mq_leave(mq);
+  }
+
+  suscan_mq_ring_wake(mq);
+
+  return SU_TRUE;
+}
+
+SUPRIVATE void
+suscan_mq_ring_write_urgent(struct suscan_mq *mq, struct suscan_msg *msg)
+{
+  suscan_mq_enter(mq);
+  suscan_mq_push_front(mq, msg);
+  __atomic_add_fetch(&mq->urgent_count, 1, __ATOMIC_RELAXED);
+  suscan_mq_leave(mq);
+
+  suscan_mq_ring_wake(mq);
+}
+
+SUPRIVATE void
+suscan_mq_ring_wait(struct suscan_mq *mq)
+{
+  struct suscan_mq_ring_mark mark;
+
+  suscan_mq_enter(mq);
+  mark.scan_end = mq->ring_tail;
+  mark.urgent_count = 0;
+  mark.overflow_count = 0;
+  suscan_mq_leave(mq);
+
+  (void) suscan_mq_ring_sleep(mq, &mark, NULL);
+}
+
+SUPRIVATE void
+suscan_mq_ring_finalize(struct suscan_mq *mq)
+{
+  struct suscan_msg *msg;
+
+  while ((msg = suscan_mq_list_pop(&mq->overflow_head, &mq->overflow_tail))
+      != NULL)
+    suscan_msg_destroy(msg);
+
+  if (mq->overflows > 0)
+    SU_WARNING(
+        "%lu messages overflowed a ring of %lu slots\n",
+        (unsigned long) mq->overflows,
+        (unsigned long) mq->ring_mask + 1);
+
+  if (mq->slots != NULL)
+    free(mq->slots);
+}
+
+SUPRIVATE SUBOOL
+suscan_mq_ring_init(struct suscan_mq *mq, unsigned int size)
+{
+  uint64_t i, actual = 1;
+
+  if (size == 0)
+    size = SUSCAN_MQ_RING_DEFAULT_SIZE;
+
+  while (actual < size)
+    actual <<= 1;
+
+  SU_TRYCATCH(
+      mq->slots = calloc(actual, sizeof(struct suscan_mq_slot)),
+      return SU_FALSE);
+
+  for (i = 0; i < actual; ++i)
+    mq->slots[i].seq = i;
+
+  mq->ring_mask = actual - 1;
+
+  return SU_TRUE;
+}
+
+/**************************** Backpressure policies **************************/
+SUPRIVATE SUBOOL
+suscan_mq_take_oldest(struct suscan_mq *mq, uint32_t type, void **private)
+{
+  struct suscan_msg *msg;
+
+  if (mq->backend == SUSCAN_MQ_BACKEND_RING)
+    return suscan_mq_ring_poll(mq, SU_TRUE, type, &type, private, NULL);
+
+  suscan_mq_enter(mq);
+
+  if ((msg = suscan_mq_pop_w_type(mq, type)) != NULL)
+    suscan_mq_account_pop(mq, type);
+
+  suscan_mq_leave(mq);
+
+  if (msg == NULL)
+    return SU_FALSE;
+
+  *private = msg->privdata;
+  suscan_msg_destroy(msg);
+
+  return SU_TRUE;
+}
+
+/*
+ * Walks the payloads of all pending messages of a type, in reading order,
+ * until func returns SU_TRUE. Must be called with acquire_lock held: the
+ * reader cannot take any of them meanwhile, and published ring slots are
+ * not recycled until the tail moves past them.
+ */
+typedef SUBOOL (*suscan_mq_visit_func_t) (void **privdata, void *userdata);
+
+SUPRIVATE SUBOOL
+suscan_mq_foreach_pending_unsafe(
+    struct suscan_mq *mq,
+    uint32_t type,
+    suscan_mq_visit_func_t func,
+    void *userdata)
+{
+  struct suscan_msg *this;
+  struct suscan_mq_slot *slot;
+  uint64_t pos;
+
+  for (this = mq->head; this != NULL; this = this->next)
+    if (this->type == type && (func) (&this->privdata, userdata))
+      return SU_TRUE;
+
+  if (mq->backend == SUSCAN_MQ_BACKEND_RING) {
+    for (pos = mq->ring_tail; ; ++pos) {
+      slot = mq->slots + (pos & mq->ring_mask);
+      if (__atomic_load_n(&slot->seq, __ATOMIC_ACQUIRE) != pos + 1)
+        break;
+      if (!slot->dead
+          && slot->type == type
+          && (func) (&slot->privdata, userdata))
+        return SU_TRUE;
+    }
+
+    for (this = mq->overflow_head; this != NULL; this = this->next)
+      if (this->type == type && (func) (&this->privdata, userdata))
+        return SU_TRUE;
+  }
+
+  return SU_FALSE;
+}
+
+SUPRIVATE SUBOOL
+suscan_mq_remember_payload(void **privdata, void *userdata)
+{
+  *(void ***) userdata = privdata;
+
+  return SU_FALSE;
+}
+
+/* Replaces the payload of the newest pending message of this type */
+SUPRIVATE SUBOOL
+suscan_mq_swap_newest(
+    struct suscan_mq *mq,
+    uint32_t type,
+    void *private,
+    void **old)
+{
+  void **last = NULL;
+
+  suscan_mq_enter(mq);
+
+  (void) suscan_mq_foreach_pending_unsafe(
+      mq,
+      type,
+      suscan_mq_remember_payload,
+      &last);
+
+  if (last != NULL) {
+    *old = *last;
+    *last = private;
+  }
+
+  suscan_mq_leave(mq);
+
+  return last != NULL;
+}
+
+struct suscan_mq_coalesce_ctx {
+  suscan_mq_coalesce_func_t func;
+  void *userdata;
+};
+
+SUPRIVATE SUBOOL
+suscan_mq_coalesce_payload(void **privdata, void *userdata)
+{
+  struct suscan_mq_coalesce_ctx *ctx =
+      (struct suscan_mq_coalesce_ctx *) userdata;
+
+  return (ctx->func) (*privdata, ctx->userdata);
+}
+
+SUBOOL
+suscan_mq_coalesce(
+    struct suscan_mq *mq,
+    uint32_t type,
+    suscan_mq_coalesce_func_t func,
+    void *userdata)
+{
+  struct suscan_mq_coalesce_ctx ctx;
+  SUBOOL found;
+
+  ctx.func = func;
+  ctx.userdata = userdata;
+
+  suscan_mq_enter(mq);
+  found = suscan_mq_foreach_pending_unsafe(
+      mq,
+      type,
+      suscan_mq_coalesce_payload,
+      &ctx);
+  suscan_mq_leave(mq);
+
+  return found;
+}
+
+SUPRIVATE void
+suscan_mq_drop(
+    struct suscan_mq *mq,
+    struct suscan_mq_policy *policy,
+    uint32_t type,
+    void *private)
+{
+  __atomic_add_fetch(&policy->dropped, 1, __ATOMIC_RELAXED);
+  __atomic_add_fetch(&mq->dropped, 1, __ATOMIC_RELAXED);
+
+  (mq->dispose) (type, private);
+}
+
+/*
+ * Takes one unit of the budget of a type, if there is any left. Check
+ * and increment are a single step, so concurrent writers cannot all
+ * pass the check and overshoot the budget.
+ */
+SUPRIVATE SUBOOL
+suscan_mq_reserve(struct suscan_mq_policy *policy)
+{
+  int pending = __atomic_load_n(&policy->pending, __ATOMIC_ACQUIRE);
+
+  do {
+    if (pending >= (int) policy->budget)
+      return SU_FALSE;
+  } while (!__atomic_compare_exchange_n(
+      &policy->pending,
+      &pending,
+      pending + 1,
+      SU_TRUE,
+      __ATOMIC_ACQ_REL,
+      __ATOMIC_ACQUIRE));
+
+  return SU_TRUE;
+}
+
+/*
+ * Enforces the budget of a type before queuing a message of it. Returns
+ * SU_FALSE if the policy consumed the message (it was either dropped or
+ * merged into a pending one), in which case it must not be queued.
+ */
+SUPRIVATE SUBOOL
+suscan_mq_admit(struct suscan_mq *mq, uint32_t type, void *private)
+{
+  struct suscan_mq_policy *policy;
+  SUBOOL reserved = SU_FALSE;
+  void *old;
+
+  if ((policy = suscan_mq_get_policy(mq, type)) == NULL)
+    return SU_TRUE;
+
+  if (suscan_mq_reserve(policy))
+    return SU_TRUE;
+
+  switch (policy->type) {
+    case SUSCAN_MQ_POLICY_BLOCK:
+      /* Woken writers race for the budget: only the winners get in */
+      suscan_mq_enter(mq);
+      ++mq->blocked_writers;
+      while (policy->type == SUSCAN_MQ_POLICY_BLOCK
+          && !(reserved = suscan_mq_reserve(policy)))
+        suscan_mq_wait_unsafe(mq);
+      --mq->blocked_writers;
+      suscan_mq_leave(mq);
+
+      if (reserved)
+        return SU_TRUE;
+      break;
+
+    case SUSCAN_MQ_POLICY_DROP_OLDEST:
+      while (suscan_mq_take_oldest(mq, type, &old)) {
+        suscan_mq_drop(mq, policy, type, old);
+        if (suscan_mq_reserve(policy))
+          return SU_TRUE;
+      }
+
+      /* Nothing left to evict: the reader already holds them */
+      break;
+
+    case SUSCAN_MQ_POLICY_DROP_NEWEST:
+      suscan_mq_drop(mq, policy, type, private);
+      return SU_FALSE;
+
+    case SUSCAN_MQ_POLICY_COALESCE:
+      if (suscan_mq_swap_newest(mq, type, private, &old)) {
+        suscan_mq_drop(mq, policy, type, old);
+        return SU_FALSE;
+      }
+      break;
+
+    default:
+      break;
+  }
+
+  /* Admitted over budget */
+  __atomic_add_fetch(&policy->pending, 1, __ATOMIC_RELAXED);
+
+  return SU_TRUE;
+}
+
+/* Gives back the budget of an admitted message that could not be queued */
+SUPRIVATE void
+suscan_mq_unadmit(struct suscan_mq *mq, uint32_t type)
+{
+  suscan_mq_enter(mq);
+  suscan_mq_account_pop(mq, type);
+  suscan_mq_leave(mq);
+}
+
+void
+suscan_mq_set_disposer(struct suscan_mq *mq, suscan_mq_dispose_func_t dispose)
+{
+  suscan_mq_enter(mq);
+  mq->dispose = dispose;
+  suscan_mq_leave(mq);
+}
+
+void
+suscan_mq_set_enqueue_histogram(
+    struct suscan_mq *mq,
+    struct suscan_histogram *hist)
+{
+  mq->enqueue_hist = hist;
+}
+
+SUBOOL
+suscan_mq_set_policy(
+    struct suscan_mq *mq,
+    uint32_t type,
+    enum suscan_mq_policy_type policy,
+    unsigned int budget)
+{
+  SUBOOL ok = SU_FALSE;
+
+  suscan_mq_enter(mq);
+
+  if (type >= SUSCAN_MQ_MAX_POLICY_TYPES) {
+    SU_ERROR("Message type 0x%x cannot have a queue policy\n", type);
+    goto done;
+  }
+
+  if (policy != SUSCAN_MQ_POLICY_NONE && budget == 0) {
+    SU_ERROR("Queue budgets must be positive\n");
+    goto done;
+  }
+
+  if (policy != SUSCAN_MQ_POLICY_NONE
+      && policy != SUSCAN_MQ_POLICY_BLOCK
+      && mq->dispose == NULL) {
+    SU_ERROR("Dropping queue policies require a message disposer\n");
+    goto done;
+  }
+
+  mq->policies[type].budget = budget;
+  __atomic_store_n(&mq->policies[type].type, policy, __ATOMIC_RELEASE);
+
+  /* Budget changes may unblock writers */
+  suscan_mq_notify(mq);
+
+  ok = SU_TRUE;
+
+done:
+  suscan_mq_leave(mq);
+
+  return ok;
+}
+
+uint64_t
+suscan_mq_get_dropped(const struct suscan_mq *mq, uint32_t type)
+{
+  if (type >= SUSCAN_MQ_MAX_POLICY_TYPES)
+    return 0;
+
+  return __atomic_load_n(&mq->policies[type].dropped, __ATOMIC_RELAXED);
+}
+
+uint64_t
+suscan_mq_get_dropped_total(const struct suscan_mq *mq)
+{
+  return __atomic_load_n(&mq->dropped, __ATOMIC_RELAXED);
+}
+
+void
+suscan_mq_wait(struct suscan_mq *mq)
+{
+  if (mq->backend == SUSCAN_MQ_BACKEND_RING) {
+    suscan_mq_ring_wait(mq);
+    return;
+  }
+
+  suscan_mq_enter(mq);
+
+  suscan_mq_wait_unsafe(mq);
+
+  suscan_mq_leave(mq);
+}
+
+unsigned int
+suscan_mq_read_batch(
+    struct suscan_mq *mq,
+    struct suscan_msg *msgs,
+    unsigned int max,
+    const struct timespec *timeout)
+{
+  struct suscan_mq_ring_mark mark;
+  struct timespec deadline;
+  struct suscan_msg *msg, *chain = NULL;
+  unsigned int i, n = 0;
+
+  if (max == 0)
+    return 0;
+
+  if (timeout != NULL)
+    suscan_mq_get_deadline(&deadline, timeout);
+
+  if (mq->backend == SUSCAN_MQ_BACKEND_RING) {
+    while ((n = suscan_mq_ring_poll_batch(mq, msgs, max, &mark)) == 0)
+      if (!suscan_mq_ring_sleep(
+          mq,
+          &mark,
+          timeout != NULL ? &deadline : NULL))
+        break;
+  } else {
+    suscan_mq_enter(mq);
+
+    while (mq->head == NULL) {
+      if (timeout == NULL)
+        suscan_mq_wait_unsafe(mq);
+      else if (pthread_cond_timedwait(
+          &mq->acquire_cond,
+          &mq->acquire_lock,
+          &deadline) == ETIMEDOUT)
+        break;
+    }
+
+    while (n < max && (msg = suscan_mq_pop(mq)) != NULL) {
+      suscan_mq_account_pop(mq, msg->type);
+      msgs[n].type = msg->type;
+      msgs[n++].privdata = msg->privdata;
+      msg->next = chain;
+      chain = msg;
+    }
+
+    suscan_mq_leave(mq);
+
+    suscan_mq_return_msg_chain(chain);
+  }
+
+  for (i = 0; i < n; ++i)
+    msgs[i].next = NULL;
+
+  return n;
+}
+
 SUPRIVATE struct suscan_msg *
 suscan_mq_read_msg_internal(
     struct suscan_mq *mq,
@@ -238,6 +1234,13 @@ suscan_mq_read_msg_internal(
     uint32_t type)
 {
   struct suscan_msg *msg;
+  uint32_t msg_type;
+  void *private;
+
+  if (mq->backend == SUSCAN_MQ_BACKEND_RING) {
+    suscan_mq_ring_read(mq, with_type, type, &msg_type, &private);
+    return suscan_msg_new(msg_type, private);
+  }
 
   suscan_mq_enter(mq);
 
@@ -248,6 +1251,8 @@ suscan_mq_read_msg_internal(
     while ((msg = suscan_mq_pop(mq)) == NULL)
       suscan_mq_wait_unsafe(mq);
 
+  suscan_mq_account_pop(mq, msg->type);
+
   suscan_mq_leave(mq);
 
   return msg;
@@ -262,6 +1267,16 @@ suscan_mq_read_internal(
   struct suscan_msg *msg;
   void *private;
 
+  if (mq->backend == SUSCAN_MQ_BACKEND_RING) {
+    suscan_mq_ring_read(
+        mq,
+        ptype == NULL,
+        type,
+        ptype == NULL ? &type : ptype,
+        &private);
+    return private;
+  }
+
   msg = suscan_mq_read_msg_internal(mq, ptype == NULL, type);
 
   private = msg->privdata;
@@ -302,6 +1317,14 @@ struct suscan_msg *
 suscan_mq_poll_msg_internal(struct suscan_mq *mq, SUBOOL with_type, uint32_t type)
 {
   struct suscan_msg *msg;
+  uint32_t msg_type;
+  void *private;
+
+  if (mq->backend == SUSCAN_MQ_BACKEND_RING) {
+    if (!suscan_mq_ring_poll(mq, with_type, type, &msg_type, &private, NULL))
+      return NULL;
+    return suscan_msg_new(msg_type, private);
+  }
 
   suscan_mq_enter(mq);
 
@@ -310,6 +1333,9 @@ suscan_mq_poll_msg_internal(struct suscan_mq *mq, SUBOOL with_type, uint32_t typ
   else
     msg = suscan_mq_pop(mq);
 
+  if (msg != NULL)
+    suscan_mq_account_pop(mq, msg->type);
+
   suscan_mq_leave(mq);
 
   return msg;
@@ -324,6 +1350,15 @@ suscan_mq_poll_internal(
 {
   struct suscan_msg *msg;
 
+  if (mq->backend == SUSCAN_MQ_BACKEND_RING)
+    return suscan_mq_ring_poll(
+        mq,
+        ptype == NULL,
+        type,
+        ptype == NULL ? &type : ptype,
+        private,
+        NULL);
+
   msg = suscan_mq_poll_msg_internal(mq, ptype == NULL, type);
 
   if (msg != NULL) {
@@ -367,6 +1402,19 @@ suscan_mq_poll_msg_w_type(struct suscan_mq *mq, uint32_t type)
 void
 suscan_mq_write_msg(struct suscan_mq *mq, struct suscan_msg *msg)
 {
+  if (!suscan_mq_admit(mq, msg->type, msg->privdata)) {
+    suscan_msg_destroy(msg);
+    return;
+  }
+
+  if (mq->backend == SUSCAN_MQ_BACKEND_RING) {
+    if (!suscan_mq_ring_write(mq, msg->type, msg->privdata, msg)) {
+      suscan_mq_unadmit(mq, msg->type);
+      suscan_msg_destroy(msg);
+    }
+    return;
+  }
+
   suscan_mq_enter(mq);
 
   suscan_mq_push(mq, msg);
@@ -379,6 +1427,14 @@ suscan_mq_write_msg(struct suscan_mq *mq, struct suscan_msg *msg)
 void
 suscan_mq_write_msg_urgent(struct suscan_mq *mq, struct suscan_msg *msg)
 {
+  /* Urgent messages skip the budget, but they still count */
+  suscan_mq_account_push(mq, msg->type);
+
+  if (mq->backend == SUSCAN_MQ_BACKEND_RING) {
+    suscan_mq_ring_write_urgent(mq, msg);
+    return;
+  }
+
   suscan_mq_enter(mq);
 
   suscan_mq_push_front(mq, msg);
@@ -388,11 +1444,24 @@ suscan_mq_write_msg_urgent(struct suscan_mq *mq, struct suscan_msg *msg)
   suscan_mq_leave(mq);
 }
 
-SUBOOL
-suscan_mq_write(struct suscan_mq *mq, uint32_t type, void *private)
+SUPRIVATE SUBOOL
+suscan_mq_write_untimed(struct suscan_mq *mq, uint32_t type, void *private)
 {
   struct suscan_msg *msg;
 
+  /* No allocation at all, unless the ring overflows */
+  if (mq->backend == SUSCAN_MQ_BACKEND_RING) {
+    if (!suscan_mq_admit(mq, type, private))
+      return SU_TRUE;
+
+    if (!suscan_mq_ring_write(mq, type, private, NULL)) {
+      suscan_mq_unadmit(mq, type);
+      return SU_FALSE;
+    }
+
+    return SU_TRUE;
+  }
+
   if ((msg = suscan_msg_new(type, private)) == NULL)
     return SU_FALSE;
 
@@ -401,6 +1470,23 @@ suscan_mq_write(struct suscan_mq *mq, uint32_t type, void *private)
   return SU_TRUE;
 }
 
+SUBOOL
+suscan_mq_write(struct suscan_mq *mq, uint32_t type, void *private)
+{
+  uint64_t start;
+  SUBOOL ok;
+
+  if (mq->enqueue_hist == NULL)
+    return suscan_mq_write_untimed(mq, type, private);
+
+  /* Includes time spent blocked by SUSCAN_MQ_POLICY_BLOCK */
+  start = suscan_telemetry_now();
+  ok = suscan_mq_write_untimed(mq, type, private);
+  suscan_histogram_record(mq->enqueue_hist, suscan_telemetry_now() - start);
+
+  return ok;
+}
+
 SUBOOL
 suscan_mq_write_urgent(struct suscan_mq *mq, uint32_t type, void *private)
 {
@@ -424,21 +1510,44 @@ suscan_mq_finalize(struct suscan_mq *mq)
 
     while ((msg = suscan_mq_pop(mq)) != NULL)
       suscan_msg_destroy(msg);
+
+    if (mq->backend == SUSCAN_MQ_BACKEND_RING)
+      suscan_mq_ring_finalize(mq);
   }
 }
 
 SUBOOL
-suscan_mq_init(struct suscan_mq *mq)
+suscan_mq_init_ex(
+    struct suscan_mq *mq,
+    enum suscan_mq_backend backend,
+    unsigned int size)
 {
+  memset(mq, 0, sizeof(struct suscan_mq));
+
+  mq->backend = backend;
+
+  if (backend == SUSCAN_MQ_BACKEND_RING)
+    if (!suscan_mq_ring_init(mq, size))
+      return SU_FALSE;
+
   if (pthread_mutex_init(&mq->acquire_lock, NULL) == -1)
-    return SU_FALSE;
+    goto fail;
 
   if (pthread_cond_init(&mq->acquire_cond, NULL) == -1)
-    return SU_FALSE;
-
-  mq->head = NULL;
-  mq->tail = NULL;
+    goto fail;
 
   return SU_TRUE;
+
+fail:
+  if (mq->slots != NULL)
+    free(mq->slots);
+
+  return SU_FALSE;
+}
+
+SUBOOL
+suscan_mq_init(struct suscan_mq *mq)
+{
+  return suscan_mq_init_ex(mq, SUSCAN_MQ_BACKEND_LIST, 0);
 }
 
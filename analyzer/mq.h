@@ -25,9 +25,13 @@
 extern "C" {
 #endif /* __cplusplus */
 
+#include <stdint.h>
+#include <time.h>
 #include <pthread.h>
 #include <sigutils/sigutils.h>
 
+#include "telemetry.h"
+
 #define SUSCAN_MQ_USE_POOL
 
 #define SUSCAN_MQ_POOL_WARNING_THRESHOLD 100
@@ -42,16 +46,100 @@ struct suscan_msg {
 #endif
 };
 
+#define SUSCAN_MQ_RING_DEFAULT_SIZE 1024
+#define SUSCAN_MQ_CACHE_LINE_SIZE   64
+#define SUSCAN_MQ_RING_FULL_RETRIES 8
+#define SUSCAN_MQ_MAX_POLICY_TYPES  32
+
+/*
+ * Per-type backpressure policies, applied when a type already has `budget'
+ * messages pending. Dropping policies need a disposer to release the
+ * payloads they discard. BLOCK must never be used on types the reader
+ * itself writes to the queue.
+ */
+enum suscan_mq_policy_type {
+  SUSCAN_MQ_POLICY_NONE,        /* Unbounded (default) */
+  SUSCAN_MQ_POLICY_BLOCK,       /* Writer waits for the reader */
+  SUSCAN_MQ_POLICY_DROP_OLDEST, /* Oldest pending message is discarded */
+  SUSCAN_MQ_POLICY_DROP_NEWEST, /* Incoming message is discarded */
+  SUSCAN_MQ_POLICY_COALESCE     /* Incoming payload replaces the newest one */
+};
+
+struct suscan_mq_policy {
+  enum suscan_mq_policy_type type;
+  unsigned int budget;
+  int          pending;
+  uint64_t     dropped;
+};
+
+typedef void (*suscan_mq_dispose_func_t) (uint32_t type, void *privdata);
+
+/*
+ * Message queue backends. The list backend is a mutex-protected linked
+ * list of pooled messages. The ring backend is a bounded multi-producer
+ * ring of embedded slots: writers never take a lock unless the ring is
+ * full (messages spill to an overflow list, preserving order) or the
+ * message is urgent, and the reader is only woken up if it is sleeping.
+ * Both backends are accessed through the same API.
+ */
+enum suscan_mq_backend {
+  SUSCAN_MQ_BACKEND_LIST,
+  SUSCAN_MQ_BACKEND_RING
+};
+
+struct suscan_mq_slot {
+  uint64_t seq;
+  uint32_t type;
+  SUBOOL   dead; /* Already read out of order by a typed read */
+  void    *privdata;
+};
+
 struct suscan_mq {
+  enum suscan_mq_backend backend;
+
   pthread_mutex_t acquire_lock;
   pthread_cond_t  acquire_cond;
 
+  /* List backend. Urgent messages in the ring backend. */
   struct suscan_msg *head;
   struct suscan_msg *tail;
+
+  /* Ring backend */
+  struct suscan_mq_slot *slots;
+  uint64_t ring_mask;
+  unsigned int urgent_count;
+  unsigned int overflow_count;
+  struct suscan_msg *overflow_head;
+  struct suscan_msg *overflow_tail;
+  uint64_t overflows; /* Messages that did not fit in the ring */
+
+  /* Backpressure */
+  struct suscan_mq_policy policies[SUSCAN_MQ_MAX_POLICY_TYPES];
+  suscan_mq_dispose_func_t dispose;
+  unsigned int blocked_writers;
+  uint64_t dropped;
+
+  /* If set, suscan_mq_write times itself here */
+  struct suscan_histogram *enqueue_hist;
+
+  /* Written by readers, keep them away from the producer counter */
+  char     pad0[SUSCAN_MQ_CACHE_LINE_SIZE];
+  uint64_t ring_tail;
+  unsigned int sleepers; /* Readers waiting for messages */
+  uint32_t wake_seq;     /* Futex word */
+  char     pad1[SUSCAN_MQ_CACHE_LINE_SIZE];
+  uint64_t ring_head;
+  char     pad2[SUSCAN_MQ_CACHE_LINE_SIZE];
 };
 
 /*************************** Message queue API *******************************/
 SUBOOL suscan_mq_init(struct suscan_mq *mq);
+
+/* size is rounded up to a power of two. 0 selects the default */
+SUBOOL suscan_mq_init_ex(
+    struct suscan_mq *mq,
+    enum suscan_mq_backend backend,
+    unsigned int size);
 void   suscan_mq_finalize(struct suscan_mq *mq);
 void  *suscan_mq_read(struct suscan_mq *mq, uint32_t *type);
 void  *suscan_mq_read_w_type(struct suscan_mq *mq, uint32_t type);
@@ -62,12 +150,61 @@ SUBOOL suscan_mq_poll_w_type(struct suscan_mq *mq, uint32_t type, void **privdat
 struct suscan_msg *suscan_mq_poll_msg(struct suscan_mq *mq);
 struct suscan_msg *suscan_mq_poll_msg_w_type(struct suscan_mq *mq, uint32_t type);
 SUBOOL suscan_mq_write(struct suscan_mq *mq, uint32_t type, void *privdata);
+
+/*
+ * Moves up to max pending messages into msgs (only type and privdata are
+ * meaningful) in a single lock acquisition. Blocks until at least one
+ * message is available, or until timeout (relative) expires. A zero
+ * timeout polls. Returns the number of messages read.
+ */
+unsigned int suscan_mq_read_batch(
+    struct suscan_mq *mq,
+    struct suscan_msg *msgs,
+    unsigned int max,
+    const struct timespec *timeout);
 void   suscan_mq_wait(struct suscan_mq *mq);
 SUBOOL suscan_mq_write_urgent(struct suscan_mq *mq, uint32_t type, void *privdata);
 void suscan_mq_write_msg(struct suscan_mq *mq, struct suscan_msg *msg);
 void suscan_mq_write_msg_urgent(struct suscan_mq *mq, struct suscan_msg *msg);
 void suscan_msg_destroy(struct suscan_msg *msg);
 
+/*
+ * Policies should be set before any message of that type is written.
+ * A budget of 0 is only valid for SUSCAN_MQ_POLICY_NONE.
+ */
+void suscan_mq_set_disposer(
+    struct suscan_mq *mq,
+    suscan_mq_dispose_func_t dispose);
+SUBOOL suscan_mq_set_policy(
+    struct suscan_mq *mq,
+    uint32_t type,
+    enum suscan_mq_policy_type policy,
+    unsigned int budget);
+uint64_t suscan_mq_get_dropped(const struct suscan_mq *mq, uint32_t type);
+uint64_t suscan_mq_get_dropped_total(const struct suscan_mq *mq);
+
+/* Must not change while writers are active. NULL disables timing */
+void suscan_mq_set_enqueue_histogram(
+    struct suscan_mq *mq,
+    struct suscan_histogram *hist);
+
+/*
+ * Latest-value coalescing. func is called, under the queue lock, on the
+ * payload of each unread message of this type until it returns SU_TRUE,
+ * meaning that it recognized the message as a stale version of userdata
+ * and refreshed it in place. The message keeps its position in the queue
+ * and is not counted as dropped. Returns SU_FALSE if no message was
+ * refreshed, in which case userdata should be written as usual. func must
+ * be quick and must not touch the queue.
+ */
+typedef SUBOOL (*suscan_mq_coalesce_func_t) (void *privdata, void *userdata);
+
+SUBOOL suscan_mq_coalesce(
+    struct suscan_mq *mq,
+    uint32_t type,
+    suscan_mq_coalesce_func_t func,
+    void *userdata);
+
 #ifdef __cplusplus
 }
 #endif /* __cplusplus */
@@ -26,10 +26,12 @@
 #include <libgen.h>
 #include <pthread.h>
 #include <stdint.h>
+#include <limits.h>
 #include <pthread.h>
 
 #define SU_LOG_DOMAIN "msg"
 
+#include "bufpool.h"
 #include "mq.h"
 #include "msg.h"
 #include "source.h"
@@ -164,9 +166,17 @@ SUFLOAT *
 suscan_analyzer_inspector_msg_take_spectrum(
     struct suscan_analyzer_inspector_msg *msg)
 {
-  SUFLOAT *result = msg->spectrum_data;
-
-  msg->spectrum_data = NULL;
+  SUFLOAT *result = NULL;
+
+  /* Callers release it with free(), so it cannot stay in the pool */
+  if (msg->spectrum_data != NULL) {
+    SU_TRYCATCH(
+        result = malloc(msg->spectrum_size * sizeof(SUFLOAT)),
+        return NULL);
+    memcpy(result, msg->spectrum_data, msg->spectrum_size * sizeof(SUFLOAT));
+    suscan_pool_free(msg->spectrum_data);
+    msg->spectrum_data = NULL;
+  }
 
   return result;
 }
@@ -190,7 +200,7 @@ suscan_analyzer_inspector_msg_destroy(struct suscan_analyzer_inspector_msg *msg)
       free(msg->class_name);
   } else if (msg->kind == SUSCAN_ANALYZER_INSPECTOR_MSGKIND_SPECTRUM) {
     if (msg->spectrum_data != NULL)
-      free(msg->spectrum_data);
+      suscan_pool_free(msg->spectrum_data);
   }
 
   free(msg);
@@ -200,45 +210,63 @@ void
 suscan_analyzer_psd_msg_destroy(struct suscan_analyzer_psd_msg *msg)
 {
   if (msg->psd_data != NULL)
-    free(msg->psd_data);
+    suscan_pool_free(msg->psd_data);
 
   free(msg);
 }
 
-struct suscan_analyzer_psd_msg *
-suscan_analyzer_psd_msg_new(const su_channel_detector_t *cd)
+/* Refills a PSD message, reusing its buffer if the size did not change */
+SUBOOL
+suscan_analyzer_psd_msg_update(
+    struct suscan_analyzer_psd_msg *msg,
+    const su_channel_detector_t *cd)
 {
-  struct suscan_analyzer_psd_msg *new = NULL;
+  SUFLOAT *psd_data;
   unsigned int i;
-  SU_TRYCATCH(
-      new = calloc(1, sizeof(struct suscan_analyzer_psd_msg)),
-      goto fail);
 
-  new->psd_size = cd->params.window_size;
-  new->samp_rate = cd->params.samp_rate;
+  if (msg->psd_data == NULL || msg->psd_size != cd->params.window_size) {
+    SU_TRYCATCH(
+        psd_data = suscan_pool_alloc(sizeof(SUFLOAT) * cd->params.window_size),
+        return SU_FALSE);
+    suscan_pool_free(msg->psd_data);
+    msg->psd_data = psd_data;
+  }
 
-  if (cd->params.decimation > 1)
-    new->samp_rate /= cd->params.decimation;
+  msg->psd_size = cd->params.window_size;
+  msg->samp_rate = cd->params.samp_rate;
 
-  new->fc = 0;
+  if (cd->params.decimation > 1)
+    msg->samp_rate /= cd->params.decimation;
 
-  SU_TRYCATCH(
-      new->psd_data = malloc(sizeof(SUFLOAT) * new->psd_size),
-      goto fail);
+  msg->fc = 0;
 
   switch (cd->params.mode) {
     case SU_CHANNEL_DETECTOR_MODE_AUTOCORRELATION:
-      for (i = 0; i < new->psd_size; ++i)
-        new->psd_data[i] = SU_C_REAL(cd->fft[i]);
+      for (i = 0; i < msg->psd_size; ++i)
+        msg->psd_data[i] = SU_C_REAL(cd->fft[i]);
       break;
 
     default:
-      for (i = 0; i < new->psd_size; ++i) {
-        new->psd_data[i] = SU_C_REAL(cd->fft[i] * SU_C_CONJ(cd->fft[i]));
-        new->psd_data[i] /= cd->params.window_size;;
+      for (i = 0; i < msg->psd_size; ++i) {
+        msg->psd_data[i] = SU_C_REAL(cd->fft[i] * SU_C_CONJ(cd->fft[i]));
+        msg->psd_data[i] /= cd->params.window_size;;
       }
   }
 
+  return SU_TRUE;
+}
+
+struct suscan_analyzer_psd_msg *
+suscan_analyzer_psd_msg_new(const su_channel_detector_t *cd)
+{
+  struct suscan_analyzer_psd_msg *new = NULL;
+
+  SU_TRYCATCH(
+      new = calloc(1, sizeof(struct suscan_analyzer_psd_msg)),
+      goto fail);
+
+  SU_TRYCATCH(suscan_analyzer_psd_msg_update(new, cd), goto fail);
+
   return new;
 
 fail:
@@ -251,9 +279,17 @@ fail:
 SUFLOAT *
 suscan_analyzer_psd_msg_take_psd(struct suscan_analyzer_psd_msg *msg)
 {
-  SUFLOAT *result = msg->psd_data;
-
-  msg->psd_data = NULL;
+  SUFLOAT *result = NULL;
+
+  /* Callers release it with free(), so it cannot stay in the pool */
+  if (msg->psd_data != NULL) {
+    SU_TRYCATCH(
+        result = malloc(msg->psd_size * sizeof(SUFLOAT)),
+        return NULL);
+    memcpy(result, msg->psd_data, msg->psd_size * sizeof(SUFLOAT));
+    suscan_pool_free(msg->psd_data);
+    msg->psd_data = NULL;
+  }
 
   return result;
 }
@@ -271,7 +307,7 @@ suscan_analyzer_sample_batch_msg_new(
       goto fail);
 
   SU_TRYCATCH(
-      new->samples = malloc(count * sizeof(SUCOMPLEX)),
+      new->samples = suscan_buffer_alloc(count),
       goto fail);
 
   memcpy(new->samples, samples, count * sizeof(SUCOMPLEX));
@@ -288,12 +324,89 @@ fail:
   return NULL;
 }
 
+struct suscan_analyzer_sample_batch_msg *
+suscan_analyzer_sample_batch_msg_new_from_buffer(
+    uint32_t inspector_id,
+    SUCOMPLEX *samples,
+    SUSCOUNT count)
+{
+  struct suscan_analyzer_sample_batch_msg *new = NULL;
+
+  SU_TRYCATCH(
+      new = calloc(1, sizeof(struct suscan_analyzer_sample_batch_msg)),
+      return NULL);
+
+  new->samples = samples;
+  new->sample_count = count;
+  new->inspector_id = inspector_id;
+
+  return new;
+}
+
+SUCOMPLEX *
+suscan_analyzer_sample_batch_msg_take_samples(
+    struct suscan_analyzer_sample_batch_msg *msg)
+{
+  SUCOMPLEX *result = msg->samples;
+
+  msg->samples = NULL;
+
+  return result;
+}
+
 void
 suscan_analyzer_sample_batch_msg_destroy(
     struct suscan_analyzer_sample_batch_msg *msg)
 {
   if (msg->samples != NULL)
-    free(msg->samples);
+    suscan_buffer_return(msg->samples);
+
+  free(msg);
+}
+
+struct suscan_analyzer_telemetry_msg *
+suscan_analyzer_telemetry_msg_new(
+    unsigned int inspector_count,
+    unsigned int worker_count)
+{
+  struct suscan_analyzer_telemetry_msg *new = NULL;
+
+  SU_TRYCATCH(
+      new = calloc(1, sizeof(struct suscan_analyzer_telemetry_msg)),
+      goto fail);
+
+  if (inspector_count > 0)
+    SU_TRYCATCH(
+        new->inspector_list = calloc(
+            inspector_count,
+            sizeof(struct suscan_analyzer_telemetry_inspector)),
+        goto fail);
+
+  if (worker_count > 0)
+    SU_TRYCATCH(
+        new->worker_cpu_list = calloc(worker_count, sizeof(SUFLOAT)),
+        goto fail);
+
+  new->worker_cpu_count = worker_count;
+
+  return new;
+
+fail:
+  if (new != NULL)
+    suscan_analyzer_telemetry_msg_destroy(new);
+
+  return NULL;
+}
+
+void
+suscan_analyzer_telemetry_msg_destroy(
+    struct suscan_analyzer_telemetry_msg *msg)
+{
+  if (msg->inspector_list != NULL)
+    free(msg->inspector_list);
+
+  if (msg->worker_cpu_list != NULL)
+    free(msg->worker_cpu_list);
 
   free(msg);
 }
@@ -304,6 +417,8 @@ suscan_analyzer_dispose_message(uint32_t type, void *ptr)
   switch (type) {
     case SUSCAN_ANALYZER_MESSAGE_TYPE_SOURCE_INIT:
     case SUSCAN_ANALYZER_MESSAGE_TYPE_EOS:
+    case SUSCAN_ANALYZER_MESSAGE_TYPE_READ_ERROR:
+    case SUSCAN_ANALYZER_MESSAGE_TYPE_SAMPLES_LOST:
       suscan_analyzer_status_msg_destroy(ptr);
       break;
 
@@ -326,9 +441,53 @@ suscan_analyzer_dispose_message(uint32_t type, void *ptr)
     case SUSCAN_ANALYZER_MESSAGE_TYPE_THROTTLE:
       free(ptr);
       break;
+
+    case SUSCAN_ANALYZER_MESSAGE_TYPE_TELEMETRY:
+      suscan_analyzer_telemetry_msg_destroy(ptr);
+      break;
   }
 }
 
+/*
+ * Coalescing callbacks. Both messages swap contents, so that the fresh
+ * one takes the place of the unread one and the caller gets the stale
+ * buffers back for the next frame.
+ */
+SUPRIVATE SUBOOL
+suscan_analyzer_psd_msg_coalesce(void *pending, void *fresh)
+{
+  struct suscan_analyzer_psd_msg *old = pending;
+  struct suscan_analyzer_psd_msg *new = fresh;
+  struct suscan_analyzer_psd_msg tmp;
+
+  if (old->inspector_id != new->inspector_id)
+    return SU_FALSE;
+
+  tmp  = *old;
+  *old = *new;
+  *new = tmp;
+
+  return SU_TRUE;
+}
+
+SUBOOL
+suscan_analyzer_inspector_msg_coalesce_spectrum(void *pending, void *fresh)
+{
+  struct suscan_analyzer_inspector_msg *old = pending;
+  struct suscan_analyzer_inspector_msg *new = fresh;
+  struct suscan_analyzer_inspector_msg tmp;
+
+  if (old->kind != SUSCAN_ANALYZER_INSPECTOR_MSGKIND_SPECTRUM
+      || old->inspector_id != new->inspector_id)
+    return SU_FALSE;
+
+  tmp  = *old;
+  *old = *new;
+  *new = tmp;
+
+  return SU_TRUE;
+}
+
 /****************************** Sender methods *******************************/
 SUBOOL
 suscan_analyzer_send_status(
@@ -369,6 +528,33 @@ done:
   return ok;
 }
 
+/* Called from the source worker only (reported_drops, last_drops_report) */
+SUBOOL
+suscan_analyzer_send_output_drops(suscan_analyzer_t *self)
+{
+  uint64_t dropped = suscan_mq_get_dropped_total(self->mq_out);
+  uint64_t lost = dropped - self->reported_drops;
+
+  if (lost == 0)
+    return SU_TRUE;
+
+  self->reported_drops = dropped;
+  self->last_drops_report = suscan_telemetry_now();
+
+  return suscan_analyzer_send_status(
+      self,
+      SUSCAN_ANALYZER_MESSAGE_TYPE_SAMPLES_LOST,
+      lost > INT_MAX ? INT_MAX : (int) lost,
+      "Slow consumer: %lu messages dropped (%lu PSD, %lu sample batches)",
+      (unsigned long) lost,
+      (unsigned long) suscan_mq_get_dropped(
+          self->mq_out,
+          SUSCAN_ANALYZER_MESSAGE_TYPE_PSD),
+      (unsigned long) suscan_mq_get_dropped(
+          self->mq_out,
+          SUSCAN_ANALYZER_MESSAGE_TYPE_SAMPLES));
+}
+
 SUBOOL
 suscan_analyzer_send_detector_channels(
     suscan_analyzer_t *analyzer,
@@ -416,6 +602,10 @@ done:
   return ok;
 }
 
+/*
+ * Called from a single thread per analyzer, which owns psd_spare: the
+ * detector worker in channel mode, the source worker in wide mode.
+ */
 SUBOOL
 suscan_analyzer_send_psd(
     suscan_analyzer_t *self,
@@ -424,7 +614,18 @@ suscan_analyzer_send_psd(
   struct suscan_analyzer_psd_msg *msg = NULL;
   SUBOOL ok = SU_FALSE;
 
-  if ((msg = suscan_analyzer_psd_msg_new(detector)) == NULL) {
+  /* Reuse the frame we got back from the last coalescing, if any */
+  if ((msg = self->psd_spare) != NULL) {
+    self->psd_spare = NULL;
+    if (!suscan_analyzer_psd_msg_update(msg, detector)) {
+      suscan_analyzer_psd_msg_destroy(msg);
+      msg = NULL;
+    }
+  } else {
+    msg = suscan_analyzer_psd_msg_new(detector);
+  }
+
+  if (msg == NULL) {
     suscan_analyzer_send_status(
         self,
         SUSCAN_ANALYZER_MESSAGE_TYPE_INTERNAL,
@@ -441,6 +642,23 @@ suscan_analyzer_send_psd(
 
   msg->N0 = detector->N0;
 
+  suscan_telemetry_count(
+      &self->telemetry,
+      SUSCAN_TELEMETRY_COUNTER_PSD_FRAMES,
+      1);
+
+  /* Consumer lagging behind: overwrite the unread frame instead */
+  if (suscan_mq_coalesce(
+      self->mq_out,
+      SUSCAN_ANALYZER_MESSAGE_TYPE_PSD,
+      suscan_analyzer_psd_msg_coalesce,
+      msg)) {
+    self->psd_spare = msg;
+    msg = NULL;
+    ok = SU_TRUE;
+    goto done;
+  }
+
   if (!suscan_mq_write(
       self->mq_out,
       SUSCAN_ANALYZER_MESSAGE_TYPE_PSD,
@@ -465,3 +683,175 @@ done:
 
   return ok;
 }
+
+/* Summarizes what was recorded since the last call */
+SUPRIVATE void
+suscan_analyzer_telemetry_delta(
+    const struct suscan_histogram *hist,
+    struct suscan_histogram *last,
+    struct suscan_histogram_summary *summary)
+{
+  struct suscan_histogram current, delta;
+
+  suscan_histogram_load(hist, &current);
+
+  delta = current;
+  suscan_histogram_subtract(&delta, last);
+  suscan_histogram_summarize(&delta, summary);
+
+  *last = current;
+}
+
+/* Fraction of a core used since the last call */
+SUINLINE SUFLOAT
+suscan_analyzer_telemetry_cpu(uint64_t cpu, uint64_t *last, SUFLOAT interval)
+{
+  SUFLOAT usage = interval > 0 ? 1e-9 * (cpu - *last) / interval : 0;
+
+  *last = cpu;
+
+  return usage;
+}
+
+SUBOOL
+suscan_analyzer_send_telemetry(suscan_analyzer_t *self)
+{
+  struct suscan_analyzer_telemetry_msg *msg = NULL;
+  struct suscan_analyzer_telemetry_inspector *entry;
+  struct suscan_inspsched_worker *worker;
+  suscan_inspector_t *insp;
+  uint64_t now = suscan_telemetry_now();
+  uint64_t counter, cpu;
+  SUFLOAT interval = 1e-9 * (now - self->last_telemetry);
+  unsigned int i, j;
+  SUBOOL locked = SU_FALSE;
+  SUBOOL ok = SU_FALSE;
+
+  SU_TRYCATCH(suscan_analyzer_lock_inspector_list(self), goto done);
+  locked = SU_TRUE;
+
+  SU_TRYCATCH(
+      msg = suscan_analyzer_telemetry_msg_new(
+          self->inspector_count,
+          suscan_inspsched_get_num_workers(self->sched)),
+      goto done);
+
+  for (i = 0; i < self->inspector_count; ++i) {
+    insp = self->inspector_list[i];
+    if (insp == NULL || insp->state != SUSCAN_ASYNC_STATE_RUNNING)
+      continue;
+
+    entry = msg->inspector_list + msg->inspector_count++;
+    entry->inspector_id = insp->inspector_id;
+    entry->cpu_usage = suscan_analyzer_telemetry_cpu(
+        __atomic_load_n(&insp->telemetry.cpu_ns, __ATOMIC_RELAXED),
+        &insp->telemetry.cpu_last,
+        interval);
+
+    for (j = 0; j < SUSCAN_TELEMETRY_LOOP_COUNT; ++j)
+      suscan_analyzer_telemetry_delta(
+          &insp->telemetry.loop[j],
+          &insp->telemetry.last[j],
+          &entry->loop[j]);
+  }
+
+  suscan_analyzer_unlock_inspector_list(self);
+  locked = SU_FALSE;
+
+  for (i = 0; i < SUSCAN_TELEMETRY_STAGE_COUNT; ++i)
+    suscan_analyzer_telemetry_delta(
+        &self->telemetry.stage[i],
+        &self->telemetry_last.stage[i],
+        &msg->stage[i]);
+
+  for (i = 0; i < SUSCAN_TELEMETRY_COUNTER_COUNT; ++i) {
+    counter = __atomic_load_n(&self->telemetry.counter[i], __ATOMIC_RELAXED);
+    msg->counter[i] = counter - self->telemetry_last.counter[i];
+    self->telemetry_last.counter[i] = counter;
+  }
+
+  /* This runs in the source worker */
+  msg->source_cpu = suscan_analyzer_telemetry_cpu(
+      suscan_telemetry_thread_cpu_now(),
+      &self->telemetry_source_cpu,
+      interval);
+
+  if (suscan_worker_get_cpu_time(self->slow_wk, &cpu))
+    msg->slow_cpu = suscan_analyzer_telemetry_cpu(
+        cpu,
+        &self->telemetry_slow_cpu,
+        interval);
+
+  if (self->det_wk != NULL
+      && suscan_worker_get_cpu_time(self->det_wk, &cpu))
+    msg->detector_cpu = suscan_analyzer_telemetry_cpu(
+        cpu,
+        &self->telemetry_det_cpu,
+        interval);
+
+  msg->total_cpu = msg->source_cpu + msg->slow_cpu + msg->detector_cpu;
+
+  for (i = 0; i < msg->worker_cpu_count; ++i) {
+    worker = self->sched->worker_list[i];
+    if (suscan_inspsched_get_worker_cpu_time(self->sched, i, &cpu))
+      msg->worker_cpu_list[i] = suscan_analyzer_telemetry_cpu(
+          cpu,
+          &worker->telemetry_cpu_ns,
+          interval);
+    msg->total_cpu += msg->worker_cpu_list[i];
+  }
+
+  msg->interval = interval;
+  self->last_telemetry = now;
+
+  if (!suscan_mq_write(
+      self->mq_out,
+      SUSCAN_ANALYZER_MESSAGE_TYPE_TELEMETRY,
+      msg)) {
+    suscan_analyzer_send_status(
+        self,
+        SUSCAN_ANALYZER_MESSAGE_TYPE_INTERNAL,
+        -1,
+        "Cannot write message: %s",
+        strerror(errno));
+    goto done;
+  }
+
+  /* Message queued, forget about it */
+  msg = NULL;
+
+  ok = SU_TRUE;
+
+done:
+  if (locked)
+    suscan_analyzer_unlock_inspector_list(self);
+
+  if (msg != NULL)
+    suscan_analyzer_dispose_message(
+        SUSCAN_ANALYZER_MESSAGE_TYPE_TELEMETRY,
+        msg);
+
+  return ok;
+}
+
+SUBOOL
+suscan_analyzer_poll_output_drops(suscan_analyzer_t *self)
+{
+  if (1e-9 * (suscan_telemetry_now() - self->last_drops_report)
+      < SUSCAN_ANALYZER_DROPS_INTERVAL)
+    return SU_TRUE;
+
+  return suscan_analyzer_send_output_drops(self);
+}
+
+SUBOOL
+suscan_analyzer_poll_telemetry(suscan_analyzer_t *self)
+{
+  SUFLOAT interval = self->interval_telemetry;
+
+  if (interval <= 0
+      || 1e-9 * (suscan_telemetry_now() - self->last_telemetry) < interval)
+    return SU_TRUE;
+
+  return suscan_analyzer_send_telemetry(self);
+}
@@ -42,6 +42,7 @@ extern "C" {
 #define SUSCAN_ANALYZER_MESSAGE_TYPE_SAMPLES       0x9 /* Sample batch */
 #define SUSCAN_ANALYZER_MESSAGE_TYPE_THROTTLE      0xa /* Set throttle */
 #define SUSCAN_ANALYZER_MESSAGE_TYPE_PARAMS        0xb /* Analyzer params */
+#define SUSCAN_ANALYZER_MESSAGE_TYPE_TELEMETRY     0xc /* Pipeline timings */
 
 #define SUSCAN_ANALYZER_INIT_SUCCESS               0
 #define SUSCAN_ANALYZER_INIT_FAILURE              -1
@@ -82,6 +83,34 @@ struct suscan_analyzer_sample_batch_msg {
   unsigned int sample_count;
 };
 
+/* Loop timings and CPU usage of a running inspector */
+struct suscan_analyzer_telemetry_inspector {
+  uint32_t inspector_id;
+  SUFLOAT  cpu_usage; /* Fraction of a core */
+  struct suscan_histogram_summary loop[SUSCAN_TELEMETRY_LOOP_COUNT];
+};
+
+/*
+ * Pipeline telemetry. Everything refers to the last `interval' seconds
+ * only: counters are increments and summaries describe the latencies
+ * recorded since the previous report.
+ */
+struct suscan_analyzer_telemetry_msg {
+  SUFLOAT  interval;
+  uint64_t counter[SUSCAN_TELEMETRY_COUNTER_COUNT];
+  struct suscan_histogram_summary stage[SUSCAN_TELEMETRY_STAGE_COUNT];
+  struct suscan_analyzer_telemetry_inspector *inspector_list;
+  unsigned int inspector_count;
+
+  /* Thread CPU usage, as fractions of a core */
+  SUFLOAT  source_cpu;
+  SUFLOAT  slow_cpu;
+  SUFLOAT  detector_cpu;    /* Channel mode only */
+  SUFLOAT *worker_cpu_list; /* One per inspector scheduler worker */
+  unsigned int worker_cpu_count;
+  SUFLOAT  total_cpu;       /* All of the above */
+};
+
 /*
  * Channel inspector command. This is request-response: sample
  * updates are treated separately
@@ -141,6 +170,11 @@ struct suscan_analyzer_inspector_msg {
       SUFLOAT   N0;
     };
 
+    struct {
+      uint64_t cpu_time;  /* Worker CPU time spent so far, in ns */
+      SUFLOAT  cpu_usage; /* Fraction of a core since the previous INFO */
+    };
+
     SUSCOUNT watermark;
     struct suscan_analyzer_params params;
   };
@@ -177,6 +211,13 @@ SUBOOL suscan_analyzer_send_status(
     int code,
     const char *err_msg_fmt, ...);
 
+/*
+ * Source worker only. Emits a SAMPLES_LOST status if output messages
+ * were dropped, at most once every SUSCAN_ANALYZER_DROPS_INTERVAL.
+ */
+SUBOOL suscan_analyzer_send_output_drops(suscan_analyzer_t *analyzer);
+SUBOOL suscan_analyzer_poll_output_drops(suscan_analyzer_t *analyzer);
+
 SUBOOL suscan_analyzer_send_detector_channels(
     suscan_analyzer_t *analyzer,
     const su_channel_detector_t *detector);
@@ -185,6 +226,10 @@ SUBOOL suscan_analyzer_send_psd(
     suscan_analyzer_t *analyzer,
     const su_channel_detector_t *detector);
 
+/* Source worker only. Sends telemetry once every interval_telemetry */
+SUBOOL suscan_analyzer_send_telemetry(suscan_analyzer_t *analyzer);
+SUBOOL suscan_analyzer_poll_telemetry(suscan_analyzer_t *analyzer);
+
 /************************* Message parsing methods ***************************/
 SUBOOL suscan_analyzer_parse_inspector_msg(
     suscan_analyzer_t *analyzer,
@@ -213,6 +258,11 @@ struct suscan_analyzer_inspector_msg *suscan_analyzer_inspector_msg_new(
     enum suscan_analyzer_inspector_msgkind kind,
     uint32_t req_id);
 
+/* suscan_mq_coalesce callback for spectrum messages of the same inspector */
+SUBOOL suscan_analyzer_inspector_msg_coalesce_spectrum(
+    void *pending,
+    void *fresh);
+
 SUFLOAT *suscan_analyzer_inspector_msg_take_spectrum(
     struct suscan_analyzer_inspector_msg *msg);
 
@@ -222,6 +272,9 @@ void suscan_analyzer_inspector_msg_destroy(
 /* Spectrum update message */
 struct suscan_analyzer_psd_msg *suscan_analyzer_psd_msg_new(
     const su_channel_detector_t *cd);
+SUBOOL suscan_analyzer_psd_msg_update(
+    struct suscan_analyzer_psd_msg *msg,
+    const su_channel_detector_t *cd);
 
 SUFLOAT *suscan_analyzer_psd_msg_take_psd(struct suscan_analyzer_psd_msg *msg);
 
@@ -233,9 +286,28 @@ struct suscan_analyzer_sample_batch_msg *suscan_analyzer_sample_batch_msg_new(
     const SUCOMPLEX *samples,
     SUSCOUNT count);
 
+/* Takes ownership of a pooled buffer (see bufpool.h), no copy is made */
+struct suscan_analyzer_sample_batch_msg *
+suscan_analyzer_sample_batch_msg_new_from_buffer(
+    uint32_t inspector_id,
+    SUCOMPLEX *samples,
+    SUSCOUNT count);
+
+/* Release the result with suscan_buffer_return */
+SUCOMPLEX *suscan_analyzer_sample_batch_msg_take_samples(
+    struct suscan_analyzer_sample_batch_msg *msg);
+
 void suscan_analyzer_sample_batch_msg_destroy(
     struct suscan_analyzer_sample_batch_msg *msg);
 
+/* Telemetry message */
+struct suscan_analyzer_telemetry_msg *suscan_analyzer_telemetry_msg_new(
+    unsigned int inspector_count,
+    unsigned int worker_count);
+
+void suscan_analyzer_telemetry_msg_destroy(
+    struct suscan_analyzer_telemetry_msg *msg);
+
 /* Generic message disposer */
 void suscan_analyzer_dispose_message(uint32_t type, void *ptr);
 
@@ -0,0 +1,328 @@
+/*
+
+  Copyright (C) 2020 Gonzalo José Carracedo Carballal
+
+  This program is free software: you can redistribute it and/or modify
+  it under the terms of the GNU Lesser General Public License as
+  published by the Free Software Foundation, either version 3 of the
+  License, or (at your option) any later version.
+
+  This program is distributed in the hope that it will be useful, but
+  WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+  GNU Lesser General Public License for more details.
+
+  You should have received a copy of the GNU Lesser General Public
+  License along with this program.  If not, see
+  <http://www.gnu.org/licenses/>
+
+*/
+
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+
+#define SU_LOG_DOMAIN "pretrigger"
+
+#include <sigutils/sigutils.h>
+#include "pretrigger.h"
+
+SUPRIVATE void
+suscan_pretrigger_request_destroy(struct suscan_pretrigger_request *req)
+{
+  if (req->path != NULL)
+    free(req->path);
+
+  free(req);
+}
+
+SUPRIVATE SUBOOL
+suscan_pretrigger_wait(suscan_pretrigger_t *self, uint64_t past)
+{
+  pthread_mutex_lock(&self->mutex);
+  __atomic_store_n(&self->dumper_waiting, 1, __ATOMIC_SEQ_CST);
+  while (__atomic_load_n(&self->count, __ATOMIC_SEQ_CST) <= past
+      && !self->halt)
+    pthread_cond_wait(&self->cond, &self->mutex);
+  __atomic_store_n(&self->dumper_waiting, 0, __ATOMIC_RELAXED);
+  pthread_mutex_unlock(&self->mutex);
+
+  return __atomic_load_n(&self->count, __ATOMIC_SEQ_CST) > past;
+}
+
+SUPRIVATE SUBOOL
+suscan_pretrigger_dump(
+    suscan_pretrigger_t *self,
+    const struct suscan_pretrigger_request *req)
+{
+  FILE *fp = NULL;
+  uint64_t pos = req->start;
+  uint64_t avail;
+  SUSCOUNT chunk, offset, i;
+  SUBOOL ok = SU_FALSE;
+
+  if ((fp = fopen(req->path, "wb")) == NULL) {
+    SU_ERROR("Cannot open %s: %s\n", req->path, strerror(errno));
+    goto done;
+  }
+
+  while (pos < req->end) {
+    avail = __atomic_load_n(&self->count, __ATOMIC_SEQ_CST);
+
+    if (avail <= pos) {
+      /* Post-trigger samples not there yet */
+      if (!suscan_pretrigger_wait(self, pos))
+        break;
+      continue;
+    }
+
+    /* Too slow: skip what has already been overwritten */
+    if (avail - pos > self->size) {
+      self->lost += avail - pos - self->size;
+      pos = avail - self->size;
+    }
+
+    chunk = SU_MIN(avail, req->end) - pos;
+    if (chunk > SUSCAN_PRETRIGGER_DUMP_CHUNK)
+      chunk = SUSCAN_PRETRIGGER_DUMP_CHUNK;
+
+    offset = pos % self->size;
+    for (i = 0; i < chunk; ++i) {
+      self->chunk[2 * i]     = SU_C_REAL(self->ring[offset]);
+      self->chunk[2 * i + 1] = SU_C_IMAG(self->ring[offset]);
+      if (++offset == self->size)
+        offset = 0;
+    }
+
+    /*
+     * The producer may have lapped us while copying. The fence keeps the
+     * ring loads above from being satisfied after this one.
+     */
+    __atomic_thread_fence(__ATOMIC_ACQUIRE);
+    avail = __atomic_load_n(&self->reserve, __ATOMIC_SEQ_CST);
+    if (avail - pos > self->size) {
+      self->lost += chunk;
+      pos += chunk;
+      continue;
+    }
+
+    if (fwrite(self->chunk, 2 * sizeof(float), chunk, fp) < chunk) {
+      SU_ERROR("Failed to write to %s: %s\n", req->path, strerror(errno));
+      goto done;
+    }
+
+    pos += chunk;
+  }
+
+  ok = SU_TRUE;
+
+done:
+  if (fp != NULL)
+    fclose(fp);
+
+  return ok;
+}
+
+SUPRIVATE void *
+suscan_pretrigger_thread(void *data)
+{
+  suscan_pretrigger_t *self = (suscan_pretrigger_t *) data;
+  struct suscan_pretrigger_request *req;
+
+  for (;;) {
+    pthread_mutex_lock(&self->mutex);
+    while (self->queue_head == NULL && !self->halt)
+      pthread_cond_wait(&self->cond, &self->mutex);
+
+    if ((req = self->queue_head) != NULL) {
+      if ((self->queue_head = req->next) == NULL)
+        self->queue_tail = NULL;
+    }
+    pthread_mutex_unlock(&self->mutex);
+
+    if (req == NULL)
+      break;
+
+    if (suscan_pretrigger_dump(self, req))
+      ++self->dumps;
+
+    suscan_pretrigger_request_destroy(req);
+  }
+
+  return NULL;
+}
+
+SUBOOL
+suscan_pretrigger_feed(
+    suscan_pretrigger_t *self,
+    const SUCOMPLEX *samples,
+    SUSCOUNT length)
+{
+  uint64_t count = self->count;
+  SUSCOUNT offset, chunk;
+
+  /* Only the tail of a huge block can be kept */
+  if (length > self->size) {
+    samples += length - self->size;
+    count += length - self->size;
+    length = self->size;
+  }
+
+  /*
+   * Announce which samples are about to be overwritten. The fence keeps
+   * the ring stores below from becoming visible before the announcement.
+   */
+  __atomic_store_n(&self->reserve, count + length, __ATOMIC_SEQ_CST);
+  __atomic_thread_fence(__ATOMIC_RELEASE);
+
+  offset = count % self->size;
+  chunk = SU_MIN(length, self->size - offset);
+
+  memcpy(self->ring + offset, samples, chunk * sizeof(SUCOMPLEX));
+  if (chunk < length)
+    memcpy(self->ring, samples + chunk, (length - chunk) * sizeof(SUCOMPLEX));
+
+  __atomic_store_n(&self->count, count + length, __ATOMIC_SEQ_CST);
+
+  if (__atomic_load_n(&self->dumper_waiting, __ATOMIC_SEQ_CST)) {
+    pthread_mutex_lock(&self->mutex);
+    pthread_cond_broadcast(&self->cond);
+    pthread_mutex_unlock(&self->mutex);
+  }
+
+  return SU_TRUE;
+}
+
+SUBOOL
+suscan_pretrigger_baseband_filter(
+    void *privdata,
+    struct suscan_analyzer *analyzer,
+    const SUCOMPLEX *samples,
+    SUSCOUNT length)
+{
+  return suscan_pretrigger_feed(
+      (suscan_pretrigger_t *) privdata,
+      samples,
+      length);
+}
+
+SUBOOL
+suscan_pretrigger_trigger(
+    suscan_pretrigger_t *self,
+    SUFLOAT pre,
+    SUFLOAT post,
+    const char *path)
+{
+  struct suscan_pretrigger_request *req = NULL;
+  uint64_t now, pre_samples;
+
+  SU_TRYCATCH(pre >= 0 && post >= 0, goto fail);
+
+  SU_TRYCATCH(
+      req = calloc(1, sizeof(struct suscan_pretrigger_request)),
+      goto fail);
+  SU_TRYCATCH(req->path = strdup(path), goto fail);
+
+  now = __atomic_load_n(&self->count, __ATOMIC_SEQ_CST);
+  pre_samples = SU_MIN((uint64_t) (pre * self->samp_rate), self->size);
+  if (pre_samples > now)
+    pre_samples = now;
+
+  req->start = now - pre_samples;
+  req->end = now + (uint64_t) (post * self->samp_rate);
+
+  pthread_mutex_lock(&self->mutex);
+  if (self->queue_tail != NULL)
+    self->queue_tail->next = req;
+  else
+    self->queue_head = req;
+  self->queue_tail = req;
+  pthread_cond_broadcast(&self->cond);
+  pthread_mutex_unlock(&self->mutex);
+
+  return SU_TRUE;
+
+fail:
+  if (req != NULL)
+    suscan_pretrigger_request_destroy(req);
+
+  return SU_FALSE;
+}
+
+void
+suscan_pretrigger_destroy(suscan_pretrigger_t *self)
+{
+  struct suscan_pretrigger_request *req;
+
+  if (self->thread_running) {
+    pthread_mutex_lock(&self->mutex);
+    self->halt = SU_TRUE;
+    pthread_cond_broadcast(&self->cond);
+    pthread_mutex_unlock(&self->mutex);
+
+    pthread_join(self->thread, NULL);
+  }
+
+  while ((req = self->queue_head) != NULL) {
+    self->queue_head = req->next;
+    suscan_pretrigger_request_destroy(req);
+  }
+
+  if (self->lost > 0)
+    SU_WARNING(
+        "Pre-trigger dumps lost %lu samples\n",
+        (unsigned long) self->lost);
+
+  if (self->mutex_init)
+    pthread_mutex_destroy(&self->mutex);
+
+  if (self->cond_init)
+    pthread_cond_destroy(&self->cond);
+
+  if (self->ring != NULL)
+    free(self->ring);
+
+  if (self->chunk != NULL)
+    free(self->chunk);
+
+  free(self);
+}
+
+suscan_pretrigger_t *
+suscan_pretrigger_new(SUFLOAT samp_rate, SUFLOAT history)
+{
+  suscan_pretrigger_t *new = NULL;
+
+  SU_TRYCATCH(samp_rate > 0 && history > 0, goto fail);
+
+  SU_TRYCATCH(new = calloc(1, sizeof(suscan_pretrigger_t)), goto fail);
+
+  new->samp_rate = samp_rate;
+  new->size = SU_CEIL(samp_rate * history);
+
+  SU_TRYCATCH(new->ring = malloc(new->size * sizeof(SUCOMPLEX)), goto fail);
+  SU_TRYCATCH(
+      new->chunk = malloc(SUSCAN_PRETRIGGER_DUMP_CHUNK * 2 * sizeof(float)),
+      goto fail);
+
+  SU_TRYCATCH(pthread_mutex_init(&new->mutex, NULL) == 0, goto fail);
+  new->mutex_init = SU_TRUE;
+
+  SU_TRYCATCH(pthread_cond_init(&new->cond, NULL) == 0, goto fail);
+  new->cond_init = SU_TRUE;
+
+  SU_TRYCATCH(
+      pthread_create(&new->thread, NULL, suscan_pretrigger_thread, new) == 0,
+      goto fail);
+  new->thread_running = SU_TRUE;
+
+  return new;
+
+fail:
+  if (new != NULL)
+    suscan_pretrigger_destroy(new);
+
+  return NULL;
+}
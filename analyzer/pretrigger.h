@@ -0,0 +1,110 @@
+/*
+
+  Copyright (C) 2020 Gonzalo José Carracedo Carballal
+
+  This program is free software: you can redistribute it and/or modify
+  it under the terms of the GNU Lesser General Public License as
+  published by the Free Software Foundation, either version 3 of the
+  License, or (at your option) any later version.
+
+  This program is distributed in the hope that it will be useful, but
+  WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+  GNU Lesser General Public License for more details.
+
+  You should have received a copy of the GNU Lesser General Public
+  License along with this program.  If not, see
+  <http://www.gnu.org/licenses/>
+
+*/
+
+
+#ifndef _PRETRIGGER_H
+#define _PRETRIGGER_H
+
+#include <stdint.h>
+#include <pthread.h>
+#include <sigutils/sigutils.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif /* __cplusplus */
+
+#define SUSCAN_PRETRIGGER_DUMP_CHUNK 16384 /* Samples */
+
+/*
+ * Pre-trigger history. The source worker keeps the last `size' baseband
+ * samples in a preallocated ring without taking any lock. Triggers ask
+ * a dump thread to save a window around the trigger instant (which may
+ * start in the past) as raw complex float32 samples.
+ */
+struct suscan_pretrigger_request {
+  char *path;
+  uint64_t start; /* Absolute sample index */
+  uint64_t end;
+  struct suscan_pretrigger_request *next;
+};
+
+struct suscan_pretrigger {
+  SUCOMPLEX *ring;
+  SUSCOUNT   size;
+  SUFLOAT    samp_rate;
+  uint64_t   count;   /* Samples written so far */
+  uint64_t   reserve; /* Samples written once the current feed ends */
+
+  float *chunk;
+
+  /* Pending requests, FIFO */
+  struct suscan_pretrigger_request *queue_head;
+  struct suscan_pretrigger_request *queue_tail;
+
+  SUBOOL halt;
+  int dumper_waiting;
+
+  pthread_mutex_t mutex;
+  SUBOOL mutex_init;
+  pthread_cond_t cond;
+  SUBOOL cond_init;
+  pthread_t thread;
+  SUBOOL thread_running;
+
+  /* Statistics */
+  unsigned int dumps;
+  uint64_t lost; /* Samples overwritten before they could be saved */
+};
+
+typedef struct suscan_pretrigger suscan_pretrigger_t;
+
+suscan_pretrigger_t *suscan_pretrigger_new(SUFLOAT samp_rate, SUFLOAT history);
+
+SUBOOL suscan_pretrigger_feed(
+    suscan_pretrigger_t *self,
+    const SUCOMPLEX *samples,
+    SUSCOUNT length);
+
+/*
+ * Saves pre seconds before and post seconds after the current instant.
+ * The pre-trigger window is clipped to the history length.
+ */
+SUBOOL suscan_pretrigger_trigger(
+    suscan_pretrigger_t *self,
+    SUFLOAT pre,
+    SUFLOAT post,
+    const char *path);
+
+/* Pending dumps are completed with the samples available so far */
+void suscan_pretrigger_destroy(suscan_pretrigger_t *self);
+
+struct suscan_analyzer;
+
+SUBOOL suscan_pretrigger_baseband_filter(
+    void *privdata,
+    struct suscan_analyzer *analyzer,
+    const SUCOMPLEX *samples,
+    SUSCOUNT length);
+
+#ifdef __cplusplus
+}
+#endif /* __cplusplus */
+
+#endif /* _PRETRIGGER_H */
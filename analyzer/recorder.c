@@ -0,0 +1,229 @@
+/*
+
+  Copyright (C) 2020 Gonzalo José Carracedo Carballal
+
+  This program is free software: you can redistribute it and/or modify
+  it under the terms of the GNU Lesser General Public License as
+  published by the Free Software Foundation, either version 3 of the
+  License, or (at your option) any later version.
+
+  This program is distributed in the hope that it will be useful, but
+  WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+  GNU Lesser General Public License for more details.
+
+  You should have received a copy of the GNU Lesser General Public
+  License along with this program.  If not, see
+  <http://www.gnu.org/licenses/>
+
+*/
+
+
+#ifndef _GNU_SOURCE
+#  define _GNU_SOURCE /* For O_DIRECT */
+#endif /* _GNU_SOURCE */
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <errno.h>
+
+#define SU_LOG_DOMAIN "recorder"
+
+#include <sigutils/sigutils.h>
+#include "recorder.h"
+
+SUPRIVATE SUBOOL
+suscan_recorder_write_all(suscan_recorder_t *self, const uint8_t *data, size_t size)
+{
+  ssize_t ret;
+
+  while (size > 0) {
+    if ((ret = write(self->fd, data, size)) < 0) {
+      if (errno == EINTR)
+        continue;
+
+      SU_ERROR("Recorder write failed: %s\n", strerror(errno));
+      return SU_FALSE;
+    }
+
+    data += ret;
+    size -= ret;
+    __atomic_add_fetch(&self->bytes_written, ret, __ATOMIC_RELAXED);
+  }
+
+  return SU_TRUE;
+}
+
+SUPRIVATE SUBOOL
+suscan_recorder_consume(
+    void *privdata,
+    void *block,
+    SUSCOUNT samples,
+    unsigned int index)
+{
+  suscan_recorder_t *self = (suscan_recorder_t *) privdata;
+
+  return suscan_recorder_write_all(
+      self,
+      (const uint8_t *) block,
+      samples * 2 * sizeof(float));
+}
+
+SUPRIVATE void
+suscan_recorder_copy(void *dest, const SUCOMPLEX *samples, SUSCOUNT length)
+{
+#ifdef _SU_SINGLE_PRECISION
+  memcpy(dest, samples, length * sizeof(SUCOMPLEX));
+#else
+  float *block = (float *) dest;
+  SUSCOUNT i;
+
+  for (i = 0; i < length; ++i) {
+    block[2 * i]     = SU_C_REAL(samples[i]);
+    block[2 * i + 1] = SU_C_IMAG(samples[i]);
+  }
+#endif /* _SU_SINGLE_PRECISION */
+}
+
+SUBOOL
+suscan_recorder_write(
+    suscan_recorder_t *self,
+    const SUCOMPLEX *samples,
+    SUSCOUNT length)
+{
+  return suscan_block_ring_write(&self->ring, samples, length);
+}
+
+void
+suscan_recorder_get_stats(
+    const suscan_recorder_t *self,
+    struct suscan_recorder_stats *stats)
+{
+  stats->bytes_written =
+      __atomic_load_n(&self->bytes_written, __ATOMIC_RELAXED);
+  stats->dropped_blocks = suscan_block_ring_get_dropped(&self->ring);
+  stats->fill = suscan_block_ring_get_fill(&self->ring);
+  stats->failed = suscan_block_ring_has_failed(&self->ring);
+}
+
+SUBOOL
+suscan_recorder_baseband_filter(
+    void *privdata,
+    struct suscan_analyzer *analyzer,
+    const SUCOMPLEX *samples,
+    SUSCOUNT length)
+{
+  suscan_recorder_t *self = (suscan_recorder_t *) privdata;
+
+  /* A failed recorder must not stop the analyzer */
+  (void) suscan_recorder_write(self, samples, length);
+
+  return SU_TRUE;
+}
+
+void
+suscan_recorder_destroy(suscan_recorder_t *self)
+{
+  SUSCOUNT samples;
+  unsigned int index;
+  void *partial;
+  int flags;
+
+  if (self->ring_init)
+    suscan_block_ring_halt(&self->ring);
+
+  if (self->fd != -1) {
+    /* Last partial block: not aligned, so it cannot go through O_DIRECT */
+    if (self->ring_init && !suscan_block_ring_has_failed(&self->ring)) {
+      partial = suscan_block_ring_get_partial(&self->ring, &samples, &index);
+      if (samples > 0) {
+#ifdef O_DIRECT
+        if (self->direct && (flags = fcntl(self->fd, F_GETFL)) != -1)
+          (void) fcntl(self->fd, F_SETFL, flags & ~O_DIRECT);
+#endif /* O_DIRECT */
+        (void) suscan_recorder_write_all(
+            self,
+            (const uint8_t *) partial,
+            samples * 2 * sizeof(float));
+      }
+    }
+
+    if (self->ring_init && suscan_block_ring_get_dropped(&self->ring) > 0)
+      SU_WARNING(
+          "Recorder dropped %lu blocks of %lu bytes\n",
+          (unsigned long) suscan_block_ring_get_dropped(&self->ring),
+          (unsigned long) self->block_size);
+
+    close(self->fd);
+  }
+
+  if (self->ring_init)
+    suscan_block_ring_finalize(&self->ring);
+
+  free(self);
+}
+
+suscan_recorder_t *
+suscan_recorder_new(
+    const char *path,
+    size_t block_size,
+    unsigned int block_count)
+{
+  struct suscan_block_ring_ops ops;
+  suscan_recorder_t *new = NULL;
+
+  if (block_size == 0)
+    block_size = SUSCAN_RECORDER_DEFAULT_BLOCK_SIZE;
+
+  if (block_count == 0)
+    block_count = SUSCAN_RECORDER_DEFAULT_BLOCK_COUNT;
+
+  /* Blocks must be aligned for O_DIRECT, and hold whole samples */
+  block_size += SUSCAN_RECORDER_ALIGNMENT - 1;
+  block_size -= block_size % SUSCAN_RECORDER_ALIGNMENT;
+
+  SU_TRYCATCH(new = calloc(1, sizeof(suscan_recorder_t)), goto fail);
+
+  new->fd = -1;
+  new->block_size = block_size;
+
+#ifdef O_DIRECT
+  if ((new->fd = open(
+      path,
+      O_WRONLY | O_CREAT | O_TRUNC | O_DIRECT,
+      0644)) != -1)
+    new->direct = SU_TRUE;
+#endif /* O_DIRECT */
+
+  /* No O_DIRECT support (e.g. tmpfs): fall back to buffered writes */
+  if (new->fd == -1
+      && (new->fd = open(path, O_WRONLY | O_CREAT | O_TRUNC, 0644)) == -1) {
+    SU_ERROR("Cannot open %s for recording: %s\n", path, strerror(errno));
+    goto fail;
+  }
+
+  memset(&ops, 0, sizeof(struct suscan_block_ring_ops));
+  ops.consume = suscan_recorder_consume;
+  ops.copy = suscan_recorder_copy;
+
+  SU_TRYCATCH(
+      suscan_block_ring_init(
+          &new->ring,
+          &ops,
+          new,
+          2 * sizeof(float),
+          block_size / (2 * sizeof(float)),
+          block_count,
+          SUSCAN_RECORDER_ALIGNMENT),
+      goto fail);
+  new->ring_init = SU_TRUE;
+
+  return new;
+
+fail:
+  if (new != NULL)
+    suscan_recorder_destroy(new);
+
+  return NULL;
+}
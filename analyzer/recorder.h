@@ -0,0 +1,100 @@
+/*
+
+  Copyright (C) 2020 Gonzalo José Carracedo Carballal
+
+  This program is free software: you can redistribute it and/or modify
+  it under the terms of the GNU Lesser General Public License as
+  published by the Free Software Foundation, either version 3 of the
+  License, or (at your option) any later version.
+
+  This program is distributed in the hope that it will be useful, but
+  WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+  GNU Lesser General Public License for more details.
+
+  You should have received a copy of the GNU Lesser General Public
+  License along with this program.  If not, see
+  <http://www.gnu.org/licenses/>
+
+*/
+
+
+#ifndef _RECORDER_H
+#define _RECORDER_H
+
+#include <stdint.h>
+#include <sigutils/sigutils.h>
+#include "blockring.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif /* __cplusplus */
+
+#define SUSCAN_RECORDER_ALIGNMENT           4096
+#define SUSCAN_RECORDER_DEFAULT_BLOCK_SIZE  (4 << 20) /* Bytes */
+#define SUSCAN_RECORDER_DEFAULT_BLOCK_COUNT 16
+
+/*
+ * Asynchronous baseband recorder. Samples are copied (as interleaved
+ * little endian float32, i.e. SUSCAN_SOURCE_FORMAT_RAW) into a block
+ * ring (see blockring.h) of page-aligned blocks, whose writer thread
+ * writes them with O_DIRECT whenever the filesystem allows it.
+ */
+struct suscan_recorder {
+  int fd;
+  SUBOOL direct; /* Opened with O_DIRECT */
+
+  size_t block_size; /* Bytes */
+  struct suscan_block_ring ring;
+  SUBOOL ring_init;
+
+  /* Written by the writer thread, accessed atomically */
+  uint64_t bytes_written;
+};
+
+typedef struct suscan_recorder suscan_recorder_t;
+
+struct suscan_recorder_stats {
+  uint64_t bytes_written;
+  uint64_t dropped_blocks;
+  unsigned int fill; /* Blocks waiting to be written */
+  SUBOOL   failed;
+};
+
+/* block_size and block_count may be 0 to use the defaults */
+suscan_recorder_t *suscan_recorder_new(
+    const char *path,
+    size_t block_size,
+    unsigned int block_count);
+
+SUBOOL suscan_recorder_write(
+    suscan_recorder_t *self,
+    const SUCOMPLEX *samples,
+    SUSCOUNT length);
+
+void suscan_recorder_get_stats(
+    const suscan_recorder_t *self,
+    struct suscan_recorder_stats *stats);
+
+/* Waits for all pending blocks to be written and closes the file */
+void suscan_recorder_destroy(suscan_recorder_t *self);
+
+/*
+ * Baseband filter callback (see suscan_analyzer_register_baseband_filter).
+ * privdata must be a suscan_recorder_t. Unregister it with
+ * suscan_analyzer_unregister_baseband_filter before destroying the
+ * recorder.
+ */
+struct suscan_analyzer;
+
+SUBOOL suscan_recorder_baseband_filter(
+    void *privdata,
+    struct suscan_analyzer *analyzer,
+    const SUCOMPLEX *samples,
+    SUSCOUNT length);
+
+#ifdef __cplusplus
+}
+#endif /* __cplusplus */
+
+#endif /* _RECORDER_H */
@@ -0,0 +1,317 @@
+/*
+
+  Copyright (C) 2020 Gonzalo José Carracedo Carballal
+
+  This program is free software: you can redistribute it and/or modify
+  it under the terms of the GNU Lesser General Public License as
+  published by the Free Software Foundation, either version 3 of the
+  License, or (at your option) any later version.
+
+  This program is distributed in the hope that it will be useful, but
+  WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+  GNU Lesser General Public License for more details.
+
+  You should have received a copy of the GNU Lesser General Public
+  License along with this program.  If not, see
+  <http://www.gnu.org/licenses/>
+
+*/
+
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <ctype.h>
+#include <time.h>
+
+#define SU_LOG_DOMAIN "sigmf"
+
+#include <sigutils/sigutils.h>
+#include <util.h>
+#include "sigmf.h"
+
+/*
+ * SigMF metadata is JSON. We do not need a full JSON parser: all the keys
+ * we are interested in are namespaced ("core:...") and scalar, so we just
+ * walk the token stream and look at every key/value pair regardless of its
+ * nesting level. The first occurrence of each key wins, which for the
+ * per-capture keys means the first capture segment.
+ */
+struct suscan_sigmf_parser {
+  const char *p;
+  const char *end;
+  struct suscan_sigmf_info *info;
+  SUBOOL have_format;
+  SUBOOL format_ok;
+};
+
+SUPRIVATE SUBOOL
+suscan_sigmf_has_ext(const char *path, const char *ext)
+{
+  size_t len = strlen(path);
+  size_t ext_len = strlen(ext);
+
+  return len > ext_len && strcmp(path + len - ext_len, ext) == 0;
+}
+
+SUBOOL
+suscan_sigmf_is_sigmf_path(const char *path)
+{
+  return suscan_sigmf_has_ext(path, SUSCAN_SIGMF_META_EXT)
+      || suscan_sigmf_has_ext(path, SUSCAN_SIGMF_DATA_EXT);
+}
+
+SUPRIVATE char *
+suscan_sigmf_replace_ext(const char *path, const char *ext)
+{
+  const char *dot;
+
+  if (!suscan_sigmf_is_sigmf_path(path))
+    return NULL;
+
+  dot = strrchr(path, '.');
+
+  return strbuild("%.*s%s", (int) (dot - path), path, ext);
+}
+
+char *
+suscan_sigmf_get_meta_path(const char *path)
+{
+  return suscan_sigmf_replace_ext(path, SUSCAN_SIGMF_META_EXT);
+}
+
+char *
+suscan_sigmf_get_data_path(const char *path)
+{
+  return suscan_sigmf_replace_ext(path, SUSCAN_SIGMF_DATA_EXT);
+}
+
+SUPRIVATE SUBOOL
+suscan_sigmf_parse_datatype(const char *type, enum suscan_source_format *fmt)
+{
+  if (strcmp(type, "cf32_le") == 0)
+    *fmt = SUSCAN_SOURCE_FORMAT_RAW;
+  else if (strcmp(type, "ci16_le") == 0)
+    *fmt = SUSCAN_SOURCE_FORMAT_RAW_CS16;
+  else if (strcmp(type, "ci8") == 0 || strcmp(type, "ci8_le") == 0)
+    *fmt = SUSCAN_SOURCE_FORMAT_RAW_CS8;
+  else if (strcmp(type, "cu8") == 0 || strcmp(type, "cu8_le") == 0)
+    *fmt = SUSCAN_SOURCE_FORMAT_RAW_CU8;
+  else
+    return SU_FALSE;
+
+  return SU_TRUE;
+}
+
+/* ISO 8601, UTC: YYYY-MM-DDTHH:MM:SS[.ffffff]Z */
+SUPRIVATE SUBOOL
+suscan_sigmf_parse_datetime(const char *date, struct timeval *tv)
+{
+  struct tm tm;
+  const char *frac;
+  long usec = 0;
+  long scale = 100000;
+
+  memset(&tm, 0, sizeof(struct tm));
+
+  if (sscanf(
+      date,
+      "%4d-%2d-%2dT%2d:%2d:%2d",
+      &tm.tm_year,
+      &tm.tm_mon,
+      &tm.tm_mday,
+      &tm.tm_hour,
+      &tm.tm_min,
+      &tm.tm_sec) != 6)
+    return SU_FALSE;
+
+  tm.tm_year -= 1900;
+  tm.tm_mon  -= 1;
+
+  if ((frac = strchr(date, '.')) != NULL)
+    for (++frac; isdigit(*frac) && scale > 0; ++frac, scale /= 10)
+      usec += (*frac - '0') * scale;
+
+  tv->tv_sec  = timegm(&tm);
+  tv->tv_usec = usec;
+
+  return SU_TRUE;
+}
+
+SUPRIVATE void
+suscan_sigmf_skip_ws(struct suscan_sigmf_parser *self)
+{
+  while (self->p < self->end && isspace(*self->p))
+    ++self->p;
+}
+
+/* Returns a newly allocated copy of the string at p, escapes removed */
+SUPRIVATE char *
+suscan_sigmf_read_string(struct suscan_sigmf_parser *self)
+{
+  char *str = NULL;
+  unsigned int len = 0;
+
+  SU_TRYCATCH(str = malloc(self->end - self->p), return NULL);
+
+  for (++self->p; self->p < self->end && *self->p != '"'; ++self->p) {
+    if (*self->p == '\\' && self->p + 1 < self->end)
+      ++self->p;
+    str[len++] = *self->p;
+  }
+
+  if (self->p == self->end) {
+    free(str);
+    return NULL;
+  }
+
+  ++self->p;
+  str[len] = '\0';
+
+  return str;
+}
+
+SUPRIVATE void
+suscan_sigmf_handle_pair(
+    struct suscan_sigmf_parser *self,
+    const char *key,
+    const char *value)
+{
+  struct suscan_sigmf_info *info = self->info;
+  char *end;
+
+  if (strcmp(key, "core:datatype") == 0) {
+    if (!self->have_format) {
+      self->have_format = SU_TRUE;
+      if (!(self->format_ok =
+          suscan_sigmf_parse_datatype(value, &info->format)))
+        SU_ERROR("Unsupported SigMF datatype `%s'\n", value);
+    }
+  } else if (strcmp(key, "core:sample_rate") == 0) {
+    if (!info->have_samp_rate) {
+      info->samp_rate = strtod(value, &end);
+      info->have_samp_rate = end != value && info->samp_rate > 0;
+    }
+  } else if (strcmp(key, "core:frequency") == 0) {
+    if (!info->have_freq) {
+      info->freq = strtod(value, &end);
+      info->have_freq = end != value;
+    }
+  } else if (strcmp(key, "core:datetime") == 0) {
+    if (!info->have_start_time)
+      info->have_start_time =
+          suscan_sigmf_parse_datetime(value, &info->start_time);
+  }
+}
+
+SUPRIVATE SUBOOL
+suscan_sigmf_walk(struct suscan_sigmf_parser *self)
+{
+  char *key = NULL;
+  char *value = NULL;
+  const char *start;
+  SUBOOL ok = SU_FALSE;
+
+  while (self->p < self->end) {
+    suscan_sigmf_skip_ws(self);
+    if (self->p == self->end)
+      break;
+
+    if (*self->p != '"') {
+      ++self->p;
+      continue;
+    }
+
+    SU_TRYCATCH(key = suscan_sigmf_read_string(self), goto done);
+
+    suscan_sigmf_skip_ws(self);
+    if (self->p < self->end && *self->p == ':') {
+      ++self->p;
+      suscan_sigmf_skip_ws(self);
+
+      if (self->p < self->end && *self->p == '"') {
+        SU_TRYCATCH(value = suscan_sigmf_read_string(self), goto done);
+      } else {
+        /* Numbers and literals. Objects and arrays are walked into. */
+        start = self->p;
+        while (self->p < self->end
+            && strchr(",}]{[", *self->p) == NULL
+            && !isspace(*self->p))
+          ++self->p;
+        SU_TRYCATCH(
+            value = strbuild("%.*s", (int) (self->p - start), start),
+            goto done);
+      }
+
+      suscan_sigmf_handle_pair(self, key, value);
+      free(value);
+      value = NULL;
+    }
+
+    free(key);
+    key = NULL;
+  }
+
+  ok = SU_TRUE;
+
+done:
+  if (key != NULL)
+    free(key);
+
+  if (value != NULL)
+    free(value);
+
+  return ok;
+}
+
+SUBOOL
+suscan_sigmf_parse(const char *meta_path, struct suscan_sigmf_info *info)
+{
+  struct suscan_sigmf_parser parser;
+  FILE *fp = NULL;
+  char *data = NULL;
+  long size;
+  SUBOOL ok = SU_FALSE;
+
+  memset(info, 0, sizeof(struct suscan_sigmf_info));
+  memset(&parser, 0, sizeof(struct suscan_sigmf_parser));
+
+  if ((fp = fopen(meta_path, "rb")) == NULL) {
+    SU_ERROR("Cannot open SigMF metadata file %s\n", meta_path);
+    goto done;
+  }
+
+  SU_TRYCATCH(fseek(fp, 0, SEEK_END) == 0, goto done);
+  SU_TRYCATCH((size = ftell(fp)) >= 0, goto done);
+  SU_TRYCATCH(size <= SUSCAN_SIGMF_MAX_META_SIZE, goto done);
+  SU_TRYCATCH(fseek(fp, 0, SEEK_SET) == 0, goto done);
+
+  SU_TRYCATCH(data = malloc(size + 1), goto done);
+  SU_TRYCATCH(fread(data, 1, size, fp) == size, goto done);
+
+  parser.p = data;
+  parser.end = data + size;
+  parser.info = info;
+
+  SU_TRYCATCH(suscan_sigmf_walk(&parser), goto done);
+
+  if (!parser.have_format) {
+    SU_ERROR("%s: no core:datatype found\n", meta_path);
+    goto done;
+  }
+
+  if (!parser.format_ok)
+    goto done;
+
+  ok = SU_TRUE;
+
+done:
+  if (data != NULL)
+    free(data);
+
+  if (fp != NULL)
+    fclose(fp);
+
+  return ok;
+}
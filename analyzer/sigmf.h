@@ -0,0 +1,65 @@
+/*
+
+  Copyright (C) 2020 Gonzalo José Carracedo Carballal
+
+  This program is free software: you can redistribute it and/or modify
+  it under the terms of the GNU Lesser General Public License as
+  published by the Free Software Foundation, either version 3 of the
+  License, or (at your option) any later version.
+
+  This program is distributed in the hope that it will be useful, but
+  WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+  GNU Lesser General Public License for more details.
+
+  You should have received a copy of the GNU Lesser General Public
+  License along with this program.  If not, see
+  <http://www.gnu.org/licenses/>
+
+*/
+
+
+#ifndef _SIGMF_H
+#define _SIGMF_H
+
+#include <sys/time.h>
+#include <sigutils/sigutils.h>
+#include "source.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif /* __cplusplus */
+
+#define SUSCAN_SIGMF_META_EXT     ".sigmf-meta"
+#define SUSCAN_SIGMF_DATA_EXT     ".sigmf-data"
+#define SUSCAN_SIGMF_MAX_META_SIZE (1 << 20)
+
+/*
+ * Subset of a SigMF recording description relevant to file sources. Only
+ * the first capture segment is taken into account.
+ */
+struct suscan_sigmf_info {
+  enum suscan_source_format format;
+  SUFLOAT samp_rate;
+  SUFREQ  freq;
+  struct timeval start_time;
+
+  SUBOOL have_samp_rate;
+  SUBOOL have_freq;
+  SUBOOL have_start_time;
+};
+
+/* Returns TRUE if path names either half of a SigMF recording */
+SUBOOL suscan_sigmf_is_sigmf_path(const char *path);
+
+/* Both return a newly allocated path, or NULL if path is not SigMF */
+char *suscan_sigmf_get_meta_path(const char *path);
+char *suscan_sigmf_get_data_path(const char *path);
+
+SUBOOL suscan_sigmf_parse(const char *meta_path, struct suscan_sigmf_info *info);
+
+#ifdef __cplusplus
+}
+#endif /* __cplusplus */
+
+#endif /* _SIGMF_H */
@@ -32,57 +32,12 @@
  * not critical.
  */
 
-SUPRIVATE void
-suscan_analyzer_gain_request_destroy(struct suscan_analyzer_gain_request *req)
-{
-  if (req->name != NULL)
-    free(req->name);
-
-  free(req);
-}
-
-SUPRIVATE struct suscan_analyzer_gain_request *
-suscan_analyzer_gain_request_new(const char *name, SUFLOAT value)
-{
-  struct suscan_analyzer_gain_request *new = NULL;
-
-  SU_TRYCATCH(
-      new = calloc(1, sizeof(struct suscan_analyzer_gain_request)),
-      goto fail);
-
-  SU_TRYCATCH(new->name = strdup(name), goto fail);
-  new->value = value;
-
-  return new;
-
-fail:
-  if (new != NULL)
-    suscan_analyzer_gain_request_destroy(new);
-
-  return NULL;
-}
-
-
-void
-suscan_analyzer_destroy_slow_worker_data(suscan_analyzer_t *analyzer)
-{
-  unsigned int i;
-
-  /* Delete all pending gain requessts */
-  for (i = 0; i < analyzer->gain_request_count; ++i)
-    suscan_analyzer_gain_request_destroy(analyzer->gain_request_list[i]);
-
-  if (analyzer->gain_request_list != NULL)
-    free(analyzer->gain_request_list);
-
-  if (analyzer->gain_req_mutex_init)
-    pthread_mutex_destroy(&analyzer->hotconf_mutex);
-
-  if (analyzer->antenna_req != NULL)
-    free(analyzer->antenna_req);
-}
-
 /***************************** Slow worker callbacks *************************/
+/*
+ * These callbacks read the latest hotconf snapshot and apply whatever
+ * changed since the last time. Requests issued while one is in progress
+ * are picked up by their own callback invocation.
+ */
 SUPRIVATE SUBOOL
 suscan_analyzer_set_gain_cb(
     struct suscan_mq *mq_out,
@@ -90,43 +45,21 @@ suscan_analyzer_set_gain_cb(
     void *cb_private)
 {
   suscan_analyzer_t *analyzer = (suscan_analyzer_t *) wk_private;
-  SUBOOL mutex_acquired = SU_FALSE;
-  PTR_LIST_LOCAL(struct suscan_analyzer_gain_request, request);
+  const struct suscan_hotconf_snapshot *snap;
   unsigned int i;
 
-  /* vvvvvvvvvvvvvvvvvv Acquire hotconf request mutex vvvvvvvvvvvvvvvvvvvvvvvvv */
-  SU_TRYCATCH(pthread_mutex_lock(&analyzer->hotconf_mutex) != -1, goto fail);
-  mutex_acquired = SU_TRUE;
+  snap = suscan_hotconf_enter(&analyzer->hotconf, analyzer->slow_reader);
 
-  request_list  = analyzer->gain_request_list;
-  request_count = analyzer->gain_request_count;
+  for (i = 0; i < snap->gain_count; ++i)
+    if (snap->gain_list[i].version > analyzer->gain_applied)
+      (void) suscan_source_set_gain(
+          analyzer->source,
+          snap->gain_list[i].name,
+          snap->gain_list[i].value);
 
-  analyzer->gain_request_list  = NULL;
-  analyzer->gain_request_count = 0;
+  analyzer->gain_applied = snap->version;
 
-  pthread_mutex_unlock(&analyzer->hotconf_mutex);
-  mutex_acquired = SU_FALSE;
-  /* ^^^^^^^^^^^^^^^^^^ Release hotconf request mutex ^^^^^^^^^^^^^^^^^^^^^^^^^ */
-
-  /* Process all requests */
-  for (i = 0; i < request_count; ++i) {
-    SU_TRYCATCH(
-        suscan_source_set_gain(
-            analyzer->source,
-            request_list[i]->name,
-            request_list[i]->value),
-        goto fail);
-  }
-
-fail:
-  if (mutex_acquired)
-    pthread_mutex_unlock(&analyzer->hotconf_mutex);
-
-  for (i = 0; i < request_count; ++i)
-    suscan_analyzer_gain_request_destroy(request_list[i]);
-
-  if (request_list != NULL)
-    free(request_list);
+  suscan_hotconf_leave(&analyzer->hotconf, analyzer->slow_reader);
 
   return SU_FALSE;
 }
@@ -138,29 +71,16 @@ suscan_analyzer_set_antenna_cb(
     void *cb_private)
 {
   suscan_analyzer_t *analyzer = (suscan_analyzer_t *) wk_private;
-  SUBOOL mutex_acquired = SU_FALSE;
-  char *req = NULL;
-  unsigned int i;
-
-  /* vvvvvvvvvvvvvvvvvv Acquire hotconf request mutex vvvvvvvvvvvvvvvvvvvvvvvvv */
-  SU_TRYCATCH(pthread_mutex_lock(&analyzer->hotconf_mutex) != -1, goto fail);
-  mutex_acquired = SU_TRUE;
+  const struct suscan_hotconf_snapshot *snap;
 
-  req = analyzer->antenna_req;
-  analyzer->antenna_req = NULL;
+  snap = suscan_hotconf_enter(&analyzer->hotconf, analyzer->slow_reader);
 
-  pthread_mutex_unlock(&analyzer->hotconf_mutex);
-  mutex_acquired = SU_FALSE;
-  /* ^^^^^^^^^^^^^^^^^^ Release hotconf request mutex ^^^^^^^^^^^^^^^^^^^^^^^^^ */
+  if (snap->antenna_version > analyzer->antenna_applied)
+    suscan_source_set_antenna(analyzer->source, snap->antenna);
 
-  suscan_source_set_antenna(analyzer->source, req);
+  analyzer->antenna_applied = snap->version;
 
-fail:
-  if (mutex_acquired)
-    pthread_mutex_unlock(&analyzer->hotconf_mutex);
-
-  if (req != NULL)
-    free(req);
+  suscan_hotconf_leave(&analyzer->hotconf, analyzer->slow_reader);
 
   return SU_FALSE;
 }
@@ -200,17 +120,23 @@ suscan_analyzer_set_bw_cb(
     void *cb_private)
 {
   suscan_analyzer_t *analyzer = (suscan_analyzer_t *) wk_private;
-  SUFLOAT bw;
+  const struct suscan_hotconf_snapshot *snap;
+
+  snap = suscan_hotconf_enter(&analyzer->hotconf, analyzer->slow_reader);
 
-  if (analyzer->bw_req) {
-    bw = analyzer->bw_req_value;
-    if (suscan_source_set_bandwidth(analyzer->source, bw)) {
+  if (snap->bw_version > analyzer->bw_applied) {
+    if (suscan_source_set_bandwidth(analyzer->source, snap->bw)) {
       /* XXX: Use a proper frequency adjust method */
-      analyzer->detector->params.bw = bw;
+      suscan_analyzer_enter_detector(analyzer);
+      analyzer->detector->params.bw = snap->bw;
+      suscan_analyzer_leave_detector(analyzer);
     }
-    analyzer->bw_req = analyzer->bw_req_value != bw;
   }
 
+  analyzer->bw_applied = snap->version;
+
+  suscan_hotconf_leave(&analyzer->hotconf, analyzer->slow_reader);
+
   return SU_FALSE;
 }
 
@@ -221,134 +147,72 @@ suscan_analyzer_set_freq_cb(
     void *cb_private)
 {
   suscan_analyzer_t *analyzer = (suscan_analyzer_t *) wk_private;
-  SUFREQ freq;
-  SUFREQ lnb_freq;
+  const struct suscan_hotconf_snapshot *snap;
 
-  if (analyzer->freq_req) {
-    freq = analyzer->freq_req_value;
-    lnb_freq = analyzer->lnb_req_value;
-    if (suscan_source_set_freq2(analyzer->source, freq, lnb_freq)) {
+  snap = suscan_hotconf_enter(&analyzer->hotconf, analyzer->slow_reader);
+
+  if (snap->freq_version > analyzer->freq_applied) {
+    if (suscan_source_set_freq2(analyzer->source, snap->freq, snap->lnb)) {
       /* XXX: Use a proper frequency adjust method */
-      analyzer->detector->params.fc = freq;
+      suscan_analyzer_enter_detector(analyzer);
+      analyzer->detector->params.fc = snap->freq;
+      suscan_analyzer_leave_detector(analyzer);
     }
-    analyzer->freq_req = (analyzer->freq_req_value != freq ||
-        analyzer->lnb_req_value != lnb_freq);
   }
 
-  return SU_FALSE;
-}
-
-SUBOOL
-suscan_analyzer_set_inspector_freq_slow(
-    suscan_analyzer_t *analyzer,
-    SUHANDLE handle,
-    SUFREQ freq)
-{
-  SUBOOL ok = SU_FALSE;
-  struct suscan_inspector_overridable_request *req;
-
-  SU_TRYCATCH(
-      req = suscan_analyzer_acquire_overridable(analyzer, handle),
-      goto done);
-
-  req->freq_request = SU_TRUE;
-  req->new_freq = freq;
-
-  SU_TRYCATCH(
-      suscan_analyzer_release_overridable(analyzer, req),
-      goto done);
-
-  ok = SU_TRUE;
-
-done:
-
-  return ok;
-}
-
-SUBOOL
-suscan_analyzer_set_inspector_bandwidth_slow(
-    suscan_analyzer_t *analyzer,
-    SUHANDLE handle,
-    SUFLOAT bw)
-{
-  SUBOOL ok = SU_FALSE;
-  struct suscan_inspector_overridable_request *req;
-
-  SU_TRYCATCH(
-      req = suscan_analyzer_acquire_overridable(analyzer, handle),
-      goto done);
-
-  req->bandwidth_request = SU_TRUE;
-  req->new_bandwidth = bw;
+  analyzer->freq_applied = snap->version;
 
-  SU_TRYCATCH(
-      suscan_analyzer_release_overridable(analyzer, req),
-      goto done);
-
-  ok = SU_TRUE;
-
-done:
-
-  return ok;
-}
-
-SUPRIVATE SUBOOL
-suscan_analyzer_set_inspector_freq_cb(
-    struct suscan_mq *mq_out,
-    void *wk_private,
-    void *cb_private)
-{
-  suscan_analyzer_t *analyzer = (suscan_analyzer_t *) wk_private;
-
-  if (analyzer->inspector_freq_req) {
-    analyzer->inspector_freq_req = SU_FALSE;
-    (void) suscan_analyzer_set_inspector_freq_slow(
-        analyzer,
-        analyzer->inspector_freq_req_handle,
-        analyzer->inspector_freq_req_value);
-  }
+  suscan_hotconf_leave(&analyzer->hotconf, analyzer->slow_reader);
 
   return SU_FALSE;
 }
 
-
+/****************************** Slow methods **********************************/
+/*
+ * Called between suscan_hotconf_begin and suscan_hotconf_commit. Closing
+ * an inspector forgets its overrides through the hotconf too, after the
+ * handle stops resolving, so an override that passes this check is either
+ * applied or forgotten later, never left behind.
+ */
 SUPRIVATE SUBOOL
-suscan_analyzer_set_inspector_bandwidth_cb(
-    struct suscan_mq *mq_out,
-    void *wk_private,
-    void *cb_private)
+suscan_analyzer_inspector_is_live(suscan_analyzer_t *self, SUHANDLE handle)
 {
-  suscan_analyzer_t *analyzer = (suscan_analyzer_t *) wk_private;
+  SUBOOL live;
 
-  if (analyzer->inspector_bw_req) {
-    analyzer->inspector_bw_req = SU_FALSE;
-    (void) suscan_analyzer_set_inspector_bandwidth_slow(
-        analyzer,
-        analyzer->inspector_bw_req_handle,
-        analyzer->inspector_bw_req_value);
-  }
+  SU_TRYCATCH(suscan_analyzer_lock_inspector_list(self), return SU_FALSE);
+  live = suscan_analyzer_get_inspector(self, handle) != NULL;
+  suscan_analyzer_unlock_inspector_list(self);
 
-  return SU_FALSE;
+  return live;
 }
-/****************************** Slow methods **********************************/
+
+/*
+ * Inspector overrides are applied by the source worker itself, at the next
+ * block boundary. There is no need to go through the slow worker.
+ */
 SUBOOL
 suscan_analyzer_set_inspector_freq_overridable(
     suscan_analyzer_t *self,
     SUHANDLE handle,
     SUFREQ freq)
 {
+  struct suscan_hotconf_snapshot *snap;
+
   SU_TRYCATCH(
       self->params.mode == SUSCAN_ANALYZER_MODE_CHANNEL,
       return SU_FALSE);
 
-  self->inspector_freq_req_handle = handle;
-  self->inspector_freq_req_value  = freq;
-  self->inspector_freq_req        = SU_TRUE;
+  SU_TRYCATCH(snap = suscan_hotconf_begin(&self->hotconf), return SU_FALSE);
 
-  return suscan_worker_push(
-      self->slow_wk,
-      suscan_analyzer_set_inspector_freq_cb,
-      NULL);
+  if (!suscan_analyzer_inspector_is_live(self, handle)
+      || !suscan_hotconf_snapshot_set_inspector_freq(snap, handle, freq)) {
+    suscan_hotconf_abort(&self->hotconf, snap);
+    return SU_FALSE;
+  }
+
+  suscan_hotconf_commit(&self->hotconf, snap);
+
+  return SU_TRUE;
 }
 
 SUBOOL
@@ -357,30 +221,37 @@ suscan_analyzer_set_inspector_bandwidth_overridable(
     SUHANDLE handle,
     SUFLOAT bw)
 {
+  struct suscan_hotconf_snapshot *snap;
+
   SU_TRYCATCH(
       self->params.mode == SUSCAN_ANALYZER_MODE_CHANNEL,
       return SU_FALSE);
 
-  self->inspector_bw_req_handle = handle;
-  self->inspector_bw_req_value  = bw;
-  self->inspector_bw_req        = SU_TRUE;
+  SU_TRYCATCH(snap = suscan_hotconf_begin(&self->hotconf), return SU_FALSE);
 
-  return suscan_worker_push(
-      self->slow_wk,
-      suscan_analyzer_set_inspector_bandwidth_cb,
-      NULL);
+  if (!suscan_analyzer_inspector_is_live(self, handle)
+      || !suscan_hotconf_snapshot_set_inspector_bandwidth(snap, handle, bw)) {
+    suscan_hotconf_abort(&self->hotconf, snap);
+    return SU_FALSE;
+  }
+
+  suscan_hotconf_commit(&self->hotconf, snap);
+
+  return SU_TRUE;
 }
 
 SUBOOL
 suscan_analyzer_set_freq(suscan_analyzer_t *self, SUFREQ freq, SUFREQ lnb)
 {
+  struct suscan_hotconf_snapshot *snap;
+
   SU_TRYCATCH(
       self->params.mode == SUSCAN_ANALYZER_MODE_CHANNEL,
       return SU_FALSE);
 
-  self->freq_req_value = freq;
-  self->lnb_req_value  = lnb;
-  self->freq_req = SU_TRUE;
+  SU_TRYCATCH(snap = suscan_hotconf_begin(&self->hotconf), return SU_FALSE);
+  suscan_hotconf_snapshot_set_freq(snap, freq, lnb);
+  suscan_hotconf_commit(&self->hotconf, snap);
 
   /* This operation is rather slow. Do it somewhere else. */
   return suscan_worker_push(
@@ -412,46 +283,35 @@ suscan_analyzer_set_antenna(
     suscan_analyzer_t *analyzer,
     const char *name)
 {
-  char *req = NULL;
-  SUBOOL mutex_acquired = SU_FALSE;
+  struct suscan_hotconf_snapshot *snap;
 
-  SU_TRYCATCH(req = strdup(name), goto fail);
-
-  /* vvvvvvvvvvvvvvvvvv Acquire hotconf request mutex vvvvvvvvvvvvvvvvvvvvvvv */
   SU_TRYCATCH(
-      pthread_mutex_lock(&analyzer->hotconf_mutex) != -1,
-      goto fail);
-  mutex_acquired = SU_TRUE;
+      snap = suscan_hotconf_begin(&analyzer->hotconf),
+      return SU_FALSE);
 
-  if (analyzer->antenna_req != NULL)
-    free(analyzer->antenna_req);
-  analyzer->antenna_req = req;
-  req = NULL;
+  if (!suscan_hotconf_snapshot_set_antenna(snap, name)) {
+    suscan_hotconf_abort(&analyzer->hotconf, snap);
+    return SU_FALSE;
+  }
 
-  pthread_mutex_unlock(&analyzer->hotconf_mutex);
-  mutex_acquired = SU_FALSE;
-  /* ^^^^^^^^^^^^^^^^^^ Release hotconf request mutex ^^^^^^^^^^^^^^^^^^^^^^^ */
+  suscan_hotconf_commit(&analyzer->hotconf, snap);
 
   return suscan_worker_push(
       analyzer->slow_wk,
       suscan_analyzer_set_antenna_cb,
       NULL);
-
-fail:
-  if (mutex_acquired)
-    pthread_mutex_unlock(&analyzer->hotconf_mutex);
-
-  if (req != NULL)
-    free(req);
-
-  return SU_FALSE;
 }
 
 SUBOOL
 suscan_analyzer_set_bw(suscan_analyzer_t *analyzer, SUFLOAT bw)
 {
-  analyzer->bw_req_value = bw;
-  analyzer->bw_req = SU_TRUE;
+  struct suscan_hotconf_snapshot *snap;
+
+  SU_TRYCATCH(
+      snap = suscan_hotconf_begin(&analyzer->hotconf),
+      return SU_FALSE);
+  suscan_hotconf_snapshot_set_bandwidth(snap, bw);
+  suscan_hotconf_commit(&analyzer->hotconf, snap);
 
   /* This operation is rather slow. Do it somewhere else. */
   return suscan_worker_push(
@@ -466,38 +326,21 @@ suscan_analyzer_set_gain(
     const char *name,
     SUFLOAT value)
 {
-  struct suscan_analyzer_gain_request *req = NULL;
-  SUBOOL mutex_acquired = SU_FALSE;
+  struct suscan_hotconf_snapshot *snap;
 
-  SU_TRYCATCH(req = suscan_analyzer_gain_request_new(name, value), goto fail);
-
-  /* vvvvvvvvvvvvvvvvvv Acquire hotconf request mutex vvvvvvvvvvvvvvvvvvvvvvv */
   SU_TRYCATCH(
-      pthread_mutex_lock(&analyzer->hotconf_mutex) != -1,
-      goto fail);
-  mutex_acquired = SU_TRUE;
+      snap = suscan_hotconf_begin(&analyzer->hotconf),
+      return SU_FALSE);
 
-  SU_TRYCATCH(
-      PTR_LIST_APPEND_CHECK(analyzer->gain_request, req) != -1,
-      goto fail);
-  req = NULL;
+  if (!suscan_hotconf_snapshot_set_gain(snap, name, value)) {
+    suscan_hotconf_abort(&analyzer->hotconf, snap);
+    return SU_FALSE;
+  }
 
-  pthread_mutex_unlock(&analyzer->hotconf_mutex);
-  mutex_acquired = SU_FALSE;
-  /* ^^^^^^^^^^^^^^^^^^ Release hotconf request mutex ^^^^^^^^^^^^^^^^^^^^^^^ */
+  suscan_hotconf_commit(&analyzer->hotconf, snap);
 
   return suscan_worker_push(
       analyzer->slow_wk,
       suscan_analyzer_set_gain_cb,
       NULL);
-
-fail:
-  if (mutex_acquired)
-    pthread_mutex_unlock(&analyzer->hotconf_mutex);
-
-  if (req != NULL)
-    suscan_analyzer_gain_request_destroy(req);
-
-  return SU_FALSE;
 }
-
@@ -23,12 +23,23 @@
 #include <assert.h>
 #include <ctype.h>
 #include <libgen.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
 
 #define SU_LOG_DOMAIN "source"
 #include <confdb.h>
 #include "source.h"
+#include "decimator.h"
+#include "capture.h"
+#include "sigmf.h"
 #include <sigutils/taps.h>
 
+#ifdef HAVE_VOLK
+#  include <volk/volk.h>
+#endif /* HAVE_VOLK */
+
 #ifdef _SU_SINGLE_PRECISION
 #  define sf_read sf_read_float
 #  define SUSCAN_SOAPY_SAMPFMT SOAPY_SDR_CF32
@@ -971,6 +982,50 @@ suscan_source_config_set_samp_rate(
   config->samp_rate = samp_rate;
 }
 
+enum suscan_source_decimation
+suscan_source_config_get_decimation(const suscan_source_config_t *config)
+{
+  return config->decimation;
+}
+
+void
+suscan_source_config_set_decimation(
+    suscan_source_config_t *config,
+    enum suscan_source_decimation decimation)
+{
+  config->decimation = decimation;
+}
+
+unsigned int
+suscan_source_config_get_readahead(const suscan_source_config_t *config)
+{
+  return config->readahead;
+}
+
+void
+suscan_source_config_set_readahead(
+    suscan_source_config_t *config,
+    unsigned int readahead)
+{
+  config->readahead = readahead;
+}
+
+void
+suscan_source_config_get_start_time(
+    const suscan_source_config_t *config,
+    struct timeval *tv)
+{
+  *tv = config->start_time;
+}
+
+void
+suscan_source_config_set_start_time(
+    suscan_source_config_t *config,
+    const struct timeval *tv)
+{
+  config->start_time = *tv;
+}
+
 unsigned int
 suscan_source_config_get_average(const suscan_source_config_t *config)
 {
@@ -1237,8 +1292,11 @@ suscan_source_config_clone(const suscan_source_config_t *config)
   new->dc_remove = config->dc_remove;
   new->samp_rate = config->samp_rate;
   new->average = config->average;
+  new->decimation = config->decimation;
+  new->readahead = config->readahead;
   new->channel = config->channel;
   new->loop = config->loop;
+  new->start_time = config->start_time;
   new->device = config->device;
 
   return new;
@@ -1289,11 +1347,48 @@ suscan_source_config_helper_format_to_str(enum suscan_source_format type)
 
     case SUSCAN_SOURCE_FORMAT_WAV:
       return "WAV";
+
+    case SUSCAN_SOURCE_FORMAT_RAW_CS8:
+      return "CS8";
+
+    case SUSCAN_SOURCE_FORMAT_RAW_CU8:
+      return "CU8";
+
+    case SUSCAN_SOURCE_FORMAT_RAW_CS16:
+      return "CS16";
+
+    case SUSCAN_SOURCE_FORMAT_CAPTURE:
+      return "CAPTURE";
   }
 
   return NULL;
 }
 
+SUPRIVATE const char *
+suscan_source_config_helper_decimation_to_str(
+    enum suscan_source_decimation decimation)
+{
+  switch (decimation) {
+    case SUSCAN_SOURCE_DECIMATION_FIR:
+      return "FIR";
+
+    case SUSCAN_SOURCE_DECIMATION_MULTISTAGE:
+      return "MULTISTAGE";
+  }
+
+  return NULL;
+}
+
+SUPRIVATE enum suscan_source_decimation
+suscan_source_config_helper_str_to_decimation(const char *decimation)
+{
+  if (decimation != NULL)
+    if (strcasecmp(decimation, "MULTISTAGE") == 0)
+      return SUSCAN_SOURCE_DECIMATION_MULTISTAGE;
+
+  return SUSCAN_SOURCE_DECIMATION_FIR;
+}
+
 SUPRIVATE enum suscan_source_format
 suscan_source_type_config_helper_str_to_format(const char *format)
 {
@@ -1304,6 +1399,14 @@ suscan_source_type_config_helper_str_to_format(const char *format)
       return SUSCAN_SOURCE_FORMAT_RAW;
     else if (strcasecmp(format, "WAV") == 0)
       return SUSCAN_SOURCE_FORMAT_WAV;
+    else if (strcasecmp(format, "CS8") == 0)
+      return SUSCAN_SOURCE_FORMAT_RAW_CS8;
+    else if (strcasecmp(format, "CU8") == 0)
+      return SUSCAN_SOURCE_FORMAT_RAW_CU8;
+    else if (strcasecmp(format, "CS16") == 0)
+      return SUSCAN_SOURCE_FORMAT_RAW_CS16;
+    else if (strcasecmp(format, "CAPTURE") == 0)
+      return SUSCAN_SOURCE_FORMAT_CAPTURE;
   }
 
   return SUSCAN_SOURCE_FORMAT_AUTO;
@@ -1343,6 +1446,13 @@ suscan_source_config_to_object(const suscan_source_config_t *cfg)
     SU_TRYCATCH(suscan_object_set_field_value(new, "format", tmp), goto fail);
   }
 
+  SU_TRYCATCH(
+      tmp = suscan_source_config_helper_decimation_to_str(cfg->decimation),
+      goto fail);
+  SU_TRYCATCH(
+      suscan_object_set_field_value(new, "decimation", tmp),
+      goto fail);
+
   if (cfg->label != NULL)
     SU_CFGSAVE(value, label);
 
@@ -1361,6 +1471,7 @@ suscan_source_config_to_object(const suscan_source_config_t *cfg)
   SU_CFGSAVE(bool,  loop);
   SU_CFGSAVE(uint,  samp_rate);
   SU_CFGSAVE(uint,  average);
+  SU_CFGSAVE(uint,  readahead);
   SU_CFGSAVE(uint,  channel);
 
   /* Save SoapySDR kwargs */
@@ -1453,6 +1564,11 @@ suscan_source_config_from_object(const suscan_object_t *object)
   if ((tmp = suscan_object_get_field_value(object, "antenna")) != NULL)
     SU_TRYCATCH(suscan_source_config_set_antenna(new, tmp), goto fail);
 
+  suscan_source_config_set_decimation(
+      new,
+      suscan_source_config_helper_str_to_decimation(
+          suscan_object_get_field_value(object, "decimation")));
+
   SU_CFGLOAD(float, freq, 0);
   SU_CFGLOAD(float, lnb_freq, 0);
   SU_CFGLOAD(float, bandwidth, 0);
@@ -1461,6 +1577,7 @@ suscan_source_config_from_object(const suscan_object_t *object)
   SU_CFGLOAD(bool, loop, SU_FALSE);
   SU_CFGLOAD(uint, samp_rate, 1.8e6);
   SU_CFGLOAD(uint, channel, 0);
+  SU_CFGLOAD(uint, readahead, 0);
 
   SU_TRYCATCH(SU_CFGLOAD(uint, average, 1), goto fail);
 
@@ -1534,27 +1651,298 @@ fail:
   return NULL;
 }
 
+/****************************** Read-ahead ***********************************/
+SUPRIVATE void
+suscan_source_readahead_destroy(struct suscan_source_readahead *self)
+{
+  if (self->mutex_init)
+    pthread_mutex_destroy(&self->mutex);
+
+  if (self->cond_init)
+    pthread_cond_destroy(&self->cond);
+
+  if (self->buffer != NULL)
+    free(self->buffer);
+
+  if (self->lengths != NULL)
+    free(self->lengths);
+
+  free(self);
+}
+
+SUPRIVATE struct suscan_source_readahead *
+suscan_source_readahead_new(unsigned int depth, SUSCOUNT block_size)
+{
+  struct suscan_source_readahead *new = NULL;
+
+  SU_TRYCATCH(
+      new = calloc(1, sizeof(struct suscan_source_readahead)),
+      goto fail);
+
+  new->depth = depth;
+  new->block_size = block_size;
+
+  SU_TRYCATCH(
+      new->buffer = malloc((depth + 1) * block_size * sizeof(SUCOMPLEX)),
+      goto fail);
+
+  SU_TRYCATCH(new->lengths = calloc(depth, sizeof(SUSDIFF)), goto fail);
+
+  new->scratch = new->buffer + depth * block_size;
+
+  SU_TRYCATCH(pthread_mutex_init(&new->mutex, NULL) == 0, goto fail);
+  new->mutex_init = SU_TRUE;
+
+  SU_TRYCATCH(pthread_cond_init(&new->cond, NULL) == 0, goto fail);
+  new->cond_init = SU_TRUE;
+
+  return new;
+
+fail:
+  if (new != NULL)
+    suscan_source_readahead_destroy(new);
+
+  return NULL;
+}
+
+/*
+ * Sleeping protocol: the sleeper announces itself in *waiting and
+ * re-checks the ring under the mutex. The waker publishes its counter
+ * first, and only takes the mutex if it sees someone waiting. Both
+ * operations are sequentially consistent, so at least one side always
+ * sees the other.
+ */
+SUPRIVATE void
+suscan_source_readahead_wake(
+    struct suscan_source_readahead *self,
+    int *waiting)
+{
+  if (__atomic_load_n(waiting, __ATOMIC_SEQ_CST)) {
+    pthread_mutex_lock(&self->mutex);
+    pthread_cond_broadcast(&self->cond);
+    pthread_mutex_unlock(&self->mutex);
+  }
+}
+
+SUPRIVATE unsigned int
+suscan_source_readahead_fill(const struct suscan_source_readahead *self)
+{
+  return __atomic_load_n(&self->head, __ATOMIC_ACQUIRE)
+      - __atomic_load_n(&self->tail, __ATOMIC_ACQUIRE);
+}
+
+SUPRIVATE void *
+suscan_source_readahead_thread(void *data)
+{
+  suscan_source_t *source = (suscan_source_t *) data;
+  struct suscan_source_readahead *self = source->readahead;
+  SUSDIFF got = 0;
+  SUBOOL pending = SU_FALSE;
+  unsigned int fill;
+  unsigned int head = self->head;
+
+  while (!__atomic_load_n(&self->halt, __ATOMIC_ACQUIRE)) {
+    fill = head - __atomic_load_n(&self->tail, __ATOMIC_SEQ_CST);
+
+    if (fill == self->depth) {
+      /*
+       * Device sources cannot wait: keep draining the device into the
+       * scratch block and account the loss. EOS and errors, on the other
+       * hand, are kept until there is room to report them.
+       */
+      if (source->config->type == SUSCAN_SOURCE_TYPE_SDR && !pending) {
+        got = (source->read) (source, self->scratch, self->block_size);
+        if (got > 0) {
+          __atomic_fetch_add(&self->overflows, 1, __ATOMIC_RELAXED);
+          continue;
+        }
+
+        pending = SU_TRUE;
+      }
+
+      pthread_mutex_lock(&self->mutex);
+      __atomic_store_n(&self->producer_waiting, 1, __ATOMIC_SEQ_CST);
+      while (head - __atomic_load_n(&self->tail, __ATOMIC_SEQ_CST)
+          == self->depth
+          && !__atomic_load_n(&self->halt, __ATOMIC_ACQUIRE))
+        pthread_cond_wait(&self->cond, &self->mutex);
+      __atomic_store_n(&self->producer_waiting, 0, __ATOMIC_RELAXED);
+      pthread_mutex_unlock(&self->mutex);
+
+      continue;
+    }
+
+    if (!pending)
+      got = (source->read) (
+          source,
+          self->buffer + (head % self->depth) * self->block_size,
+          self->block_size);
+
+    self->lengths[head % self->depth] = got;
+    __atomic_store_n(&self->head, ++head, __ATOMIC_SEQ_CST);
+
+    /* Only this thread writes it, but stats are read from elsewhere */
+    if (++fill > __atomic_load_n(&self->high_water, __ATOMIC_RELAXED))
+      __atomic_store_n(&self->high_water, fill, __ATOMIC_RELAXED);
+
+    suscan_source_readahead_wake(self, &self->consumer_waiting);
+
+    /* End of stream or read error: the consumer will find out */
+    if (got <= 0)
+      break;
+  }
+
+  return NULL;
+}
+
+SUPRIVATE SUBOOL
+suscan_source_readahead_start(suscan_source_t *source)
+{
+  struct suscan_source_readahead *self = source->readahead;
+
+  self->head = self->tail = 0;
+  self->tail_offset = 0;
+  self->halt = SU_FALSE;
+
+  SU_TRYCATCH(
+      pthread_create(
+          &self->thread,
+          NULL,
+          suscan_source_readahead_thread,
+          source) == 0,
+      return SU_FALSE);
+
+  self->thread_running = SU_TRUE;
+
+  return SU_TRUE;
+}
+
+SUPRIVATE void
+suscan_source_readahead_stop(suscan_source_t *source)
+{
+  struct suscan_source_readahead *self = source->readahead;
+
+  if (!self->thread_running)
+    return;
+
+  pthread_mutex_lock(&self->mutex);
+  __atomic_store_n(&self->halt, SU_TRUE, __ATOMIC_RELEASE);
+  pthread_cond_broadcast(&self->cond);
+  pthread_mutex_unlock(&self->mutex);
+
+  pthread_join(self->thread, NULL);
+
+  self->thread_running = SU_FALSE;
+}
+
+SUPRIVATE SUSDIFF
+suscan_source_readahead_read(
+    suscan_source_t *source,
+    SUCOMPLEX *buffer,
+    SUSCOUNT max)
+{
+  struct suscan_source_readahead *self = source->readahead;
+  unsigned int index;
+  SUSDIFF got;
+
+  if (source->force_eos)
+    return 0;
+
+  if (__atomic_load_n(&self->head, __ATOMIC_SEQ_CST) == self->tail) {
+    pthread_mutex_lock(&self->mutex);
+    __atomic_store_n(&self->consumer_waiting, 1, __ATOMIC_SEQ_CST);
+    while (__atomic_load_n(&self->head, __ATOMIC_SEQ_CST) == self->tail
+        && !__atomic_load_n(&self->halt, __ATOMIC_ACQUIRE))
+      pthread_cond_wait(&self->cond, &self->mutex);
+    __atomic_store_n(&self->consumer_waiting, 0, __ATOMIC_RELAXED);
+    pthread_mutex_unlock(&self->mutex);
+
+    /* Capture stopped while we were waiting */
+    if (__atomic_load_n(&self->head, __ATOMIC_SEQ_CST) == self->tail)
+      return 0;
+  }
+
+  index = self->tail % self->depth;
+  got = self->lengths[index];
+
+  /* Errors and EOS are sticky: the producer has already left */
+  if (got <= 0)
+    return got;
+
+  got -= self->tail_offset;
+  if (max > got)
+    max = got;
+
+  memcpy(
+      buffer,
+      self->buffer + index * self->block_size + self->tail_offset,
+      max * sizeof(SUCOMPLEX));
+
+  self->tail_offset += max;
+
+  if (self->tail_offset == self->lengths[index]) {
+    self->tail_offset = 0;
+    __atomic_store_n(&self->tail, self->tail + 1, __ATOMIC_SEQ_CST);
+    suscan_source_readahead_wake(self, &self->producer_waiting);
+  }
+
+  return max;
+}
+
+SUBOOL
+suscan_source_get_readahead_stats(
+    const suscan_source_t *source,
+    struct suscan_source_readahead_stats *stats)
+{
+  const struct suscan_source_readahead *self = source->readahead;
+
+  if (self == NULL)
+    return SU_FALSE;
+
+  stats->depth = self->depth;
+  stats->fill = suscan_source_readahead_fill(self);
+  stats->high_water = __atomic_load_n(&self->high_water, __ATOMIC_RELAXED);
+  stats->overflows = __atomic_load_n(&self->overflows, __ATOMIC_RELAXED);
+
+  return SU_TRUE;
+}
+
 /****************************** Source API ***********************************/
 void
 suscan_source_destroy(suscan_source_t *source)
 {
+  if (source->readahead != NULL)
+    suscan_source_readahead_stop(source);
+
   if (source->sf != NULL)
     sf_close(source->sf);
 
+  if (source->map != NULL)
+    munmap(source->map, source->map_length);
+
+  if (source->capture != NULL)
+    suscan_capture_reader_destroy(source->capture);
+
+  if (source->fd != -1)
+    close(source->fd);
+
   if (source->rx_stream != NULL)
     SoapySDRDevice_closeStream(source->sdr, source->rx_stream);
 
   if (source->sdr != NULL)
     SoapySDRDevice_unmake(source->sdr);
 
+  if (source->readahead != NULL)
+    suscan_source_readahead_destroy(source->readahead);
+
   if (source->config != NULL)
     suscan_source_config_destroy(source->config);
 
-  if (source->antialias_alloc != NULL)
-    free(source->antialias_alloc);
+  if (source->decimator != NULL)
+    suscan_decimator_destroy(source->decimator);
 
-  if (source->decim_buf != NULL)
-    free(source->decim_buf);
+  if (source->decim_chain != NULL)
+    suscan_decimator_chain_destroy(source->decim_chain);
 
   free(source);
 }
@@ -1565,94 +1953,295 @@ suscan_source_configure_decimation(
     suscan_source_t *self,
     int decim)
 {
-  int i;
-  SUFLOAT *antialias;
-
-  /* Decim is M: Compute an antialias filter of M * SUSCAN_SOURCE_POLYPHASE_BANK_SIZE */
-
   SU_TRYCATCH(decim > 0, return SU_FALSE);
 
   self->decim = decim;
-  self->decim_length = decim * SUSCAN_SOURCE_ANTIALIAS_REL_SIZE;
 
-  /* Pointers are initialized in 0, -decim, -2 * decim, -3 * decim... */
+  if (self->config->decimation == SUSCAN_SOURCE_DECIMATION_MULTISTAGE) {
+    SU_TRYCATCH(
+        self->decim_chain = suscan_decimator_chain_new(
+            decim,
+            SUSCAN_SOURCE_DECIMATOR_TAPS_PER_PHASE,
+            SUSCAN_SOURCE_DECIMATOR_BUFFER_SIZE),
+        return SU_FALSE);
+  } else {
+    SU_TRYCATCH(
+        self->decimator = suscan_decimator_new(
+            decim,
+            SUSCAN_SOURCE_DECIMATOR_TAPS_PER_PHASE,
+            SUSCAN_SOURCE_DECIMATOR_BUFFER_SIZE),
+        return SU_FALSE);
+  }
 
-  for (i = 0; i < SUSCAN_SOURCE_ANTIALIAS_REL_SIZE; ++i)
-    self->ptrs[i] = -i * decim;
+  return SU_TRUE;
+}
 
-  /*
-   * 1 filter:  [DECIM]
-   * 2 filters: [NULLS][DECIM][DECIM]
-   * 3 filters: [NULLS][NULLS][DECIM][DECIM][DECIM]
-   */
-  SU_TRYCATCH(
-      self->antialias_alloc = calloc(
-          2 * SUSCAN_SOURCE_ANTIALIAS_REL_SIZE - 1,
-          decim * sizeof(SUFLOAT)),
-      return SU_FALSE);
+/*
+ * Sample conversion kernels for memory-mapped raw files. They are written
+ * as plain loops over the interleaved real components so that the compiler
+ * can vectorize them, and IQ reversal (negation of the Q component) is
+ * fused in the same pass.
+ */
+SUPRIVATE void
+suscan_source_convert_cf32(
+    SUCOMPLEX *buf,
+    const void *data,
+    SUSCOUNT size,
+    SUBOOL iq_rev)
+{
+  SUFLOAT *out = (SUFLOAT *) buf;
+  const float *in = (const float *) data;
+  SUFLOAT q_sign = iq_rev ? -1 : 1;
+  SUSCOUNT i;
 
-  SU_TRYCATCH(
-      self->decim_buf = malloc(
-          SUSCAN_SOURCE_DECIMATOR_BUFFER_SIZE * sizeof(SUCOMPLEX)),
-      return SU_FALSE);
+#ifdef _SU_SINGLE_PRECISION
+  if (!iq_rev) {
+    memcpy(buf, data, size * sizeof(SUCOMPLEX));
+    return;
+  }
+#endif /* _SU_SINGLE_PRECISION */
 
-  antialias = self->antialias_alloc
-      + (SUSCAN_SOURCE_ANTIALIAS_REL_SIZE - 1) * decim;
-  self->antialias = antialias;
+  for (i = 0; i < size; ++i) {
+    out[2 * i]     = in[2 * i];
+    out[2 * i + 1] = q_sign * in[2 * i + 1];
+  }
+}
 
-  /*
-   * Decim 1: Filter cutoff: 1
-   * Decim 2: Filter cutoff: .5
-   * Decim 3: Filter cutoff: .3333...
-   */
-  su_taps_brickwall_lp_init(
-      antialias,
-      1 / (SUFLOAT) decim,
-      self->decim_length);
+SUPRIVATE void
+suscan_source_convert_cs8(
+    SUCOMPLEX *buf,
+    const void *data,
+    SUSCOUNT size,
+    SUBOOL iq_rev)
+{
+  SUFLOAT *out = (SUFLOAT *) buf;
+  const int8_t *in = (const int8_t *) data;
+  SUFLOAT i_scale = 1. / 128;
+  SUFLOAT q_scale = iq_rev ? -i_scale : i_scale;
+  SUSCOUNT i;
 
-  return SU_TRUE;
+#if defined(HAVE_VOLK) && defined(_SU_SINGLE_PRECISION)
+  if (!iq_rev) {
+    volk_8i_s32f_convert_32f(out, in, 128., 2 * size);
+    return;
+  }
+#endif /* defined(HAVE_VOLK) && defined(_SU_SINGLE_PRECISION) */
+
+  for (i = 0; i < size; ++i) {
+    out[2 * i]     = i_scale * in[2 * i];
+    out[2 * i + 1] = q_scale * in[2 * i + 1];
+  }
 }
 
-#define ACCUMULATE(val) \
-  self->accums[val] += data[i] * (self->antialias[self->ptrs[val]++])
-#define IF_DONE_PRODUCE_SAMPLE(val) \
-    if (self->ptrs[val] == self->decim_length) { \
-      self->decim_buf[samples++] = self->accums[val]; \
-      self->accums[val] = self->ptrs[val] = 0; \
-      if (samples >= SUSCAN_SOURCE_DECIMATOR_BUFFER_SIZE) \
-        break; \
-    }
+SUPRIVATE void
+suscan_source_convert_cu8(
+    SUCOMPLEX *buf,
+    const void *data,
+    SUSCOUNT size,
+    SUBOOL iq_rev)
+{
+  SUFLOAT *out = (SUFLOAT *) buf;
+  const uint8_t *in = (const uint8_t *) data;
+  SUFLOAT i_scale = 1. / 128;
+  SUFLOAT q_scale = iq_rev ? -i_scale : i_scale;
+  SUSCOUNT i;
 
-SUPRIVATE SUSCOUNT
-suscan_source_feed_decimator(
-    suscan_source_t *self,
-    const SUCOMPLEX *data,
-    SUSCOUNT len)
-{
-  SUSCOUNT samples = 0;
+  /* RTL-SDR style: unsigned samples centered around 127.5 */
+  for (i = 0; i < size; ++i) {
+    out[2 * i]     = i_scale * (in[2 * i]     - (SUFLOAT) 127.5);
+    out[2 * i + 1] = q_scale * (in[2 * i + 1] - (SUFLOAT) 127.5);
+  }
+}
+
+SUPRIVATE void
+suscan_source_convert_cs16(
+    SUCOMPLEX *buf,
+    const void *data,
+    SUSCOUNT size,
+    SUBOOL iq_rev)
+{
+  SUFLOAT *out = (SUFLOAT *) buf;
+  const int16_t *in = (const int16_t *) data;
+  SUFLOAT i_scale = 1. / 32768;
+  SUFLOAT q_scale = iq_rev ? -i_scale : i_scale;
   SUSCOUNT i;
 
-  /* Loop unrolling. I'm sorry. */
+#if defined(HAVE_VOLK) && defined(_SU_SINGLE_PRECISION)
+  if (!iq_rev) {
+    volk_16i_s32f_convert_32f(out, in, 32768., 2 * size);
+    return;
+  }
+#endif /* defined(HAVE_VOLK) && defined(_SU_SINGLE_PRECISION) */
+
+  for (i = 0; i < size; ++i) {
+    out[2 * i]     = i_scale * in[2 * i];
+    out[2 * i + 1] = q_scale * in[2 * i + 1];
+  }
+}
+
+/*
+ * Raw IQ files are mapped in memory and read sequentially. This saves us
+ * from going through libsndfile (and its per-call buffering) for captures
+ * that are already in a format we can convert directly.
+ */
+SUPRIVATE SUBOOL
+suscan_source_open_file_mmap(suscan_source_t *source)
+{
+  struct stat sbuf;
+  void *map = MAP_FAILED;
+  int fd = -1;
+  size_t length = 0;
+  size_t sample_size;
+  void (*convert) (SUCOMPLEX *, const void *, SUSCOUNT, SUBOOL);
+
+#if defined(__BYTE_ORDER__) && __BYTE_ORDER__ != __ORDER_LITTLE_ENDIAN__
+  /* Raw files are little endian. Let libsndfile handle the swap */
+  goto fail;
+#endif
+
+  switch (source->config->format) {
+    case SUSCAN_SOURCE_FORMAT_RAW_CS8:
+      sample_size = 2 * sizeof(int8_t);
+      convert = suscan_source_convert_cs8;
+      break;
 
-  for (i = 0; i < len; ++i) {
-    ACCUMULATE(0);
-    ACCUMULATE(1);
-    ACCUMULATE(2);
-    ACCUMULATE(3);
-    ACCUMULATE(4);
+    case SUSCAN_SOURCE_FORMAT_RAW_CU8:
+      sample_size = 2 * sizeof(uint8_t);
+      convert = suscan_source_convert_cu8;
+      break;
 
-    IF_DONE_PRODUCE_SAMPLE(0)
-    else IF_DONE_PRODUCE_SAMPLE(1)
-    else IF_DONE_PRODUCE_SAMPLE(2)
-    else IF_DONE_PRODUCE_SAMPLE(3)
-    else IF_DONE_PRODUCE_SAMPLE(4)
+    case SUSCAN_SOURCE_FORMAT_RAW_CS16:
+      sample_size = 2 * sizeof(int16_t);
+      convert = suscan_source_convert_cs16;
+      break;
+
+    default:
+      sample_size = 2 * sizeof(float);
+      convert = suscan_source_convert_cf32;
   }
 
-  return samples;
+  if ((fd = open(source->config->path, O_RDONLY)) == -1)
+    goto fail;
+
+  if (fstat(fd, &sbuf) == -1 || !S_ISREG(sbuf.st_mode))
+    goto fail;
+
+  /* Empty files or files with less than one sample cannot be mapped */
+  if (sbuf.st_size < sample_size)
+    goto fail;
+
+  length = sbuf.st_size;
+
+  if ((map = mmap(
+      NULL,
+      length,
+      PROT_READ,
+      MAP_PRIVATE,
+      fd,
+      0)) == MAP_FAILED)
+    goto fail;
+
+#ifdef MADV_SEQUENTIAL
+  (void) madvise(map, length, MADV_SEQUENTIAL);
+#endif /* MADV_SEQUENTIAL */
+
+  source->fd = fd;
+  source->map = map;
+  source->map_length = length;
+  source->map_size = length - length % sample_size;
+  source->map_ptr = 0;
+  source->map_sample_size = sample_size;
+  source->convert = convert;
+
+  return SU_TRUE;
+
+fail:
+  if (map != MAP_FAILED)
+    munmap(map, length);
+
+  if (fd != -1)
+    close(fd);
+
+  return SU_FALSE;
 }
 
-#undef ACCUMULATE
-#undef IF_DONE_PRODUCE_SAMPLE
+SUPRIVATE int
+suscan_source_format_to_sf_subtype(enum suscan_source_format format)
+{
+  switch (format) {
+    case SUSCAN_SOURCE_FORMAT_RAW_CS8:
+      return SF_FORMAT_PCM_S8;
+
+    case SUSCAN_SOURCE_FORMAT_RAW_CU8:
+      return SF_FORMAT_PCM_U8;
+
+    case SUSCAN_SOURCE_FORMAT_RAW_CS16:
+      return SF_FORMAT_PCM_16;
+
+    default:
+      return SF_FORMAT_FLOAT;
+  }
+}
+
+/*
+ * SigMF recordings are raw files described by a JSON sidecar. Format,
+ * sample rate, frequency and start time are taken from the metadata, and
+ * the data file is opened as any other raw file.
+ */
+SUPRIVATE SUBOOL
+suscan_source_load_sigmf(suscan_source_t *source)
+{
+  struct suscan_sigmf_info info;
+  char *meta_path = NULL;
+  char *data_path = NULL;
+  SUBOOL ok = SU_FALSE;
+
+  SU_TRYCATCH(
+      meta_path = suscan_sigmf_get_meta_path(source->config->path),
+      goto done);
+  SU_TRYCATCH(
+      data_path = suscan_sigmf_get_data_path(source->config->path),
+      goto done);
+
+  if (!suscan_sigmf_parse(meta_path, &info))
+    goto done;
+
+  SU_TRYCATCH(
+      suscan_source_config_set_path(source->config, data_path),
+      goto done);
+
+  source->config->format = info.format;
+
+  if (info.have_samp_rate)
+    source->config->samp_rate = SU_FLOOR(info.samp_rate + .5);
+
+  if (info.have_freq)
+    source->config->freq = info.freq;
+
+  if (info.have_start_time)
+    source->config->start_time = info.start_time;
+
+  if (source->config->samp_rate < 1) {
+    SU_ERROR("%s: sample rate not found in SigMF metadata\n", meta_path);
+    goto done;
+  }
+
+  SU_INFO(
+      "SigMF recording: %s, sample rate = %d\n",
+      suscan_source_config_helper_format_to_str(source->config->format),
+      source->config->samp_rate);
+
+  ok = SU_TRUE;
+
+done:
+  if (meta_path != NULL)
+    free(meta_path);
+
+  if (data_path != NULL)
+    free(data_path);
+
+  return ok;
+}
 
 SUPRIVATE SUBOOL
 suscan_source_open_file(suscan_source_t *source)
@@ -1662,7 +2251,35 @@ suscan_source_open_file(suscan_source_t *source)
     return SU_FALSE;
   }
 
+  if (suscan_sigmf_is_sigmf_path(source->config->path))
+    SU_TRYCATCH(suscan_source_load_sigmf(source), return SU_FALSE);
+
+  if (source->config->format == SUSCAN_SOURCE_FORMAT_CAPTURE
+      || (source->config->format == SUSCAN_SOURCE_FORMAT_AUTO
+          && suscan_capture_file_probe(source->config->path))) {
+    if ((source->capture = suscan_capture_reader_new(
+        source->config->path,
+        source->config->loop)) == NULL) {
+      SU_ERROR(
+          "Failed to open %s as suscan capture file\n",
+          source->config->path);
+      return SU_FALSE;
+    }
+
+    source->config->samp_rate =
+        suscan_capture_reader_get_samp_rate(source->capture);
+    source->samp_rate = source->config->samp_rate;
+    source->iq_file = SU_TRUE;
+
+    SU_INFO(
+        "Capture file source opened, sample rate = %d\n",
+        source->config->samp_rate);
+
+    return SU_TRUE;
+  }
+
   switch (source->config->format) {
+    case SUSCAN_SOURCE_FORMAT_CAPTURE: /* Handled above */
     case SUSCAN_SOURCE_FORMAT_WAV:
     case SUSCAN_SOURCE_FORMAT_AUTO:
       /* Autodetect: open as wav and, if failed, attempt to open as raw */
@@ -1688,7 +2305,22 @@ suscan_source_open_file(suscan_source_t *source)
       /* No, not an error. There is no break here. */
 
     case SUSCAN_SOURCE_FORMAT_RAW:
-      source->sf_info.format = SF_FORMAT_RAW | SF_FORMAT_FLOAT | SF_ENDIAN_LITTLE;
+    case SUSCAN_SOURCE_FORMAT_RAW_CS8:
+    case SUSCAN_SOURCE_FORMAT_RAW_CU8:
+    case SUSCAN_SOURCE_FORMAT_RAW_CS16:
+      if (suscan_source_open_file_mmap(source)) {
+        SU_INFO(
+            "Raw file source mapped in memory (%lu samples)\n",
+            (unsigned long) (source->map_size / source->map_sample_size));
+        source->sf_info.channels = 2;
+        source->sf_info.samplerate = source->config->samp_rate;
+        break;
+      }
+
+      source->sf_info.format =
+          SF_FORMAT_RAW
+          | suscan_source_format_to_sf_subtype(source->config->format)
+          | SF_ENDIAN_LITTLE;
       source->sf_info.channels = 2;
       source->sf_info.samplerate = source->config->samp_rate;
       if ((source->sf = sf_open(
@@ -1879,6 +2511,52 @@ suscan_source_open_sdr(suscan_source_t *source)
   return SU_TRUE;
 }
 
+SUPRIVATE SUSDIFF
+suscan_source_read_file_mmap(
+    suscan_source_t *source,
+    SUCOMPLEX *buf,
+    SUSCOUNT max)
+{
+  SUSCOUNT avail;
+
+  if (source->force_eos)
+    return 0;
+
+  if (source->map_ptr == source->map_size) {
+    if (!source->config->loop)
+      return 0;
+
+    source->map_ptr = 0;
+  }
+
+  avail = (source->map_size - source->map_ptr) / source->map_sample_size;
+
+  if (max > avail)
+    max = avail;
+
+  (source->convert) (
+      buf,
+      (const char *) source->map + source->map_ptr,
+      max,
+      __atomic_load_n(&source->iq_rev, __ATOMIC_RELAXED));
+
+  source->map_ptr += max * source->map_sample_size;
+
+  return max;
+}
+
+SUPRIVATE SUSDIFF
+suscan_source_read_capture(
+    suscan_source_t *source,
+    SUCOMPLEX *buf,
+    SUSCOUNT max)
+{
+  if (source->force_eos)
+    return 0;
+
+  return suscan_capture_reader_read(source->capture, buf, max);
+}
+
 SUPRIVATE SUSDIFF
 suscan_source_read_file(suscan_source_t *source, SUCOMPLEX *buf, SUSCOUNT max)
 {
@@ -1889,9 +2567,6 @@ suscan_source_read_file(suscan_source_t *source, SUCOMPLEX *buf, SUSCOUNT max)
   if (source->force_eos)
     return 0;
 
-  if (max > SUSCAN_SOURCE_DEFAULT_BUFSIZ)
-    max = SUSCAN_SOURCE_DEFAULT_BUFSIZ;
-
   real_count = max * (source->iq_file ? 2 : 1);
 
   as_real = (SUFLOAT *) buf;
@@ -1961,11 +2636,30 @@ suscan_source_read_sdr(suscan_source_t *source, SUCOMPLEX *buf, SUSCOUNT max)
   return result;
 }
 
+SUPRIVATE SUSDIFF
+suscan_source_acquire(suscan_source_t *source, SUCOMPLEX *buffer, SUSCOUNT max)
+{
+  SUSDIFF got;
+
+  if (source->readahead != NULL)
+    got = suscan_source_readahead_read(source, buffer, max);
+  else
+    got = (source->read) (source, buffer, max);
+
+  /* Software DC removal and IQ balance, for devices that lack them */
+  if (got > 0 && suscan_iq_corrector_is_enabled(&source->iqcorr))
+    suscan_iq_corrector_feed(&source->iqcorr, buffer, got);
+
+  return got;
+}
+
 SUSDIFF
 suscan_source_read(suscan_source_t *source, SUCOMPLEX *buffer, SUSCOUNT max)
 {
   SUSDIFF got;
   SUSCOUNT result;
+  SUSCOUNT len;
+  SUCOMPLEX *input;
   SU_TRYCATCH(source->capturing, return SU_FALSE);
 
   if (source->read == NULL) {
@@ -1973,20 +2667,91 @@ suscan_source_read(suscan_source_t *source, SUCOMPLEX *buffer, SUSCOUNT max)
     return -1;
   }
 
-  if (source->decim > 1) {
-    if (max > SUSCAN_SOURCE_DECIMATOR_BUFFER_SIZE)
-      max = SUSCAN_SOURCE_DECIMATOR_BUFFER_SIZE;
-
+  if (source->decimator != NULL) {
+    /*
+     * Samples are acquired directly into the decimator's history, and
+     * decimated samples are written directly into the caller's buffer.
+     */
     do {
-      if ((got = (source->read) (source, buffer, max)) < 1)
+      input = suscan_decimator_get_input(source->decimator, max, &len);
+      if ((got = suscan_source_acquire(source, input, len)) < 1)
         return got;
-      result = suscan_source_feed_decimator(source, buffer, got);
+      result = suscan_decimator_feed(source->decimator, got, buffer, max);
     } while (result == 0);
 
-    memcpy(buffer, source->decim_buf, result * sizeof(SUCOMPLEX));
+    return result;
+  } else if (source->decim_chain != NULL) {
+    /* Deliver samples left by the previous call before reading more */
+    do {
+      got = 0;
+      if (suscan_decimator_chain_get_pending(source->decim_chain) == 0) {
+        input = suscan_decimator_chain_get_input(
+            source->decim_chain,
+            max,
+            &len);
+        if ((got = suscan_source_acquire(source, input, len)) < 1)
+          return got;
+      }
+      result = suscan_decimator_chain_feed(
+          source->decim_chain,
+          got,
+          buffer,
+          max);
+    } while (result == 0);
 
     return result;
-  } else return (source->read) (source, buffer, max);
+  } else return suscan_source_acquire(source, buffer, max);
+}
+
+SUBOOL
+suscan_source_seek(suscan_source_t *source, SUSCOUNT sample)
+{
+  SUBOOL restart = SU_FALSE;
+  SUBOOL ok = SU_FALSE;
+
+  if (source->config->type != SUSCAN_SOURCE_TYPE_FILE) {
+    SU_ERROR("Only file sources can be seeked\n");
+    return SU_FALSE;
+  }
+
+  /* Blocks already read ahead belong to the previous position */
+  if (source->readahead != NULL && source->readahead->thread_running) {
+    suscan_source_readahead_stop(source);
+    restart = SU_TRUE;
+  }
+
+  if (source->map != NULL) {
+    if (sample > source->map_size / source->map_sample_size) {
+      SU_ERROR("Seek past the end of the file\n");
+      goto done;
+    }
+
+    source->map_ptr = sample * source->map_sample_size;
+  } else if (source->capture != NULL) {
+    SU_TRYCATCH(suscan_capture_reader_seek(source->capture, sample), goto done);
+  } else if (source->sf != NULL) {
+    if (sf_seek(source->sf, sample, SEEK_SET) == -1) {
+      SU_ERROR("Seek failed: %s\n", sf_strerror(source->sf));
+      goto done;
+    }
+  }
+
+  if (source->decimator != NULL)
+    suscan_decimator_reset(source->decimator);
+
+  if (source->decim_chain != NULL)
+    suscan_decimator_chain_reset(source->decim_chain);
+
+  /* DC and IQ imbalance estimates belong to the previous position */
+  suscan_iq_corrector_reset(&source->iqcorr);
+
+  ok = SU_TRUE;
+
+done:
+  if (restart)
+    SU_TRYCATCH(suscan_source_readahead_start(source), ok = SU_FALSE);
+
+  return ok;
 }
 
 SUBOOL
@@ -2011,7 +2776,15 @@ suscan_source_start_capture(suscan_source_t *source)
 
   source->capturing = SU_TRUE;
 
+  if (source->readahead != NULL)
+    SU_TRYCATCH(suscan_source_readahead_start(source), goto fail);
+
   return SU_TRUE;
+
+fail:
+  suscan_source_stop_capture(source);
+
+  return SU_FALSE;
 }
 
 SUBOOL
@@ -2022,6 +2795,10 @@ suscan_source_stop_capture(suscan_source_t *source)
     return SU_TRUE;
   }
 
+  /* Stop the producer before the device goes away */
+  if (source->readahead != NULL)
+    suscan_source_readahead_stop(source);
+
   if (source->config->type == SUSCAN_SOURCE_TYPE_SDR) {
     if (SoapySDRDevice_deactivateStream(
         source->sdr,
@@ -2061,6 +2838,25 @@ suscan_source_set_agc(suscan_source_t *source, SUBOOL set)
   return SU_TRUE;
 }
 
+/*
+ * Returns SU_TRUE if the source is able to perform IQ reversal by itself
+ * (i.e. during sample conversion). Otherwise, it is up to the caller to
+ * reverse the samples.
+ */
+SUBOOL
+suscan_source_set_iq_reverse(suscan_source_t *source, SUBOOL rev)
+{
+  /* Read by the read-ahead thread, if any */
+  if (source->map == NULL) {
+    __atomic_store_n(&source->iq_rev, SU_FALSE, __ATOMIC_RELAXED);
+    return SU_FALSE;
+  }
+
+  __atomic_store_n(&source->iq_rev, rev, __ATOMIC_RELAXED);
+
+  return SU_TRUE;
+}
+
 SUBOOL
 suscan_source_set_dc_remove(suscan_source_t *source, SUBOOL remove)
 {
@@ -2070,10 +2866,18 @@ suscan_source_set_dc_remove(suscan_source_t *source, SUBOOL remove)
   if (source->config->type == SUSCAN_SOURCE_TYPE_FILE)
     return SU_FALSE;
 
-  if (SoapySDRDevice_setDCOffsetMode(
+  if (!SoapySDRDevice_hasDCOffsetMode(
       source->sdr,
       SOAPY_SDR_RX,
-      0,
+      source->config->channel)) {
+    /* No hardware support: toggle the software DC blocker */
+    source->soft_dc_correction = remove;
+    suscan_iq_corrector_set_dc_remove(&source->iqcorr, remove);
+    source->config->dc_remove = remove;
+  } else if (SoapySDRDevice_setDCOffsetMode(
+      source->sdr,
+      SOAPY_SDR_RX,
+      source->config->channel,
       remove ? true : false)
       != 0) {
     SU_ERROR("Failed to set DC mode\n");
@@ -2274,7 +3078,10 @@ suscan_source_config_check(const suscan_source_config_t *config)
 
   if (config->samp_rate < 1
       && !(config->type == SUSCAN_SOURCE_TYPE_FILE
-          && config->format == SUSCAN_SOURCE_FORMAT_WAV)) {
+          && (config->format == SUSCAN_SOURCE_FORMAT_WAV
+              || config->format == SUSCAN_SOURCE_FORMAT_CAPTURE
+              || (config->path != NULL
+                  && suscan_sigmf_is_sigmf_path(config->path))))) {
     SU_ERROR("Sample rate cannot be zero!\n");
     return SU_FALSE;
   }
@@ -2292,6 +3099,7 @@ suscan_source_new(suscan_source_config_t *config)
   SU_TRYCATCH(new->config = suscan_source_config_clone(config), goto fail);
 
   new->decim = 1;
+  new->fd = -1;
 
   if (config->average > 1)
     SU_TRYCATCH(
@@ -2301,7 +3109,12 @@ suscan_source_new(suscan_source_config_t *config)
   switch (new->config->type) {
     case SUSCAN_SOURCE_TYPE_FILE:
       SU_TRYCATCH(suscan_source_open_file(new), goto fail);
-      new->read = suscan_source_read_file;
+      if (new->capture != NULL)
+        new->read = suscan_source_read_capture;
+      else if (new->map != NULL)
+        new->read = suscan_source_read_file_mmap;
+      else
+        new->read = suscan_source_read_file;
       break;
 
     case SUSCAN_SOURCE_TYPE_SDR:
@@ -2314,6 +3127,19 @@ suscan_source_new(suscan_source_config_t *config)
       goto fail;
   }
 
+  suscan_iq_corrector_init(
+      &new->iqcorr,
+      SUSCAN_SOURCE_IQCORR_TIME_CONSTANT * new->samp_rate);
+  suscan_iq_corrector_set_dc_remove(&new->iqcorr, new->soft_dc_correction);
+  suscan_iq_corrector_set_iq_balance(&new->iqcorr, new->soft_iq_balance);
+
+  if (config->readahead > 0)
+    SU_TRYCATCH(
+        new->readahead = suscan_source_readahead_new(
+            config->readahead,
+            SU_MAX(new->mtu, SUSCAN_SOURCE_READAHEAD_BLOCK_SIZE)),
+        goto fail);
+
   return new;
 
 fail:
@@ -25,12 +25,16 @@
 extern "C" {
 #endif /* __cplusplus */
 
+#include <pthread.h>
+#include <stdint.h>
+#include <sys/time.h>
 #include <sndfile.h>
 #include <sigutils/sigutils.h>
 #include <SoapySDR/Device.h>
 #include <SoapySDR/Formats.h>
 #include <SoapySDR/Version.h>
 #include "../util/object.h"
+#include "iqcorr.h"
 
 #define SUSCAN_SOURCE_DEFAULT_BUFSIZ 1024
 
@@ -39,8 +43,10 @@ extern "C" {
 #define SUSCAN_SOURCE_DEFAULT_SAMP_RATE 1000000
 #define SUSCAN_SOURCE_DEFAULT_BANDWIDTH SUSCAN_SOURCE_DEFAULT_SAMP_RATE
 #define SUSCAN_SOURCE_DEFAULT_READ_TIMEOUT 100000 /* 100 ms */
-#define SUSCAN_SOURCE_ANTIALIAS_REL_SIZE    5
-#define SUSCAN_SOURCE_DECIMATOR_BUFFER_SIZE 512
+#define SUSCAN_SOURCE_DECIMATOR_TAPS_PER_PHASE 5
+#define SUSCAN_SOURCE_DECIMATOR_BUFFER_SIZE    8192 /* Input samples */
+#define SUSCAN_SOURCE_READAHEAD_BLOCK_SIZE  4096
+#define SUSCAN_SOURCE_IQCORR_TIME_CONSTANT  .25 /* In seconds */
 
 /************************** Source config API ********************************/
 struct suscan_source_gain_desc {
@@ -157,7 +163,16 @@ enum suscan_source_type {
 enum suscan_source_format {
   SUSCAN_SOURCE_FORMAT_AUTO,
   SUSCAN_SOURCE_FORMAT_RAW,
-  SUSCAN_SOURCE_FORMAT_WAV
+  SUSCAN_SOURCE_FORMAT_WAV,
+  SUSCAN_SOURCE_FORMAT_RAW_CS8,  /* Signed 8-bit interleaved IQ */
+  SUSCAN_SOURCE_FORMAT_RAW_CU8,  /* Unsigned 8-bit interleaved IQ (RTL-SDR) */
+  SUSCAN_SOURCE_FORMAT_RAW_CS16, /* Signed 16-bit interleaved IQ */
+  SUSCAN_SOURCE_FORMAT_CAPTURE   /* Suscan capture file (see capture.h) */
+};
+
+enum suscan_source_decimation {
+  SUSCAN_SOURCE_DECIMATION_FIR,       /* Single polyphase FIR stage */
+  SUSCAN_SOURCE_DECIMATION_MULTISTAGE /* CIC + half-band + polyphase FIR */
 };
 
 struct suscan_source_gain_value {
@@ -178,10 +193,13 @@ struct suscan_source_config {
   SUBOOL  dc_remove;
   unsigned int samp_rate;
   unsigned int average;
+  enum suscan_source_decimation decimation;
+  unsigned int readahead; /* Read-ahead depth in blocks (0: disabled) */
 
   /* For file sources */
   char *path;
   SUBOOL loop;
+  struct timeval start_time; /* Capture start, if known (e.g. from SigMF) */
 
   /* For SDR sources */
   const suscan_source_device_t *device; /* Borrowed, optional */
@@ -274,6 +292,25 @@ SUBOOL suscan_source_config_set_average(
     suscan_source_config_t *config,
     unsigned int average);
 
+enum suscan_source_decimation suscan_source_config_get_decimation(
+    const suscan_source_config_t *config);
+void suscan_source_config_set_decimation(
+    suscan_source_config_t *config,
+    enum suscan_source_decimation decimation);
+
+unsigned int suscan_source_config_get_readahead(
+    const suscan_source_config_t *config);
+void suscan_source_config_set_readahead(
+    suscan_source_config_t *config,
+    unsigned int readahead);
+
+void suscan_source_config_get_start_time(
+    const suscan_source_config_t *config,
+    struct timeval *tv);
+void suscan_source_config_set_start_time(
+    suscan_source_config_t *config,
+    const struct timeval *tv);
+
 unsigned int suscan_source_config_get_channel(
     const suscan_source_config_t *config);
 void suscan_source_config_set_channel(
@@ -333,11 +370,52 @@ SUBOOL suscan_source_config_unregister(suscan_source_config_t *config);
 void suscan_source_config_destroy(suscan_source_config_t *);
 
 /****************************** Source API ***********************************/
+/*
+ * Read-ahead ring. Blocks are acquired by a dedicated thread (producer)
+ * and consumed by suscan_source_read (consumer). Head and tail are
+ * free-running counters, each written by one side only. The mutex and
+ * condition variable are only used to put either side to sleep.
+ */
+struct suscan_source_readahead {
+  SUCOMPLEX *buffer;  /* (depth + 1) * block_size samples */
+  SUCOMPLEX *scratch; /* Last block: where overflowing reads go */
+  SUSDIFF   *lengths; /* Read result, per block */
+  unsigned int depth;
+  SUSCOUNT block_size;
+
+  unsigned int head;    /* Written by the producer */
+  unsigned int tail;    /* Written by the consumer */
+  SUSCOUNT tail_offset; /* Samples already consumed from the tail block */
+
+  SUBOOL halt;
+  int producer_waiting;
+  int consumer_waiting;
+
+  pthread_mutex_t mutex;
+  SUBOOL mutex_init;
+  pthread_cond_t cond;
+  SUBOOL cond_init;
+  pthread_t thread;
+  SUBOOL thread_running;
+
+  /* Statistics: written by the producer, accessed atomically */
+  unsigned int high_water;
+  uint64_t overflows;
+};
+
+struct suscan_source_readahead_stats {
+  unsigned int depth;
+  unsigned int fill;
+  unsigned int high_water;
+  uint64_t overflows;
+};
+
 struct suscan_source {
   suscan_source_config_t *config; /* Source may alter configuration! */
   SUBOOL capturing;
   SUBOOL soft_dc_correction;
   SUBOOL soft_iq_balance;
+  suscan_iq_corrector_t iqcorr;
   SUSDIFF (*read) (
         struct suscan_source *source,
         SUCOMPLEX *buffer,
@@ -348,6 +426,25 @@ struct suscan_source {
   SF_INFO sf_info;
   SUBOOL iq_file;
 
+  /* Raw files are memory-mapped whenever possible */
+  int fd;
+  void *map;
+  size_t map_length; /* As mapped, i.e. the whole file */
+  size_t map_size; /* In whole samples, in bytes */
+  size_t map_ptr; /* In bytes */
+  size_t map_sample_size; /* Bytes per complex sample */
+  void (*convert) (
+        SUCOMPLEX *buffer,
+        const void *data,
+        SUSCOUNT size,
+        SUBOOL iq_rev);
+
+  /* Set if IQ reversal is performed by the source itself. Atomic */
+  SUBOOL iq_rev;
+
+  /* Suscan capture files are decoded by a capture reader */
+  struct suscan_capture_reader *capture;
+
   /* SDR sources are accessed through SoapySDR */
   SoapySDRDevice *sdr;
   SoapySDRStream *rx_stream;
@@ -358,14 +455,13 @@ struct suscan_source {
   /* To prevent source from looping forever */
   SUBOOL force_eos;
 
+  /* Optional read-ahead acquisition thread */
+  struct suscan_source_readahead *readahead;
+
   /* Downsampling members */
-  SUFLOAT *antialias_alloc;
-  const SUFLOAT *antialias;
-  SUCOMPLEX accums[SUSCAN_SOURCE_ANTIALIAS_REL_SIZE];
-  SUCOMPLEX *decim_buf;
-  int ptrs[SUSCAN_SOURCE_ANTIALIAS_REL_SIZE];
+  struct suscan_decimator *decimator;
+  struct suscan_decimator_chain *decim_chain;
   int decim;
-  int decim_length;
 };
 
 typedef struct suscan_source suscan_source_t;
@@ -375,6 +471,13 @@ SUBOOL suscan_source_start_capture(suscan_source_t *source);
 
 SUBOOL suscan_source_set_agc(suscan_source_t *source, SUBOOL set);
 SUBOOL suscan_source_set_dc_remove(suscan_source_t *source, SUBOOL remove);
+/*
+ * Fuses IQ reversal with sample conversion (memory-mapped files only).
+ * May be called from any thread. With read-ahead, blocks already in the
+ * ring keep their orientation: the change shows up readahead blocks
+ * later, which is not worth flushing the ring for.
+ */
+SUBOOL suscan_source_set_iq_reverse(suscan_source_t *source, SUBOOL rev);
 SUBOOL suscan_source_set_freq(suscan_source_t *source, SUFREQ freq);
 SUBOOL suscan_source_set_lnb_freq(suscan_source_t *source, SUFREQ freq);
 SUBOOL suscan_source_set_freq2(suscan_source_t *source, SUFREQ freq, SUFREQ lnb);
@@ -396,6 +499,16 @@ SUSDIFF suscan_source_read(
     SUCOMPLEX *buffer,
     SUSCOUNT max);
 
+/*
+ * Moves a file source to the given sample (at the file sample rate).
+ * Read-ahead blocks and decimator state are discarded.
+ */
+SUBOOL suscan_source_seek(suscan_source_t *source, SUSCOUNT sample);
+
+SUBOOL suscan_source_get_readahead_stats(
+    const suscan_source_t *source,
+    struct suscan_source_readahead_stats *stats);
+
 SUINLINE enum suscan_source_type
 suscan_source_get_type(const suscan_source_t *src)
 {
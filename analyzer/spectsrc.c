@@ -164,6 +164,12 @@ suscan_spectsrc_drop(suscan_spectsrc_t *src)
   return SU_TRUE;
 }
 
+void
+suscan_spectsrc_reset(suscan_spectsrc_t *src)
+{
+  src->window_ptr = 0;
+}
+
 SUBOOL
 suscan_spectsrc_calculate(suscan_spectsrc_t *src, SUFLOAT *result)
 {
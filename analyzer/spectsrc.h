@@ -84,6 +84,9 @@ SUBOOL suscan_spectsrc_calculate(suscan_spectsrc_t *src, SUFLOAT *result);
 
 SUBOOL suscan_spectsrc_drop(suscan_spectsrc_t *src);
 
+/* Discards the samples of the window being filled */
+void suscan_spectsrc_reset(suscan_spectsrc_t *src);
+
 SUSCOUNT suscan_spectsrc_feed(
     suscan_spectsrc_t *src,
     const SUCOMPLEX *data,
@@ -0,0 +1,266 @@
+/*
+
+  Copyright (C) 2020 Gonzalo José Carracedo Carballal
+
+  This program is free software: you can redistribute it and/or modify
+  it under the terms of the GNU Lesser General Public License as
+  published by the Free Software Foundation, either version 3 of the
+  License, or (at your option) any later version.
+
+  This program is distributed in the hope that it will be useful, but
+  WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+  GNU Lesser General Public License for more details.
+
+  You should have received a copy of the GNU Lesser General Public
+  License along with this program.  If not, see
+  <http://www.gnu.org/licenses/>
+
+*/
+
+
+#define SU_LOG_DOMAIN "telemetry"
+
+#include <string.h>
+#include <sigutils/log.h>
+
+#include "telemetry.h"
+
+SUINLINE unsigned int
+suscan_histogram_index(uint64_t value)
+{
+  unsigned int exponent;
+
+  if (value < SUSCAN_HISTOGRAM_SUB_BUCKETS)
+    return value;
+
+  exponent = 63 - __builtin_clzll(value);
+  if (exponent > SUSCAN_HISTOGRAM_MAX_EXPONENT)
+    return SUSCAN_HISTOGRAM_BUCKETS - 1;
+
+  return (exponent - SUSCAN_HISTOGRAM_SUB_BUCKET_BITS + 1)
+      * SUSCAN_HISTOGRAM_SUB_BUCKETS
+      + ((value >> (exponent - SUSCAN_HISTOGRAM_SUB_BUCKET_BITS))
+         & (SUSCAN_HISTOGRAM_SUB_BUCKETS - 1));
+}
+
+SUPRIVATE uint64_t
+suscan_histogram_bucket_lowest(unsigned int index)
+{
+  unsigned int exponent;
+  unsigned int sub;
+
+  if (index < SUSCAN_HISTOGRAM_SUB_BUCKETS)
+    return index;
+
+  exponent = index / SUSCAN_HISTOGRAM_SUB_BUCKETS
+      + SUSCAN_HISTOGRAM_SUB_BUCKET_BITS - 1;
+  sub = index % SUSCAN_HISTOGRAM_SUB_BUCKETS;
+
+  return (uint64_t) (SUSCAN_HISTOGRAM_SUB_BUCKETS + sub)
+      << (exponent - SUSCAN_HISTOGRAM_SUB_BUCKET_BITS);
+}
+
+SUPRIVATE uint64_t
+suscan_histogram_bucket_highest(unsigned int index)
+{
+  unsigned int exponent;
+
+  if (index < SUSCAN_HISTOGRAM_SUB_BUCKETS)
+    return index;
+
+  exponent = index / SUSCAN_HISTOGRAM_SUB_BUCKETS
+      + SUSCAN_HISTOGRAM_SUB_BUCKET_BITS - 1;
+
+  return suscan_histogram_bucket_lowest(index)
+      + (1ull << (exponent - SUSCAN_HISTOGRAM_SUB_BUCKET_BITS)) - 1;
+}
+
+void
+suscan_histogram_record(struct suscan_histogram *hist, uint64_t value)
+{
+  __atomic_fetch_add(
+      &hist->bucket[suscan_histogram_index(value)],
+      1,
+      __ATOMIC_RELAXED);
+  __atomic_fetch_add(&hist->sum, value, __ATOMIC_RELAXED);
+  __atomic_fetch_add(&hist->count, 1, __ATOMIC_RELAXED);
+}
+
+void
+suscan_histogram_load(
+    const struct suscan_histogram *hist,
+    struct suscan_histogram *out)
+{
+  unsigned int i;
+
+  out->count = 0;
+  out->sum = __atomic_load_n(&hist->sum, __ATOMIC_RELAXED);
+
+  /* Count from buckets, so percentiles always add up */
+  for (i = 0; i < SUSCAN_HISTOGRAM_BUCKETS; ++i) {
+    out->bucket[i] = __atomic_load_n(&hist->bucket[i], __ATOMIC_RELAXED);
+    out->count += out->bucket[i];
+  }
+}
+
+void
+suscan_histogram_subtract(
+    struct suscan_histogram *hist,
+    const struct suscan_histogram *base)
+{
+  unsigned int i;
+
+  hist->count -= base->count;
+  hist->sum   -= base->sum;
+
+  for (i = 0; i < SUSCAN_HISTOGRAM_BUCKETS; ++i)
+    hist->bucket[i] -= base->bucket[i];
+}
+
+uint64_t
+suscan_histogram_percentile(const struct suscan_histogram *hist, SUFLOAT q)
+{
+  uint64_t rank;
+  uint64_t seen = 0;
+  unsigned int i;
+
+  if (hist->count == 0)
+    return 0;
+
+  rank = SU_CEIL(q * hist->count);
+  if (rank < 1)
+    rank = 1;
+  else if (rank > hist->count)
+    rank = hist->count;
+
+  for (i = 0; i < SUSCAN_HISTOGRAM_BUCKETS; ++i) {
+    seen += hist->bucket[i];
+    if (seen >= rank)
+      return suscan_histogram_bucket_highest(i);
+  }
+
+  return suscan_histogram_bucket_highest(SUSCAN_HISTOGRAM_BUCKETS - 1);
+}
+
+void
+suscan_histogram_summarize(
+    const struct suscan_histogram *hist,
+    struct suscan_histogram_summary *summary)
+{
+  int i;
+
+  memset(summary, 0, sizeof(struct suscan_histogram_summary));
+
+  if ((summary->count = hist->count) == 0)
+    return;
+
+  summary->mean = hist->sum / hist->count;
+  summary->p50  = suscan_histogram_percentile(hist, .5);
+  summary->p90  = suscan_histogram_percentile(hist, .9);
+  summary->p99  = suscan_histogram_percentile(hist, .99);
+  summary->p999 = suscan_histogram_percentile(hist, .999);
+
+  for (i = 0; i < SUSCAN_HISTOGRAM_BUCKETS; ++i)
+    if (hist->bucket[i] > 0) {
+      summary->min = suscan_histogram_bucket_lowest(i);
+      break;
+    }
+
+  for (i = SUSCAN_HISTOGRAM_BUCKETS - 1; i >= 0; --i)
+    if (hist->bucket[i] > 0) {
+      summary->max = suscan_histogram_bucket_highest(i);
+      break;
+    }
+}
+
+SUBOOL
+suscan_telemetry_get_thread_cpu(pthread_t thread, uint64_t *ns)
+{
+  clockid_t clock;
+  struct timespec ts;
+
+  if (pthread_getcpuclockid(thread, &clock) != 0)
+    return SU_FALSE;
+
+  if (clock_gettime(clock, &ts) == -1)
+    return SU_FALSE;
+
+  *ns = (uint64_t) ts.tv_sec * 1000000000ull + ts.tv_nsec;
+
+  return SU_TRUE;
+}
+
+void
+suscan_telemetry_load(
+    const struct suscan_telemetry *self,
+    struct suscan_telemetry *out)
+{
+  unsigned int i;
+
+  for (i = 0; i < SUSCAN_TELEMETRY_STAGE_COUNT; ++i)
+    suscan_histogram_load(&self->stage[i], &out->stage[i]);
+
+  for (i = 0; i < SUSCAN_TELEMETRY_COUNTER_COUNT; ++i)
+    out->counter[i] = __atomic_load_n(&self->counter[i], __ATOMIC_RELAXED);
+}
+
+const char *
+suscan_telemetry_stage_to_string(enum suscan_telemetry_stage stage)
+{
+  switch (stage) {
+    case SUSCAN_TELEMETRY_STAGE_READ:
+      return "read";
+
+    case SUSCAN_TELEMETRY_STAGE_BBFILT:
+      return "bbfilt";
+
+    case SUSCAN_TELEMETRY_STAGE_DETECTOR:
+      return "detector";
+
+    case SUSCAN_TELEMETRY_STAGE_SPECTTUNER:
+      return "specttuner";
+
+    case SUSCAN_TELEMETRY_STAGE_SCHED_WAIT:
+      return "sched-wait";
+
+    case SUSCAN_TELEMETRY_STAGE_SAMPLER:
+      return "sampler";
+
+    case SUSCAN_TELEMETRY_STAGE_ESTIMATOR:
+      return "estimator";
+
+    case SUSCAN_TELEMETRY_STAGE_SPECTRUM:
+      return "spectrum";
+
+    case SUSCAN_TELEMETRY_STAGE_MQ_ENQUEUE:
+      return "mq-enqueue";
+
+    default:
+      return "unknown";
+  }
+}
+
+const char *
+suscan_telemetry_counter_to_string(enum suscan_telemetry_counter counter)
+{
+  switch (counter) {
+    case SUSCAN_TELEMETRY_COUNTER_SAMPLES_READ:
+      return "samples-read";
+
+    case SUSCAN_TELEMETRY_COUNTER_BLOCKS_READ:
+      return "blocks-read";
+
+    case SUSCAN_TELEMETRY_COUNTER_SAMPLES_TUNED:
+      return "samples-tuned";
+
+    case SUSCAN_TELEMETRY_COUNTER_PSD_FRAMES:
+      return "psd-frames";
+
+    case SUSCAN_TELEMETRY_COUNTER_DETECTOR_DROPS:
+      return "detector-drops";
+
+    default:
+      return "unknown";
+  }
+}
@@ -0,0 +1,190 @@
+/*
+
+  Copyright (C) 2020 Gonzalo José Carracedo Carballal
+
+  This program is free software: you can redistribute it and/or modify
+  it under the terms of the GNU Lesser General Public License as
+  published by the Free Software Foundation, either version 3 of the
+  License, or (at your option) any later version.
+
+  This program is distributed in the hope that it will be useful, but
+  WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+  GNU Lesser General Public License for more details.
+
+  You should have received a copy of the GNU Lesser General Public
+  License along with this program.  If not, see
+  <http://www.gnu.org/licenses/>
+
+*/
+
+
+#ifndef _ANALYZER_TELEMETRY_H
+#define _ANALYZER_TELEMETRY_H
+
+#include <sigutils/types.h>
+#include <stdint.h>
+#include <time.h>
+#include <pthread.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif /* __cplusplus */
+
+/*
+ * Log-linear latency histograms (HDR style): values below
+ * SUSCAN_HISTOGRAM_SUB_BUCKETS nanoseconds are counted exactly, and every
+ * power of two above is split in SUSCAN_HISTOGRAM_SUB_BUCKETS buckets,
+ * which bounds the relative error to 1 / SUSCAN_HISTOGRAM_SUB_BUCKETS.
+ * Recording is lock-free and may happen from any number of threads.
+ */
+#define SUSCAN_HISTOGRAM_SUB_BUCKET_BITS 3
+#define SUSCAN_HISTOGRAM_SUB_BUCKETS     (1 << SUSCAN_HISTOGRAM_SUB_BUCKET_BITS)
+#define SUSCAN_HISTOGRAM_MAX_EXPONENT    40 /* Around 18 minutes */
+#define SUSCAN_HISTOGRAM_BUCKETS                                      \
+  ((SUSCAN_HISTOGRAM_MAX_EXPONENT - SUSCAN_HISTOGRAM_SUB_BUCKET_BITS + 2) \
+   * SUSCAN_HISTOGRAM_SUB_BUCKETS)
+
+struct suscan_histogram {
+  uint64_t count;
+  uint64_t sum; /* In nanoseconds */
+  uint64_t bucket[SUSCAN_HISTOGRAM_BUCKETS];
+};
+
+/* All values in nanoseconds, min and max at bucket resolution */
+struct suscan_histogram_summary {
+  uint64_t count;
+  uint64_t mean;
+  uint64_t min;
+  uint64_t p50;
+  uint64_t p90;
+  uint64_t p99;
+  uint64_t p999;
+  uint64_t max;
+};
+
+enum suscan_telemetry_stage {
+  SUSCAN_TELEMETRY_STAGE_READ,       /* suscan_source_read */
+  SUSCAN_TELEMETRY_STAGE_BBFILT,     /* Baseband filters */
+  SUSCAN_TELEMETRY_STAGE_DETECTOR,   /* Channel detector feed */
+  SUSCAN_TELEMETRY_STAGE_SPECTTUNER, /* Spectral tuner feed and dispatch */
+  SUSCAN_TELEMETRY_STAGE_SCHED_WAIT, /* Source blocked on the inspectors */
+  SUSCAN_TELEMETRY_STAGE_SAMPLER,    /* Inspector loops, all inspectors */
+  SUSCAN_TELEMETRY_STAGE_ESTIMATOR,
+  SUSCAN_TELEMETRY_STAGE_SPECTRUM,
+  SUSCAN_TELEMETRY_STAGE_MQ_ENQUEUE, /* Writes to the output queue */
+  SUSCAN_TELEMETRY_STAGE_COUNT
+};
+
+enum suscan_telemetry_counter {
+  SUSCAN_TELEMETRY_COUNTER_SAMPLES_READ,
+  SUSCAN_TELEMETRY_COUNTER_BLOCKS_READ,
+  SUSCAN_TELEMETRY_COUNTER_SAMPLES_TUNED,
+  SUSCAN_TELEMETRY_COUNTER_PSD_FRAMES,
+  SUSCAN_TELEMETRY_COUNTER_DETECTOR_DROPS, /* Blocks the detector missed */
+  SUSCAN_TELEMETRY_COUNTER_COUNT
+};
+
+enum suscan_telemetry_loop {
+  SUSCAN_TELEMETRY_LOOP_SAMPLER,
+  SUSCAN_TELEMETRY_LOOP_ESTIMATOR,
+  SUSCAN_TELEMETRY_LOOP_SPECTRUM,
+  SUSCAN_TELEMETRY_LOOP_COUNT
+};
+
+struct suscan_telemetry {
+  struct suscan_histogram stage[SUSCAN_TELEMETRY_STAGE_COUNT];
+  uint64_t counter[SUSCAN_TELEMETRY_COUNTER_COUNT];
+};
+
+/*
+ * Per-inspector loop timings and CPU time (in nanoseconds, as spent by
+ * the scheduler workers on this inspector). The *last fields are only
+ * touched by the publisher.
+ */
+struct suscan_inspector_telemetry {
+  struct suscan_histogram loop[SUSCAN_TELEMETRY_LOOP_COUNT];
+  struct suscan_histogram last[SUSCAN_TELEMETRY_LOOP_COUNT];
+  uint64_t cpu_ns;
+  uint64_t cpu_last;
+};
+
+SUINLINE uint64_t
+suscan_telemetry_now(void)
+{
+  struct timespec ts;
+
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+
+  return (uint64_t) ts.tv_sec * 1000000000ull + ts.tv_nsec;
+}
+
+/* CPU time consumed by the calling thread */
+SUINLINE uint64_t
+suscan_telemetry_thread_cpu_now(void)
+{
+  struct timespec ts;
+
+  clock_gettime(CLOCK_THREAD_CPUTIME_ID, &ts);
+
+  return (uint64_t) ts.tv_sec * 1000000000ull + ts.tv_nsec;
+}
+
+/* CPU time consumed by another (running) thread of this process */
+SUBOOL suscan_telemetry_get_thread_cpu(pthread_t thread, uint64_t *ns);
+
+void suscan_histogram_record(struct suscan_histogram *hist, uint64_t value);
+
+/* Consistent enough copy of a histogram that is being recorded into */
+void suscan_histogram_load(
+    const struct suscan_histogram *hist,
+    struct suscan_histogram *out);
+
+/* Leaves in hist what was recorded after base was loaded */
+void suscan_histogram_subtract(
+    struct suscan_histogram *hist,
+    const struct suscan_histogram *base);
+
+uint64_t suscan_histogram_percentile(
+    const struct suscan_histogram *hist,
+    SUFLOAT q);
+
+void suscan_histogram_summarize(
+    const struct suscan_histogram *hist,
+    struct suscan_histogram_summary *summary);
+
+/* Records the time elapsed since start and returns the current time */
+SUINLINE uint64_t
+suscan_telemetry_record(
+    struct suscan_telemetry *self,
+    enum suscan_telemetry_stage stage,
+    uint64_t start)
+{
+  uint64_t now = suscan_telemetry_now();
+
+  suscan_histogram_record(&self->stage[stage], now - start);
+
+  return now;
+}
+
+SUINLINE void
+suscan_telemetry_count(
+    struct suscan_telemetry *self,
+    enum suscan_telemetry_counter counter,
+    uint64_t amount)
+{
+  __atomic_fetch_add(&self->counter[counter], amount, __ATOMIC_RELAXED);
+}
+
+void suscan_telemetry_load(
+    const struct suscan_telemetry *self,
+    struct suscan_telemetry *out);
+
+const char *suscan_telemetry_stage_to_string(enum suscan_telemetry_stage);
+const char *suscan_telemetry_counter_to_string(enum suscan_telemetry_counter);
+
+#ifdef __cplusplus
+}
+#endif /* __cplusplus */
+
+#endif /* _ANALYZER_TELEMETRY_H */
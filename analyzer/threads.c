@@ -0,0 +1,458 @@
+/*
+
+  Copyright (C) 2020 Gonzalo José Carracedo Carballal
+
+  This program is free software: you can redistribute it and/or modify
+  it under the terms of the GNU Lesser General Public License as
+  published by the Free Software Foundation, either version 3 of the
+  License, or (at your option) any later version.
+
+  This program is distributed in the hope that it will be useful, but
+  WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+  GNU Lesser General Public License for more details.
+
+  You should have received a copy of the GNU Lesser General Public
+  License along with this program.  If not, see
+  <http://www.gnu.org/licenses/>
+
+*/
+
+
+#ifndef _GNU_SOURCE
+#  define _GNU_SOURCE /* For pthread_setaffinity_np and pthread_setname_np */
+#endif /* _GNU_SOURCE */
+
+#define SU_LOG_DOMAIN "threads"
+
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <sched.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sigutils/log.h>
+
+#ifdef HAVE_NUMA
+#  include <numa.h>
+#  include <numaif.h>
+#endif /* HAVE_NUMA */
+
+#include "threads.h"
+
+SUPRIVATE pthread_mutex_t g_mlock_mutex = PTHREAD_MUTEX_INITIALIZER;
+SUPRIVATE unsigned int    g_mlock_count;
+
+SUBOOL
+suscan_thread_cpu_mask_is_empty(const struct suscan_thread_cpu_mask *mask)
+{
+  unsigned int i;
+
+  for (i = 0; i < SUSCAN_THREAD_MASK_WORDS; ++i)
+    if (mask->bits[i] != 0)
+      return SU_FALSE;
+
+  return SU_TRUE;
+}
+
+SUBOOL
+suscan_thread_cpu_mask_parse(
+    struct suscan_thread_cpu_mask *mask,
+    const char *list)
+{
+  struct suscan_thread_cpu_mask result;
+  unsigned long first, last, cpu;
+  const char *p = list;
+  char *end;
+
+  memset(&result, 0, sizeof(struct suscan_thread_cpu_mask));
+
+  while (*p != '\0') {
+    errno = 0;
+    first = strtoul(p, &end, 10);
+    if (end == p || errno != 0)
+      goto fail;
+
+    last = first;
+    p = end;
+
+    if (*p == '-') {
+      ++p;
+      last = strtoul(p, &end, 10);
+      if (end == p || errno != 0)
+        goto fail;
+      p = end;
+    }
+
+    if (last < first || last >= SUSCAN_THREAD_MAX_CPUS)
+      goto fail;
+
+    for (cpu = first; cpu <= last; ++cpu)
+      suscan_thread_cpu_mask_set(&result, cpu);
+
+    if (*p == ',')
+      ++p;
+    else if (*p != '\0')
+      goto fail;
+  }
+
+  *mask = result;
+
+  return SU_TRUE;
+
+fail:
+  SU_ERROR("Invalid CPU list `%s'\n", list);
+
+  return SU_FALSE;
+}
+
+SUBOOL
+suscan_analyzer_thread_params_set_cpus(
+    struct suscan_analyzer_thread_params *params,
+    enum suscan_analyzer_thread_role role,
+    const char *list)
+{
+  SU_TRYCATCH(role < SUSCAN_ANALYZER_THREAD_ROLE_COUNT, return SU_FALSE);
+
+  return suscan_thread_cpu_mask_parse(&params->cpus[role], list);
+}
+
+void
+suscan_thread_set_affinity(
+    pthread_t thread,
+    const char *name,
+    const struct suscan_thread_cpu_mask *mask)
+{
+#ifdef __linux__
+  cpu_set_t set;
+  unsigned int i;
+  int err;
+
+  CPU_ZERO(&set);
+
+  for (i = 0; i < SUSCAN_THREAD_MAX_CPUS && i < CPU_SETSIZE; ++i)
+    if (suscan_thread_cpu_mask_is_set(mask, i))
+      CPU_SET(i, &set);
+
+  if ((err = pthread_setaffinity_np(thread, sizeof(cpu_set_t), &set)) != 0)
+    SU_WARNING("%s: cannot set CPU affinity: %s\n", name, strerror(err));
+#else
+  SU_WARNING("%s: CPU affinity not supported on this platform\n", name);
+#endif /* __linux__ */
+}
+
+SUBOOL
+suscan_analyzer_thread_params_apply(
+    const struct suscan_analyzer_thread_params *params,
+    enum suscan_analyzer_thread_role role,
+    pthread_t thread,
+    const char *name)
+{
+  struct sched_param sp;
+  int err;
+
+  SU_TRYCATCH(role < SUSCAN_ANALYZER_THREAD_ROLE_COUNT, return SU_FALSE);
+
+#ifdef __linux__
+  /* Names longer than 15 characters are rejected with ERANGE */
+  if ((err = pthread_setname_np(thread, name)) != 0)
+    SU_WARNING("%s: cannot set thread name: %s\n", name, strerror(err));
+#endif /* __linux__ */
+
+  if (!suscan_thread_cpu_mask_is_empty(&params->cpus[role]))
+    suscan_thread_set_affinity(thread, name, &params->cpus[role]);
+
+  if (role == SUSCAN_ANALYZER_THREAD_ROLE_SOURCE
+      && params->source_fifo_priority > 0) {
+    memset(&sp, 0, sizeof(struct sched_param));
+    sp.sched_priority = params->source_fifo_priority;
+
+    if ((err = pthread_setschedparam(thread, SCHED_FIFO, &sp)) != 0)
+      SU_WARNING(
+          "%s: cannot set SCHED_FIFO priority %d: %s\n",
+          name,
+          params->source_fifo_priority,
+          strerror(err));
+  }
+
+  return SU_TRUE;
+}
+
+SUPRIVATE SUBOOL
+suscan_analyzer_thread_params_init_attr(
+    const struct suscan_analyzer_thread_params *params,
+    enum suscan_analyzer_thread_role role,
+    pthread_attr_t *attr)
+{
+  struct sched_param sp;
+#ifdef __linux__
+  cpu_set_t set;
+  unsigned int i;
+#endif /* __linux__ */
+
+  if (pthread_attr_init(attr) != 0)
+    return SU_FALSE;
+
+#ifdef __linux__
+  if (!suscan_thread_cpu_mask_is_empty(&params->cpus[role])) {
+    CPU_ZERO(&set);
+
+    for (i = 0; i < SUSCAN_THREAD_MAX_CPUS && i < CPU_SETSIZE; ++i)
+      if (suscan_thread_cpu_mask_is_set(&params->cpus[role], i))
+        CPU_SET(i, &set);
+
+    if (pthread_attr_setaffinity_np(attr, sizeof(cpu_set_t), &set) != 0)
+      goto fail;
+  }
+#endif /* __linux__ */
+
+  if (role == SUSCAN_ANALYZER_THREAD_ROLE_SOURCE
+      && params->source_fifo_priority > 0) {
+    memset(&sp, 0, sizeof(struct sched_param));
+    sp.sched_priority = params->source_fifo_priority;
+
+    if (pthread_attr_setinheritsched(attr, PTHREAD_EXPLICIT_SCHED) != 0
+        || pthread_attr_setschedpolicy(attr, SCHED_FIFO) != 0
+        || pthread_attr_setschedparam(attr, &sp) != 0)
+      goto fail;
+  }
+
+  return SU_TRUE;
+
+fail:
+  (void) pthread_attr_destroy(attr);
+
+  return SU_FALSE;
+}
+
+SUBOOL
+suscan_analyzer_thread_create(
+    const struct suscan_analyzer_thread_params *params,
+    enum suscan_analyzer_thread_role role,
+    const char *name,
+    pthread_t *thread,
+    void *(*func) (void *),
+    void *arg)
+{
+  pthread_attr_t attr;
+  int err;
+
+  SU_TRYCATCH(role < SUSCAN_ANALYZER_THREAD_ROLE_COUNT, return SU_FALSE);
+
+  if (suscan_analyzer_thread_params_init_attr(params, role, &attr)) {
+    err = pthread_create(thread, &attr, func, arg);
+    (void) pthread_attr_destroy(&attr);
+
+    if (err == 0) {
+#ifdef __linux__
+      /* Names longer than 15 characters are rejected with ERANGE */
+      if ((err = pthread_setname_np(*thread, name)) != 0)
+        SU_WARNING("%s: cannot set thread name: %s\n", name, strerror(err));
+#endif /* __linux__ */
+      return SU_TRUE;
+    }
+
+    SU_WARNING(
+        "%s: cannot start with its CPU/scheduling settings: %s\n",
+        name,
+        strerror(err));
+  }
+
+  /* Start as any other thread, and set what can be set afterwards */
+  if ((err = pthread_create(thread, NULL, func, arg)) != 0) {
+    SU_ERROR("%s: cannot create thread: %s\n", name, strerror(err));
+    return SU_FALSE;
+  }
+
+  return suscan_analyzer_thread_params_apply(params, role, *thread, name);
+}
+
+SUBOOL
+suscan_analyzer_thread_params_lock_memory(
+    const struct suscan_analyzer_thread_params *params)
+{
+  SUBOOL ok = SU_FALSE;
+
+  if (!params->lock_memory)
+    return SU_FALSE;
+
+  pthread_mutex_lock(&g_mlock_mutex);
+
+  if (g_mlock_count == 0 && mlockall(MCL_CURRENT | MCL_FUTURE) == -1) {
+    SU_WARNING("Cannot lock analyzer memory: %s\n", strerror(errno));
+    goto done;
+  }
+
+  ++g_mlock_count;
+  ok = SU_TRUE;
+
+done:
+  pthread_mutex_unlock(&g_mlock_mutex);
+
+  return ok;
+}
+
+void
+suscan_thread_unlock_memory(void)
+{
+  pthread_mutex_lock(&g_mlock_mutex);
+
+  if (g_mlock_count > 0 && --g_mlock_count == 0)
+    (void) munlockall();
+
+  pthread_mutex_unlock(&g_mlock_mutex);
+}
+
+void
+suscan_thread_prefault(void *buffer, size_t size)
+{
+  volatile uint8_t *bytes = (volatile uint8_t *) buffer;
+  long page = sysconf(_SC_PAGESIZE);
+  size_t i;
+
+  if (page <= 0)
+    page = 4096;
+
+  /* Write, so that copy-on-write zero pages are replaced too */
+  for (i = 0; i < size; i += page)
+    bytes[i] = bytes[i];
+}
+
+/******************************** NUMA support *******************************/
+unsigned int
+suscan_numa_get_node_count(void)
+{
+#ifdef HAVE_NUMA
+  int nodes;
+
+  if (numa_available() == -1)
+    return 1;
+
+  if ((nodes = numa_num_configured_nodes()) < 1)
+    return 1;
+
+  return nodes;
+#else
+  return 1;
+#endif /* HAVE_NUMA */
+}
+
+SUBOOL
+suscan_numa_get_node_cpus(
+    unsigned int node,
+    struct suscan_thread_cpu_mask *mask)
+{
+#ifdef HAVE_NUMA
+  struct bitmask *cpus = NULL;
+  unsigned int i;
+  SUBOOL ok = SU_FALSE;
+
+  SU_TRYCATCH(node < suscan_numa_get_node_count(), goto done);
+  SU_TRYCATCH(cpus = numa_allocate_cpumask(), goto done);
+  SU_TRYCATCH(numa_node_to_cpus(node, cpus) == 0, goto done);
+
+  memset(mask, 0, sizeof(struct suscan_thread_cpu_mask));
+
+  for (i = 0; i < SUSCAN_THREAD_MAX_CPUS && i < cpus->size; ++i)
+    if (numa_bitmask_isbitset(cpus, i))
+      suscan_thread_cpu_mask_set(mask, i);
+
+  ok = SU_TRUE;
+
+done:
+  if (cpus != NULL)
+    numa_free_cpumask(cpus);
+
+  return ok;
+#else
+  long count = sysconf(_SC_NPROCESSORS_CONF);
+  unsigned int i;
+
+  SU_TRYCATCH(node == 0, return SU_FALSE);
+
+  memset(mask, 0, sizeof(struct suscan_thread_cpu_mask));
+
+  for (i = 0; i < count; ++i)
+    suscan_thread_cpu_mask_set(mask, i);
+
+  return SU_TRUE;
+#endif /* HAVE_NUMA */
+}
+
+void *
+suscan_numa_alloc(size_t size, int node)
+{
+#ifdef HAVE_NUMA
+  if (node >= 0 && suscan_numa_get_node_count() > 1)
+    return numa_alloc_onnode(size, node);
+#endif /* HAVE_NUMA */
+
+  return malloc(size);
+}
+
+void
+suscan_numa_free(void *ptr, size_t size, int node)
+{
+#ifdef HAVE_NUMA
+  /* Must mirror suscan_numa_alloc: buffers without a node are malloc'd */
+  if (node >= 0 && suscan_numa_get_node_count() > 1) {
+    numa_free(ptr, size);
+    return;
+  }
+#endif /* HAVE_NUMA */
+
+  free(ptr);
+}
+
+void
+suscan_numa_move(void *ptr, size_t size, int node)
+{
+#ifdef HAVE_NUMA
+  long page = sysconf(_SC_PAGESIZE);
+  uintptr_t first, last;
+  void **pages = NULL;
+  int *nodes = NULL;
+  int *status = NULL;
+  unsigned long i, count;
+
+  if (node < 0 || suscan_numa_get_node_count() < 2 || page <= 0)
+    return;
+
+  first = ((uintptr_t) ptr + page - 1) & ~((uintptr_t) page - 1);
+  last  = ((uintptr_t) ptr + size) & ~((uintptr_t) page - 1);
+
+  if (last <= first)
+    return;
+
+  count = (last - first) / page;
+
+  SU_TRYCATCH(pages  = malloc(count * sizeof(void *)), goto done);
+  SU_TRYCATCH(nodes  = malloc(count * sizeof(int)), goto done);
+  SU_TRYCATCH(status = malloc(count * sizeof(int)), goto done);
+
+  for (i = 0; i < count; ++i) {
+    pages[i] = (void *) (first + i * page);
+    nodes[i] = node;
+  }
+
+  if (numa_move_pages(0, count, pages, nodes, status, MPOL_MF_MOVE) == -1)
+    SU_WARNING("Cannot move %lu pages to node %d: %s\n",
+        count,
+        node,
+        strerror(errno));
+
+done:
+  if (pages != NULL)
+    free(pages);
+
+  if (nodes != NULL)
+    free(nodes);
+
+  if (status != NULL)
+    free(status);
+#else
+  (void) ptr;
+  (void) size;
+  (void) node;
+#endif /* HAVE_NUMA */
+}
@@ -0,0 +1,173 @@
+/*
+
+  Copyright (C) 2020 Gonzalo José Carracedo Carballal
+
+  This program is free software: you can redistribute it and/or modify
+  it under the terms of the GNU Lesser General Public License as
+  published by the Free Software Foundation, either version 3 of the
+  License, or (at your option) any later version.
+
+  This program is distributed in the hope that it will be useful, but
+  WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+  GNU Lesser General Public License for more details.
+
+  You should have received a copy of the GNU Lesser General Public
+  License along with this program.  If not, see
+  <http://www.gnu.org/licenses/>
+
+*/
+
+
+#ifndef _ANALYZER_THREADS_H
+#define _ANALYZER_THREADS_H
+
+#include <sigutils/types.h>
+#include <pthread.h>
+#include <stdint.h>
+#include <stddef.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif /* __cplusplus */
+
+#define SUSCAN_THREAD_MAX_CPUS    256
+#define SUSCAN_THREAD_MASK_WORDS  (SUSCAN_THREAD_MAX_CPUS / 64)
+#define SUSCAN_THREAD_NAME_MAX    16 /* Including the terminating NUL */
+
+enum suscan_analyzer_thread_role {
+  SUSCAN_ANALYZER_THREAD_ROLE_SOURCE,    /* Source worker (acquisition) */
+  SUSCAN_ANALYZER_THREAD_ROLE_SLOW,      /* Slow worker (SDR settings) */
+  SUSCAN_ANALYZER_THREAD_ROLE_INSPECTOR, /* Inspector scheduler workers */
+  SUSCAN_ANALYZER_THREAD_ROLE_DETECTOR,  /* Detector worker (PSD) */
+  SUSCAN_ANALYZER_THREAD_ROLE_COUNT
+};
+
+struct suscan_thread_cpu_mask {
+  uint64_t bits[SUSCAN_THREAD_MASK_WORDS];
+};
+
+/*
+ * Threading configuration of an analyzer. Threads whose role has an
+ * empty CPU mask float freely. Settings that need privileges (real-time
+ * priority, memory locking) only emit a warning if they cannot be
+ * applied, so the same configuration can be used unprivileged.
+ */
+struct suscan_analyzer_thread_params {
+  struct suscan_thread_cpu_mask cpus[SUSCAN_ANALYZER_THREAD_ROLE_COUNT];
+  int          source_fifo_priority; /* SCHED_FIFO priority, 0 disables */
+  unsigned int inspector_workers;    /* 0: one per online CPU, minus one */
+  SUBOOL       lock_memory;          /* mlockall (process-wide), prefault */
+  SUBOOL       numa_placement;       /* Group inspector workers by node */
+};
+
+#define suscan_analyzer_thread_params_INITIALIZER {                         \
+  {{{0}}},                                      /* cpus */                  \
+  0,                                            /* source_fifo_priority */  \
+  0,                                            /* inspector_workers */     \
+  SU_FALSE,                                     /* lock_memory */           \
+  SU_TRUE,                                      /* numa_placement */        \
+}
+
+SUINLINE void
+suscan_thread_cpu_mask_set(struct suscan_thread_cpu_mask *mask, unsigned int cpu)
+{
+  if (cpu < SUSCAN_THREAD_MAX_CPUS)
+    mask->bits[cpu >> 6] |= 1ull << (cpu & 63);
+}
+
+SUINLINE SUBOOL
+suscan_thread_cpu_mask_is_set(
+    const struct suscan_thread_cpu_mask *mask,
+    unsigned int cpu)
+{
+  return cpu < SUSCAN_THREAD_MAX_CPUS
+      && (mask->bits[cpu >> 6] & (1ull << (cpu & 63))) != 0;
+}
+
+SUBOOL suscan_thread_cpu_mask_is_empty(const struct suscan_thread_cpu_mask *mask);
+
+/* Parses CPU lists like "0-3,8,10-11" (as in taskset -c or cpuset) */
+SUBOOL suscan_thread_cpu_mask_parse(
+    struct suscan_thread_cpu_mask *mask,
+    const char *list);
+
+SUBOOL suscan_analyzer_thread_params_set_cpus(
+    struct suscan_analyzer_thread_params *params,
+    enum suscan_analyzer_thread_role role,
+    const char *list);
+
+/* Warns (but does not fail) if the affinity cannot be set */
+void suscan_thread_set_affinity(
+    pthread_t thread,
+    const char *name,
+    const struct suscan_thread_cpu_mask *mask);
+
+/*
+ * Names the thread and applies the affinity and scheduling policy of
+ * its role. Only fails on invalid arguments: failures to apply a setting
+ * are reported as warnings.
+ */
+SUBOOL suscan_analyzer_thread_params_apply(
+    const struct suscan_analyzer_thread_params *params,
+    enum suscan_analyzer_thread_role role,
+    pthread_t thread,
+    const char *name);
+
+/*
+ * Starts a thread with the affinity and scheduling policy of its role
+ * already in its attributes, so it never runs a single block outside
+ * them, and names it. If the attributes are refused (e.g. SCHED_FIFO
+ * without privileges), the thread is started without them and the
+ * settings are applied as in suscan_analyzer_thread_params_apply.
+ */
+SUBOOL suscan_analyzer_thread_create(
+    const struct suscan_analyzer_thread_params *params,
+    enum suscan_analyzer_thread_role role,
+    const char *name,
+    pthread_t *thread,
+    void *(*func) (void *),
+    void *arg);
+
+/*
+ * Locks current and future pages of the process, if requested. Locking
+ * is process-wide and reference counted: every successful call must be
+ * paired with suscan_thread_unlock_memory. When the last reference goes
+ * away, munlockall unlocks the whole process, including pages the host
+ * application locked on its own. Applications that lock their memory
+ * themselves should leave lock_memory unset.
+ */
+SUBOOL suscan_analyzer_thread_params_lock_memory(
+    const struct suscan_analyzer_thread_params *params);
+
+void suscan_thread_unlock_memory(void);
+
+/* Touches every page of a buffer, so it is not faulted in later */
+void suscan_thread_prefault(void *buffer, size_t size);
+
+/*
+ * NUMA topology and placement. Without libnuma (HAVE_NUMA), or on
+ * single-node hosts, there is just node 0, allocations fall back to
+ * malloc and moves do nothing.
+ */
+unsigned int suscan_numa_get_node_count(void);
+
+SUBOOL suscan_numa_get_node_cpus(
+    unsigned int node,
+    struct suscan_thread_cpu_mask *mask);
+
+/*
+ * Contents are undefined. Release with suscan_numa_free, passing the
+ * same size and node (-1 for none) the buffer was allocated with.
+ */
+void *suscan_numa_alloc(size_t size, int node);
+void suscan_numa_free(void *ptr, size_t size, int node);
+
+/* Best effort: migrates the pages fully contained in the buffer */
+void suscan_numa_move(void *ptr, size_t size, int node);
+
+#ifdef __cplusplus
+}
+#endif /* __cplusplus */
+
+#endif /* _ANALYZER_THREADS_H */
@@ -29,29 +29,42 @@
  */
 
 
-SUPRIVATE struct suscan_worker_callback *
-suscan_worker_callback_new(
+SUPRIVATE struct suscan_worker_task *
+suscan_worker_task_new(
     SUBOOL (*func) (
         struct suscan_mq *mq_out,
       void *worker_private,
       void *callback_private),
   void *private)
 {
-  struct suscan_worker_callback *cb;
+  struct suscan_worker_task *task;
 
-  if ((cb = malloc(sizeof (struct suscan_worker_callback))) == NULL)
+  if ((task = malloc(sizeof (struct suscan_worker_task))) == NULL)
     return NULL;
 
-  cb->func = func;
-  cb->privdata = private;
+  suscan_worker_task_init(task, func, private);
+  task->owned = SU_TRUE;
 
-  return cb;
+  return task;
 }
 
+/* Called once the worker is done with the task */
 SUPRIVATE void
-suscan_worker_callback_destroy(struct suscan_worker_callback *callback)
+suscan_worker_task_release(struct suscan_worker_task *task)
 {
-  free(callback);
+  if (task->owned)
+    free(task);
+}
+
+/*
+ * Same, for a task whose callback has already returned: by then the node
+ * may belong to its owner again, so only what was read before counts.
+ */
+SUPRIVATE void
+suscan_worker_task_release_run(struct suscan_worker_task *task, SUBOOL owned)
+{
+  if (owned)
+    free(task);
 }
 
 SUPRIVATE void
@@ -67,16 +80,16 @@ SUPRIVATE void
 suscan_worker_wait_for_halt(suscan_worker_t *worker)
 {
   uint32_t type;
-  struct suscan_worker_callback *cb;
+  struct suscan_worker_task *task;
 
   for (;;) {
-    cb = suscan_mq_read(&worker->mq_in, &type);
+    task = suscan_mq_read(&worker->mq_in, &type);
     if (type == SUSCAN_WORKER_MSG_TYPE_HALT) {
       suscan_worker_ack_halt(worker);
       break;
     }
 
-    suscan_worker_callback_destroy(cb);
+    suscan_worker_task_release(task);
   }
 }
 
@@ -84,25 +97,32 @@ SUPRIVATE void *
 suscan_worker_thread(void *data)
 {
   suscan_worker_t *worker = (suscan_worker_t *) data;
-  struct suscan_msg *msg = NULL;
-  struct suscan_worker_callback *cb;
+  struct suscan_worker_task *task;
+  uint32_t type;
+  SUBOOL owned;
   SUBOOL halt_acked = SU_FALSE;
 
   while (!worker->halt_req) {
     /* First read: blocking read of a message */
-    msg = suscan_mq_read_msg(&worker->mq_in);
+    task = suscan_mq_read(&worker->mq_in, &type);
 
     do {
-      switch (msg->type) {
+      switch (type) {
         case SUSCAN_WORKER_MSG_TYPE_CALLBACK:
-          cb = (struct suscan_worker_callback *) msg->privdata;
-          if (!(cb->func) (worker->mq_out, worker->privdata, cb->privdata)) {
+          owned = task->owned;
+          if (!(task->callback.func) (
+              worker->mq_out,
+              worker->privdata,
+              task->callback.privdata)) {
             /* Callback returns FALSE: remove from message queue */
-            suscan_worker_callback_destroy(cb);
-            suscan_msg_destroy(msg);
-          } else {
-            /* Callback returns TRUE: queue again */
-            suscan_mq_write_msg(&worker->mq_in, msg);
+            suscan_worker_task_release_run(task, owned);
+          } else if (!suscan_mq_write(
+              &worker->mq_in,
+              SUSCAN_WORKER_MSG_TYPE_CALLBACK,
+              task)) {
+            /* Callback returns TRUE: queue again (same node, no allocation) */
+            SU_ERROR("Failed to requeue worker task, dropping it\n");
+            suscan_worker_task_release_run(task, owned);
           }
           break;
 
@@ -111,20 +131,13 @@ suscan_worker_thread(void *data)
           goto done;
 
         default:
-          SU_WARNING("Unexpected worker message type #%d\n", msg->type);
-          suscan_msg_destroy(msg); /* Destroy message anyways */
+          SU_WARNING("Unexpected worker message type #%d\n", type);
       }
 
-      /*
-       * We reached this point, one way or another, we don't hold the
-       * ownership of the message anymore.
-       */
-      msg = NULL;
-
       /* Next reads: until queue is empty */
     } while (
         !worker->halt_req
-        && (msg = suscan_mq_poll_msg(&worker->mq_in)) != NULL);
+        && suscan_mq_poll(&worker->mq_in, &type, (void **) &task));
   }
 
 done:
@@ -132,14 +145,6 @@ done:
 
   if (worker->halt_req) {
     halt_acked = SU_TRUE;
-
-    /*
-     * No need to deal with callbacks here. If we reached this point
-     * and message is not NULL, it is because we received MSG_TYPE_HALT.
-     */
-    if (msg != NULL)
-      suscan_msg_destroy(msg);
-
     suscan_worker_ack_halt(worker);
   }
 
@@ -151,6 +156,12 @@ done:
   return NULL;
 }
 
+SUBOOL
+suscan_worker_push_task(suscan_worker_t *worker, struct suscan_worker_task *task)
+{
+  return suscan_mq_write(&worker->mq_in, SUSCAN_WORKER_MSG_TYPE_CALLBACK, task);
+}
+
 SUBOOL
 suscan_worker_push(
     suscan_worker_t *worker,
@@ -160,13 +171,13 @@ suscan_worker_push(
           void *callback_private),
     void *private)
 {
-  struct suscan_worker_callback *cb;
+  struct suscan_worker_task *task;
 
-  if ((cb = suscan_worker_callback_new(func, private)) == NULL)
+  if ((task = suscan_worker_task_new(func, private)) == NULL)
     return SU_FALSE;
 
-  if (!suscan_mq_write(&worker->mq_in, SUSCAN_WORKER_MSG_TYPE_CALLBACK, cb)) {
-    suscan_worker_callback_destroy(cb);
+  if (!suscan_worker_push_task(worker, task)) {
+    suscan_worker_task_release(task);
     return SU_FALSE;
   }
 
@@ -184,10 +195,19 @@ suscan_worker_req_halt(suscan_worker_t *worker)
       NULL);
 }
 
+SUBOOL
+suscan_worker_get_cpu_time(const suscan_worker_t *worker, uint64_t *ns)
+{
+  if (worker->state != SUSCAN_WORKER_STATE_RUNNING)
+    return SU_FALSE;
+
+  return suscan_telemetry_get_thread_cpu(worker->thread, ns);
+}
+
 SUBOOL
 suscan_worker_destroy(suscan_worker_t *worker)
 {
-  void *cb;
+  void *task;
   uint32_t type;
 
   if (worker->state == SUSCAN_WORKER_STATE_RUNNING) {
@@ -202,9 +222,9 @@ suscan_worker_destroy(suscan_worker_t *worker)
     }
 
   /* Thread stopped, pop all messages and release memory */
-  while (suscan_mq_poll(&worker->mq_in, &type, &cb))
+  while (suscan_mq_poll(&worker->mq_in, &type, &task))
     if (type == SUSCAN_WORKER_MSG_TYPE_CALLBACK)
-      suscan_worker_callback_destroy((struct suscan_worker_callback *) cb);
+      suscan_worker_task_release((struct suscan_worker_task *) task);
 
   suscan_mq_finalize(&worker->mq_in);
 
@@ -234,9 +254,12 @@ suscan_worker_halt(suscan_worker_t *worker)
 }
 
 suscan_worker_t *
-suscan_worker_new(
+suscan_worker_new_ex(
     struct suscan_mq *mq_out,
-    void *private)
+    void *private,
+    const struct suscan_analyzer_thread_params *threads,
+    enum suscan_analyzer_thread_role role,
+    const char *name)
 {
   suscan_worker_t *new = NULL;
 
@@ -247,15 +270,26 @@ suscan_worker_new(
   new->mq_out = mq_out;
   new->privdata = private;
 
-  if (!suscan_mq_init(&new->mq_in))
+  /* Tasks are pushed and requeued without allocating */
+  if (!suscan_mq_init_ex(&new->mq_in, SUSCAN_MQ_BACKEND_RING, 0))
     goto fail;
 
-  if (pthread_create(
+  if (threads != NULL) {
+    if (!suscan_analyzer_thread_create(
+        threads,
+        role,
+        name,
+        &new->thread,
+        suscan_worker_thread,
+        new))
+      goto fail;
+  } else if (pthread_create(
       &new->thread,
       NULL,
       suscan_worker_thread,
-      new) == -1)
+      new) != 0) {
     goto fail;
+  }
 
   new->state = SUSCAN_WORKER_STATE_RUNNING;
 
@@ -267,3 +301,16 @@ fail:
 
   return NULL;
 }
+
+suscan_worker_t *
+suscan_worker_new(
+    struct suscan_mq *mq_out,
+    void *private)
+{
+  return suscan_worker_new_ex(
+      mq_out,
+      private,
+      NULL,
+      SUSCAN_ANALYZER_THREAD_ROLE_COUNT,
+      NULL);
+}
@@ -25,6 +25,7 @@
 #include <sigutils/sigutils.h>
 
 #include "mq.h"
+#include "threads.h"
 
 #define SUSCAN_WORKER_MSG_TYPE_CALLBACK 0
 #define SUSCAN_WORKER_MSG_TYPE_HALT     0xffffffff
@@ -54,6 +55,35 @@ struct suscan_worker_callback {
   void *privdata;
 };
 
+/*
+ * Intrusive task node. Callers embed it in their own objects and push it
+ * with suscan_worker_push_task, which does not allocate: the worker queue
+ * is a ring and only holds a pointer to the node. A task must not be
+ * pushed again, modified or released while it is queued, i.e. until its
+ * callback returns SU_FALSE or the worker is destroyed. The worker does
+ * not touch the node once its callback has decided to return SU_FALSE,
+ * so the callback itself may hand it back to its owner (e.g. by clearing
+ * a "queued" flag under the owner's lock) right before returning.
+ */
+struct suscan_worker_task {
+  struct suscan_worker_callback callback;
+  SUBOOL owned; /* Allocated by suscan_worker_push, freed by the worker */
+};
+
+SUINLINE void
+suscan_worker_task_init(
+    struct suscan_worker_task *task,
+    SUBOOL (*func) (
+        struct suscan_mq *mq_out,
+        void *wk_private,
+        void *cb_private),
+    void *privdata)
+{
+  task->callback.func = func;
+  task->callback.privdata = privdata;
+  task->owned = SU_FALSE;
+}
+
 /******************************* Worker API ***********************************/
 SUBOOL suscan_worker_push(
     suscan_worker_t *worker,
@@ -62,12 +92,29 @@ SUBOOL suscan_worker_push(
         void *wk_private,
         void *cb_private),
     void *privdata);
+SUBOOL suscan_worker_push_task(
+    suscan_worker_t *worker,
+    struct suscan_worker_task *task);
 void suscan_worker_req_halt(suscan_worker_t *worker);
+
+/* CPU time consumed by the worker thread so far, in nanoseconds */
+SUBOOL suscan_worker_get_cpu_time(
+    const suscan_worker_t *worker,
+    uint64_t *ns);
+
 SUBOOL suscan_worker_destroy(suscan_worker_t *worker);
 SUBOOL suscan_worker_halt(suscan_worker_t *worker);
 suscan_worker_t *suscan_worker_new(
     struct suscan_mq *mq_out,
     void *privdata);
 
+/* Same, with the thread started under the settings of an analyzer role */
+suscan_worker_t *suscan_worker_new_ex(
+    struct suscan_mq *mq_out,
+    void *privdata,
+    const struct suscan_analyzer_thread_params *threads,
+    enum suscan_analyzer_thread_role role,
+    const char *name);
+
 
 #endif /* _WORKER_H */
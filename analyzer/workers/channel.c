@@ -38,6 +38,7 @@
 
 #include "mq.h"
 #include "msg.h"
+#include "bufpool.h"
 
 /*********************** Performance measurement *****************************/
 SUINLINE void
@@ -50,45 +51,27 @@ suscan_analyzer_read_start(suscan_analyzer_t *analyzer)
 #endif
 }
 
-SUINLINE void
-suscan_analyzer_process_start(suscan_analyzer_t *analyzer)
-{
-#ifdef __linux__
-  clock_gettime(CLOCK_MONOTONIC_COARSE, &analyzer->process_start);
-#else
-  clock_gettime(CLOCK_MONOTONIC, &analyzer->process_start);
-#endif
-}
-
+/*
+ * CPU usage is the CPU time actually consumed by the source thread
+ * between two consecutive blocks, over the wall time between them. Time
+ * spent blocked in the source or waiting for the inspectors is not
+ * counted.
+ */
 SUINLINE void
 suscan_analyzer_process_end(suscan_analyzer_t *analyzer)
 {
-  struct timespec sub;
-  uint64_t total, cpu;
-
-#ifdef __linux__
-  clock_gettime(CLOCK_MONOTONIC_COARSE, &analyzer->process_end);
-#else
-  clock_gettime(CLOCK_MONOTONIC, &analyzer->process_end);
-#endif
-
-  if (analyzer->read_start.tv_sec > 0) {
-    timespecsub(&analyzer->process_end, &analyzer->read_start, &sub);
-    total = sub.tv_sec * 1000000000 + sub.tv_nsec;
-
-    timespecsub(&analyzer->process_end, &analyzer->process_start, &sub);
-    cpu = sub.tv_sec * 1000000000 + sub.tv_nsec;
-
-    /* Update CPU usage */
-    if (total == 0)
-      analyzer->cpu_usage +=
-          SUSCAN_ANALYZER_CPU_USAGE_UPDATE_ALPHA
-          * (1. - analyzer->cpu_usage);
-    else
-      analyzer->cpu_usage +=
-          SUSCAN_ANALYZER_CPU_USAGE_UPDATE_ALPHA
-          * ((SUFLOAT) cpu / (SUFLOAT) total - analyzer->cpu_usage);
-  }
+  uint64_t cpu = suscan_telemetry_thread_cpu_now();
+  uint64_t now = suscan_telemetry_now();
+
+  if (analyzer->usage_wall_ns > 0 && now > analyzer->usage_wall_ns)
+    analyzer->cpu_usage +=
+        SUSCAN_ANALYZER_CPU_USAGE_UPDATE_ALPHA
+        * ((SUFLOAT) (cpu - analyzer->usage_cpu_ns)
+            / (SUFLOAT) (now - analyzer->usage_wall_ns)
+            - analyzer->cpu_usage);
+
+  analyzer->usage_cpu_ns  = cpu;
+  analyzer->usage_wall_ns = now;
 }
 
 
@@ -140,22 +123,22 @@ suscan_analyzer_feed_inspectors(
     suscan_analyzer_enter_sched(analyzer);
     got = su_specttuner_feed_bulk_single(analyzer->stuner, data, size);
 
-    if (su_specttuner_new_data(analyzer->stuner)) {
-      /*
-       * New data has been queued to the existing inspectors. We must
-       * ensure that all of them are done by issuing a barrier at the end
-       * of the worker queue.
-       */
-
-      suscan_inspsched_sync(analyzer->sched);
-
+    /*
+     * New data has been copied to the inspector task buffers, so the
+     * tuner can move on while the inspectors process it.
+     */
+    if (su_specttuner_new_data(analyzer->stuner))
       su_specttuner_ack_data(analyzer->stuner);
-    }
 
     suscan_analyzer_leave_sched(analyzer);
 
     if (got == -1)
       ok = SU_FALSE;
+    else
+      suscan_telemetry_count(
+          &analyzer->telemetry,
+          SUSCAN_TELEMETRY_COUNTER_SAMPLES_TUNED,
+          got);
 
     data += got;
     size -= got;
@@ -164,66 +147,347 @@ suscan_analyzer_feed_inspectors(
   return ok;
 }
 
+/******************* Detector worker for channel mode ************************/
+/*
+ * Blocks are fed to the detector here, and the PSD is sent from here
+ * too, so that the source worker never waits for the spectrum. Each
+ * block comes with a reference to the read buffer it was read into.
+ */
+SUPRIVATE SUBOOL
+suscan_analyzer_detector_wk_cb(
+    struct suscan_mq *mq_out,
+    void *wk_private,
+    void *cb_private)
+{
+  suscan_analyzer_t *analyzer = (suscan_analyzer_t *) wk_private;
+  struct suscan_analyzer_detector_block block;
+  SUBOOL wanted;
+  SUBOOL det_entered = SU_FALSE;
+  SUBOOL psd_sent = SU_FALSE;
+  SUBOOL ok = SU_FALSE;
+  uint64_t t;
+
+  (void) pthread_mutex_lock(&analyzer->det_queue_mutex);
+
+  if (analyzer->det_queue_count == 0) {
+    /* Drained. The source worker pushes us again with the next block */
+    analyzer->det_task_queued = SU_FALSE;
+    (void) pthread_mutex_unlock(&analyzer->det_queue_mutex);
+    return SU_FALSE;
+  }
+
+  block = analyzer->det_queue[analyzer->det_queue_head];
+  analyzer->det_queue_head =
+      (analyzer->det_queue_head + 1) % SUSCAN_ANALYZER_DETECTOR_QUEUE_LEN;
+  --analyzer->det_queue_count;
+
+  /* The PSDs that were due may have been sent already */
+  wanted = analyzer->det_num_psd > 0;
+
+  (void) pthread_mutex_unlock(&analyzer->det_queue_mutex);
+
+  if (wanted) {
+    suscan_analyzer_enter_detector(analyzer);
+    det_entered = SU_TRUE;
+
+    /* Samples are missing: start this PSD over */
+    if (block.gap) {
+      su_channel_detector_rewind(analyzer->detector);
+      analyzer->det_count = 0;
+    }
+
+    t = suscan_telemetry_now();
+    SU_TRYCATCH(
+        su_channel_detector_feed_bulk(
+            analyzer->detector,
+            block.data,
+            block.size) == block.size,
+        goto done);
+    (void) suscan_telemetry_record(
+        &analyzer->telemetry,
+        SUSCAN_TELEMETRY_STAGE_DETECTOR,
+        t);
+
+    analyzer->det_count += block.size;
+    if (analyzer->det_count
+        >= su_channel_detector_get_window_size(analyzer->detector)) {
+      SU_TRYCATCH(
+          suscan_analyzer_send_psd(analyzer, analyzer->detector),
+          goto done);
+      su_channel_detector_rewind(analyzer->detector);
+      analyzer->det_count = 0;
+      psd_sent = SU_TRUE;
+    }
+
+    suscan_analyzer_leave_detector(analyzer);
+    det_entered = SU_FALSE;
+  }
+
+  if (psd_sent) {
+    (void) pthread_mutex_lock(&analyzer->det_queue_mutex);
+    analyzer->last_psd = block.read_start;
+    if (analyzer->det_num_psd > 0)
+      --analyzer->det_num_psd;
+    (void) pthread_mutex_unlock(&analyzer->det_queue_mutex);
+  }
+
+  ok = SU_TRUE;
+
+done:
+  if (det_entered)
+    suscan_analyzer_leave_detector(analyzer);
+
+  suscan_pool_free(block.data);
+
+  if (!ok) {
+    /* Removed from the worker: let the source worker push us again */
+    (void) pthread_mutex_lock(&analyzer->det_queue_mutex);
+    analyzer->det_task_queued = SU_FALSE;
+    (void) pthread_mutex_unlock(&analyzer->det_queue_mutex);
+  }
+
+  return ok;
+}
+
+/*
+ * Called by the source worker after every read. While a PSD is due, the
+ * block is handed to the detector worker, which gets its own reference
+ * to the read buffer (*shared is set then). This never waits for the
+ * detector: if it lags behind, the block is dropped and the detector
+ * starts its PSD over with the next one.
+ */
+SUPRIVATE SUBOOL
+suscan_analyzer_feed_detector(
+    suscan_analyzer_t *analyzer,
+    SUSCOUNT size,
+    SUBOOL *shared)
+{
+  struct suscan_analyzer_detector_block *block;
+  struct timespec sub;
+  SUFLOAT seconds;
+  SUBOOL push = SU_FALSE;
+
+  *shared = SU_FALSE;
+
+  (void) pthread_mutex_lock(&analyzer->det_queue_mutex);
+
+  if (analyzer->det_num_psd > 0) {
+    if (analyzer->det_queue_count < SUSCAN_ANALYZER_DETECTOR_QUEUE_LEN) {
+      block = analyzer->det_queue
+          + (analyzer->det_queue_head + analyzer->det_queue_count)
+          % SUSCAN_ANALYZER_DETECTOR_QUEUE_LEN;
+
+      suscan_pool_ref(analyzer->read_buf);
+      block->data = analyzer->read_buf;
+      block->size = size;
+      block->read_start = analyzer->read_start;
+      block->gap = analyzer->det_gap;
+      ++analyzer->det_queue_count;
+
+      analyzer->det_gap = SU_FALSE;
+      *shared = SU_TRUE;
+
+      if (!analyzer->det_task_queued) {
+        analyzer->det_task_queued = SU_TRUE;
+        push = SU_TRUE;
+      }
+    } else {
+      analyzer->det_gap = SU_TRUE;
+      suscan_telemetry_count(
+          &analyzer->telemetry,
+          SUSCAN_TELEMETRY_COUNTER_DETECTOR_DROPS,
+          1);
+    }
+  }
+
+  if (analyzer->interval_psd > 0 && analyzer->det_num_psd == 0) {
+    timespecsub(&analyzer->read_start, &analyzer->last_psd, &sub);
+    seconds = sub.tv_sec + sub.tv_nsec * 1e-9;
+
+    if (seconds >= analyzer->interval_psd)
+      analyzer->det_num_psd = SU_ROUND(seconds / analyzer->interval_psd);
+  }
+
+  (void) pthread_mutex_unlock(&analyzer->det_queue_mutex);
+
+  if (push) {
+    suscan_worker_task_init(
+        &analyzer->det_task,
+        suscan_analyzer_detector_wk_cb,
+        NULL);
+
+    if (!suscan_worker_push_task(analyzer->det_wk, &analyzer->det_task)) {
+      /* The block stays queued and goes with the next push */
+      (void) pthread_mutex_lock(&analyzer->det_queue_mutex);
+      analyzer->det_task_queued = SU_FALSE;
+      (void) pthread_mutex_unlock(&analyzer->det_queue_mutex);
+      SU_ERROR("Failed to push detector task\n");
+      return SU_FALSE;
+    }
+  }
+
+  return SU_TRUE;
+}
+
 /******************** Source worker for channel mode *************************/
+/* Inspectors start over after a seek, as if their channel had just opened */
+SUPRIVATE SUBOOL
+suscan_analyzer_reset_inspectors(suscan_analyzer_t *self)
+{
+  suscan_inspector_t *insp;
+  unsigned int i;
+  SUBOOL ok = SU_TRUE;
+
+  /* Blocks read before the seek must be done with */
+  SU_TRYCATCH(suscan_inspsched_sync(self->sched), return SU_FALSE);
+  SU_TRYCATCH(suscan_analyzer_lock_inspector_list(self), return SU_FALSE);
+
+  for (i = 0; i < self->inspector_count; ++i) {
+    insp = self->inspector_list[i];
+    if (insp == NULL || insp->state != SUSCAN_ASYNC_STATE_RUNNING)
+      continue;
+
+    if (!suscan_inspector_reset(insp)) {
+      SU_ERROR("Failed to reset inspector 0x%x\n", insp->inspector_id);
+      ok = SU_FALSE;
+    }
+  }
+
+  suscan_analyzer_unlock_inspector_list(self);
+
+  return ok;
+}
+
+/*
+ * Seeks are served here, between reads, so the source and everything
+ * downstream of it can be reset without racing the worker.
+ */
+SUPRIVATE SUBOOL
+suscan_analyzer_parse_seek(suscan_analyzer_t *self)
+{
+  SUSCOUNT sample;
+  SUSCOUNT flush;
+  SUSCOUNT chunk;
+
+  if (!__atomic_exchange_n(&self->seek_req, SU_FALSE, __ATOMIC_ACQ_REL))
+    return SU_TRUE;
+
+  sample = __atomic_load_n(&self->seek_req_value, __ATOMIC_ACQUIRE);
+
+  if (!suscan_source_seek(self->source, sample)) {
+    suscan_analyzer_send_status(
+        self,
+        SUSCAN_ANALYZER_MESSAGE_TYPE_INTERNAL,
+        -1,
+        "Failed to seek to sample %lu",
+        (unsigned long) sample);
+    return SU_TRUE;
+  }
+
+  /* Start the PSD over. The detector worker rewinds on the next block */
+  (void) pthread_mutex_lock(&self->det_queue_mutex);
+  self->det_gap = SU_TRUE;
+  (void) pthread_mutex_unlock(&self->det_queue_mutex);
+
+  /*
+   * Push one window of silence through the spectral tuner, so that
+   * opened channels do not mix samples from both sides of the seek. The
+   * silence only clears the channel filters: it never reaches the
+   * inspectors.
+   */
+  memset(self->read_buf, 0, self->read_size * sizeof(SUCOMPLEX));
+  flush = su_channel_detector_get_window_size(self->detector);
+  self->seek_flushing = SU_TRUE;
+  while (flush > 0) {
+    chunk = SU_MIN(flush, self->read_size);
+    if (!suscan_analyzer_feed_inspectors(self, self->read_buf, chunk))
+      break;
+    flush -= chunk;
+  }
+  self->seek_flushing = SU_FALSE;
+
+  SU_TRYCATCH(flush == 0, return SU_FALSE);
+
+  return suscan_analyzer_reset_inspectors(self);
+}
+
+/* Applies inspector overrides published since the last block */
 SUPRIVATE SUBOOL
 suscan_analyzer_parse_overridable(suscan_analyzer_t *self)
 {
-  struct suscan_inspector_overridable_request *this, *next;
+  const struct suscan_hotconf_snapshot *snap;
+  const struct suscan_hotconf_override *ovr;
+  suscan_inspector_t *insp;
+  uint64_t applied = self->source_hotconf_version;
+  SUBOOL list_locked = SU_FALSE;
   SUBOOL ok = SU_FALSE;
   SUFLOAT f0;
   SUFLOAT relbw;
+  unsigned int i;
 
-  if (self->insp_overridable != NULL) {
-    SU_TRYCATCH(suscan_analyzer_lock_inspector_list(self), goto done);
-
-    while (self->insp_overridable != NULL) {
-      this = self->insp_overridable;
-      next = self->insp_overridable->next;
-
-      if (!this->dead) {
-        /* Acknowledged */
-        suscan_inspector_set_userdata(this->insp, NULL);
-
-        /* Parse this request */
-        if (this->freq_request) {
-          f0 = SU_NORM2ANG_FREQ(
-                SU_ABS2NORM_FREQ(
-                    suscan_analyzer_get_samp_rate(self),
-                    this->new_freq));
-
-          if (f0 < 0)
-            f0 += 2 * PI;
-
-          su_specttuner_set_channel_freq(
-              self->stuner,
-              suscan_inspector_get_channel(this->insp),
-              f0);
-        }
-
-        /* Set bandwidth request */
-        if (this->bandwidth_request) {
-          relbw = SU_NORM2ANG_FREQ(
-                SU_ABS2NORM_FREQ(
-                    suscan_analyzer_get_samp_rate(self),
-                    this->new_bandwidth));
-          su_specttuner_set_channel_bandwidth(
-              self->stuner,
-              suscan_inspector_get_channel(this->insp),
-              relbw);
-          SU_TRYCATCH(
-              suscan_inspector_notify_bandwidth(this->insp, this->new_bandwidth),
-              goto done);
-        }
-      }
+  /* Nothing new: no locks, no atomic read-modify-write */
+  if (suscan_hotconf_get_version(&self->hotconf) == applied)
+    return SU_TRUE;
+
+  snap = suscan_hotconf_enter(&self->hotconf, self->source_reader);
+
+  for (i = 0; i < snap->override_count; ++i) {
+    ovr = snap->override_list + i;
+
+    if (ovr->freq_version <= applied && ovr->bw_version <= applied)
+      continue;
 
-      self->insp_overridable = next;
+    if (!list_locked) {
+      /* Inspectors must not be working while we touch them */
+      SU_TRYCATCH(suscan_inspsched_sync(self->sched), goto done);
+      SU_TRYCATCH(suscan_analyzer_lock_inspector_list(self), goto done);
+      list_locked = SU_TRUE;
+    }
+
+    /* Closed inspectors remove their overrides, but they may be halting */
+    if ((insp = suscan_analyzer_get_inspector(self, ovr->handle)) == NULL)
+      continue;
+
+    if (ovr->freq_version > applied) {
+      f0 = SU_NORM2ANG_FREQ(
+            SU_ABS2NORM_FREQ(
+                suscan_analyzer_get_samp_rate(self),
+                ovr->freq));
+
+      if (f0 < 0)
+        f0 += 2 * PI;
+
+      su_specttuner_set_channel_freq(
+          self->stuner,
+          suscan_inspector_get_channel(insp),
+          f0);
+    }
+
+    if (ovr->bw_version > applied) {
+      relbw = SU_NORM2ANG_FREQ(
+            SU_ABS2NORM_FREQ(
+                suscan_analyzer_get_samp_rate(self),
+                ovr->bw));
+      su_specttuner_set_channel_bandwidth(
+          self->stuner,
+          suscan_inspector_get_channel(insp),
+          relbw);
+      SU_TRYCATCH(
+          suscan_inspector_notify_bandwidth(insp, ovr->bw),
+          goto done);
     }
-    suscan_analyzer_unlock_inspector_list(self);
   }
 
+  self->source_hotconf_version = snap->version;
+
   ok = SU_TRUE;
 
 done:
+  if (list_locked)
+    suscan_analyzer_unlock_inspector_list(self);
+
+  suscan_hotconf_leave(&self->hotconf, self->source_reader);
+
   return ok;
 }
 
@@ -236,13 +500,13 @@ suscan_source_channel_wk_cb(
   suscan_analyzer_t *analyzer = (suscan_analyzer_t *) wk_private;
   SUSDIFF got;
   SUSCOUNT read_size;
-  SUSCOUNT psd_win_size =
-      su_channel_detector_get_window_size(analyzer->detector);
   SUBOOL mutex_acquired = SU_FALSE;
+  SUBOOL det_shared = SU_FALSE;
   SUBOOL restart = SU_FALSE;
   unsigned int i;
   struct timespec sub;
   SUFLOAT seconds;
+  uint64_t t;
 
   SU_TRYCATCH(suscan_analyzer_lock_loop(analyzer), goto done);
   mutex_acquired = SU_TRUE;
@@ -263,17 +527,30 @@ suscan_source_channel_wk_cb(
   }
 
   SU_TRYCATCH(suscan_analyzer_parse_overridable(analyzer), goto done);
+  SU_TRYCATCH(suscan_analyzer_parse_seek(analyzer), goto done);
 
   /* Ready to read */
   suscan_analyzer_read_start(analyzer);
+  t = suscan_telemetry_now();
 
   if ((got = suscan_source_read(
       analyzer->source,
       analyzer->read_buf,
       read_size)) > 0) {
-    suscan_analyzer_process_start(analyzer);
-
-    if (analyzer->iq_rev)
+    (void) suscan_telemetry_record(
+        &analyzer->telemetry,
+        SUSCAN_TELEMETRY_STAGE_READ,
+        t);
+    suscan_telemetry_count(
+        &analyzer->telemetry,
+        SUSCAN_TELEMETRY_COUNTER_SAMPLES_READ,
+        got);
+    suscan_telemetry_count(
+        &analyzer->telemetry,
+        SUSCAN_TELEMETRY_COUNTER_BLOCKS_READ,
+        1);
+
+    if (__atomic_load_n(&analyzer->iq_rev, __ATOMIC_RELAXED))
       suscan_analyzer_do_iq_rev(analyzer->read_buf, got);
 
     if (!suscan_analyzer_is_real_time(analyzer)) {
@@ -286,40 +563,22 @@ suscan_source_channel_wk_cb(
           goto done);
     }
 
+    t = suscan_telemetry_now();
     SU_TRYCATCH(
         suscan_analyzer_feed_baseband_filters(
             analyzer,
             analyzer->read_buf,
             got),
         goto done);
+    (void) suscan_telemetry_record(
+        &analyzer->telemetry,
+        SUSCAN_TELEMETRY_STAGE_BBFILT,
+        t);
 
-    if (analyzer->det_num_psd > 0) {
-      /* Feed channel detector! */
-      SU_TRYCATCH(
-          su_channel_detector_feed_bulk(
-              analyzer->detector,
-              analyzer->read_buf,
-              got) == got,
-          goto done);
-      analyzer->det_count += got;
-      if (analyzer->det_count >= psd_win_size) {
-        SU_TRYCATCH(
-            suscan_analyzer_send_psd(analyzer, analyzer->detector),
-            goto done);
-        su_channel_detector_rewind(analyzer->detector);
-        analyzer->last_psd = analyzer->read_start;
-        analyzer->det_count = 0;
-        --analyzer->det_num_psd;
-      }
-    }
-
-    if (analyzer->interval_psd > 0 && analyzer->det_num_psd == 0) {
-      timespecsub(&analyzer->read_start, &analyzer->last_psd, &sub);
-      seconds = sub.tv_sec + sub.tv_nsec * 1e-9;
-
-      if (seconds >= analyzer->interval_psd)
-        analyzer->det_num_psd = SU_ROUND(seconds / analyzer->interval_psd);
-    }
+    /* Feed channel detector! (in the detector worker) */
+    SU_TRYCATCH(
+        suscan_analyzer_feed_detector(analyzer, got, &det_shared),
+        goto done);
 
     if (SUSCAN_ANALYZER_FS_MEASURE_INTERVAL > 0) {
       timespecsub(&analyzer->read_start, &analyzer->last_measure, &sub);
@@ -339,9 +598,14 @@ suscan_source_channel_wk_cb(
     }
 
     /* Feed inspectors! */
+    t = suscan_telemetry_now();
     SU_TRYCATCH(
         suscan_analyzer_feed_inspectors(analyzer, analyzer->read_buf, got),
         goto done);
+    (void) suscan_telemetry_record(
+        &analyzer->telemetry,
+        SUSCAN_TELEMETRY_STAGE_SPECTTUNER,
+        t);
 
   } else {
     analyzer->eos = SU_TRUE;
@@ -394,9 +658,22 @@ suscan_source_channel_wk_cb(
   /* Finish processing */
   suscan_analyzer_process_end(analyzer);
 
+  (void) suscan_analyzer_poll_telemetry(analyzer);
+  (void) suscan_analyzer_poll_output_drops(analyzer);
+
   restart = SU_TRUE;
 
 done:
+  /* The detector worker still reads this buffer: read into a fresh one */
+  if (det_shared) {
+    suscan_pool_free(analyzer->read_buf);
+    if ((analyzer->read_buf = suscan_pool_alloc(
+        analyzer->read_size * sizeof(SUCOMPLEX))) == NULL) {
+      SU_ERROR("Failed to allocate read buffer\n");
+      restart = SU_FALSE;
+    }
+  }
+
   if (mutex_acquired)
     (void) suscan_analyzer_unlock_loop(analyzer);
 
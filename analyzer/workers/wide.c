@@ -114,6 +114,8 @@ suscan_analyzer_set_sweep_stratrgy(
     suscan_analyzer_t *self,
     enum suscan_analyzer_sweep_strategy strategy)
 {
+  struct suscan_hotconf_snapshot *snap;
+  struct suscan_analyzer_sweep_params params;
   SUBOOL ok = SU_FALSE;
 
   SU_TRYCATCH(
@@ -121,12 +123,13 @@ suscan_analyzer_set_sweep_stratrgy(
       goto done);
 
 
-  self->pending_sweep_params =
-        self->sweep_params_requested
-        ? self->pending_sweep_params
-        : self->current_sweep_params;
-  self->pending_sweep_params.strategy = strategy;
-  self->sweep_params_requested = SU_TRUE;
+  SU_TRYCATCH(snap = suscan_hotconf_begin(&self->hotconf), goto done);
+
+  params = snap->sweep;
+  params.strategy = strategy;
+  suscan_hotconf_snapshot_set_sweep_params(snap, &params);
+
+  suscan_hotconf_commit(&self->hotconf, snap);
 
   ok = SU_TRUE;
 
@@ -139,18 +142,21 @@ suscan_analyzer_set_spectrum_partitioning(
     suscan_analyzer_t *self,
     enum suscan_analyzer_spectrum_partitioning partitioning)
 {
+  struct suscan_hotconf_snapshot *snap;
+  struct suscan_analyzer_sweep_params params;
   SUBOOL ok = SU_FALSE;
 
   SU_TRYCATCH(
       self->params.mode == SUSCAN_ANALYZER_MODE_WIDE_SPECTRUM,
       goto done);
 
-  self->pending_sweep_params =
-      self->sweep_params_requested
-      ? self->pending_sweep_params
-      : self->current_sweep_params;
-  self->pending_sweep_params.partitioning = partitioning;
-  self->sweep_params_requested = SU_TRUE;
+  SU_TRYCATCH(snap = suscan_hotconf_begin(&self->hotconf), goto done);
+
+  params = snap->sweep;
+  params.partitioning = partitioning;
+  suscan_hotconf_snapshot_set_sweep_params(snap, &params);
+
+  suscan_hotconf_commit(&self->hotconf, snap);
 
   ok = SU_TRUE;
 
@@ -163,18 +169,21 @@ suscan_analyzer_set_buffering_size(
     suscan_analyzer_t *self,
     SUSCOUNT size)
 {
+  struct suscan_hotconf_snapshot *snap;
+  struct suscan_analyzer_sweep_params params;
   SUBOOL ok = SU_FALSE;
 
   SU_TRYCATCH(
       self->params.mode == SUSCAN_ANALYZER_MODE_WIDE_SPECTRUM,
       goto done);
 
-  self->pending_sweep_params =
-        self->sweep_params_requested
-        ? self->pending_sweep_params
-        : self->current_sweep_params;
-  self->pending_sweep_params.fft_min_samples = size;
-  self->sweep_params_requested = SU_TRUE;
+  SU_TRYCATCH(snap = suscan_hotconf_begin(&self->hotconf), goto done);
+
+  params = snap->sweep;
+  params.fft_min_samples = size;
+  suscan_hotconf_snapshot_set_sweep_params(snap, &params);
+
+  suscan_hotconf_commit(&self->hotconf, snap);
 
   ok = SU_TRUE;
 
@@ -188,7 +197,8 @@ suscan_analyzer_set_hop_range(
     SUFREQ min,
     SUFREQ max)
 {
-  SUBOOL mutex_acquired = SU_FALSE;
+  struct suscan_hotconf_snapshot *snap;
+  struct suscan_analyzer_sweep_params params;
   SUBOOL ok = SU_FALSE;
 
   SU_TRYCATCH(
@@ -197,13 +207,14 @@ suscan_analyzer_set_hop_range(
 
   SU_TRYCATCH(max - min >= 0, goto done);
 
-  self->pending_sweep_params =
-        self->sweep_params_requested
-        ? self->pending_sweep_params
-        : self->current_sweep_params;
-  self->pending_sweep_params.min_freq = min;
-  self->pending_sweep_params.max_freq = max;
-  self->sweep_params_requested = SU_TRUE;
+  SU_TRYCATCH(snap = suscan_hotconf_begin(&self->hotconf), goto done);
+
+  params = snap->sweep;
+  params.min_freq = min;
+  params.max_freq = max;
+  suscan_hotconf_snapshot_set_sweep_params(snap, &params);
+
+  suscan_hotconf_commit(&self->hotconf, snap);
 
   ok = SU_TRUE;
 
@@ -218,10 +229,12 @@ suscan_source_wide_wk_cb(
     void *cb_private)
 {
   suscan_analyzer_t *self = (suscan_analyzer_t *) wk_private;
+  const struct suscan_hotconf_snapshot *snap;
   SUSDIFF got;
   SUBOOL mutex_acquired = SU_FALSE;
   SUBOOL restart = SU_FALSE;
   struct timespec sub;
+  uint64_t t;
 
   SU_TRYCATCH(suscan_analyzer_lock_loop(self), goto done);
   mutex_acquired = SU_TRUE;
@@ -229,28 +242,52 @@ suscan_source_wide_wk_cb(
   /* Non real time sources are not allowed. */
   SU_TRYCATCH(suscan_analyzer_is_real_time(self), goto done);
 
-  if (self->sweep_params_requested) {
-    self->current_sweep_params = self->pending_sweep_params;
-    self->sweep_params_requested = SU_FALSE;
+  /* Pick up new sweep parameters, if any */
+  if (suscan_hotconf_get_version(&self->hotconf)
+      != self->source_hotconf_version) {
+    snap = suscan_hotconf_enter(&self->hotconf, self->source_reader);
+    if (snap->sweep_version > self->source_hotconf_version)
+      self->current_sweep_params = snap->sweep;
+    self->source_hotconf_version = snap->version;
+    suscan_hotconf_leave(&self->hotconf, self->source_reader);
   }
 
+  t = suscan_telemetry_now();
+
   if ((got = suscan_source_read(
       self->source,
       self->read_buf,
       self->read_size)) > 0) {
-
-    if (self->iq_rev)
+    (void) suscan_telemetry_record(
+        &self->telemetry,
+        SUSCAN_TELEMETRY_STAGE_READ,
+        t);
+    suscan_telemetry_count(
+        &self->telemetry,
+        SUSCAN_TELEMETRY_COUNTER_SAMPLES_READ,
+        got);
+    suscan_telemetry_count(
+        &self->telemetry,
+        SUSCAN_TELEMETRY_COUNTER_BLOCKS_READ,
+        1);
+
+    if (__atomic_load_n(&self->iq_rev, __ATOMIC_RELAXED))
       suscan_analyzer_do_iq_rev(self->read_buf, got);
     self->fft_samples += got;
 
     if (self->fft_samples > self->current_sweep_params.fft_min_samples) {
       /* Feed detector (works in spectrum mode only) */
+      t = suscan_telemetry_now();
       SU_TRYCATCH(
           su_channel_detector_feed_bulk(
               self->detector,
               self->read_buf,
               got) == got,
           goto done);
+      (void) suscan_telemetry_record(
+          &self->telemetry,
+          SUSCAN_TELEMETRY_STAGE_DETECTOR,
+          t);
 
       /*
        * Reached threshold. Send message and hop. Note we do this right here,
@@ -316,6 +353,9 @@ suscan_source_wide_wk_cb(
     goto done;
   }
 
+  (void) suscan_analyzer_poll_telemetry(self);
+  (void) suscan_analyzer_poll_output_drops(self);
+
   restart = SU_TRUE;
 
 done:
@@ -189,7 +189,7 @@ suscan_perform_fingerprint(struct suscan_source_config *config)
   SUBOOL running = SU_TRUE;
   SUBOOL ok = SU_FALSE;
 
-  if (!suscan_mq_init(&mq))
+  if (!suscan_mq_init_ex(&mq, SUSCAN_MQ_BACKEND_RING, 0))
     return SU_FALSE;
 
   SU_TRYCATCH(analyzer = suscan_analyzer_new(&params, config, &mq), goto done);